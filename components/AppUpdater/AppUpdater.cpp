@@ -7,7 +7,10 @@
 #include "AppUpdater.h"
 
 #include <string.h>
-#include "md5.h"
+#include <stdlib.h>
+#include "mbedtls/md5.h"
+#include "mbedtls/sha256.h"
+#include "esp_timer.h"
 #include "Wifi.h"
 #include "System.h"
 #include "Config.h"
@@ -58,6 +61,14 @@
 /////////////////////////////////////////////////////////////////////////////////////////
 #define REQUIRE_VERIFY_BIT_CMD       SIZE_MAX
 #define UPDATE_RX_DATA_BLOCK_SIZE    4096
+#define UPDATE_BLOCK_TIMEOUT_MIN     1000    // ms, before a missing block is requested again
+#define UPDATE_BLOCK_TIMEOUT_MAX     8000    // ms, also the timeout until rtt is measured
+#define UPDATE_BLOCK_REQUEST_MAX     5       // requests of one block before giving up
+#define UPDATE_REPLY_TIMEOUT         30000   // ms, for version info and verify bits
+#define UPDATE_STALL_TIMEOUT         60000   // ms without a block received or written
+#define UPDATE_FLAG_SHA256           0x01    // version info flags, verify bits are a sha-256
+#define UPDATE_FLAG_DELTA            0x02    // data is a DeltaPatch of the running partition
+#define UPDATE_FLAG_HEATSHRINK       0x04    // data is heatshrink compressed
 
 #define APP_UPDATE_TOPIC             "api/update"
 static char _updateDrxDataTopic[48];   // device rx
@@ -76,14 +87,56 @@ enum UpdateRetCode {
   RXDATA_SIZE_LARGER_THAN_EXPECTED,
   MD5_CHECK_OK,
   MD5_CHECK_FAILED,
-  DOWNLOAD_PROGRESS
+  DOWNLOAD_PROGRESS,
+  DOWNLOAD_STATS,
+  RXDATA_TIMEOUT,
+  DELTA_PATCH_FAILED,
+  DECOMPRESS_FAILED
 };
 
 char       *_retBuf = NULL;
 
-#define      MD5_LENGTH 16
-md5_context _md5Contex;
-char        _md5Result[MD5_LENGTH];
+// sha-256 runs on the hardware accelerator, md5 is kept for servers sending md5 verify bits
+#define      MD5_LENGTH     16
+#define      SHA256_LENGTH  32
+static mbedtls_md5_context     _md5Context;
+static mbedtls_sha256_context  _sha256Context;
+static unsigned char           _digest[SHA256_LENGTH];
+
+static void hashUpdate(bool sha256, const uint8_t *data, size_t length)
+{
+  if (sha256) mbedtls_sha256_update(&_sha256Context, data, length);
+  else mbedtls_md5_update(&_md5Context, data, length);
+}
+
+inline static uint32_t nowMilli()
+{
+  return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// pipeline stage tasks
+/////////////////////////////////////////////////////////////////////////////////////////
+#define UPDATE_STAGE_STOP            0xff    // queued after the last block, stops the stage
+#define UPDATE_HASH_TASK_PRIORITY    3
+#define UPDATE_WRITE_TASK_PRIORITY   3
+
+enum UpdateJobType {
+  UpdateJobWritten,                  // data[0] slot, data[1] patch, data[2] decode status, flag esp_err_t
+  UpdateJobStopped
+};
+
+static void update_hash_task(void *param)
+{
+  static_cast<AppUpdater *>(param)->runHashStage();
+  vTaskDelete(NULL);
+}
+
+static void update_write_task(void *param)
+{
+  static_cast<AppUpdater *>(param)->runWriteStage();
+  vTaskDelete(NULL);
+}
 
 /////////////////////////////////////////////////////////////////////////////////////////
 // AppUpdater implementation
@@ -95,9 +148,36 @@ AppUpdater::AppUpdater()
 , _newVersionSize(0)
 , _updateHandle(0)
 , _delegate(NULL)
+, _window(1)
+, _outstanding(0)
+, _requestIndex(0)
+, _queueIndex(0)
+, _writtenIndex(0)
+, _progress(0)
+, _sha256(false)
+, _delta(false)
+, _compressed(false)
+, _sourcePartition(NULL)
+, _targetErr(ESP_OK)
+, _bufferCount(0)
+, _buffers(NULL)
+, _hashQueue(NULL)
+, _writeQueue(NULL)
+, _pipelineRunning(false)
+, _pipelineStopping(false)
+, _otaEndPending(false)
+, _progressMilli(0)
+, _startMilli(0)
+, _rttSumMilli(0)
+, _rttCount(0)
+, _rerequestCount(0)
+, _rxBusyMicro(0)
+, _hashBusyMicro(0)
+, _writeBusyMicro(0)
 {
   _writeFlag.index = 0;
   _writeFlag.amount = 0;
+  memset(_slots, 0, sizeof(_slots));
 }
 
 void AppUpdater::init()
@@ -123,8 +203,30 @@ const char* AppUpdater::updateRxTopic()
   return _updateDrxDataTopic;
 }
 
+void AppUpdater::setMqttClientDelegate(MqttClientDelegate *delegate)
+{
+  if (_delegate && _delegate->topicRouter()) {
+    _delegate->topicRouter()->removeRoute(_updateDrxDataTopic, this);
+  }
+  _delegate = delegate;
+  if (_delegate && _delegate->topicRouter()) {
+    _delegate->topicRouter()->addRoute(_updateDrxDataTopic, this);
+  }
+  if (_delegate && _delegate->reactor()) {
+    _delegate->reactor()->addClient(this);
+  }
+}
+
+void AppUpdater::onTopicMessage(const char* topic, size_t topicLen, const char* msg, size_t msgLen, void *context)
+{
+  if (isUpdating()) updateLoop(msg, msgLen);
+}
+
 void AppUpdater::_onUpdateEnded(bool unsubUpdateTopic, bool subCmdTopic)
 {
+  _stopPipeline();
+  _window = 1;
+
   if (_delegate) {
     if (unsubUpdateTopic) {
       _delegate->addUnsubTopic(_updateDrxDataTopic);
@@ -144,17 +246,17 @@ void AppUpdater::_retCode(int code, const char *msg, int value)
 #ifdef LOG_APPUPDATER
   if (code == UPDATE_OK) APP_LOGC(TAG, "%s", msg);
   else if (code == DOWNLOAD_PROGRESS) APP_LOGI(TAG, "write data complete %d%%", value);
-  else if (code == MD5_CHECK_OK) APP_LOGI(TAG, "%s", msg);
+  else if (code == MD5_CHECK_OK || code == DOWNLOAD_STATS) APP_LOGI(TAG, "%s", msg);
   else APP_LOGE(TAG, "%s, 0x%x", msg, value);
 #else
-  if (code == MD5_CHECK_OK) APP_LOGI(TAG, "%s", msg);
+  if (code == MD5_CHECK_OK || code == DOWNLOAD_STATS) APP_LOGI(TAG, "%s", msg);
   else if (code != UPDATE_OK && code != DOWNLOAD_PROGRESS) APP_LOGE(TAG, "%s, 0x%x", msg, value);
 #endif
 
   sprintf(_retBuf, "{\"code\":\"%d\",\"msg\":\"%s\",\"val\":\"%d\"}", code, msg, value);
   _delegate->publish(_updateCrxCodeTopic, _retBuf, strlen(_retBuf), 1);
 
-  if (code != UPDATE_OK && code != DOWNLOAD_PROGRESS && code != MD5_CHECK_OK) {
+  if (code != UPDATE_OK && code != DOWNLOAD_PROGRESS && code != MD5_CHECK_OK && code != DOWNLOAD_STATS) {
     System::instance()->resumePeripherals();
   }
 }
@@ -169,7 +271,9 @@ void AppUpdater::_sendUpdateCmd()
     _delegate->addSubTopic(_updateDrxDataTopic);
     _delegate->subscribeTopics();
     System* sys = System::instance();
-    sprintf(_retBuf, "{\"uid\":\"%s\",\"bdv\":\"%s\"}", sys->uid(), sys->boardVersion());
+    sprintf(_retBuf, "{\"uid\":\"%s\",\"bdv\":\"%s\",\"firmv\":\"%s\",\"win\":%d,\"hash\":\"sha256\",\"delta\":1,"
+            "\"comp\":\"heatshrink\",\"hsw\":%d,\"hsl\":%d}", sys->uid(), sys->boardVersion(), FIRMWARE_VERSION_STR,
+            UPDATE_WINDOW_MAX, HEATSHRINK_WINDOW_BITS, HEATSHRINK_LOOKAHEAD_BITS);
     _delegate->publish(APP_UPDATE_TOPIC, _retBuf, strlen(_retBuf), 1);
   }
 }
@@ -253,15 +357,14 @@ bool AppUpdater::_prepareUpdate()
 
 bool AppUpdater::_verifyData(const char *verifyBits, size_t length)
 {
-  // APP_LOGC(TAG, "md5 result:   %.*s", length, _md5Result);
-  // APP_LOGC(TAG, "verify bytes: %.*s", length, verifyBits);
-  if (memcmp(verifyBits, _md5Result, MD5_LENGTH) == 0) {
+  size_t digestLength = _sha256 ? SHA256_LENGTH : MD5_LENGTH;
+  if (length >= digestLength && memcmp(verifyBits, _digest, digestLength) == 0) {
     _retCode(MD5_CHECK_OK, "downloaded data verified OK");
     return true;
   }
   else {
-    _onUpdateEnded(true, true); // unsub update toic, sub cmd topic
-    _retCode(MD5_CHECK_FAILED, "downloaded data verified fail");
+    // ota handle ended, a new update command starts over
+    _abortData(MD5_CHECK_FAILED, "downloaded data verified fail", 0);
     return false;
   }
 }
@@ -271,17 +374,35 @@ void AppUpdater::updateLoop(const char* data, size_t dataLen)
   // APP_LOGI(TAG, "update loop");
   switch (_state) {
     case UPDATE_STATE_WAIT_VERSION_INFO: {
+      size_t infoLen = sizeof(VersionNoType) + sizeof(size_t);
+      if (dataLen < infoLen) {
+        _onUpdateEnded(true, true); // unsub update toic, sub cmd topic
+        _retCode(RXDATA_MISMATCHED_WITH_REQUIRED, "version info too short", dataLen);
+        _state = UPDATE_STATE_IDLE;
+        break;
+      }
       VersionNoType newVersion = *((VersionNoType *)data);
       if (newVersion > _currentVersion) {
         _newVersionSize = *((size_t *)(data + sizeof(VersionNoType)));
 #ifdef LOG_APPUPDATER
         APP_LOGC(TAG, "version: %d, size: %d", newVersion, _newVersionSize);
 #endif
+        // nothing to request of an empty one, a larger one can not be written
+        const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+        if (_newVersionSize == 0 || (partition && _newVersionSize > partition->size)) {
+          _onUpdateEnded(true, true); // unsub update toic, sub cmd topic
+          _retCode(RXDATA_SIZE_LARGER_THAN_EXPECTED, "new version size out of range", _newVersionSize);
+          _state = UPDATE_STATE_IDLE;
+          break;
+        }
         if (!_prepareUpdate()) break;
-        md5_starts(&_md5Contex);
         APP_LOGI(TAG, "begin downloading data ...");
-        _delegate->publish(_updateDtxDataTopic, &_writeFlag, sizeof(_writeFlag), 1);
+        // window and flags after the version info, none from stop-and-wait servers
+        const uint32_t *extra = (const uint32_t *)(data + infoLen);
+        uint32_t window = dataLen >= infoLen + sizeof(uint32_t) ? extra[0] : 1;
+        uint32_t flags = dataLen >= infoLen + 2 * sizeof(uint32_t) ? extra[1] : 0;
         _state = UPDATE_STATE_WAIT_DATA;
+        _beginData(window, flags);
       }
       else {
         _onUpdateEnded(true, true); // unsub update toic, sub cmd topic
@@ -292,57 +413,9 @@ void AppUpdater::updateLoop(const char* data, size_t dataLen)
       break;
     }
 
-    case UPDATE_STATE_WAIT_DATA: {
-      // data block index, size
-      size_t dataIndex = *((size_t*)data);
-      if (dataIndex != _writeFlag.index) {
-        _onUpdateEnded(true, true); // unsub update toic, sub cmd topic
-        _retCode(RXDATA_MISMATCHED_WITH_REQUIRED, "received data index mismatched with requested");
-        break;
-      }
-      const void *dataBlock = data + sizeof(size_t);
-      size_t blockSize = dataLen - sizeof(size_t);
-#ifdef LOG_APPUPDATER
-      APP_LOGI(TAG, "rx data block index: %d, size: %d", dataIndex, blockSize);
-#endif
-      if (_writeFlag.index + blockSize > _newVersionSize) {
-        _onUpdateEnded(true, true); // unsub update toic, sub cmd topic
-        _retCode(RXDATA_SIZE_LARGER_THAN_EXPECTED, "received data size mismatched with the new version size");
-        _state = UPDATE_STATE_IDLE;
-        break;
-      }
-      // md5 accumulate calculation
-      md5_update(&_md5Contex, (const unsigned char*)dataBlock, blockSize);
-      // try to write ota
-      esp_err_t err = ESP_OTA_WRITE(_updateHandle, dataBlock, blockSize);
-      if (err == ESP_OK) {
-        _writeFlag.index += blockSize;
-        _retCode(DOWNLOAD_PROGRESS, "", int((_writeFlag.index/(float)_newVersionSize) * 100));
-        if (_writeFlag.index == _newVersionSize) {
-          // APP_LOGI(TAG, "total write binary data length : %d", _newVersionSize);
-          md5_finish(&_md5Contex, (unsigned char*)_md5Result);
-          _writeFlag.index = REQUIRE_VERIFY_BIT_CMD;
-          _writeFlag.amount = REQUIRE_VERIFY_BIT_CMD;
-          APP_LOGI(TAG, "downloading data completed");
-          _delegate->publish(_updateDtxDataTopic, &_writeFlag, sizeof(_writeFlag), 1);
-          _state = UPDATE_STATE_WAIT_VERIFY_BITS;
-        }
-        else {
-          if (_newVersionSize - _writeFlag.index < UPDATE_RX_DATA_BLOCK_SIZE)
-            _writeFlag.amount = _newVersionSize - _writeFlag.index;
-          _delegate->publish(_updateDtxDataTopic, &_writeFlag, sizeof(_writeFlag), 1);
-        }
-      } else {
-        _onUpdateEnded(true, true); // unsub update toic, sub cmd topic
-        _retCode(OTA_WRITE_FAILED, "ota_write failed", err);
-        if (ESP_OTA_END(_updateHandle) != ESP_OK) {
-          _retCode(OTA_END_FAILED, "ota end failed");
-          // should exit and restart ?
-        }
-        _state = UPDATE_STATE_IDLE;
-      }
+    case UPDATE_STATE_WAIT_DATA:
+      _rxData(data, dataLen);
       break;
-    }
 
     case UPDATE_STATE_WAIT_VERIFY_BITS:
       if (_verifyData(data, dataLen)) {
@@ -358,14 +431,485 @@ void AppUpdater::updateLoop(const char* data, size_t dataLen)
   }
 }
 
+void AppUpdater::_beginData(uint32_t window, uint32_t flags)
+{
+  _sha256 = flags & UPDATE_FLAG_SHA256;
+  _delta = flags & UPDATE_FLAG_DELTA;
+  _compressed = flags & UPDATE_FLAG_HEATSHRINK;
+  _targetErr = ESP_OK;
+  if (_delta) {
+    _sourcePartition = esp_ota_get_running_partition();
+    _patch.begin(this, this);
+  }
+  if (_compressed) _decoder.begin(this);
+  if (_sha256) {
+    mbedtls_sha256_init(&_sha256Context);
+    mbedtls_sha256_starts(&_sha256Context, 0);
+  }
+  else {
+    mbedtls_md5_init(&_md5Context);
+    mbedtls_md5_starts(&_md5Context);
+  }
+
+  _startMilli = nowMilli();
+  _progressMilli = _startMilli;
+  _rttSumMilli = 0;
+  _rttCount = 0;
+  _rerequestCount = 0;
+  _rxBusyMicro = 0;
+  _progress = 0;
+  _outstanding = 0;
+  _requestIndex = 0;
+  _queueIndex = 0;
+  _writtenIndex = 0;
+  if (!_startPipeline()) {
+    _abortData(OTA_BEGIN_FAILED, "cannot start update pipeline", 0);
+    return;
+  }
+
+  // as many requests out as the server takes and the buffers hold
+  if (window < 1) window = 1;
+  if (window > UPDATE_WINDOW_MAX) window = UPDATE_WINDOW_MAX;
+  _window = window < _bufferCount ? window : _bufferCount;
+  _fillWindow();
+}
+
+void AppUpdater::_requestVerifyBits()
+{
+  // every block written is hashed, the hash stage is idle
+  if (_sha256) mbedtls_sha256_finish(&_sha256Context, _digest);
+  else mbedtls_md5_finish(&_md5Context, _digest);
+  _stopPipeline();
+  APP_LOGI(TAG, "downloading data completed");
+
+  char stats[224];
+  uint32_t elapsed = nowMilli() - _startMilli;
+  uint32_t rate = elapsed ? (uint64_t)_newVersionSize * 1000 / elapsed : 0;
+  snprintf(stats, sizeof(stats), "%u bytes in %u ms, %u.%02u MB/s, window %d, rtt %u ms, %u re-requests, "
+           "busy rx %u%% hash %u%% write %u%%",
+           (unsigned)_newVersionSize, (unsigned)elapsed, (unsigned)(rate / 1000000), (unsigned)(rate / 10000 % 100),
+           _window, (unsigned)(_rttCount ? _rttSumMilli / _rttCount : 0), (unsigned)_rerequestCount,
+           _busyPercent(_rxBusyMicro, elapsed), _busyPercent(_hashBusyMicro, elapsed),
+           _busyPercent(_writeBusyMicro, elapsed));
+  if (_compressed) {
+    size_t length = strlen(stats);
+    snprintf(stats + length, sizeof(stats) - length, ", decoded %u bytes", (unsigned)_decoder.decodedSize());
+  }
+  if (_delta) {
+    size_t length = strlen(stats);
+    snprintf(stats + length, sizeof(stats) - length, ", delta to %u bytes", (unsigned)_patch.targetSize());
+  }
+  _retCode(DOWNLOAD_STATS, stats, rate);    // bytes per second
+
+  _writeFlag.index = REQUIRE_VERIFY_BIT_CMD;
+  _writeFlag.amount = REQUIRE_VERIFY_BIT_CMD;
+  _delegate->publish(_updateDtxDataTopic, &_writeFlag, sizeof(_writeFlag), 1);
+  _state = UPDATE_STATE_WAIT_VERIFY_BITS;
+  _progressMilli = nowMilli();
+}
+
+void AppUpdater::_abortData(int code, const char *msg, int value)
+{
+  _onUpdateEnded(true, true); // unsub update toic, sub cmd topic
+  _retCode(code, msg, value);
+  // the writer may be amid a block, ota ends once the pipeline stopped
+  if (_pipelineRunning) _otaEndPending = true;
+  else _endOta();
+  _state = UPDATE_STATE_IDLE;
+}
+
+void AppUpdater::_endOta()
+{
+  if (ESP_OTA_END(_updateHandle) != ESP_OK) {
+    _retCode(OTA_END_FAILED, "ota end failed");
+    // should exit and restart ?
+  }
+}
+
+unsigned AppUpdater::_busyPercent(uint32_t busyMicro, uint32_t elapsedMilli)
+{
+  return elapsedMilli ? busyMicro / 10 / elapsedMilli : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// transfer
+/////////////////////////////////////////////////////////////////////////////////////////
+size_t AppUpdater::_blockLength(size_t index)
+{
+  size_t left = _newVersionSize - index;
+  return left < UPDATE_RX_DATA_BLOCK_SIZE ? left : UPDATE_RX_DATA_BLOCK_SIZE;
+}
+
+uint8_t AppUpdater::_slotOf(size_t index)
+{
+  return (index / UPDATE_RX_DATA_BLOCK_SIZE) % _bufferCount;
+}
+
+uint8_t * AppUpdater::_bufferOf(uint8_t slot)
+{
+  return _buffers + slot * UPDATE_RX_DATA_BLOCK_SIZE;
+}
+
+uint32_t AppUpdater::_blockTimeout()
+{
+  // a few round trips, the whole window may be queued ahead of a block
+  if (_rttCount == 0) return UPDATE_BLOCK_TIMEOUT_MAX;
+  uint32_t timeout = _rttSumMilli / _rttCount * (_window + 2);
+  if (timeout < UPDATE_BLOCK_TIMEOUT_MIN) return UPDATE_BLOCK_TIMEOUT_MIN;
+  return timeout < UPDATE_BLOCK_TIMEOUT_MAX ? timeout : UPDATE_BLOCK_TIMEOUT_MAX;
+}
+
+void AppUpdater::_requestBlock(size_t index)
+{
+  WriteFlag flag = { index, _blockLength(index) };
+  BufferSlot &slot = _slots[_slotOf(index)];
+  slot.requestedMilli = nowMilli();
+  ++slot.requests;
+  _delegate->publish(_updateDtxDataTopic, &flag, sizeof(flag), 1);
+}
+
+void AppUpdater::_fillWindow()
+{
+  // a block is requested only into a free buffer, the writer holds back the network
+  size_t end = _writtenIndex + _bufferCount * UPDATE_RX_DATA_BLOCK_SIZE;
+  while (_requestIndex < _newVersionSize && _requestIndex < end && _outstanding < _window) {
+    BufferSlot &slot = _slots[_slotOf(_requestIndex)];
+    slot.requests = 0;
+    slot.state = SLOT_REQUESTED;
+    slot.length = _blockLength(_requestIndex);
+    _requestBlock(_requestIndex);
+    ++_outstanding;
+    _requestIndex += slot.length;
+  }
+}
+
+void AppUpdater::_rxData(const char* data, size_t dataLen)
+{
+  if (dataLen < sizeof(size_t)) return;
+  size_t index = *((size_t*)data);
+  const char *block = data + sizeof(size_t);
+  size_t blockSize = dataLen - sizeof(size_t);
+
+  // outside the window are late copies of blocks requested again, dropped as are
+  // blocks of the wrong size; a missing block is requested again when it times out
+  if (index % UPDATE_RX_DATA_BLOCK_SIZE || index < _queueIndex || index >= _requestIndex
+      || blockSize != _blockLength(index)) return;
+  uint8_t slotIndex = _slotOf(index);
+  BufferSlot &slot = _slots[slotIndex];
+  if (slot.state != SLOT_REQUESTED) return;
+  // rtt only of blocks requested once, a reply to which request is ambiguous otherwise
+  if (slot.requests == 1) {
+    _rttSumMilli += nowMilli() - slot.requestedMilli;
+    ++_rttCount;
+  }
+
+  int64_t startMicro = esp_timer_get_time();
+  _progressMilli = nowMilli();
+  memcpy(_bufferOf(slotIndex), block, blockSize);
+  slot.state = SLOT_RECEIVED;
+  --_outstanding;
+
+  // in order into the pipeline, queues hold every buffer so this never blocks
+  while (_queueIndex < _requestIndex && _slots[_slotOf(_queueIndex)].state == SLOT_RECEIVED) {
+    uint8_t next = _slotOf(_queueIndex);
+    _slots[next].state = SLOT_QUEUED;
+    xQueueSend(_hashQueue, &next, 0);
+    _queueIndex += _slots[next].length;
+  }
+  _rxBusyMicro += esp_timer_get_time() - startMicro;
+
+  _fillWindow();
+}
+
+void AppUpdater::_onBlockWritten(uint8_t slot, esp_err_t err, int patchStatus, int decodeStatus)
+{
+  // aborted meanwhile, the pipeline is draining
+  if (_state != UPDATE_STATE_WAIT_DATA) return;
+  if (err != ESP_OK) {
+    _abortData(OTA_WRITE_FAILED, "ota_write failed", err);
+    return;
+  }
+  if (patchStatus != DeltaPatch::DELTA_OK) {
+    _abortData(DELTA_PATCH_FAILED, "delta patch failed", patchStatus);
+    return;
+  }
+  if (decodeStatus != HeatshrinkDecoder::HEATSHRINK_OK) {
+    _abortData(DECOMPRESS_FAILED, "decompress failed", decodeStatus);
+    return;
+  }
+
+  // written in order, the slot is of the block at _writtenIndex
+  _progressMilli = nowMilli();
+  _writtenIndex += _slots[slot].length;
+  _slots[slot].state = SLOT_FREE;
+
+  // progress once a percent, not once a block
+  uint8_t progress = _writtenIndex * 100ULL / _newVersionSize;
+  if (progress != _progress) {
+    _progress = progress;
+    _retCode(DOWNLOAD_PROGRESS, "", progress);
+  }
+
+  if (_writtenIndex < _newVersionSize) {
+    _fillWindow();
+    return;
+  }
+  // all data decoded and applied, the writer is idle
+  if (_compressed && (decodeStatus = _decoder.finish()) != HeatshrinkDecoder::HEATSHRINK_OK) {
+    _abortData(DECOMPRESS_FAILED, "compressed data incomplete", decodeStatus);
+    return;
+  }
+  if (_delta && (patchStatus = _patch.finish()) != DeltaPatch::DELTA_OK) {
+    _abortData(DELTA_PATCH_FAILED, "delta patch incomplete", patchStatus);
+    return;
+  }
+  _requestVerifyBits();
+}
+
+uint32_t AppUpdater::_stallTimeout()
+{
+  return _state == UPDATE_STATE_WAIT_DATA ? UPDATE_STALL_TIMEOUT : UPDATE_REPLY_TIMEOUT;
+}
+
+uint32_t AppUpdater::nextPollTimeout()
+{
+  if (_state == UPDATE_STATE_IDLE) return UINT32_MAX;
+
+  uint32_t now = nowMilli();
+  uint32_t stall = _stallTimeout();
+  uint32_t idle = now - _progressMilli;
+  uint32_t timeout = idle < stall ? stall - idle : 0;
+  if (_state != UPDATE_STATE_WAIT_DATA || !_buffers) return timeout;
+
+  uint32_t limit = _blockTimeout();
+  for (size_t index = _queueIndex; index < _requestIndex; index += UPDATE_RX_DATA_BLOCK_SIZE) {
+    const BufferSlot &slot = _slots[_slotOf(index)];
+    if (slot.state != SLOT_REQUESTED) continue;
+    uint32_t age = now - slot.requestedMilli;
+    uint32_t left = age < limit ? limit - age : 0;
+    if (left < timeout) timeout = left;
+  }
+  return timeout;
+}
+
+void AppUpdater::onPolled()
+{
+  if (_state == UPDATE_STATE_IDLE) return;
+
+  // server stopped answering, or the pipeline stopped moving
+  uint32_t now = nowMilli();
+  if (now - _progressMilli >= _stallTimeout()) {
+    if (_state == UPDATE_STATE_WAIT_VERSION_INFO) {
+      _onUpdateEnded(true, true); // unsub update toic, sub cmd topic
+      _retCode(RXDATA_TIMEOUT, "no version info from server");
+      _state = UPDATE_STATE_IDLE;
+    }
+    else {
+      _abortData(RXDATA_TIMEOUT, _state == UPDATE_STATE_WAIT_DATA ? "update stalled" : "no verify bits from server",
+                 now - _progressMilli);
+    }
+    return;
+  }
+  if (_state != UPDATE_STATE_WAIT_DATA || !_buffers) return;
+
+  uint32_t limit = _blockTimeout();
+  for (size_t index = _queueIndex; index < _requestIndex; index += UPDATE_RX_DATA_BLOCK_SIZE) {
+    const BufferSlot &slot = _slots[_slotOf(index)];
+    if (slot.state != SLOT_REQUESTED || now - slot.requestedMilli < limit) continue;
+    if (slot.requests >= UPDATE_BLOCK_REQUEST_MAX) {
+      _abortData(RXDATA_TIMEOUT, "data block not received", index);
+      return;
+    }
+    ++_rerequestCount;
+    _requestBlock(index);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// pipeline
+/////////////////////////////////////////////////////////////////////////////////////////
+bool AppUpdater::_startPipeline()
+{
+  // written blocks come back through the reactor
+  if (!_delegate->reactor()) return false;
+
+  // fewer buffers if memory is short, one still overlaps network and flash somewhat
+  for (_bufferCount = UPDATE_BUFFER_COUNT; _bufferCount > 0; --_bufferCount) {
+    _buffers = (uint8_t *)malloc(_bufferCount * UPDATE_RX_DATA_BLOCK_SIZE);
+    if (_buffers) break;
+  }
+  if (!_buffers) return false;
+  if (_bufferCount < UPDATE_BUFFER_COUNT) APP_LOGE(TAG, "no memory for all buffers, %d taken", _bufferCount);
+  memset(_slots, 0, sizeof(_slots));
+  _hashBusyMicro = 0;
+  _writeBusyMicro = 0;
+  _pipelineStopping = false;
+
+  // room for every buffer and the stop mark
+  _hashQueue = xQueueCreate(_bufferCount + 1, sizeof(uint8_t));
+  _writeQueue = xQueueCreate(_bufferCount + 1, sizeof(uint8_t));
+  if (!_hashQueue || !_writeQueue
+      || xTaskCreate(update_write_task, "update_write_task", 4096, this, UPDATE_WRITE_TASK_PRIORITY, NULL) != pdPASS) {
+    if (_hashQueue) vQueueDelete(_hashQueue);
+    if (_writeQueue) vQueueDelete(_writeQueue);
+    _hashQueue = _writeQueue = NULL;
+    free(_buffers);
+    _buffers = NULL;
+    return false;
+  }
+  _pipelineRunning = true;
+
+  if (xTaskCreate(update_hash_task, "update_hash_task", 3072, this, UPDATE_HASH_TASK_PRIORITY, NULL) != pdPASS) {
+    // writer is up, stopped as the hash stage would
+    uint8_t stop = UPDATE_STAGE_STOP;
+    xQueueSend(_writeQueue, &stop, 0);
+    _pipelineStopping = true;
+    return false;
+  }
+  return true;
+}
+
+void AppUpdater::_stopPipeline()
+{
+  if (!_pipelineRunning || _pipelineStopping) return;
+  _pipelineStopping = true;
+  uint8_t stop = UPDATE_STAGE_STOP;
+  xQueueSend(_hashQueue, &stop, 0);
+}
+
+void AppUpdater::onNetJob(NetJob *job)
+{
+  if (job->type == UpdateJobWritten) {
+    _onBlockWritten(job->data[0], job->flag, job->data[1], job->data[2]);
+    return;
+  }
+
+  // both stages are done with queues and buffers
+  vQueueDelete(_hashQueue);
+  vQueueDelete(_writeQueue);
+  _hashQueue = _writeQueue = NULL;
+  free(_buffers);
+  _buffers = NULL;
+  _pipelineRunning = false;
+  if (_otaEndPending) {
+    _otaEndPending = false;
+    _endOta();
+  }
+}
+
+void AppUpdater::runHashStage()
+{
+  uint8_t slot = 0;
+  while (slot != UPDATE_STAGE_STOP) {
+    if (xQueueReceive(_hashQueue, &slot, portMAX_DELAY) != pdTRUE) continue;
+    // a patch or compressed data is not hashed, the image the writer makes of it is
+    if (slot != UPDATE_STAGE_STOP && !_delta && !_compressed) {
+      int64_t startMicro = esp_timer_get_time();
+      hashUpdate(_sha256, _bufferOf(slot), _slots[slot].length);
+      _hashBusyMicro += esp_timer_get_time() - startMicro;
+    }
+    xQueueSend(_writeQueue, &slot, portMAX_DELAY);
+  }
+}
+
+void AppUpdater::runWriteStage()
+{
+  NetJob done;
+  done.client = this;
+  done.length = 0;
+  esp_err_t err = ESP_OK;
+  DeltaPatch::Status patchStatus = DeltaPatch::DELTA_OK;
+  HeatshrinkDecoder::Status decodeStatus = HeatshrinkDecoder::HEATSHRINK_OK;
+  uint8_t slot = 0;
+  while (slot != UPDATE_STAGE_STOP) {
+    if (xQueueReceive(_writeQueue, &slot, portMAX_DELAY) != pdTRUE) continue;
+    if (slot == UPDATE_STAGE_STOP) done.type = UpdateJobStopped;
+    else {
+      // nothing written after a failure, the rest only drains
+      if (err == ESP_OK && patchStatus == DeltaPatch::DELTA_OK && decodeStatus == HeatshrinkDecoder::HEATSHRINK_OK) {
+        if (_compressed) {
+          decodeStatus = _decoder.decode(_bufferOf(slot), _slots[slot].length);
+          if (_delta) patchStatus = _patch.status();
+          err = _targetErr;
+        }
+        else if (_delta) {
+          patchStatus = _patch.apply(_bufferOf(slot), _slots[slot].length);
+          err = _targetErr;
+        }
+        else {
+          int64_t startMicro = esp_timer_get_time();
+          err = ESP_OTA_WRITE(_updateHandle, _bufferOf(slot), _slots[slot].length);
+          _writeBusyMicro += esp_timer_get_time() - startMicro;
+        }
+      }
+      done.type = UpdateJobWritten;
+      done.data[0] = slot;
+      done.data[1] = patchStatus;
+      done.data[2] = decodeStatus;
+    }
+    done.flag = err;
+    NetReactor *reactor = _delegate->reactor();
+    while (!reactor->submit(&done)) vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+}
+
+bool AppUpdater::verify(uint32_t size, const uint8_t *sha256)
+{
+  if (!_sourcePartition || size > _sourcePartition->size) return false;
+
+  // own context, sha-256 of the image may be running on the writer's
+  mbedtls_sha256_context context;
+  uint8_t buf[DELTA_PATCH_CHUNK_SIZE];
+  unsigned char hash[SHA256_LENGTH];
+  bool readOk = true;
+  mbedtls_sha256_init(&context);
+  mbedtls_sha256_starts(&context, 0);
+  for (uint32_t offset = 0; readOk && offset < size; offset += sizeof(buf)) {
+    size_t length = size - offset < sizeof(buf) ? size - offset : sizeof(buf);
+    readOk = esp_partition_read(_sourcePartition, offset, buf, length) == ESP_OK;
+    if (readOk) mbedtls_sha256_update(&context, buf, length);
+  }
+  mbedtls_sha256_finish(&context, hash);
+  mbedtls_sha256_free(&context);
+  return readOk && memcmp(hash, sha256, SHA256_LENGTH) == 0;
+}
+
+bool AppUpdater::read(uint32_t offset, uint8_t *buf, size_t length)
+{
+  return esp_partition_read(_sourcePartition, offset, buf, length) == ESP_OK;
+}
+
+bool AppUpdater::write(const uint8_t *data, size_t length)
+{
+  int64_t startMicro = esp_timer_get_time();
+  hashUpdate(_sha256, data, length);
+  int64_t hashedMicro = esp_timer_get_time();
+  _targetErr = ESP_OTA_WRITE(_updateHandle, data, length);
+  _hashBusyMicro += hashedMicro - startMicro;
+  _writeBusyMicro += esp_timer_get_time() - hashedMicro;
+  return _targetErr == ESP_OK;
+}
+
+bool AppUpdater::decoded(const uint8_t *data, size_t length)
+{
+  if (_delta) return _patch.apply(data, length) == DeltaPatch::DELTA_OK;
+  return write(data, length);
+}
+
 void AppUpdater::update()
 {
   APP_LOGI(TAG, "receive update command");
+  // a second command would restart the session under the running pipeline
+  if (isUpdating()) {
+    APP_LOGE(TAG, "update already in progress");
+    return;
+  }
   if (!_beforeUpdateCheck()) return;
 
   Wifi::instance()->waitConnected();
 
   _state = UPDATE_STATE_WAIT_VERSION_INFO;
+  _progressMilli = nowMilli();
 
   _sendUpdateCmd();
 }
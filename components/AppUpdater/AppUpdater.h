@@ -8,12 +8,36 @@
 #define _APP_UPDATER_H
 
 #include "MqttClientDelegate.h"
+#include "TopicRouter.h"
+#include "NetReactor.h"
+#include "DeltaPatch.h"
+#include "HeatshrinkDecoder.h"
 
 #include "esp_ota_ops.h"
 #include "esp_partition.h"
 
+// Windowed transfer: the device offers UPDATE_WINDOW_MAX in its update request, a server
+// that supports it grants a window after the version info and serves that many block
+// requests at once. A server granting no window gets the stop-and-wait requests it
+// always had. A block not received in time is requested again on its own.
+//
+// Pipeline: blocks are received into a pool of UPDATE_BUFFER_COUNT block buffers and
+// handed in order to a hashing task, then to a flash writer task, so the network task
+// takes the next blocks while earlier ones are hashed and written. A buffer is free
+// again once its block is written, no block is requested without a free buffer.
+//
+// Delta update: a server may send a DeltaPatch against the running partition instead of
+// the image, the writer task applies it into the update partition as it comes. Verify
+// bits are then of the patched image, hashed as written.
+//
+// Compressed update: the data, image or patch, may come heatshrink compressed, the writer
+// task decodes it through a HEATSHRINK_WINDOW_SIZE window before writing or patching.
+// Verify bits are of the decoded image.
+#define UPDATE_WINDOW_MAX            4
+#define UPDATE_BUFFER_COUNT          (UPDATE_WINDOW_MAX + 2)     // one hashing, one writing
 
-class AppUpdater
+class AppUpdater : public TopicMessageHandler, public NetReactorClient, public DeltaPatchSource,
+                   public DeltaPatchTarget, public HeatshrinkOutput
 {
 public:
     // type
@@ -28,16 +52,49 @@ public:
         size_t amount;
     };
     typedef uint32_t VersionNoType;
+    enum SlotState {
+        SLOT_FREE,
+        SLOT_REQUESTED,
+        SLOT_RECEIVED,
+        SLOT_QUEUED              // in the pipeline until written
+    };
+    struct BufferSlot {
+        uint32_t requestedMilli;
+        uint8_t  requests;       // of the block now in the slot
+        uint8_t  state;
+        size_t   length;
+    };
 
 public:
     AppUpdater();
     void init();
     size_t updateRxTopicLen();
     const char* updateRxTopic();
-    void setMqttClientDelegate(MqttClientDelegate *delegate) { _delegate = delegate; }
+    void setMqttClientDelegate(MqttClientDelegate *delegate);
     void update();
     void updateLoop(const char* data, size_t dataLen);
-    bool isUpdating() { return _state != UPDATE_STATE_IDLE; }
+    bool isUpdating() { return _state != UPDATE_STATE_IDLE || _pipelineRunning; }
+
+    // TopicMessageHandler interface
+    virtual void onTopicMessage(const char* topic, size_t topicLen, const char* msg, size_t msgLen, void *context);
+
+    // NetReactorClient, re-requests missing blocks, takes written ones back and gives up
+    // an update the server stopped answering
+    virtual uint32_t nextPollTimeout();
+    virtual void onPolled();
+    virtual void onNetJob(NetJob *job);
+
+    // pipeline stage tasks
+    void runHashStage();
+    void runWriteStage();
+
+    // DeltaPatchSource, the running partition, and DeltaPatchTarget, the update
+    // partition; writer task
+    virtual bool verify(uint32_t size, const uint8_t *sha256);
+    virtual bool read(uint32_t offset, uint8_t *buf, size_t length);
+    virtual bool write(const uint8_t *data, size_t length);
+    // HeatshrinkOutput, into the patch or the update partition; writer task
+    virtual bool decoded(const uint8_t *data, size_t length);
 
 protected:
     void _retCode(int code, const char *msg, int value = 0);
@@ -47,6 +104,24 @@ protected:
     void _onUpdateEnded(bool unsubUpdateTopic, bool subCmdTopic);
     void _onRxDataComplete();
     bool _verifyData(const char *verifyBits, size_t length);
+    void _beginData(uint32_t window, uint32_t flags);
+    void _requestVerifyBits();
+    void _abortData(int code, const char *msg, int value);
+    void _endOta();
+    uint32_t _stallTimeout();
+    unsigned _busyPercent(uint32_t busyMicro, uint32_t elapsedMilli);
+    // transfer
+    void _rxData(const char* data, size_t dataLen);
+    void _onBlockWritten(uint8_t slot, esp_err_t err, int patchStatus, int decodeStatus);
+    void _fillWindow();
+    void _requestBlock(size_t index);
+    uint32_t _blockTimeout();
+    size_t _blockLength(size_t index);
+    uint8_t _slotOf(size_t index);
+    uint8_t * _bufferOf(uint8_t slot);
+    // pipeline
+    bool _startPipeline();
+    void _stopPipeline();
 
 protected:
     UpdateState              _state;
@@ -57,6 +132,39 @@ protected:
     esp_ota_handle_t         _updateHandle;
     const esp_partition_t  * _updatePartition;
     MqttClientDelegate      *_delegate;
+    // transfer, _window 1 on stop-and-wait
+    uint8_t                  _window;
+    uint8_t                  _outstanding;       // blocks requested, not received
+    size_t                   _requestIndex;      // next block offset to request
+    size_t                   _queueIndex;        // next block offset into the pipeline
+    size_t                   _writtenIndex;      // flash written up to
+    uint8_t                  _progress;
+    bool                     _sha256;            // verify bits kind, md5 for old servers
+    bool                     _delta;             // data is a patch of the running partition
+    DeltaPatch               _patch;
+    bool                     _compressed;        // data is heatshrink compressed
+    HeatshrinkDecoder        _decoder;
+    const esp_partition_t  * _sourcePartition;
+    esp_err_t                _targetErr;         // of the last patched write
+    // pipeline, buffers and queues live until the writer reports it stopped
+    uint8_t                  _bufferCount;
+    uint8_t                 *_buffers;
+    BufferSlot               _slots[UPDATE_BUFFER_COUNT];
+    QueueHandle_t            _hashQueue;
+    QueueHandle_t            _writeQueue;
+    bool                     _pipelineRunning;
+    bool                     _pipelineStopping;
+    bool                     _otaEndPending;     // aborted, ota ends once the writer stopped
+    // last reply or block, an update without one for too long is given up
+    uint32_t                 _progressMilli;
+    // throughput against rtt and stage utilization, reported when data complete
+    uint32_t                 _startMilli;
+    uint32_t                 _rttSumMilli;
+    uint32_t                 _rttCount;
+    uint32_t                 _rerequestCount;
+    uint32_t                 _rxBusyMicro;
+    volatile uint32_t        _hashBusyMicro;
+    volatile uint32_t        _writeBusyMicro;
 };
 
 #endif // _APP_UPDATER_H
@@ -0,0 +1,170 @@
+/*
+ * DeltaPatch: streaming binary patch applier for delta updates
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "DeltaPatch.h"
+
+#include <string.h>
+
+static uint32_t readUint32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ DeltaPatch class
+/////////////////////////////////////////////////////////////////////////////////////////
+DeltaPatch::DeltaPatch()
+: _source(NULL)
+, _target(NULL)
+, _status(DELTA_OK)
+, _state(STATE_HEADER)
+, _headLength(0)
+, _sourceSize(0)
+, _targetSize(0)
+, _targetWritten(0)
+, _sourceOffset(0)
+, _copyLeft(0)
+, _diffLeft(0)
+, _extraLeft(0)
+, _seek(0)
+{}
+
+void DeltaPatch::begin(DeltaPatchSource *source, DeltaPatchTarget *target)
+{
+  _source = source;
+  _target = target;
+  _status = DELTA_OK;
+  _state = STATE_HEADER;
+  _headLength = 0;
+  _sourceSize = 0;
+  _targetSize = 0;
+  _targetWritten = 0;
+  _sourceOffset = 0;
+  _copyLeft = 0;
+  _diffLeft = 0;
+  _extraLeft = 0;
+  _seek = 0;
+}
+
+DeltaPatch::Status DeltaPatch::apply(const uint8_t *data, size_t length)
+{
+  // copies take no patch bytes, one may be all that is left
+  while (_status == DELTA_OK && (length > 0 || _state == STATE_COPY)) {
+    size_t n;
+    switch (_state) {
+      case STATE_HEADER:
+      case STATE_RECORD: {
+        size_t size = _state == STATE_HEADER ? DELTA_PATCH_HEADER_SIZE : DELTA_PATCH_RECORD_SIZE;
+        n = size - _headLength < length ? size - _headLength : length;
+        memcpy(_head + _headLength, data, n);
+        _headLength += n;
+        if (_headLength == size) {
+          _headLength = 0;
+          if (_state == STATE_HEADER) _status = _header();
+          else _record();
+        }
+        break;
+      }
+
+      case STATE_COPY:
+        n = 0;
+        _status = _copy();
+        break;
+
+      case STATE_DIFF:
+        n = _diffLeft < length ? _diffLeft : length;
+        if (n > DELTA_PATCH_CHUNK_SIZE) n = DELTA_PATCH_CHUNK_SIZE;
+        _status = _diff(data, n);
+        break;
+
+      case STATE_EXTRA:
+        n = _extraLeft < length ? _extraLeft : length;
+        _status = _extra(data, n);
+        break;
+
+      default:
+        n = length;
+        break;
+    }
+    data += n;
+    length -= n;
+  }
+  return _status;
+}
+
+DeltaPatch::Status DeltaPatch::finish()
+{
+  if (_status != DELTA_OK) return _status;
+  if (_state != STATE_RECORD || _headLength != 0 || _targetWritten != _targetSize) _status = DELTA_TRUNCATED;
+  return _status;
+}
+
+DeltaPatch::Status DeltaPatch::_header()
+{
+  if (memcmp(_head, DELTA_PATCH_MAGIC, DELTA_PATCH_MAGIC_SIZE) != 0) return DELTA_BAD_HEADER;
+  _sourceSize = readUint32(_head + DELTA_PATCH_MAGIC_SIZE);
+  _targetSize = readUint32(_head + DELTA_PATCH_MAGIC_SIZE + 4);
+  if (!_source->verify(_sourceSize, _head + DELTA_PATCH_MAGIC_SIZE + 8)) return DELTA_SOURCE_MISMATCHED;
+  _state = STATE_RECORD;
+  return DELTA_OK;
+}
+
+void DeltaPatch::_record()
+{
+  _copyLeft = readUint32(_head);
+  _diffLeft = readUint32(_head + 4);
+  _extraLeft = readUint32(_head + 8);
+  _seek = (int32_t)readUint32(_head + 12);
+  _next();
+}
+
+// next part of the record, or the next record once the source seeked
+void DeltaPatch::_next()
+{
+  _state = _copyLeft ? STATE_COPY : _diffLeft ? STATE_DIFF : _extraLeft ? STATE_EXTRA : STATE_RECORD;
+  if (_state == STATE_RECORD) _sourceOffset += _seek;
+}
+
+DeltaPatch::Status DeltaPatch::_copy()
+{
+  size_t length = _copyLeft < DELTA_PATCH_CHUNK_SIZE ? _copyLeft : DELTA_PATCH_CHUNK_SIZE;
+  if (_sourceOffset < 0 || _sourceOffset + length > _sourceSize) return DELTA_SOURCE_OUT_OF_RANGE;
+  if (length > _targetSize - _targetWritten) return DELTA_TARGET_TOO_LONG;
+  if (!_source->read(_sourceOffset, _chunk, length)) return DELTA_SOURCE_READ_FAILED;
+  if (!_target->write(_chunk, length)) return DELTA_TARGET_WRITE_FAILED;
+
+  _sourceOffset += length;
+  _targetWritten += length;
+  _copyLeft -= length;
+  if (_copyLeft == 0) _next();
+  return DELTA_OK;
+}
+
+DeltaPatch::Status DeltaPatch::_diff(const uint8_t *data, size_t length)
+{
+  if (_sourceOffset < 0 || _sourceOffset + length > _sourceSize) return DELTA_SOURCE_OUT_OF_RANGE;
+  if (length > _targetSize - _targetWritten) return DELTA_TARGET_TOO_LONG;
+  if (!_source->read(_sourceOffset, _chunk, length)) return DELTA_SOURCE_READ_FAILED;
+  for (size_t i = 0; i < length; ++i) _chunk[i] += data[i];
+  if (!_target->write(_chunk, length)) return DELTA_TARGET_WRITE_FAILED;
+
+  _sourceOffset += length;
+  _targetWritten += length;
+  _diffLeft -= length;
+  if (_diffLeft == 0) _next();
+  return DELTA_OK;
+}
+
+DeltaPatch::Status DeltaPatch::_extra(const uint8_t *data, size_t length)
+{
+  if (length > _targetSize - _targetWritten) return DELTA_TARGET_TOO_LONG;
+  if (!_target->write(data, length)) return DELTA_TARGET_WRITE_FAILED;
+
+  _targetWritten += length;
+  _extraLeft -= length;
+  if (_extraLeft == 0) _next();
+  return DELTA_OK;
+}
@@ -0,0 +1,112 @@
+/*
+ * DeltaPatch: streaming binary patch applier for delta updates
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _DELTA_PATCH_H
+#define _DELTA_PATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Patch of a source image into a target image, bsdiff records interleaved so it can be
+// applied as it arrives, in any chunking, with DELTA_PATCH_CHUNK_SIZE of source and
+// target bytes buffered. All integers little endian.
+//
+//   header   "SDP1", uint32 source size, uint32 target size, source sha-256
+//   records  uint32 copy length, uint32 diff length, uint32 extra length, int32 source seek
+//            copy: source bytes as target bytes, no patch bytes, source offset advances
+//            diff bytes: target byte = source byte + diff byte, source offset advances
+//            extra bytes: target byte as is
+//            then source offset += seek
+//
+// Copy is the zero runs of bsdiff's diff, which make most of it on firmware images.
+//
+// tools/deltaPatch.cpp makes patches and applies them to files.
+
+#define DELTA_PATCH_MAGIC           "SDP1"
+#define DELTA_PATCH_MAGIC_SIZE      4
+#define DELTA_PATCH_HASH_SIZE       32
+#define DELTA_PATCH_HEADER_SIZE     (DELTA_PATCH_MAGIC_SIZE + 8 + DELTA_PATCH_HASH_SIZE)
+#define DELTA_PATCH_RECORD_SIZE     16
+#define DELTA_PATCH_CHUNK_SIZE      512
+
+class DeltaPatchSource
+{
+public:
+  // false if the source is not size bytes hashing to sha256
+  virtual bool verify(uint32_t size, const uint8_t *sha256) = 0;
+  virtual bool read(uint32_t offset, uint8_t *buf, size_t length) = 0;
+};
+
+class DeltaPatchTarget
+{
+public:
+  // target bytes in order
+  virtual bool write(const uint8_t *data, size_t length) = 0;
+};
+
+class DeltaPatch
+{
+public:
+  enum Status {
+    DELTA_OK = 0,
+    DELTA_BAD_HEADER,
+    DELTA_SOURCE_MISMATCHED,
+    DELTA_SOURCE_READ_FAILED,
+    DELTA_TARGET_WRITE_FAILED,
+    DELTA_SOURCE_OUT_OF_RANGE,      // record reads outside the source
+    DELTA_TARGET_TOO_LONG,
+    DELTA_TRUNCATED
+  };
+
+public:
+  DeltaPatch();
+
+  void begin(DeltaPatchSource *source, DeltaPatchTarget *target);
+  // next patch bytes, target bytes are written before it returns; the first failure
+  // sticks and is returned from then on
+  Status apply(const uint8_t *data, size_t length);
+  // after the last patch byte, DELTA_OK if it ended on a record with the target complete
+  Status finish();
+
+  Status status() { return _status; }
+  uint32_t targetSize() { return _targetSize; }
+  uint32_t targetWritten() { return _targetWritten; }
+
+protected:
+  enum State {
+    STATE_HEADER,
+    STATE_RECORD,
+    STATE_COPY,
+    STATE_DIFF,
+    STATE_EXTRA
+  };
+
+  Status _header();
+  void _record();
+  void _next();
+  Status _copy();
+  Status _diff(const uint8_t *data, size_t length);
+  Status _extra(const uint8_t *data, size_t length);
+
+protected:
+  DeltaPatchSource   *_source;
+  DeltaPatchTarget   *_target;
+  Status              _status;
+  State               _state;
+  uint8_t             _head[DELTA_PATCH_HEADER_SIZE];   // header or record being read
+  size_t              _headLength;
+  uint32_t            _sourceSize;
+  uint32_t            _targetSize;
+  uint32_t            _targetWritten;
+  int64_t             _sourceOffset;
+  uint32_t            _copyLeft;
+  uint32_t            _diffLeft;
+  uint32_t            _extraLeft;
+  int32_t             _seek;
+  uint8_t             _chunk[DELTA_PATCH_CHUNK_SIZE];
+};
+
+#endif // _DELTA_PATCH_H
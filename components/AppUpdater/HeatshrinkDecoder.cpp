@@ -0,0 +1,121 @@
+/*
+ * HeatshrinkDecoder: streaming heatshrink decompression for compressed updates
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "HeatshrinkDecoder.h"
+
+#include <string.h>
+
+#define WINDOW_MASK  (HEATSHRINK_WINDOW_SIZE - 1)
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ HeatshrinkDecoder class
+/////////////////////////////////////////////////////////////////////////////////////////
+HeatshrinkDecoder::HeatshrinkDecoder()
+: _output(NULL)
+, _status(HEATSHRINK_OK)
+, _state(STATE_TAG)
+, _bits(0)
+, _bitCount(0)
+, _offset(0)
+, _decodedSize(0)
+, _head(0)
+, _flushed(0)
+{}
+
+void HeatshrinkDecoder::begin(HeatshrinkOutput *output)
+{
+  _output = output;
+  _status = HEATSHRINK_OK;
+  _state = STATE_TAG;
+  _bits = 0;
+  _bitCount = 0;
+  _offset = 0;
+  _decodedSize = 0;
+  _head = 0;
+  _flushed = 0;
+}
+
+HeatshrinkDecoder::Status HeatshrinkDecoder::decode(const uint8_t *data, size_t length)
+{
+  for (size_t i = 0; i < length && _status == HEATSHRINK_OK; ++i) {
+    // fewer bits than a field are ever left over, 32 hold them and a byte
+    _bits = (_bits << 8) | data[i];
+    _bitCount += 8;
+
+    uint32_t value;
+    bool taken = true;
+    while (taken && _status == HEATSHRINK_OK) {
+      switch (_state) {
+        case STATE_TAG:
+          if ((taken = _take(1, value))) _state = value ? STATE_LITERAL : STATE_INDEX;
+          break;
+
+        case STATE_LITERAL:
+          if ((taken = _take(8, value))) {
+            _put(value);
+            _state = STATE_TAG;
+          }
+          break;
+
+        case STATE_INDEX:
+          if ((taken = _take(HEATSHRINK_WINDOW_BITS, value))) {
+            _offset = value + 1;
+            _state = STATE_COUNT;
+          }
+          break;
+
+        case STATE_COUNT:
+          if ((taken = _take(HEATSHRINK_LOOKAHEAD_BITS, value))) {
+            if (_offset > _decodedSize) {
+              _status = HEATSHRINK_BAD_BACKREF;
+              break;
+            }
+            // may overlap the bytes it makes, so byte by byte
+            for (uint32_t count = value + 1; count > 0 && _status == HEATSHRINK_OK; --count)
+              _put(_window[(_head - _offset) & WINDOW_MASK]);
+            _state = STATE_TAG;
+          }
+          break;
+      }
+    }
+  }
+  if (_status == HEATSHRINK_OK) _flush(_head);
+  return _status;
+}
+
+HeatshrinkDecoder::Status HeatshrinkDecoder::finish()
+{
+  if (_status != HEATSHRINK_OK) return _status;
+  // the padding may have been taken for a backref tag
+  bool padding = (_state == STATE_TAG && _bitCount < 8) || (_state == STATE_INDEX && _bitCount < 7);
+  if (!padding || _bits != 0) _status = HEATSHRINK_TRUNCATED;
+  return _status;
+}
+
+bool HeatshrinkDecoder::_take(int count, uint32_t &value)
+{
+  if (_bitCount < count) return false;
+  _bitCount -= count;
+  value = _bits >> _bitCount;
+  _bits &= (1u << _bitCount) - 1;
+  return true;
+}
+
+void HeatshrinkDecoder::_put(uint8_t byte)
+{
+  _window[_head] = byte;
+  _head = (_head + 1) & WINDOW_MASK;
+  ++_decodedSize;
+  // about to overwrite bytes not output yet
+  if (_head == 0) _flush(HEATSHRINK_WINDOW_SIZE);
+}
+
+void HeatshrinkDecoder::_flush(uint32_t end)
+{
+  if (end > _flushed && !_output->decoded(_window + _flushed, end - _flushed))
+    _status = HEATSHRINK_OUTPUT_FAILED;
+  _flushed = end & WINDOW_MASK;
+}
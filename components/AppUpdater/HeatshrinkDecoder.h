@@ -0,0 +1,83 @@
+/*
+ * HeatshrinkDecoder: streaming heatshrink decompression for compressed updates
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _HEATSHRINK_DECODER_H
+#define _HEATSHRINK_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Decoder of the heatshrink (LZSS) bit stream, as `heatshrink -e -w 11 -l 4` makes it,
+// fed in any chunking. Bits MSB first, each command one of
+//
+//   1, 8 bits            literal byte
+//   0, W bits, L bits    backref, copy count + 1 bytes from offset + 1 bytes back
+//
+// and zero bits pad the last byte. Decoding takes no memory but the window, which is
+// also the output buffer: decoded bytes go out when it wraps and when a chunk is done.
+//
+// tools/otaCompress.cpp compresses images and round-trips them through this decoder.
+
+#define HEATSHRINK_WINDOW_BITS      11
+#define HEATSHRINK_LOOKAHEAD_BITS   4
+#define HEATSHRINK_WINDOW_SIZE      (1 << HEATSHRINK_WINDOW_BITS)
+
+class HeatshrinkOutput
+{
+public:
+  // decoded bytes in order
+  virtual bool decoded(const uint8_t *data, size_t length) = 0;
+};
+
+class HeatshrinkDecoder
+{
+public:
+  enum Status {
+    HEATSHRINK_OK = 0,
+    HEATSHRINK_BAD_BACKREF,         // backref before the first byte
+    HEATSHRINK_OUTPUT_FAILED,
+    HEATSHRINK_TRUNCATED
+  };
+
+public:
+  HeatshrinkDecoder();
+
+  void begin(HeatshrinkOutput *output);
+  // next compressed bytes, decoded bytes are output before it returns; the first failure
+  // sticks and is returned from then on
+  Status decode(const uint8_t *data, size_t length);
+  // after the last compressed byte, HEATSHRINK_OK if only padding is left
+  Status finish();
+
+  Status status() { return _status; }
+  uint32_t decodedSize() { return _decodedSize; }
+
+protected:
+  enum State {
+    STATE_TAG,
+    STATE_LITERAL,
+    STATE_INDEX,
+    STATE_COUNT
+  };
+
+  bool _take(int count, uint32_t &value);
+  void _put(uint8_t byte);
+  void _flush(uint32_t end);
+
+protected:
+  HeatshrinkOutput   *_output;
+  Status              _status;
+  State               _state;
+  uint32_t            _bits;          // not yet taken, _bitCount of them
+  int                 _bitCount;
+  uint32_t            _offset;        // of the backref being read
+  uint32_t            _decodedSize;
+  uint32_t            _head;          // window index of the next byte
+  uint32_t            _flushed;       // window index of the first byte not output
+  uint8_t             _window[HEATSHRINK_WINDOW_SIZE];
+};
+
+#endif // _HEATSHRINK_DECODER_H
@@ -55,7 +55,7 @@ void wifi_task(void *pvParameters)
   // set wifi mode accordingly
   DeployMode deployMode = System::instance()->deployMode();
   if (deployMode == MQTTClientMode) Wifi::instance()->setWifiMode(WIFI_MODE_STA);
-  else if (deployMode == HTTPServerMode) Wifi::instance()->setWifiMode(WIFI_MODE_AP);
+  else if (deployMode == HTTPServerMode || deployMode == MQTTBrokerMode) Wifi::instance()->setWifiMode(WIFI_MODE_AP);
   else if (deployMode == MQTTClientAndHTTPServerMode) Wifi::instance()->setWifiMode(WIFI_MODE_APSTA);
 
   Wifi::instance()->init();
@@ -238,6 +238,7 @@ bool _hasPwrEvent = true;
 PowerManager::ChargeStatus _chargeStatus = PowerManager::NotCharging;
 
 TaskState _statusTaskState = TaskEmpty;
+TaskHandle_t statusCheckTaskHandle = NULL;
 void status_check_task(void *p)
 {
   InputMonitor::instance()->init();   // this will launch another task
@@ -251,7 +252,7 @@ void status_check_task(void *p)
         // wifi status
         if (!Wifi::instance()->started())
           dc.setNetworkState(NetworkOff);
-        else if (System::instance()->deployMode() == HTTPServerMode)
+        else if (System::instance()->deployMode() == HTTPServerMode || System::instance()->deployMode() == MQTTBrokerMode)
           dc.setNetworkState(Wifi::instance()->apStaConnected()? NetworkConnected : NetworkNotConnected);
         else
           dc.setNetworkState(Wifi::instance()->connected()? NetworkConnected : NetworkNotConnected);
@@ -319,10 +320,17 @@ uint32_t _lAlertMask = 0;
 uint32_t _gAlertMask = 0;
 float    _alertValue[SensorDataTypeCount];
 
+#ifdef SENSOR_TELEMETRY_ENABLED
+void _publishSensorTelemetry(SensorDataType type, float value);
+#endif
+
 void checkAlert(SensorDataType type, float value)
 {
   System *sys = System::instance();
   _alertValue[type] = value;
+#ifdef SENSOR_TELEMETRY_ENABLED
+  _publishSensorTelemetry(type, value);
+#endif
   uint32_t mask = (uint32_t)sensorAlertMask(type);
   TriggerAlert trigger = sys->sensorValueTriggerAlert(type, value);
   if (trigger == TriggerL) { _lAlertMask |= mask; _gAlertMask &= (~mask); }
@@ -462,10 +470,12 @@ void orientation_sensor_task(void *p)
 //----------------------------------------------
 // the following line must be place after #include "ILI9341.h", 
 // as mongoose.h has macro write (s, b, l)
+#include "NetReactor.h"
 #include "MqttClient.h"
 #include "CmdEngine.h"
 #include "SharedBuffer.h"
 
+NetReactor reactor;
 MqttClient mqtt;
 
 // ------ generate alert push notification request string
@@ -521,11 +531,15 @@ size_t genAlertPushNotificationJsonString(uint32_t mask, const char* tag)
 }
 
 // ------ use counter to check and publish alert push notification request
+void _sendLAlertPushNotification();
+void _sendGAlertPushNotification();
+
 #define REACTIVE_COUNT_FOR_BOOT               1000 // 1000 * 10ms = 10 seconds
-#define REACTIVE_COUNT_FOR_NO_RECENT_PUB      6000 // 1000 * 10ms = 60 seconds
+#define REACTIVE_COUNT_FOR_NO_RECENT_PUB      6000 // 6000 * 10ms = 60 seconds
 uint32_t _alertReactiveCount;
 uint32_t _lAlertReactiveCounter;
 uint32_t _gAlertReactiveCounter;
+TickType_t _alertCounterTick;
 
 void _resetAlertReactiveCounter(bool deepSleepReset = false)
 {
@@ -540,6 +554,23 @@ void _resetAlertReactiveCounter(bool deepSleepReset = false)
     _lAlertReactiveCounter = _alertReactiveCount - REACTIVE_COUNT_FOR_BOOT;
     _gAlertReactiveCounter = _alertReactiveCount - REACTIVE_COUNT_FOR_BOOT;
   }
+  _alertCounterTick = xTaskGetTickCount();
+}
+
+// advance counters by elapsed time, return units until next counter due
+uint32_t _advanceAlertReactiveCounters()
+{
+  TickType_t elapsedTicks = xTaskGetTickCount() - _alertCounterTick;
+  uint32_t units = elapsedTicks * portTICK_PERIOD_MS / ALERT_REACTIVE_COUNT_UNIT;
+  // keep remainder for next advance
+  _alertCounterTick += units * ALERT_REACTIVE_COUNT_UNIT / portTICK_PERIOD_MS;
+  _lAlertReactiveCounter += units;
+  _gAlertReactiveCounter += units;
+  if (_lAlertReactiveCounter >= _alertReactiveCount) _sendLAlertPushNotification();
+  if (_gAlertReactiveCounter >= _alertReactiveCount) _sendGAlertPushNotification();
+  uint32_t lRemain = _alertReactiveCount - _lAlertReactiveCounter;
+  uint32_t gRemain = _alertReactiveCount - _gAlertReactiveCounter;
+  return lRemain < gRemain ? lRemain : gRemain;
 }
 
 #define NPS_TOPIC           "api/nps"
@@ -552,7 +583,7 @@ void _sendLAlertPushNotification()
     size_t jsonSize = genAlertPushNotificationJsonString(_lAlertMask, "l");
     if (jsonSize > 0) {
 #ifdef LOG_ALERT
-      APP_LOGC("[mqtt_task]", "push L alert PN request, free RAM: %d bytes", esp_get_free_heap_size());
+      APP_LOGC("[net_task]", "push L alert PN request, free RAM: %d bytes", esp_get_free_heap_size());
 #endif
       mqtt.publish(NPS_TOPIC, _alertStringBuf, jsonSize, 0);
       _lAlertReactiveCounter = 0;
@@ -568,7 +599,7 @@ void _sendGAlertPushNotification()
     size_t jsonSize = genAlertPushNotificationJsonString(_gAlertMask, "g");
     if (jsonSize > 0) {
 #ifdef LOG_ALERT
-      APP_LOGC("[mqtt_task]", "push G alert PN request, free RAM: %d bytes", esp_get_free_heap_size());
+      APP_LOGC("[net_task]", "push G alert PN request, free RAM: %d bytes", esp_get_free_heap_size());
 #endif
       mqtt.publish(NPS_TOPIC, _alertStringBuf, jsonSize, 0);
       _gAlertReactiveCounter = 0;
@@ -609,6 +640,7 @@ void _genDebugMsgPN(const char* tag, const char* msg)
   packCount += strlen(_debugMsg + packCount);
 
   _hasDebugMsg = true;
+  mqtt.wakeLoop();
 }
 
 void _sendDebugMsgPN()
@@ -621,27 +653,41 @@ void _sendDebugMsgPN()
 
 #endif
 
-// ------ mqtt task
-#include "Crypto.h"
-#include "certs/mqtt_user.h"
-#include "certs/mqtt_passwd.h"
-static void mqtt_task(void *pvParams)
-{
-  CmdEngine cmdEngine;
-  {
-    char user[32];
-    char pass[32];
-    unsigned char v1[] = "CkECr+xGO4YKbicw";
-    unsigned char v2[] = "cBh++uagobC8s1bK";
-    size_t len;
-    decryptBase64(mqttUser,   strlen(mqttUser),   '\0', v1, v2, user, &len);
-    decryptBase64(mqttPasswd, strlen(mqttPasswd), '\0', v1, v2, pass, &len);
-    // ESP_LOG_BUFFER_HEXDUMP("user", user, 64, ESP_LOG_INFO);
-    // ESP_LOG_BUFFER_HEXDUMP("pass", pass, 64, ESP_LOG_INFO);
-    // APP_LOGC("[mqtt_task]", "user: %s, pass: %s", user, pass);
-    mqtt.setUserPassword(user, pass);
-  }
-  mqtt.init();
+#ifdef SENSOR_TELEMETRY_ENABLED
+
+// ------ sensor telemetry
+// every sample on api/sensor/<uid>/<type>, called from the sensor tasks; the coalescer
+// keeps the latest per topic and sends what a window gathered in one batch publish
+#define SENSOR_TOPIC_HEAD           "api/sensor/"
+#define SENSOR_TELEMETRY_WINDOW     1000    // ms, see tools/pubCoalesceBench.cpp
+
+char _sensorTopics[SensorDataTypeCount][48];
+
+void _publishSensorTelemetry(SensorDataType type, float value)
+{
+  if (!mqtt.connected()) return;
+  char payload[32];
+  payload[0] = '{';
+  int length = snprintf(payload + 1, sizeof(payload) - 2, sensorDataValueStrFormat(type), "", value);
+  if (length <= 0 || length >= (int)sizeof(payload) - 2) return;
+  payload[length + 1] = '}';
+  mqtt.coalescePublish(_sensorTopics[type], payload, length + 2, 0);
+}
+
+#endif // SENSOR_TELEMETRY_ENABLED
+
+// ------ mqtt setup, runs in net task
+static void _setupMqtt(CmdEngine &cmdEngine)
+{
+#ifdef SENSOR_TELEMETRY_ENABLED
+  for (uint8_t t=PM; t<SensorDataTypeCount; ++t)
+    snprintf(_sensorTopics[t], sizeof(_sensorTopics[t]), SENSOR_TOPIC_HEAD "%s/%s",
+             System::instance()->uid(), sensorDataTypeStr((SensorDataType)t));
+  mqtt.setCoalesceWindow(SENSOR_TELEMETRY_WINDOW);
+#endif
+
+  // credentials are decrypted once by MqttClient and cached for reconnects
+  mqtt.init(&reactor);
   mqtt.start();
 
   cmdEngine.setProtocolDelegate(&mqtt);
@@ -650,40 +696,270 @@ static void mqtt_task(void *pvParams)
 
   _resetAlertReactiveCounter(isDeepSleepReset());
   _alertStringBuf = SharedBuffer::msgBuffer();
+}
 
-  while (true) {
-    mqtt.poll();
-#ifdef DEBUG_PN
-    _sendDebugMsgPN();
-#endif
-    if (++_lAlertReactiveCounter == _alertReactiveCount) _sendLAlertPushNotification();
-    if (++_gAlertReactiveCounter == _alertReactiveCount) _sendGAlertPushNotification();
-    vTaskDelay(10 / portTICK_PERIOD_MS);
+
+//----------------------------------------------
+// Metrics exporter
+//----------------------------------------------
+// Prometheus text format on GET /metrics, each line formatted straight
+// into the connection send buffer
+#include "HttpRouter.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+#define METRICS_CONTENT_TYPE  "text/plain; version=0.0.4; charset=utf-8"
+#define METRIC_PREFIX         "sensorapp_"
+
+extern TaskHandle_t netTaskHandle;
+extern TaskHandle_t cmdWorkerTaskHandle;
+extern TaskHandle_t statusCheckTaskHandle;
+
+struct MetricsTask {
+  const char    *name;
+  TaskHandle_t  *handle;
+};
+
+static const MetricsTask _metricsTasks[] = {
+  { "display_task",            &displayTaskHandle },
+  { "display_guard_task",      &displayGuardTaskHandle },
+  { "sht3x_sensor_task",       &sht3xSensorTaskHandle },
+  { "pm_sensor_task",          &pmSensorTaskHandle },
+  { "co2_sensor_task",         &co2SensorTaskHandle },
+  { "tsl2561_sensor_task",     &tsl2561SensorTaskHandle },
+  { "orientation_sensor_task", &orientationSensorTaskHandle },
+  { "status_check_task",       &statusCheckTaskHandle },
+  { "wifi_connection_task",    &wifiTaskHandle },
+  { "sntp_task",               &sntpTaskHandle },
+  { "net_task",                &netTaskHandle },
+  { "cmd_worker_task",         &cmdWorkerTaskHandle }
+};
+
+// upper bounds of CmdLatency buckets, +Inf last
+static const char * const _cmdLatencyLe[CMD_LATENCY_BUCKETS] = {
+  "0.001", "0.002", "0.004", "0.008", "0.016", "0.032", "0.064", "0.128", "0.256", "0.512", "+Inf"
+};
+
+static const char * const _chargeStateStr[] = { "none", "pre", "fast", "done" };
+
+static void _metricHeader(HttpResponse &resp, const char *name, const char *type, const char *help)
+{
+  resp.printf("# HELP " METRIC_PREFIX "%s %s\n# TYPE " METRIC_PREFIX "%s %s\n", name, help, name, type);
+}
+
+static void _metricUint(HttpResponse &resp, const char *name, const char *type, const char *help, unsigned value)
+{
+  _metricHeader(resp, name, type, help);
+  resp.printf(METRIC_PREFIX "%s %u\n", name, value);
+}
+
+class MetricsExporter : public HttpRouteHandler
+{
+public:
+  virtual int onHttpRoute(HttpResponse &resp, void *context);
+};
+
+int MetricsExporter::onHttpRoute(HttpResponse &resp, void *context)
+{
+  resp.setContentType(METRICS_CONTENT_TYPE);
+
+  // sensors
+  SensorValue values[SENSOR_VALUE_MAX_COUNT];
+  size_t count = SensorDataPacker::sharedInstance()->values(values, SENSOR_VALUE_MAX_COUNT);
+  _metricHeader(resp, "sensor_value", "gauge", "Latest sensor reading.");
+  for (size_t i = 0; i < count; ++i)
+    resp.printf(METRIC_PREFIX "sensor_value{sensor=\"%s\"} %.3f\n", values[i].name, values[i].value);
+  _metricHeader(resp, "sensor_level", "gauge", "Level of latest sensor reading.");
+  for (size_t i = 0; i < count; ++i) {
+    if (values[i].level >= 0)
+      resp.printf(METRIC_PREFIX "sensor_level{sensor=\"%s\"} %d\n", values[i].name, values[i].level);
+  }
+
+  // power, values cached by status check task
+  _metricHeader(resp, "battery_level_percent", "gauge", "Battery level.");
+  resp.printf(METRIC_PREFIX "battery_level_percent %.1f\n", powerManager.batteryLevel());
+  _metricHeader(resp, "battery_charge_state", "gauge", "Battery charge state, 1 for the current one.");
+  for (int i = PowerManager::NotCharging; i <= PowerManager::ChargeTermination; ++i)
+    resp.printf(METRIC_PREFIX "battery_charge_state{state=\"%s\"} %d\n", _chargeStateStr[i], _chargeStatus == i ? 1 : 0);
+
+  // wifi
+  Wifi *wifi = Wifi::instance();
+  const WifiConnectStats &wifiStats = wifi->connectStats();
+  int8_t rssi;
+  _metricUint(resp, "wifi_connected", "gauge", "Station has an IP address.", wifi->connected() ? 1 : 0);
+  if (wifi->staRssi(rssi)) {
+    _metricHeader(resp, "wifi_rssi_dbm", "gauge", "Signal strength of the connected AP.");
+    resp.printf(METRIC_PREFIX "wifi_rssi_dbm %d\n", rssi);
+  }
+  _metricUint(resp, "wifi_disconnects_total", "counter", "Station disconnects after having an IP address.", wifiStats.disconnectCount);
+  _metricUint(resp, "wifi_scans_total", "counter", "AP scans for ranked connect.", wifiStats.scanCount);
+  _metricUint(resp, "wifi_connect_attempts_total", "counter", "Connect attempts to ranked APs.", wifiStats.candidateAttemptCount);
+  _metricUint(resp, "wifi_connect_failures_total", "counter", "Failed connect attempts to ranked APs.", wifiStats.candidateFailCount);
+  _metricUint(resp, "wifi_fast_connects_total", "counter", "Connects to the cached AP without scan.", wifi->fastConnectCount());
+  _metricUint(resp, "wifi_fast_connect_fallbacks_total", "counter", "Cached AP connects that fell back to scan.", wifi->fastConnectFallbackCount());
+
+  // mqtt
+  _metricUint(resp, "mqtt_connected", "gauge", "Connected to a broker.", mqtt.connected() ? 1 : 0);
+  _metricUint(resp, "mqtt_connects_total", "counter", "Broker connections accepted.", mqtt.connectCount());
+  _metricUint(resp, "mqtt_publishes_total", "counter", "Messages published.", mqtt.publishCount());
+  _metricUint(resp, "mqtt_pub_acks_total", "counter", "QoS 1 and 2 publishes acknowledged.", mqtt.pubAckCount());
+  _metricUint(resp, "mqtt_retransmits_total", "counter", "Unacknowledged publishes sent again.", mqtt.retransmitCount());
+
+  // commands, cumulative buckets
+  CmdLatency latency;
+  _metricHeader(resp, "cmd_latency_seconds", "histogram", "Command latency from receipt to reply.");
+  for (int key = 0; key < CmdKeyMaxValue; ++key) {
+    if (!CmdEngine::latency((CmdKey)key, latency)) continue;
+    const char *cmd = cmdKeyToStr((CmdKey)key);
+    uint32_t cumulative = 0;
+    for (int i = 0; i < CMD_LATENCY_BUCKETS; ++i) {
+      cumulative += latency.buckets[i];
+      resp.printf(METRIC_PREFIX "cmd_latency_seconds_bucket{cmd=\"%s\",le=\"%s\"} %u\n", cmd, _cmdLatencyLe[i], (unsigned)cumulative);
+    }
+    resp.printf(METRIC_PREFIX "cmd_latency_seconds_sum{cmd=\"%s\"} %.6f\n", cmd, latency.sumMicro / 1000000.0);
+    resp.printf(METRIC_PREFIX "cmd_latency_seconds_count{cmd=\"%s\"} %u\n", cmd, (unsigned)latency.count);
+  }
+  _metricUint(resp, "cmd_queued_total", "counter", "Commands queued behind the command worker.", CmdEngine::queuedCount());
+  _metricUint(resp, "cmd_rejects_total", "counter", "Commands rejected on a full command queue.", CmdEngine::rejectCount());
+  _metricUint(resp, "cmd_cache_hits_total", "counter", "Get replies served from the response cache.", CmdEngine::cacheHitCount());
+  _metricUint(resp, "cmd_cache_misses_total", "counter", "Get replies serialized for the response cache.", CmdEngine::cacheMissCount());
+  _metricUint(resp, "cmd_not_modified_total", "counter", "Versioned Get requests answered not modified.", CmdEngine::notModifiedCount());
+  _metricHeader(resp, "cmd_rate_limited_total", "counter", "Commands refused over their source or class quota.");
+  for (int i = 0; i < CmdLimitClassCount; ++i) {
+    resp.printf(METRIC_PREFIX "cmd_rate_limited_total{class=\"%s\"} %u\n",
+                CmdEngine::limitClassStr((CmdLimitClass)i), (unsigned)CmdEngine::limitedCount((CmdLimitClass)i));
   }
+
+  // heap and stacks
+  _metricUint(resp, "heap_free_bytes", "gauge", "Free heap.", esp_get_free_heap_size());
+  _metricUint(resp, "heap_free_min_bytes", "gauge", "Lowest free heap since boot.", esp_get_minimum_free_heap_size());
+  _metricUint(resp, "heap_largest_free_block_bytes", "gauge", "Largest free 8-bit capable heap block.",
+              heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+  _metricHeader(resp, "task_stack_free_min_bytes", "gauge", "Stack high-water mark, lowest free stack since task start.");
+  for (size_t i = 0; i < sizeof(_metricsTasks) / sizeof(_metricsTasks[0]); ++i) {
+    TaskHandle_t handle = *_metricsTasks[i].handle;
+    if (handle)
+      resp.printf(METRIC_PREFIX "task_stack_free_min_bytes{task=\"%s\"} %u\n",
+                  _metricsTasks[i].name, (unsigned)uxTaskGetStackHighWaterMark(handle));
+  }
+
+  _metricUint(resp, "uptime_seconds", "gauge", "Seconds since boot.", (unsigned)(esp_timer_get_time() / 1000000));
+  return 200;
 }
 
+MetricsExporter metricsExporter;
+
 
 //----------------------------------------------
-// Http server task
+// Http server
 //----------------------------------------------
 // the following line must be place after #include "ILI9341.h", 
 // as mongoose.h has macro write (s, b, l)
 #include "HttpServer.h"
 
-static void http_task(void *pvParams)
+HttpServer server;
+
+static void _setupHttp(CmdEngine &cmdEngine)
 {
-  CmdEngine cmdEngine;
-  HttpServer server;
-  server.init();
+  server.init(&reactor);
   server.start();
 
   cmdEngine.setProtocolDelegate(&server);
   cmdEngine.init();
+  server.httpRouter()->addRoute("/metrics", &metricsExporter);
+}
+
+
+//----------------------------------------------
+// Local mqtt broker
+//----------------------------------------------
+#include "MqttBroker.h"
+
+MqttBroker broker;
+
+static void _setupBroker(CmdEngine &cmdEngine)
+{
+  broker.init(&reactor);
+  broker.start();
+
+  // same topics and command format as cloud mode; lan clients are not authenticated,
+  // no writes
+  cmdEngine.setProtocolDelegate(&broker);
+  cmdEngine.setReadOnly();
+  cmdEngine.init();
+}
+
+
+//----------------------------------------------
+// CoAP server
+//----------------------------------------------
+#ifdef COAP_SERVER_ENABLED
+#include "CoapServer.h"
+
+CoapServer coapServer;
 
+static void _setupCoap(CmdEngine &cmdEngine)
+{
+  coapServer.init(&reactor);
+  coapServer.start();
+
+  // resources are the http api routes, commands on COAP_CMD_PATH; requesters are not
+  // authenticated, no writes
+  cmdEngine.setProtocolDelegate(&coapServer);
+  cmdEngine.setReadOnly();
+  cmdEngine.init();
+}
+#endif // COAP_SERVER_ENABLED
+
+
+//----------------------------------------------
+// Command worker task
+//----------------------------------------------
+// runs the config writing commands of all engines, network task keeps polling meanwhile
+TaskHandle_t cmdWorkerTaskHandle = NULL;
+static void cmd_worker_task(void *pvParams)
+{
+  CmdEngine::runWorker();
+}
+
+
+//----------------------------------------------
+// Network task
+//----------------------------------------------
+// one reactor (mongoose manager) serves mqtt client, local broker, http and coap server together
+TaskHandle_t netTaskHandle = NULL;
+static void net_task(void *pvParams)
+{
+  DeployMode mode = System::instance()->deployMode();
+  bool mqttOn = mode == MQTTClientMode || mode == MQTTClientAndHTTPServerMode;
+  bool httpOn = mode == HTTPServerMode || mode == MQTTClientAndHTTPServerMode || mode == MQTTBrokerMode;
+  bool brokerOn = mode == MQTTBrokerMode;
+
+  CmdEngine mqttCmdEngine;
+  CmdEngine httpCmdEngine;
+  CmdEngine coapCmdEngine;
+  reactor.init();
+  if (mqttOn) _setupMqtt(mqttCmdEngine);
+  if (httpOn) _setupHttp(httpCmdEngine);
+  if (brokerOn) _setupBroker(mqttCmdEngine);
+#ifdef COAP_SERVER_ENABLED
+  // local api over udp, same deploy modes as the http one
+  if (httpOn) _setupCoap(coapCmdEngine);
+#endif
+
+  // block in poll until network event, wake request, client deadline or next alert check
   while (true) {
-    server.poll();
-    // _websocketConnected = server.websocketConnected();
-    vTaskDelay(10 / portTICK_PERIOD_MS);
+    int sleepMilli = NET_REACTOR_DEFAULT_POLL_SLEEP;
+    if (mqttOn) {
+      uint32_t alertRemain = _advanceAlertReactiveCounters();
+      if (alertRemain < (uint32_t)sleepMilli / ALERT_REACTIVE_COUNT_UNIT)
+        sleepMilli = alertRemain * ALERT_REACTIVE_COUNT_UNIT;
+    }
+    reactor.poll(sleepMilli);
+#ifdef DEBUG_PN
+    _sendDebugMsgPN();
+#endif
   }
 }
 
@@ -764,7 +1040,8 @@ static void beforeCreateTasks()
 static const char * const DeployModeStr[] = {
   "HTTPServerMode",                  // 0
   "MQTTClientMode",                  // 1
-  "MQTTClientAndHTTPServerMode"      // 2
+  "MQTTClientAndHTTPServerMode",     // 2
+  "MQTTBrokerMode"                   // 3
 };
 
 const char * deployModeStr(DeployMode mode)
@@ -816,6 +1093,11 @@ System * System::instance()
   return &_sysInstance;
 }
 
+MqttClient * System::mqttClient()
+{
+  return &mqtt;
+}
+
 System::System()
 : _state(Uninitialized)
 , _dataNeedToSave(false)
@@ -823,6 +1105,7 @@ System::System()
 {
   _setDefaultConfig();
   _data.init();
+  for (int i = 0; i < SysSectionCount; ++i) _generations[i] = 0;
 }
 
 void System::_setDefaultConfig()
@@ -850,6 +1133,9 @@ void System::init()
   NvsFlash::init();
   _initMacADDR();
   _loadData();
+  // versions handed out before a restart must not match after it
+  uint32_t seed = esp_random();
+  for (int i = 0; i < SysSectionCount; ++i) _generations[i] = seed + i * 0x10000;
   _launchTasks();
   _state = Running;
 }
@@ -866,8 +1152,8 @@ void System::_logInfo()
 #define DISPLAY_GUARD_TASK_PRIORITY         3
 #define WIFI_TASK_PRIORITY                  3
 #define SNTP_TASK_PRIORITY                  3
-#define MQTTCLIENT_TASK_PRIORITY            3
-#define HTTPSERVER_TASK_PRIORITY            3
+#define NET_TASK_PRIORITY                   3
+#define CMD_WORKER_TASK_PRIORITY            3
 #define PM_SENSOR_TASK_PRIORITY             3
 #define CO2_SENSOR_TASK_PRIORITY            3
 #define SHT3X_TASK_PRIORITY                 3
@@ -908,7 +1194,7 @@ void System::_launchTasks()
   if (_data.config2.devCapability & ORIENTATION_CAPABILITY_MASK)
     xTaskCreatePinnedToCore(orientation_sensor_task, "orientation_sensor_task", 4096, NULL, ORIENTATION_TASK_PRIORITY, &orientationSensorTaskHandle, RUN_ON_CORE);
 
-  xTaskCreatePinnedToCore(status_check_task, "status_check_task", 2048, NULL, STATUS_CHECK_TASK_PRIORITY, NULL, RUN_ON_CORE);
+  xTaskCreatePinnedToCore(status_check_task, "status_check_task", 2048, NULL, STATUS_CHECK_TASK_PRIORITY, &statusCheckTaskHandle, RUN_ON_CORE);
 
   xTaskCreate(&wifi_task, "wifi_connection_task", 4096, NULL, WIFI_TASK_PRIORITY, &wifiTaskHandle);
   vTaskDelay(100 / portTICK_PERIOD_MS);
@@ -916,10 +1202,10 @@ void System::_launchTasks()
   xTaskCreate(&sntp_task, "sntp_task", 4096, NULL, SNTP_TASK_PRIORITY, &sntpTaskHandle);
   vTaskDelay(100 / portTICK_PERIOD_MS);
 
-  if (_data.config1.deployMode == MQTTClientMode || _data.config1.deployMode == MQTTClientAndHTTPServerMode)
-    xTaskCreatePinnedToCore(mqtt_task, "mqtt_task", 8192, NULL, MQTTCLIENT_TASK_PRIORITY, NULL, RUN_ON_CORE);
-  else if (_data.config1.deployMode == HTTPServerMode || _data.config1.deployMode == MQTTClientAndHTTPServerMode)
-    xTaskCreatePinnedToCore(http_task, "http_task", 8192, NULL, HTTPSERVER_TASK_PRIORITY, NULL, RUN_ON_CORE);
+  if (_data.config1.deployMode < DeployModeMax) {
+    xTaskCreatePinnedToCore(cmd_worker_task, "cmd_worker_task", 4096, NULL, CMD_WORKER_TASK_PRIORITY, &cmdWorkerTaskHandle, RUN_ON_CORE);
+    xTaskCreatePinnedToCore(net_task, "net_task", 8192, NULL, NET_TASK_PRIORITY, &netTaskHandle, RUN_ON_CORE);
+  }
 
   // xTaskCreatePinnedToCore(touch_pad_task, "touch_pad_task", 2048, NULL, TOUCH_PAD_TASK_PRIORITY, NULL, RUN_ON_CORE);
 
@@ -1110,36 +1396,43 @@ void System::_saveMemoryData()
 
 void System::_updateConfig1(bool saveImmedidately)
 {
+  ++_generations[SysConfig1Section];
   _updateData(saveImmedidately);
 }
 
 void System::_updateConfig2(bool saveImmedidately)
 {
+  ++_generations[SysConfig2Section];
   _updateData(saveImmedidately);
 }
 
 void System::_updateMaintenance(bool saveImmedidately)
 {
+  ++_generations[SysMaintenanceSection];
   _updateData(saveImmedidately);
 }
 
 void System::_updateResetRestore(bool saveImmedidately)
 {
+  ++_generations[SysResetRestoreSection];
   _updateData(saveImmedidately);
 }
 
 void System::_updateBias(bool saveImmedidately)
 {
+  ++_generations[SysBiasSection];
   _updateData(saveImmedidately);
 }
 
 void System::_updateAlerts(bool saveImmedidately)
 {
+  ++_generations[SysAlertsSection];
   _updateData(saveImmedidately);
 }
 
 void System::_updateMobileTokens(bool saveImmedidately)
 {
+  ++_generations[SysMobileTokensSection];
   _updateData(saveImmedidately);
 }
 
@@ -1289,7 +1582,7 @@ void System::setAlertPnEnabled(bool enabled)
 {
   if (_data.alerts.pnEnabled != enabled) {
     _data.alerts.pnEnabled = enabled;
-    _dataNeedToSave = true;
+    _updateAlerts();
     if (enabled) _resetAlertReactiveCounter();
   }
 }
@@ -1298,7 +1591,7 @@ void System::setAlertSoundEnabled(bool enabled)
 {
   if (_data.alerts.soundEnabled != enabled) {
     _data.alerts.soundEnabled = enabled;
-    _dataNeedToSave = true;
+    _updateAlerts();
     if (!enabled) turnAlertSoundOn(false);
   }
 }
@@ -1328,13 +1621,13 @@ void System::setAlert(SensorDataType type, bool lEnabled, bool gEnabled, float l
   _data.alerts.sensors[type].gEnabled = gEnabled;
   _data.alerts.sensors[type].lValue = lValue;
   _data.alerts.sensors[type].gValue = gValue;
-  _dataNeedToSave = true;
+  _updateAlerts();
 }
 
 void System::setPnToken(bool enabled, MobileOS os, const char *token, size_t groupLen, const char *group)
 {
   _data.mobileTokens.setToken(enabled, os, token, groupLen, group);
-  _dataNeedToSave = true;
+  _updateMobileTokens();
 }
 
 void System::resetAlertReactiveCounter()
@@ -22,6 +22,7 @@ enum DeployMode {
   HTTPServerMode,
   MQTTClientMode,
   MQTTClientAndHTTPServerMode,
+  MQTTBrokerMode,
   DeployModeMax
 };
 
@@ -161,7 +162,8 @@ struct Alert {
   uint64_t    reserve[DEFAULT_RESERVE];
 };
 
-#define ALERT_REACTIVE_COUNT   60000  // 60000 * 10ms(mqtt_task delay) = 10 min
+#define ALERT_REACTIVE_COUNT_UNIT  10     // ms, advanced by elapsed time in net_task
+#define ALERT_REACTIVE_COUNT       60000  // 60000 * 10ms = 10 min
 
 struct Alerts {
   bool  pnEnabled;
@@ -183,6 +185,18 @@ struct Reserved {
   uint8_t     bytes[64];
 };
 
+// sections of SysData with a generation, moved on by each _updateXxx of the section
+enum SysSection {
+  SysConfig1Section,
+  SysConfig2Section,
+  SysMaintenanceSection,
+  SysResetRestoreSection,
+  SysBiasSection,
+  SysAlertsSection,
+  SysMobileTokensSection,
+  SysSectionCount
+};
+
 struct SysData {
   SysConfig1        config1;
   SysConfig2        config2;
@@ -211,6 +225,8 @@ struct SysData {
 /////////////////////////////////////////////////////////////////////////////////////////
 // Sytem class
 /////////////////////////////////////////////////////////////////////////////////////////
+class MqttClient;
+
 class System
 {
 public:
@@ -293,6 +309,12 @@ public:
 
   void onEvent(int eventId);
 
+  // the device's mqtt client, also when not in a mqtt deploy mode
+  MqttClient * mqttClient();
+
+  // changes whenever the section changes, starts from a random value each boot
+  uint32_t generation(SysSection section) { return _generations[section]; }
+
 private:
   void _logInfo();
   void _launchTasks();
@@ -315,6 +337,7 @@ private:
   bool              _dataNeedToSave;
   LifeTime          _currentSessionLife;
   SysData           _data;
+  uint32_t          _generations[SysSectionCount];
 };
 
 #endif // _SYSTEM_H_
@@ -7,25 +7,34 @@
 #include "CmdEngine.h"
 
 #include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
 #include "CmdFormat.h"
 #include "AppLog.h"
 #include "System.h"
 #include "SensorDataPacker.h"
 #include "DisplayController.h"
 #include "SharedBuffer.h"
+#include "StrFormat.h"
 #include "AppUpdater.h"
 #include "MqttClientDelegate.h"
+#include "MqttClient.h"
 #include "Wifi.h"
 #include "Config.h"
-
-#include "cJSON.h"
+#include "JsonParser.h"
 
 AppUpdater _appUpdater;
 char    *_strBuf = NULL;
 uint8_t *_cmdBuf = NULL;
 
 CmdEngine::CmdEngine()
-: _delegate(NULL)
+: _readOnly(false)
+, _delegate(NULL)
 {}
 
 void CmdEngine::setProtocolDelegate(ProtocolDelegate *delegate)
@@ -39,6 +48,20 @@ bool CmdEngine::init()
   bool succeeded = false;
   if (_delegate) {
     _delegate->setup();
+    TopicRouter *router = _delegate->topicRouter();
+    if (router) {
+      router->addRoute(MqttClientDelegate::cmdTopic(), this, (void *)Binary);
+      router->addRoute(MqttClientDelegate::strCmdTopic(), this, (void *)JSON);
+    }
+    HttpRouter *httpRouter = _delegate->httpRouter();
+    if (httpRouter) {
+      httpRouter->addRoute("/api/v1/sensors", this, (void *)GetSensorData);
+      httpRouter->addRoute("/api/v1/device", this, (void *)GetDeviceInfo);
+      httpRouter->addRoute("/api/v1/alerts", this, (void *)GetAlertConfig);
+      httpRouter->addRoute("/api/v1/stream", this, (void *)GetLiveStreamStats);
+    }
+    LiveStream *stream = _delegate->liveStream();
+    if (stream) stream->setSource(this);
     succeeded = true;
   }
   _strBuf = SharedBuffer::msgBuffer();
@@ -66,576 +89,1515 @@ union FloatBytes {
   uint8_t bytes[FloatLen];
 };
 
-inline bool strEqual(const char* str1, const char* str2)
+// json objects shared by command replies and http routes, return length needed
+static size_t deviceInfoJson(char *buf, size_t size)
 {
-  return strlen(str1) == strlen(str2) && strcmp(str1, str2) == 0;
+  System *sys = System::instance();
+  size_t length = 0;
+  appendf(buf, size, length, "{\"uid\":\"%s\",\"cap\":\"%u\",\"libv\":\"%s\",\"firmv\":\"%s\",\"bdv\":\"%s\",\"model\":\"%s\",\"alcd\":%s,\"deploy\":\"%s\",\"hostname\":\"%s\",\"devname\":\"%s\",\"life\":\"%d\"}",
+          sys->uid(),
+          sys->devCapability(),
+          sys->idfVersion(),
+          sys->firmwareVersion(),
+          sys->boardVersion(),
+          sys->model(),
+          sys->displayAutoAdjustOn()? "true" : "false",
+          deployModeStr(sys->deployMode()),
+          Wifi::instance()->getHostName(),
+          sys->deviceName(),
+          sys->maintenance()->allSessionsLife);
+  return length;
 }
 
-CmdKey _parseJsonStringCmd(const char* msg, size_t msgLen, uint8_t *&args, size_t &argsSize, CmdEngine::RetFormat &retFmt)
+static size_t alertConfigJson(char *buf, size_t size)
 {
-  cJSON *root = cJSON_Parse(msg);
-  cJSON *cmd = cJSON_GetObjectItem(root, "cmd");
-#ifdef LOG_REMOTE_CMD
-  if (!cmd) APP_LOGE("[CmdEngine]", "json cmd parse err, raw msg len: %d, msg: %.*s", msgLen, msgLen, msg);
-  else APP_LOGC("[CmdEngine]", "json cmd %s", cmd->valuestring);
-#endif
-  if (!cmd) return DoNothing;
+  System *sys = System::instance();
+  size_t length = 0;
+  appendf(buf, size, length, "{\"enpn\":%s,\"ensnd\":%s,\"vals\":{",
+          sys->alertPnEnabled() ? "true" : "false",
+          sys->alertSoundEnabled() ? "true" : "false");
+
+  Alerts *alerts = sys->alerts();
+  for (int i=0; i<SensorDataTypeCount; ++i) {
+    appendf(buf, size, length, "\"%s\":{\"len\":%s,\"gen\":%s,\"lval\":%.2f,\"gval\":%.2f}%s",
+            sensorDataTypeStr((SensorDataType)i),
+            alerts->sensors[i].lEnabled ? "true" : "false",
+            alerts->sensors[i].gEnabled ? "true" : "false",
+            alerts->sensors[i].lValue,
+            alerts->sensors[i].gValue,
+            i < SensorDataTypeCount - 1 ? "," : "");
+  }
+  appendf(buf, size, length, "}}");
+  return length;
+}
 
-  CmdKey cmdKey = strToCmdKey(cmd->valuestring);
+static size_t liveStreamStatsJson(LiveStream *stream, char *buf, size_t size)
+{
+  size_t length = 0;
+  appendf(buf, size, length, "{\"frames\":%u,\"clients\":[", stream->serializeCount());
+  bool commaPreceded = false;
+  LiveStreamClientStats stats;
+  for (uint8_t i=0; i<LIVE_STREAM_CLIENT_CAPACITY; ++i) {
+    if (!stream->clientStats(i, stats)) continue;
+    appendf(buf, size, length, "%s{\"interval\":%u,\"fmt\":\"%s\",\"queued\":%u,\"sent\":%u,\"dropped\":%u}",
+            commaPreceded ? "," : "",
+            stats.intervalMilli,
+            stats.format == PROTOCOL_MSG_FORMAT_BINARY ? "binary" : "json",
+            stats.queuedBytes,
+            stats.sentFrames,
+            stats.droppedFrames);
+    commaPreceded = true;
+  }
+  appendf(buf, size, length, "]}");
+  return length;
+}
 
-  cJSON *retfmt = cJSON_GetObjectItem(root, "retfmt");
-  if (retfmt && strcmp("json", retfmt->valuestring) == 0) retFmt = CmdEngine::JSON;
-  else retFmt = CmdEngine::Binary;
+void appendCmdKeyToJsonString(CmdKey cmdKey, char *jsonStr, size_t &count)
+{
+  sprintf(jsonStr + count - 1, ",\"cmd\":\"%s\"}", cmdKeyToStr(cmdKey));
+  count += strlen(jsonStr + count);
+}
 
-  CmdKey cmdKeyRet = DoNothing;
-  args = _cmdBuf;
+// ------ command handlers
+// Registered per key by CMD_KEY_LIST (CmdKey.h). A command runs its executor, then the
+// formatter of the requested format writes the reply into buf and returns its length,
+// 0 for no reply, or points call.reply at a reply held elsewhere.
+
+// one command being executed
+struct CmdCall {
+  CmdKey                key;
+  CmdEngine::RetFormat  retFmt;
+  const uint8_t        *args;
+  size_t                argsSize;
+  void                 *userdata;
+  ProtocolDelegate     *delegate;
+  // executor results
+  const char           *str;
+  const char           *str2;
+  uint32_t              value;
+  // reply outside buf
+  const void           *reply;
+};
 
-  switch (cmdKey) {
+typedef bool (*CmdParser)(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize);
+typedef void (*CmdExecutor)(CmdCall &call);
+typedef size_t (*CmdFormatter)(CmdCall &call, char *buf, size_t size);
 
-    case SetHostname:
-    case SetDeviceName: {
-      cJSON *name = cJSON_GetObjectItem(root, "name");
-      if (name) {
-        argsSize = strlen(name->valuestring);
-        memcpy(args, name->valuestring, argsSize);
-        cmdKeyRet = cmdKey;
-      }
-      break;
-    }
+enum CmdRun {
+  CmdRunRead,
+  CmdRunWrite,
+  CmdRunNet,
+  CmdRunBatch
+};
 
-    case SetStaSsidPass:
-    case SetApSsidPass:
-    case AppendAltApSsidPass: {
-      cJSON *ssid = cJSON_GetObjectItem(root, "ssid");
-      cJSON *pass = cJSON_GetObjectItem(root, "pass");
-      if (ssid && pass) {
-        // cJSON *sih = cJSON_GetObjectItem(root, "sih");
-        // cJSON *sil = cJSON_GetObjectItem(root, "sil");
-        // if (sih && sil && sih->type == cJSON_Number && sil->type == cJSON_Number) {
-        //   args[0] = 1;
-        //   uint32_t hv = (uint32_t)sih->valuedouble;
-        //   uint32_t lv = (uint32_t)sil->valuedouble;
-        //   memcpy(args + 1, &hv, 4);
-        //   memcpy(args + 5, &lv, 4);
-        // }
-        // else {
-        //   args[0] = 0;
-        // }
-        size_t offset = 9;
-        args[offset] = strlen(ssid->valuestring);
-        size_t passLen = strlen(pass->valuestring);
-        memcpy(args + offset + 1,                ssid->valuestring, args[offset]);
-        memcpy(args + offset + 1 + args[offset], pass->valuestring, passLen);
-        argsSize = offset + 1 + args[offset] + passLen;
-        cmdKeyRet = cmdKey;
-        // APP_LOGC("[CmdEngine]", "setSta: %.*s, ssidLen: %d", argsSize-1, args+1, args[0]);
-      }
-      break;
-    }
+// config section a cached reply is made of
+enum CmdCache {
+  CmdCacheNone,
+  CmdCacheConfig1,
+  CmdCacheConfig2,
+  CmdCacheWifi,
+  CmdCacheAlerts
+};
 
-    case SetSystemDeployMode: {
-      cJSON *mode = cJSON_GetObjectItem(root, "mode");
-      if (mode) {
-        argsSize = 1;
-        for (int i=0; i<DeployModeMax; ++i) {
-          if (strEqual(mode->valuestring, deployModeStr((DeployMode)i))) {
-            args[0] = i;
-            cmdKeyRet = cmdKey;
-            break;
-          }
-        }
-      }
-      break;
-    }
+struct CmdHandler {
+  CmdRun        run;
+  CmdCache      cache;
+  CmdParser     parse;
+  CmdExecutor   exec;
+  CmdFormatter  binary;
+  CmdFormatter  json;
+};
 
-    case SetSensorType: {
-      argsSize = 0;
-      for (int oi=0; oi<2; ++oi) {
-        cJSON *obj = cJSON_GetObjectItem(root, SensorTypeParseKeyStr[oi]);
-        if (!obj) break;
-        for (uint8_t i=0; i<SensorTypeMax; ++i) {
-          if (strEqual(obj->valuestring, sensorTypeStr((SensorType)i))) {
-            args[oi] = i;
-            ++argsSize;
-            break;
-          }
-        }
-      }
-      if (argsSize == 2) cmdKeyRet = cmdKey;
-      break;
-    }
+// json args parsers, cmd is the command object token, args is the command buffer, false if
+// args are missing or invalid
 
-    case TurnOnDisplay:
-    case TurnOnAutoAdjustDisplay: {
-      cJSON *on = cJSON_GetObjectItem(root, "on");
-      if (!on) break;
-      if (on->type == cJSON_True)       args[0] = 1;
-      else if (on->type == cJSON_False) args[0] = 0;
-      else break;
+#define JSON_CMD_NAME_MAX_LEN   255
+#define JSON_CMD_SSID_MAX_LEN   32
+#define JSON_CMD_PASS_MAX_LEN   64
 
-      argsSize = 1;
-      cmdKeyRet = cmdKey;
-      break;
-    }
+// number as cJSON valueint, saturated
+static int jsonInt(double value)
+{
+  if (value >= INT_MAX) return INT_MAX;
+  if (value <= INT_MIN) return INT_MIN;
+  return (int)value;
+}
 
-    case SetAlertEnableConfig: {
-      argsSize = 2;
-      cJSON *config = cJSON_GetObjectItem(root, "config");
-      if (config) {
-        for (int oi=0; oi<2; ++oi) {
-          cJSON *obj = cJSON_GetObjectItem(config, AlertEnableParseKeyStr[oi]);
-          if (!obj) { argsSize = 0; break; }
-          if (obj->type == cJSON_True)       args[oi] = 1;
-          else if (obj->type == cJSON_False) args[oi] = 0;
-          else { argsSize = 0; break; }
-        }
-      } else { argsSize = 0; }
-      if (argsSize == 2) cmdKeyRet = cmdKey;
-      break;
-    }
+static bool parseName(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  return json.copyString(json.find("name", cmd), (char *)args, JSON_CMD_NAME_MAX_LEN + 1, argsSize);
+}
 
-    case SetSensorAlertConfig: {
-      argsSize = 0;
-      bool parseOK = true;
-      FloatBytes fb;
-      size_t bLen = FloatLen * 2 + 2;
-      cJSON *config = cJSON_GetObjectItem(root, "config");
-      if (config) {
-        for (int i=0; i<SensorDataTypeCount; ++i) {
-          SensorDataType sdt = (SensorDataType)i;
-          const char* sdtstr = sensorDataTypeStr(sdt);
-          cJSON *alerts = cJSON_GetObjectItem(config, sdtstr);
-          if (!alerts) { parseOK = false; break; }
-          cJSON *len = cJSON_GetObjectItem(alerts, "len");
-          cJSON *gen = cJSON_GetObjectItem(alerts, "gen");
-          cJSON *lval = cJSON_GetObjectItem(alerts, "lval");
-          cJSON *gval = cJSON_GetObjectItem(alerts, "gval");
-          // if (!len || !gen || !lval || !gval) { parseOK = false; break; }
-          args[i*bLen+0] = (len && len->type == cJSON_True) ? 1 : 0;
-          args[i*bLen+1] = (gen && gen->type == cJSON_True) ? 1 : 0;
-          fb.v = (lval) ? (float)lval->valuedouble : 0.0f;
-          memcpy(args+i*bLen+2, fb.bytes, FloatLen);
-          fb.v = (gval) ? (float)gval->valuedouble : 0.0f;
-          memcpy(args+i*bLen+2+FloatLen, fb.bytes, FloatLen);
-          argsSize += bLen;
-        }
-      } else { parseOK = false; }
-      if (parseOK) cmdKeyRet = cmdKey;
-      break;
-    }
+static bool parseSsidPass(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  // args[0..8] reserved for the connection si (sih, sil), not parsed
+  size_t offset = 9;
+  size_t ssidLen, passLen;
+  if (!json.copyString(json.find("ssid", cmd), (char *)args + offset + 1, JSON_CMD_SSID_MAX_LEN + 1, ssidLen))
+    return false;
+  if (!json.copyString(json.find("pass", cmd), (char *)args + offset + 1 + ssidLen, JSON_CMD_PASS_MAX_LEN + 1, passLen))
+    return false;
+  args[offset] = ssidLen;
+  argsSize = offset + 1 + ssidLen + passLen;
+  return true;
+}
 
-    case SetPNToken: {
-      cJSON *en = cJSON_GetObjectItem(root, "en");
-      if (!en) break;
-      if (en->type == cJSON_True)       args[0] = 1;
-      else if (en->type == cJSON_False) args[0] = 0;
-      else break;
-
-      cJSON *os = cJSON_GetObjectItem(root, "os");
-      if (!os) break;
-      if (strEqual(os->valuestring, "ios"))          args[1] = iOS;
-      else if (strEqual(os->valuestring, "android")) args[1] = Android;
-      else break;
-
-      cJSON *token = cJSON_GetObjectItem(root, "token");
-      if (token && TOKEN_LEN == strlen(token->valuestring)) {
-        memcpy(args+2, token->valuestring, TOKEN_LEN);
-        args[2+TOKEN_LEN] = '\0'; // null terminated
-        argsSize = 3 + TOKEN_LEN;
-        cmdKeyRet = cmdKey;
-      }
-      break;
+static bool parseDeployMode(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  int mode = json.find("mode", cmd);
+  for (int i=0; i<DeployModeMax; ++i) {
+    if (json.stringEquals(mode, deployModeStr((DeployMode)i))) {
+      args[0] = i;
+      argsSize = 1;
+      return true;
     }
+  }
+  return false;
+}
 
-    case CheckPNTokenEnabled: {
-      cJSON *os = cJSON_GetObjectItem(root, "os");
-      if (!os) break;
-      if (strEqual(os->valuestring, "ios"))          args[0] = iOS;
-      else if (strEqual(os->valuestring, "android")) args[0] = Android;
-      else break;
-
-      cJSON *token = cJSON_GetObjectItem(root, "token");
-      if (token && TOKEN_LEN == strlen(token->valuestring)) {
-        memcpy(args + 1, token->valuestring, TOKEN_LEN);
-        args[1+TOKEN_LEN] = '\0'; // null terminated
-        argsSize = 2 + TOKEN_LEN;
-        cmdKeyRet = cmdKey;
+static bool parseSensorType(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  argsSize = 0;
+  for (int oi=0; oi<2; ++oi) {
+    int obj = json.find(SensorTypeParseKeyStr[oi], cmd);
+    if (obj < 0) break;
+    for (uint8_t i=0; i<SensorTypeMax; ++i) {
+      if (json.stringEquals(obj, sensorTypeStr((SensorType)i))) {
+        args[oi] = i;
+        ++argsSize;
+        break;
       }
-      break;
     }
+  }
+  return argsSize == 2;
+}
 
-    case SetDebugFlag: {
-      cJSON *flag = cJSON_GetObjectItem(root, "flag");
-      if (flag && flag->type == cJSON_Number) {
-        args[0] = flag->valueint;
-        argsSize = 1;
-        cmdKeyRet = cmdKey;
-      }
-      break;
+static bool parseOn(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  bool on;
+  if (!json.boolean(json.find("on", cmd), on)) return false;
+  args[0] = on ? 1 : 0;
+  argsSize = 1;
+  return true;
+}
+
+static bool parseAlertEnable(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  int config = json.find("config", cmd);
+  for (int oi=0; oi<2; ++oi) {
+    bool enabled;
+    if (!json.boolean(json.find(AlertEnableParseKeyStr[oi], config), enabled)) return false;
+    args[oi] = enabled ? 1 : 0;
+  }
+  argsSize = 2;
+  return true;
+}
+
+static bool parseSensorAlert(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  FloatBytes fb;
+  double value;
+  size_t bLen = FloatLen * 2 + 2;
+  int config = json.find("config", cmd);
+  argsSize = 0;
+  for (int i=0; i<SensorDataTypeCount; ++i) {
+    int alerts = json.find(sensorDataTypeStr((SensorDataType)i), config);
+    if (alerts < 0) return false;
+    args[i*bLen+0] = json.type(json.find("len", alerts)) == JsonTrue ? 1 : 0;
+    args[i*bLen+1] = json.type(json.find("gen", alerts)) == JsonTrue ? 1 : 0;
+    fb.v = json.number(json.find("lval", alerts), value) ? (float)value : 0.0f;
+    memcpy(args+i*bLen+2, fb.bytes, FloatLen);
+    fb.v = json.number(json.find("gval", alerts), value) ? (float)value : 0.0f;
+    memcpy(args+i*bLen+2+FloatLen, fb.bytes, FloatLen);
+    argsSize += bLen;
+  }
+  return true;
+}
+
+static bool parseMobileOS(const JsonParser &json, int cmd, uint8_t &os)
+{
+  int obj = json.find("os", cmd);
+  if (json.stringEquals(obj, "ios"))          os = iOS;
+  else if (json.stringEquals(obj, "android")) os = Android;
+  else return false;
+  return true;
+}
+
+// token copied null terminated to args
+static bool parseToken(const JsonParser &json, int cmd, uint8_t *args)
+{
+  size_t length;
+  return json.copyString(json.find("token", cmd), (char *)args, TOKEN_LEN + 1, length) && length == TOKEN_LEN;
+}
+
+static bool parsePNToken(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  bool en;
+  if (!json.boolean(json.find("en", cmd), en)) return false;
+  args[0] = en ? 1 : 0;
+  if (!parseMobileOS(json, cmd, args[1]) || !parseToken(json, cmd, args + 2)) return false;
+  argsSize = 3 + TOKEN_LEN;
+  return true;
+}
+
+static bool parsePNTokenCheck(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  if (!parseMobileOS(json, cmd, args[0]) || !parseToken(json, cmd, args + 1)) return false;
+  argsSize = 2 + TOKEN_LEN;
+  return true;
+}
+
+static bool parseDebugFlag(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  double flag;
+  if (!json.number(json.find("flag", cmd), flag)) return false;
+  args[0] = jsonInt(flag);
+  argsSize = 1;
+  return true;
+}
+
+static bool parseSubscribe(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  // interval optional, stream default otherwise
+  double interval;
+  if (json.number(json.find("interval", cmd), interval)) {
+    uint32_t v = interval > 0 ? (uint32_t)interval : 0;
+    memcpy(args, &v, sizeof(v));
+    argsSize = sizeof(v);
+  }
+  return true;
+}
+
+// binary: count byte, then a length byte and the address of each broker
+static bool parseEdgeBrokers(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  int brokers = json.find("brokers", cmd);
+  if (json.type(brokers) != JsonArray) return false;
+  uint8_t count = 0;
+  argsSize = 1;
+  for (int broker; (broker = json.element(brokers, count)) >= 0; ++count) {
+    size_t length;
+    if (count >= MQTT_EDGE_SERVER_CAPACITY ||
+        !json.copyString(broker, (char *)args + argsSize + 1, BROKER_ADDRESS_MAX_LEN + 1, length))
+      return false;
+    args[argsSize] = length;
+    argsSize += 1 + length;
+  }
+  args[0] = count;
+  return true;
+}
+
+// executors, binary args come unchecked from the wire in the layout the parsers write
+
+static void execGetSensorCapability(CmdCall &call)
+{
+  call.value = System::instance()->devCapability();
+}
+
+static void execGetUID(CmdCall &call)
+{
+  call.str = System::instance()->uid();
+}
+
+static void execGetFirmwareVersion(CmdCall &call)
+{
+  call.str = System::instance()->firmwareVersion();
+}
+
+static void execGetIdfVersion(CmdCall &call)
+{
+  call.str = System::instance()->idfVersion();
+}
+
+static void execGetHostname(CmdCall &call)
+{
+  call.str = Wifi::instance()->getHostName();
+}
+
+static void execSetHostname(CmdCall &call)
+{
+  // may run on the command worker, keep off the shared buffers
+  char name[JSON_CMD_NAME_MAX_LEN + 1];
+  size_t length = call.argsSize < sizeof(name) ? call.argsSize : sizeof(name) - 1;
+  memcpy(name, call.args, length);
+  name[length] = '\0';
+  Wifi::instance()->setHostName(name);
+  Wifi::instance()->saveConfig();
+}
+
+static void execGetDeviceName(CmdCall &call)
+{
+  call.str = System::instance()->deviceName();
+}
+
+static void execSetDeviceName(CmdCall &call)
+{
+  System::instance()->setDeviceName((const char*)call.args, call.argsSize);
+}
+
+static void execGetStaSsidPass(CmdCall &call)
+{
+  call.str = Wifi::instance()->staSsid();
+  call.str2 = Wifi::instance()->staPassword();
+}
+
+static void execGetApSsidPass(CmdCall &call)
+{
+  call.str = Wifi::instance()->apSsid();
+  call.str2 = Wifi::instance()->apPassword();
+}
+
+// ssid and pass hold the parser's max lengths plus terminator, longer binary args are cut
+static void unpackSsidPass(CmdCall &call, char *ssid, char *pass)
+{
+  uint8_t offset = 9;
+  uint8_t ssidLen = call.args[offset];
+  size_t passLen = call.argsSize - 1 - ssidLen - offset;
+  strncat(ssid, (const char*)(call.args + offset + 1),           ssidLen < JSON_CMD_SSID_MAX_LEN ? ssidLen : JSON_CMD_SSID_MAX_LEN);
+  strncat(pass, (const char*)(call.args + offset + 1 + ssidLen), passLen < JSON_CMD_PASS_MAX_LEN ? passLen : JSON_CMD_PASS_MAX_LEN);
+}
+
+static void execSetStaSsidPass(CmdCall &call)
+{
+  char ssid[JSON_CMD_SSID_MAX_LEN + 1] = {0};
+  char pass[JSON_CMD_PASS_MAX_LEN + 1] = {0};
+  unpackSsidPass(call, ssid, pass);
+  Wifi::instance()->setStaConfig(ssid, pass, true);
+  Wifi::instance()->saveConfig();
+}
+
+static void execSetApSsidPass(CmdCall &call)
+{
+  char ssid[JSON_CMD_SSID_MAX_LEN + 1] = {0};
+  char pass[JSON_CMD_PASS_MAX_LEN + 1] = {0};
+  unpackSsidPass(call, ssid, pass);
+  Wifi::instance()->setApConfig(ssid, pass, true);
+  Wifi::instance()->saveConfig();
+}
+
+static void execAppendAltApSsidPass(CmdCall &call)
+{
+  char ssid[JSON_CMD_SSID_MAX_LEN + 1] = {0};
+  char pass[JSON_CMD_PASS_MAX_LEN + 1] = {0};
+  unpackSsidPass(call, ssid, pass);
+  Wifi::instance()->appendAltApConnectionSsidPassword(ssid, pass);
+  Wifi::instance()->saveConfig();
+}
+
+static void execClearAltApList(CmdCall &call)
+{
+  Wifi::instance()->clearAltApConnectionSsidPassword();
+  Wifi::instance()->saveConfig();
+}
+
+static void execGetDeployMode(CmdCall &call)
+{
+  call.str = deployModeStr(System::instance()->deployMode());
+}
+
+static void execSetDeployMode(CmdCall &call)
+{
+  System::instance()->setDeployMode((DeployMode)call.args[0]);
+}
+
+static void execSetSensorType(CmdCall &call)
+{
+  System::instance()->setSensorType((SensorType)call.args[0], (SensorType)call.args[1]);
+}
+
+static void execTurnOnDisplay(CmdCall &call)
+{
+  System::instance()->turnDisplayOn(call.args[0] != 0);
+}
+
+static void execTurnOnAutoAdjust(CmdCall &call)
+{
+  System::instance()->turnDisplayAutoAdjustOn(call.args[0] != 0);
+}
+
+static void execSetAlertEnable(CmdCall &call)
+{
+  System::instance()->setAlertPnEnabled(call.args[0] == 1);
+  System::instance()->setAlertSoundEnabled(call.args[1] == 1);
+}
+
+static void execSetSensorAlert(CmdCall &call)
+{
+  FloatBytes fbl, fbg;
+  size_t bLen = FloatLen * 2 + 2;
+  const uint8_t *args = call.args;
+  System *sys = System::instance();
+  for (int i=0; i<SensorDataTypeCount; ++i) {
+    SensorDataType sdt = (SensorDataType)i;
+    memcpy(fbl.bytes, args+i*bLen+2,          FloatLen);
+    memcpy(fbg.bytes, args+i*bLen+2+FloatLen, FloatLen);
+    sys->setAlert(sdt, args[i*bLen+0]==1, args[i*bLen+1]==1, fbl.v, fbg.v);
+  }
+  sys->resetAlertReactiveCounter();
+}
+
+static void execSetPNToken(CmdCall &call)
+{
+  System::instance()->setPnToken(call.args[0]==1, (MobileOS)call.args[1], (const char*)(call.args+2));
+}
+
+static void execUpdateFirmware(CmdCall &call)
+{
+  _appUpdater.update();
+}
+
+static void execRestart(CmdCall &call)
+{
+  System::instance()->setRestartRequest();
+}
+
+static void execRestoreFactory(CmdCall &call)
+{
+  System::instance()->restoreFactory();
+}
+
+static void execSetDebugFlag(CmdCall &call)
+{
+  System::instance()->setDebugFlag(call.args[0]);
+}
+
+static void execSetEdgeBrokers(CmdCall &call)
+{
+  // runs on the command worker, addresses terminated in its own buffers
+  char addresses[MQTT_EDGE_SERVER_CAPACITY][BROKER_ADDRESS_MAX_LEN + 1];
+  const char *list[MQTT_EDGE_SERVER_CAPACITY];
+  call.str = "invalid";
+  if (call.argsSize < 1 || call.args[0] > MQTT_EDGE_SERVER_CAPACITY) return;
+  uint8_t count = call.args[0];
+  size_t offset = 1;
+  for (uint8_t i = 0; i < count; ++i) {
+    if (offset >= call.argsSize) return;
+    size_t length = call.args[offset];
+    if (length > BROKER_ADDRESS_MAX_LEN || offset + 1 + length > call.argsSize) return;
+    memcpy(addresses[i], call.args + offset + 1, length);
+    addresses[i][length] = '\0';
+    list[i] = addresses[i];
+    offset += 1 + length;
+  }
+  call.str = System::instance()->mqttClient()->setEdgeServerAddresses(list, count) ? "ok" : "failed";
+}
+
+// websocket clients only, userdata stands for the connection; no reply otherwise
+static void execSubscribe(CmdCall &call)
+{
+  LiveStream *stream = call.delegate->liveStream();
+  struct mg_connection *nc = call.delegate->connection(call.userdata);
+  if (!stream || !nc) return;
+  uint32_t interval = LIVE_STREAM_INTERVAL_DEFAULT;
+  if (call.argsSize >= sizeof(interval)) memcpy(&interval, call.args, sizeof(interval));
+  bool succeeded = stream->subscribe(nc, interval,
+                                     call.retFmt == CmdEngine::JSON ? PROTOCOL_MSG_FORMAT_TEXT : PROTOCOL_MSG_FORMAT_BINARY,
+                                     xTaskGetTickCount() * portTICK_PERIOD_MS);
+  call.str = succeeded ? "ok" : "full";
+}
+
+static void execUnsubscribe(CmdCall &call)
+{
+  LiveStream *stream = call.delegate->liveStream();
+  struct mg_connection *nc = call.delegate->connection(call.userdata);
+  if (!stream || !nc) return;
+  stream->unsubscribe(nc);
+  call.str = "ok";
+}
+
+// reply formatters
+
+static size_t binString(CmdCall &call, char *buf, size_t size)
+{
+  if (!call.str) return 0;
+  call.reply = call.str;
+  return strlen(call.str);
+}
+
+static size_t jsonString(CmdCall &call, char *buf, size_t size)
+{
+  if (!call.str) return 0;
+  size_t length = 0;
+  appendf(buf, size, length, "{\"ret\":\"%s\", \"cmd\":\"%s\"}", call.str, cmdKeyToStr(call.key));
+  return length;
+}
+
+static size_t binUint(CmdCall &call, char *buf, size_t size)
+{
+  memcpy(buf, &call.value, sizeof(call.value));
+  return sizeof(call.value);
+}
+
+static size_t jsonUint(CmdCall &call, char *buf, size_t size)
+{
+  size_t length = 0;
+  appendf(buf, size, length, "{\"ret\":\"%u\", \"cmd\":\"%s\"}", (unsigned)call.value, cmdKeyToStr(call.key));
+  return length;
+}
+
+static size_t binSensorData(CmdCall &call, char *buf, size_t size)
+{
+  size_t count = 0;
+  call.reply = SensorDataPacker::sharedInstance()->dataBlock(count);
+  return count;
+}
+
+static size_t jsonSensorData(CmdCall &call, char *buf, size_t size)
+{
+  size_t count = 0;
+  char *data = (char *)SensorDataPacker::sharedInstance()->dataJsonString(count);
+  appendCmdKeyToJsonString(call.key, data, count);
+  call.reply = data;
+  return count;
+}
+
+static size_t jsonDeviceInfo(CmdCall &call, char *buf, size_t size)
+{
+  size_t length = 0;
+  appendf(buf, size, length, "{\"ret\":");
+  if (length < size) length += deviceInfoJson(buf + length, size - length);
+  appendf(buf, size, length, ", \"cmd\":\"%s\"}", cmdKeyToStr(call.key));
+  return length;
+}
+
+// binary: ssid length byte, ssid, password
+static size_t binSsidPass(CmdCall &call, char *buf, size_t size)
+{
+  size_t length = 1;
+  buf[0] = strlen(call.str);
+  appendf(buf, size, length, "%s%s", call.str, call.str2);
+  return length;
+}
+
+static size_t jsonSsidPass(CmdCall &call, char *buf, size_t size)
+{
+  size_t length = 0;
+  appendf(buf, size, length, "{\"ret\":{\"ssid\":\"%s\",\"pass\":\"%s\"}, \"cmd\":\"%s\"}",
+          call.str, call.str2, cmdKeyToStr(call.key));
+  return length;
+}
+
+static size_t jsonAltApList(CmdCall &call, char *buf, size_t size)
+{
+  SsidPasswd *list = NULL;
+  uint8_t head, count;
+  Wifi::instance()->getAltApConnectionSsidPassword(list, head, count);
+  size_t length = 0;
+  appendf(buf, size, length, "{\"cmd\":\"%s\",\"ret\":[", cmdKeyToStr(call.key));
+  for (uint8_t i = 0; i < count; ++i) {
+    uint8_t index = (head + i) % count;
+    appendf(buf, size, length, "{\"ssid\":\"%s\",\"pass\":\"%s\"}%s",
+            list[index].ssid, list[index].password, (i<count-1)?",":"");
+  }
+  appendf(buf, size, length, "]}");
+  return length;
+}
+
+static size_t jsonAlertConfig(CmdCall &call, char *buf, size_t size)
+{
+  size_t length = 0;
+  appendf(buf, size, length, "{\"cmd\":\"%s\",\"ret\":", cmdKeyToStr(call.key));
+  if (length < size) length += alertConfigJson(buf + length, size - length);
+  appendf(buf, size, length, "}");
+  return length;
+}
+
+static size_t jsonPNTokenEnabled(CmdCall &call, char *buf, size_t size)
+{
+  size_t length = 0;
+  appendf(buf, size, length, "{\"ret\":{\"en\":%s}, \"cmd\":\"%s\"}",
+          System::instance()->tokenEnabled((MobileOS)call.args[0], (const char*)(call.args+1)) ? "true" : "false",
+          cmdKeyToStr(call.key));
+  return length;
+}
+
+static size_t jsonLiveStreamStats(CmdCall &call, char *buf, size_t size)
+{
+  LiveStream *stream = call.delegate->liveStream();
+  if (!stream) return 0;
+  size_t length = 0;
+  appendf(buf, size, length, "{\"cmd\":\"%s\",\"ret\":", cmdKeyToStr(call.key));
+  if (length < size) length += liveStreamStatsJson(stream, buf + length, size - length);
+  appendf(buf, size, length, "}");
+  return length;
+}
+
+// binary: as SetEdgeBrokers args
+static size_t binEdgeBrokers(CmdCall &call, char *buf, size_t size)
+{
+  const MqttEdgeServers &edges = System::instance()->mqttClient()->edgeServers();
+  size_t length = 1;
+  buf[0] = 0;
+  for (uint8_t i = 0; i < edges.count; ++i) {
+    size_t addressLen = strlen(edges.addresses[i]);
+    if (length + 1 + addressLen > size) break;
+    buf[length] = addressLen;
+    memcpy(buf + length + 1, edges.addresses[i], addressLen);
+    length += 1 + addressLen;
+    ++buf[0];
+  }
+  return length;
+}
+
+static size_t jsonEdgeBrokers(CmdCall &call, char *buf, size_t size)
+{
+  const MqttEdgeServers &edges = System::instance()->mqttClient()->edgeServers();
+  size_t length = 0;
+  appendf(buf, size, length, "{\"cmd\":\"%s\",\"ret\":[", cmdKeyToStr(call.key));
+  for (uint8_t i = 0; i < edges.count; ++i) {
+    appendf(buf, size, length, "\"%s\"%s", edges.addresses[i], (i<edges.count-1)?",":"");
+  }
+  appendf(buf, size, length, "]}");
+  return length;
+}
+
+// batch handlers run the handlers of their sub-commands, defined after the registry
+static bool parseBatch(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize);
+static size_t binBatch(CmdCall &call, char *buf, size_t size);
+static size_t jsonBatch(CmdCall &call, char *buf, size_t size);
+
+static const CmdHandler _cmdHandlers[CmdKeyMaxValue] = {
+#define CMD_HANDLER(name, run, cache, parse, exec, binary, json) { CmdRun##run, CmdCache##cache, parse, exec, binary, json },
+  CMD_KEY_LIST(CMD_HANDLER)
+#undef CMD_HANDLER
+};
+
+// ------ batch
+// Sub-commands run one after another inside the batch call, each reply streamed into the
+// batch reply right behind the previous one (CmdFormat.h). Room for a bare status entry
+// of every sub-command not run yet is held back, so each gets at least its status.
+
+#define CMD_BATCH_INVALID_KEY     0xffff  // json sub-command unknown or with bad args
+#define CMD_BATCH_JSON_STATUS_MIN 13      // ,{"status":N}
+#define CMD_BATCH_FORMAT_MIN      16      // fixed size binary formatters write unchecked
+
+// walks the sub-commands of batch args, stops at the first malformed one
+struct CmdBatchReader {
+  const uint8_t  *args;
+  size_t          argsSize;
+  size_t          offset;
+  uint8_t         left;
+
+  CmdBatchReader(const uint8_t *batchArgs, size_t batchArgsSize)
+  : args(batchArgs), argsSize(batchArgsSize), offset(CMD_BATCH_COUNT_SIZE), left(0)
+  {
+    if (argsSize >= CMD_BATCH_COUNT_SIZE) left = args[0] < CMD_BATCH_MAX_COUNT ? args[0] : CMD_BATCH_MAX_COUNT;
+  }
+
+  // sub call takes batch call's format and requester
+  bool next(const CmdCall &batch, CmdCall &sub)
+  {
+    uint16_t size, key;
+    if (left == 0 || offset + CMD_BATCH_SUB_SIZE_SIZE > argsSize) return false;
+    memcpy(&size, args + offset, sizeof(size));
+    if (size < CMD_DATA_AT_LEAST_SIZE || offset + CMD_BATCH_SUB_SIZE_SIZE + size > argsSize) return false;
+    offset += CMD_BATCH_SUB_SIZE_SIZE;
+    memcpy(&key, args + offset + CMD_DATA_KEY_OFFSET, sizeof(key));
+    CmdCall call = { (CmdKey)key, batch.retFmt, args + offset + CMD_DATA_ARG_OFFSET, (size_t)size - CMD_DATA_KEY_SIZE,
+                     batch.userdata, batch.delegate, NULL, NULL, 0, NULL };
+    sub = call;
+    offset += size;
+    --left;
+    return true;
+  }
+};
+
+static uint8_t batchSubStatus(CmdKey key)
+{
+  if ((unsigned)key >= CmdKeyMaxValue) return CMD_STATUS_INVALID;
+  CmdRun run = _cmdHandlers[key].run;
+  return run == CmdRunNet || run == CmdRunBatch ? CMD_STATUS_NOT_BATCHABLE : CMD_STATUS_OK;
+}
+
+// runs sub-command, its reply formatted at buf; returns reply length, 0 if none or left out
+static size_t batchRunSub(CmdCall &sub, uint8_t &status, char *buf, size_t size)
+{
+  status = batchSubStatus(sub.key);
+  if (status != CMD_STATUS_OK) return 0;
+  const CmdHandler &handler = _cmdHandlers[sub.key];
+  if (handler.exec) handler.exec(sub);
+
+  CmdFormatter format = sub.retFmt == CmdEngine::JSON ? handler.json : handler.binary;
+  if (!format) return 0;
+  size_t count = size > CMD_BATCH_FORMAT_MIN ? format(sub, buf, size) : size;
+  if (count >= size) {
+    status = CMD_STATUS_NO_SPACE;
+    return 0;
+  }
+  if (sub.reply) memmove(buf, sub.reply, count);
+  return count;
+}
+
+// true if a sub-command is a write, the batch then runs on the command worker
+static bool batchHasWrite(const uint8_t *args, size_t argsSize)
+{
+  CmdBatchReader reader(args, argsSize);
+  CmdCall batch = { Batch, CmdEngine::Binary, args, argsSize, NULL, NULL, NULL, NULL, 0, NULL };
+  CmdCall sub;
+  while (reader.next(batch, sub)) {
+    if (batchSubStatus(sub.key) == CMD_STATUS_OK && _cmdHandlers[sub.key].run == CmdRunWrite) return true;
+  }
+  return false;
+}
+
+static CmdRun cmdRun(CmdKey cmdKey, const uint8_t *args, size_t argsSize)
+{
+  CmdRun run = _cmdHandlers[cmdKey].run;
+  if (run == CmdRunBatch) run = batchHasWrite(args, argsSize) ? CmdRunWrite : CmdRunRead;
+  return run;
+}
+
+// "cmds" array of command objects into batch args, sub-commands parsed by their own parsers
+static bool parseBatch(const JsonParser &json, int cmd, uint8_t *args, size_t &argsSize)
+{
+  int cmds = json.find("cmds", cmd);
+  if (json.type(cmds) != JsonArray) return false;
+
+  size_t capacity = SharedBuffer::cmdBufferSize();
+  size_t offset = CMD_BATCH_COUNT_SIZE;
+  uint8_t count = 0;
+  int sub;
+  while (count < CMD_BATCH_MAX_COUNT && (sub = json.element(cmds, count)) >= 0) {
+    // sub-command args are at most what a queued command may carry
+    if (offset + CMD_BATCH_SUB_SIZE_SIZE + CMD_DATA_KEY_SIZE + CMD_JOB_ARGS_SIZE > capacity) break;
+    uint8_t *data = args + offset + CMD_BATCH_SUB_SIZE_SIZE;
+    char name[32];
+    size_t nameLen = 0;
+    CmdKey key = json.copyString(json.find("cmd", sub), name, sizeof(name), nameLen) ? strToCmdKey(name, nameLen) : DoNothing;
+    size_t subArgsSize = 0;
+    CmdParser parse = _cmdHandlers[key].parse;
+    uint16_t wireKey = key;
+    if (key == DoNothing || (parse && !parse(json, sub, data + CMD_DATA_ARG_OFFSET, subArgsSize))) wireKey = CMD_BATCH_INVALID_KEY;
+    if (wireKey == CMD_BATCH_INVALID_KEY) subArgsSize = 0;
+
+    uint16_t size = CMD_DATA_KEY_SIZE + subArgsSize;
+    memcpy(args + offset, &size, sizeof(size));
+    memcpy(data + CMD_DATA_KEY_OFFSET, &wireKey, sizeof(wireKey));
+    offset += CMD_BATCH_SUB_SIZE_SIZE + size;
+    ++count;
+  }
+  args[0] = count;
+  argsSize = offset;
+  return true;
+}
+
+static size_t binBatch(CmdCall &call, char *buf, size_t size)
+{
+  CmdBatchReader reader(call.args, call.argsSize);
+  size_t length = CMD_BATCH_COUNT_SIZE;
+  uint8_t count = 0;
+  CmdCall sub;
+  while (reader.next(call, sub)) {
+    size_t entry = length;
+    length += CMD_BATCH_RET_HEADER_SIZE;
+    size_t held = reader.left * CMD_BATCH_RET_HEADER_SIZE;
+    uint8_t status;
+    size_t room = size > length + held ? size - length - held : 0;
+    uint16_t retLen = batchRunSub(sub, status, buf + length, room);
+    uint16_t key = sub.key;
+    memcpy(buf + entry, &key, sizeof(key));
+    buf[entry + 2] = status;
+    memcpy(buf + entry + 3, &retLen, sizeof(retLen));
+    length += retLen;
+    ++count;
+  }
+  buf[0] = count;
+  return length;
+}
+
+static size_t jsonBatch(CmdCall &call, char *buf, size_t size)
+{
+  CmdBatchReader reader(call.args, call.argsSize);
+  size_t length = 0;
+  appendf(buf, size, length, "{\"cmd\":\"%s\",\"ret\":[", cmdKeyToStr(call.key));
+  CmdCall sub;
+  bool first = true;
+  while (reader.next(call, sub)) {
+    if (!first) appendf(buf, size, length, ",");
+    first = false;
+    // this entry's status and the closing brackets held back too
+    size_t held = (reader.left + 1) * CMD_BATCH_JSON_STATUS_MIN + 2;
+    uint8_t status;
+    size_t room = size > length + held ? size - length - held : 0;
+    size_t count = batchRunSub(sub, status, buf + length, room);
+    if (count > 0) {
+      // reply object gets the status as last member
+      length += count - 1;
+      appendf(buf, size, length, ",\"status\":%u}", status);
+    }
+    else if (status != CMD_STATUS_INVALID && length + strlen(cmdKeyToStr(sub.key)) + 21 + held < size) {
+      appendf(buf, size, length, "{\"cmd\":\"%s\",\"status\":%u}", cmdKeyToStr(sub.key), status);
+    }
+    else {
+      appendf(buf, size, length, "{\"status\":%u}", status);
     }
+  }
+  appendf(buf, size, length, "]}");
+  return length;
+}
 
-    default:
-      cmdKeyRet = cmdKey;
-      break;
+// ------ response cache
+// Replies of cached commands are kept per format with the generation of their config
+// section and served again until the generation moves on. Reactor task only, cached
+// commands are reads.
+
+#define CMD_CACHE_CAPACITY      4
+#define CMD_CACHE_DATA_SIZE     512
+
+struct CmdCacheEntry {
+  CmdKey                key;          // DoNothing if unused
+  CmdEngine::RetFormat  retFmt;
+  uint32_t              generation;
+  size_t                length;
+  char                  data[CMD_CACHE_DATA_SIZE];
+};
+
+static CmdCacheEntry _cache[CMD_CACHE_CAPACITY];
+static uint8_t _cacheNext = 0;      // replaced next when no entry of the command is found
+
+uint32_t CmdEngine::_cacheHitCount = 0;
+uint32_t CmdEngine::_cacheMissCount = 0;
+uint32_t CmdEngine::_notModifiedCount = 0;
+
+static uint32_t cacheGeneration(CmdCache cache)
+{
+  System *sys = System::instance();
+  switch (cache) {
+    case CmdCacheConfig1: return sys->generation(SysConfig1Section);
+    case CmdCacheConfig2: return sys->generation(SysConfig2Section);
+    case CmdCacheWifi:    return Wifi::instance()->configGeneration();
+    case CmdCacheAlerts:  return sys->generation(SysAlertsSection);
+    default:              return 0;
   }
+}
 
-  cJSON_Delete(root);
+static CmdCacheEntry * cacheFind(CmdKey key, CmdEngine::RetFormat retFmt)
+{
+  for (int i = 0; i < CMD_CACHE_CAPACITY; ++i) {
+    if (_cache[i].key == key && _cache[i].retFmt == retFmt) return &_cache[i];
+  }
+  return NULL;
+}
 
-  return cmdKeyRet;
+static void cacheStore(CmdKey key, CmdEngine::RetFormat retFmt, uint32_t generation, const void *data, size_t length)
+{
+  if (length > CMD_CACHE_DATA_SIZE) return;
+  CmdCacheEntry *entry = cacheFind(key, retFmt);
+  if (!entry) {
+    entry = &_cache[_cacheNext];
+    _cacheNext = (_cacheNext + 1) % CMD_CACHE_CAPACITY;
+  }
+  entry->key = key;
+  entry->retFmt = retFmt;
+  entry->generation = generation;
+  entry->length = length;
+  memcpy(entry->data, data, length);
 }
 
-void appendCmdKeyToJsonString(CmdKey cmdKey, char *jsonStr, size_t &count)
+// ------ correlation
+
+static bool correlationChars(const char *str, size_t length)
 {
-  sprintf(jsonStr + count - 1, ",\"cmd\":\"%s\"}", cmdKeyToStr(cmdKey));
-  count += strlen(jsonStr + count);
+  for (size_t i = 0; i < length; ++i) {
+    char c = str[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || strchr("-_.:", c)))
+      return false;
+  }
+  return true;
+}
+
+// binary correlation at data, data and size moved past it; false if malformed
+static bool unpackCorrelation(uint8_t *&data, size_t &size, CmdCorrelation &correlation)
+{
+  if (size < 1 || data[0] > CMD_CORRELATION_ID_MAX_LEN || size < 2 + (size_t)data[0]) return false;
+  size_t idLength = data[0];
+  size_t replyToLength = data[1 + idLength];
+  if (replyToLength > CMD_CORRELATION_REPLY_TO_MAX_LEN || size < 2 + idLength + replyToLength) return false;
+  const char *id = (const char *)data + 1;
+  const char *replyTo = id + idLength + 1;
+  if (!correlationChars(id, idLength) || !correlationChars(replyTo, replyToLength)) return false;
+
+  correlation.idLength = idLength;
+  memcpy(correlation.id, id, idLength);
+  correlation.id[idLength] = '\0';
+  memcpy(correlation.replyTo, replyTo, replyToLength);
+  correlation.replyTo[replyToLength] = '\0';
+  data += 2 + idLength + replyToLength;
+  size -= 2 + idLength + replyToLength;
+  return true;
+}
+
+// "id" and "replyto" of json command, correlated if it has either; false if malformed
+static bool parseCorrelation(const JsonParser &json, CmdCorrelation &correlation, bool &correlated)
+{
+  int id = json.find("id");
+  int replyTo = json.find("replyto");
+  correlated = id >= 0 || replyTo >= 0;
+  size_t length = 0;
+  correlation.idLength = 0;
+  correlation.id[0] = '\0';
+  correlation.replyTo[0] = '\0';
+  if (id >= 0) {
+    if (!json.copyString(id, correlation.id, sizeof(correlation.id), length) || !correlationChars(correlation.id, length))
+      return false;
+    correlation.idLength = length;
+  }
+  if (replyTo >= 0) {
+    if (!json.copyString(replyTo, correlation.replyTo, sizeof(correlation.replyTo), length)
+        || !correlationChars(correlation.replyTo, length)) return false;
+  }
+  return true;
+}
+
+// tokens of the command being parsed, shared as _cmdBuf is
+#define JSON_CMD_TOKEN_CAPACITY   128
+static JsonToken _jsonTokens[JSON_CMD_TOKEN_CAPACITY];
+
+CmdKey _parseJsonStringCmd(const char* msg, size_t msgLen, uint8_t *&args, size_t &argsSize, CmdEngine::RetFormat &retFmt,
+                           CmdCorrelation &correlation, bool &correlated)
+{
+  correlated = false;
+  JsonParser json(_jsonTokens, JSON_CMD_TOKEN_CAPACITY);
+  char cmd[32];
+  size_t cmdLen = 0;
+  bool parsed = json.parse(msg, msgLen) && json.copyString(json.find("cmd"), cmd, sizeof(cmd), cmdLen);
+#ifdef LOG_REMOTE_CMD
+  if (!parsed) APP_LOGE("[CmdEngine]", "json cmd parse err, raw msg len: %d, msg: %.*s", msgLen, msgLen, msg);
+  else APP_LOGC("[CmdEngine]", "json cmd %s", cmd);
+#endif
+  if (!parsed) return DoNothing;
+
+  CmdKey cmdKey = strToCmdKey(cmd, cmdLen);
+  if (!parseCorrelation(json, correlation, correlated)) {
+    APP_LOGE("[CmdEngine]", "json cmd %s with invalid id or replyto", cmd);
+    return DoNothing;
+  }
+
+  if (json.stringEquals(json.find("retfmt"), "json")) retFmt = CmdEngine::JSON;
+  else retFmt = CmdEngine::Binary;
+
+  args = _cmdBuf;
+  CmdParser parse = _cmdHandlers[cmdKey].parse;
+  if (parse && !parse(json, 0, args, argsSize)) cmdKey = DoNothing;
+
+  // version held by the requester, the args of cached commands
+  double version;
+  if (_cmdHandlers[cmdKey].cache != CmdCacheNone && json.number(json.find("ver"), version)
+      && version >= 0 && version <= UINT32_MAX) {
+    uint32_t v = (uint32_t)version;
+    memcpy(args, &v, sizeof(v));
+    argsSize = sizeof(v);
+  }
+
+  return cmdKey;
 }
 
 void CmdEngine::interpreteMqttMsg(const char* topic, size_t topicLen, const char* msg, size_t msgLen)
 {
-  if (_appUpdater.isUpdating()) {
-    // app update topic
-    if (strncmp(topic, _appUpdater.updateRxTopic(), _appUpdater.updateRxTopicLen()) == 0) {
-        _appUpdater.updateLoop(msg, msgLen);
+  // only reached by topics without route
+  APP_LOGE("[CmdEngine]", "no route for mqtt topic %.*s", topicLen, topic);
+}
+
+void CmdEngine::onTopicMessage(const char* topic, size_t topicLen, const char* msg, size_t msgLen, void *context)
+{
+  // commands ignored during app update
+  if (_appUpdater.isUpdating()) return;
+
+  bool exec = false;
+  CmdKey cmdKey;
+  uint8_t *data = NULL;
+  size_t size = 0;
+  RetFormat retFmt = (RetFormat)(intptr_t)context;
+  CmdCorrelation correlation;
+  bool correlated = false;
+
+  if (retFmt == Binary) {
+    // binary data command topic, data size check
+    if (msgLen >= CMD_DATA_AT_LEAST_SIZE) {
+      data = (uint8_t *)msg;
+      uint16_t key = *(uint16_t *)(data + CMD_DATA_KEY_OFFSET);
+      cmdKey = (CmdKey)(key & ~CMD_KEY_CORRELATED_FLAG);
+      data += CMD_DATA_ARG_OFFSET;
+      size = msgLen - CMD_DATA_KEY_SIZE;
+      correlated = key & CMD_KEY_CORRELATED_FLAG;
+      exec = !correlated || unpackCorrelation(data, size, correlation);
+      if (!exec) APP_LOGE("[CmdEngine]", "mqtt msg with malformed correlation");
+    }
+    else {
+      APP_LOGE("[CmdEngine]", "mqtt msg data size must be at least %d", CMD_DATA_AT_LEAST_SIZE);
     }
   }
   else {
-    bool exec = false;
-    CmdKey cmdKey;
-    uint8_t *data = NULL;
-    size_t size = 0;
-    RetFormat retFmt = Binary;
-    do {
-      // binary data command topic
-      if (topicLen == strlen(MqttClientDelegate::cmdTopic()) &&
-          strncmp(topic, MqttClientDelegate::cmdTopic(), topicLen) == 0) {
-        // data size check
-        if (msgLen >= CMD_DATA_AT_LEAST_SIZE) {
-          data = (uint8_t *)msg;
-          cmdKey = (CmdKey)( *(uint16_t *)(data + CMD_DATA_KEY_OFFSET) );
-          data += CMD_DATA_ARG_OFFSET;
-          size = msgLen - CMD_DATA_KEY_SIZE;
-          retFmt = Binary;
-          exec = true;
-        }
-        else {
-          APP_LOGE("[CmdEngine]", "mqtt msg data size must be at least %d", CMD_DATA_AT_LEAST_SIZE);
-        }
-        break;
-      }
-      // string data command topic
-      if (topicLen == strlen(MqttClientDelegate::strCmdTopic()) &&
-          strncmp(topic, MqttClientDelegate::strCmdTopic(), topicLen) == 0) {
-        cmdKey = _parseJsonStringCmd(msg, msgLen, data, size, retFmt);
-        exec = true;
-        break;
-      }
-    } while (false);
-
-    if (exec) execCmd(cmdKey, retFmt, data, size);
+    // string data command topic
+    cmdKey = _parseJsonStringCmd(msg, msgLen, data, size, retFmt, correlation, correlated);
+    exec = true;
   }
+
+  if (exec) execCmd(cmdKey, retFmt, data, size, NULL, correlated ? &correlation : NULL);
 }
 
 void CmdEngine::interpreteSocketMsg(const void* msg, size_t msgLen, void *userdata)
 {
+  // commands ignored during app update
+  if (_appUpdater.isUpdating()) return;
+
   bool exec = false;
   CmdKey cmdKey;
   uint8_t *data = NULL;
   size_t size = 0;
   RetFormat retFmt = Binary;
+  CmdCorrelation correlation;
+  bool correlated = false;
 
-  cmdKey = _parseJsonStringCmd((const char *)msg, msgLen, data, size, retFmt);
+  cmdKey = _parseJsonStringCmd((const char *)msg, msgLen, data, size, retFmt, correlation, correlated);
   exec = true;
 
-  if (exec) execCmd(cmdKey, retFmt, data, size, userdata);
+  // replies go back on the socket, reply to has no meaning here
+  correlation.replyTo[0] = '\0';
+  if (exec) execCmd(cmdKey, retFmt, data, size, userdata, correlated ? &correlation : NULL);
 }
 
-void replyJsonResult(ProtocolDelegate *delegate, const char *str, CmdKey cmdKey, void *userdata)
+size_t CmdEngine::liveStreamFrame(uint8_t *buf, size_t size, int format)
 {
-  sprintf(_strBuf, "{\"ret\":\"%s\", \"cmd\":\"%s\"}", str, cmdKeyToStr(cmdKey));
-  delegate->replyMessage(_strBuf, strlen(_strBuf), userdata);
+  if (format == PROTOCOL_MSG_FORMAT_BINARY) {
+    size_t count = 0;
+    const uint8_t *block = SensorDataPacker::sharedInstance()->dataBlock(count);
+    if (count > size) return 0;
+    memcpy(buf, block, count);
+    return count;
+  }
+
+  char *str = (char *)buf;
+  size_t length = 0;
+  appendf(str, size, length, "{\"ret\":{");
+  if (length >= size) return 0;
+  length += SensorDataPacker::sharedInstance()->dataJsonFields(str + length, size - length);
+  appendf(str, size, length, "},\"cmd\":\"%s\"}", cmdKeyToStr(GetSensorData));
+  return length < size ? length : 0;
 }
 
-int CmdEngine::execCmd(CmdKey cmdKey, RetFormat retFmt, uint8_t *args, size_t argsSize, void *userdata)
+#define HTTP_JSON_BODY_RESERVE  1024
+
+// held by the worker while a write runs, routes reading config wait for it
+static SemaphoreHandle_t _configLock = NULL;
+
+static bool takeConfigLock(TickType_t wait)
 {
-  switch (cmdKey) {
+  return !_configLock || xSemaphoreTake(_configLock, wait) == pdTRUE;
+}
 
-    case GetSensorData: {
-      size_t count = 0;
-      const void * data = NULL;
-      if (retFmt == Binary)
-        data = SensorDataPacker::sharedInstance()->dataBlock(count);
-      else if (retFmt == JSON) {
-        data = SensorDataPacker::sharedInstance()->dataJsonString(count);
-        appendCmdKeyToJsonString(cmdKey, (char*)data, count);
-      }
-      _delegate->replyMessage(data, count, userdata);
-      break;
-    }
+static void giveConfigLock()
+{
+  if (_configLock) xSemaphoreGive(_configLock);
+}
 
+int CmdEngine::onHttpRoute(HttpResponse &response, void *context)
+{
+  // serialized straight into the connection send buffer
+  char *buf = response.reserve(HTTP_JSON_BODY_RESERVE);
+  if (!buf) return 503;
+
+  size_t size = HTTP_JSON_BODY_RESERVE;
+  size_t length = 0;
+  switch ((CmdKey)(intptr_t)context) {
+    case GetSensorData:
+      buf[0] = '{';
+      length = SensorDataPacker::sharedInstance()->dataJsonFields(buf + 1, size - 2) + 2;
+      if (length < size) buf[length - 1] = '}';
+      break;
     case GetDeviceInfo:
-      if (retFmt == JSON) {
-        System *sys = System::instance();
-        sprintf(_strBuf, "{\"ret\":{\"uid\":\"%s\",\"cap\":\"%u\",\"libv\":\"%s\",\"firmv\":\"%s\",\"bdv\":\"%s\",\"model\":\"%s\",\"alcd\":%s,\"deploy\":\"%s\",\"hostname\":\"%s\",\"devname\":\"%s\",\"life\":\"%d\"}, \"cmd\":\"%s\"}",
-                sys->uid(),
-                sys->devCapability(),
-                sys->idfVersion(),
-                sys->firmwareVersion(),
-                sys->boardVersion(),
-                sys->model(),
-                sys->displayAutoAdjustOn()? "true" : "false",
-                deployModeStr(sys->deployMode()),
-                Wifi::instance()->getHostName(),
-                sys->deviceName(),
-                sys->maintenance()->allSessionsLife,
-                cmdKeyToStr(cmdKey));
-        _delegate->replyMessage(_strBuf, strlen(_strBuf), userdata);
+    case GetAlertConfig:
+      if (!takeConfigLock(CMD_CONFIG_LOCK_WAIT / portTICK_PERIOD_MS)) {
+        APP_LOGE("[CmdEngine]", "%s route, config write too long", cmdKeyToStr((CmdKey)(intptr_t)context));
+        return 503;
       }
+      length = (CmdKey)(intptr_t)context == GetDeviceInfo ? deviceInfoJson(buf, size) : alertConfigJson(buf, size);
+      giveConfigLock();
       break;
-
-    case GetUID:
-      if (retFmt == JSON) {
-        replyJsonResult(_delegate, System::instance()->uid(), cmdKey, userdata);
-      }
-      else {
-        _delegate->replyMessage(System::instance()->uid(), strlen(System::instance()->uid()), userdata);
-      }
+    case GetLiveStreamStats:
+      if (!_delegate->liveStream()) return 404;
+      length = liveStreamStatsJson(_delegate->liveStream(), buf, size);
       break;
+    default:
+      return 404;
+  }
+  if (length >= size) {
+    APP_LOGE("[CmdEngine]", "http body exceeds %d bytes", HTTP_JSON_BODY_RESERVE);
+    return 500;
+  }
+  response.commit(length);
+  return 200;
+}
 
-    case GetSensorCapability: {
-      uint32_t capability = System::instance()->devCapability();
-      if (retFmt == JSON) {
-        sprintf(_strBuf, "{\"ret\":\"%u\", \"cmd\":\"%s\"}", capability, cmdKeyToStr(cmdKey));
-        _delegate->replyMessage(_strBuf, strlen(_strBuf), userdata);
-      }
-      else {
-        _delegate->replyMessage(&capability, sizeof(capability), userdata);
-      }
-      break;
-    }
+// ------ admission
 
-    case GetIdfVersion:
-      if (retFmt == JSON) {
-        replyJsonResult(_delegate, System::instance()->idfVersion(), cmdKey, userdata);
-      }
-      else {
-        _delegate->replyMessage(System::instance()->idfVersion(),
-                                strlen(System::instance()->idfVersion()), userdata);
-      }
-      break;
+// reactor task only
+static CmdLimiter _limiter;
 
-    case GetFirmwareVersion:
-      if (retFmt == JSON) {
-        replyJsonResult(_delegate, System::instance()->firmwareVersion(), cmdKey, userdata);
-      }
-      else {
-        _delegate->replyMessage(System::instance()->firmwareVersion(),
-                                strlen(System::instance()->firmwareVersion()), userdata);
-      }
-      break;
+uint32_t CmdEngine::limitedCount(CmdLimitClass limitClass)
+{
+  return _limiter.limitedCount(limitClass);
+}
 
-    case GetHostname:
-    case GetDeviceName: {
-      const char *name = NULL;
-      if (cmdKey == GetHostname) name = Wifi::instance()->getHostName();
-      else if (cmdKey == GetDeviceName) name = System::instance()->deviceName();
-      if (retFmt == JSON) {
-        replyJsonResult(_delegate, name, cmdKey, userdata);
-      }
-      else {
-        _delegate->replyMessage(name, strlen(name), userdata);
-      }
-      break;
-    }
+const char * CmdEngine::limitClassStr(CmdLimitClass limitClass)
+{
+  return CmdLimiter::classStr(limitClass);
+}
 
-    case SetHostname:
-      sprintf(_strBuf, "%.*s", argsSize, (const char*)args);
-      Wifi::instance()->setHostName(_strBuf);
-      Wifi::instance()->saveConfig();
+static CmdLimitClass limitClassOf(CmdKey cmdKey)
+{
+  switch (cmdKey) {
+    case Restart:
+    case RestoreFactory:
+    case UpdateFirmware:
+      return CmdLimitStrict;
+    default:
       break;
+  }
+  switch (_cmdHandlers[cmdKey].run) {
+    case CmdRunWrite: return CmdLimitWrite;
+    case CmdRunNet:   return CmdLimitStream;
+    default:          return CmdLimitRead;
+  }
+}
 
-    case SetDeviceName:
-      System::instance()->setDeviceName((const char*)args, argsSize);
-      break;
+// commands of each class, a batch's sub-commands each to their own; returns the most
+// limited class charged
+static CmdLimitClass limitClassOf(CmdKey cmdKey, const uint8_t *args, size_t argsSize,
+                                  uint8_t costs[CmdLimitClassCount])
+{
+  memset(costs, 0, CmdLimitClassCount);
+  if (_cmdHandlers[cmdKey].run != CmdRunBatch) {
+    CmdLimitClass limitClass = limitClassOf(cmdKey);
+    costs[limitClass] = 1;
+    return limitClass;
+  }
 
-    case TurnOnDisplay:
-      System::instance()->turnDisplayOn(args[0] != 0);
-      break;
+  CmdLimitClass limitClass = CmdLimitRead;
+  CmdBatchReader reader(args, argsSize);
+  CmdCall batch = { Batch, CmdEngine::Binary, args, argsSize, NULL, NULL, NULL, NULL, 0, NULL };
+  CmdCall sub;
+  bool empty = true;
+  while (reader.next(batch, sub)) {
+    CmdLimitClass subClass = (unsigned)sub.key < CmdKeyMaxValue ? limitClassOf(sub.key) : CmdLimitRead;
+    if (costs[subClass] < UINT8_MAX) ++costs[subClass];
+    if (subClass > limitClass) limitClass = subClass;
+    empty = false;
+  }
+  if (empty) costs[CmdLimitRead] = 1;
+  return limitClass;
+}
 
-    case TurnOnAutoAdjustDisplay:
-      System::instance()->turnDisplayAutoAdjustOn(args[0] != 0);
-      break;
+static uint32_t limitSourceId(uint32_t requesterId, const CmdCorrelation *correlation)
+{
+  // connection ids and addresses even, the rest odd so they never meet
+  if (requesterId) return requesterId << 1;
+  if (!correlation || !correlation->replyTo[0]) return 1;
+  // fnv-1a
+  uint32_t hash = 2166136261u;
+  for (const char *p = correlation->replyTo; *p; ++p) hash = (hash ^ (uint8_t)*p) * 16777619u;
+  return hash | 1;
+}
 
-    case UpdateFirmware:
-      _appUpdater.update();
-      break;
+bool CmdEngine::_admit(CmdKey cmdKey, RetFormat retFmt, const uint8_t *args, size_t argsSize, void *userdata,
+                       const CmdCorrelation *correlation)
+{
+  uint8_t costs[CmdLimitClassCount];
+  CmdLimitClass limitClass = limitClassOf(cmdKey, args, argsSize, costs);
+  uint32_t nowMilli = xTaskGetTickCount() * portTICK_PERIOD_MS;
+  uint32_t sourceId = limitSourceId(_delegate->requesterId(userdata), correlation);
+  CmdLimiter::Result result = _limiter.admit(sourceId, costs, nowMilli);
+  if (result == CmdLimiter::Admitted) return true;
+
+  if (result == CmdLimiter::Refused)
+    APP_LOGE("[CmdEngine]", "%s over %s quota", cmdKeyToStr(cmdKey), CmdLimiter::classStr(limitClass));
+  // protocols with a status code of their own answer every refusal, the others the first
+  _replyRefusal(cmdKey, retFmt, CMD_STATUS_RATE_LIMITED, userdata, correlation, result == CmdLimiter::Refused);
+  return false;
+}
 
-    case Restart:
-      System::instance()->setRestartRequest();
-      break;
+void CmdEngine::_replyRefusal(CmdKey cmdKey, RetFormat retFmt, int status, void *userdata,
+                              const CmdCorrelation *correlation, bool statusReply)
+{
+  if (_delegate->replyStatus(userdata, status) || !statusReply) return;
+
+  // status reply, uncorrelated binary requests could not tell it from a result
+  char reply[CMD_CORRELATION_ID_MAX_LEN + 64];
+  size_t length = 0;
+  if (retFmt == JSON) {
+    appendf(reply, sizeof(reply), length, "{\"cmd\":\"%s\",\"status\":%d", cmdKeyToStr(cmdKey), status);
+    if (correlation && correlation->idLength > 0) appendf(reply, sizeof(reply), length, ",\"id\":\"%s\"", correlation->id);
+    appendf(reply, sizeof(reply), length, "}");
+  }
+  else if (correlation) {
+    reply[0] = correlation->idLength;
+    memcpy(reply + 1, correlation->id, correlation->idLength);
+    reply[1 + correlation->idLength] = status;
+    length = 2 + correlation->idLength;
+  }
+  if (length > 0 && length < sizeof(reply)) _reply(reply, length, userdata, correlation);
+}
 
-    case RestoreFactory:
-      System::instance()->restoreFactory();
-      break;
+// ------ command queue and worker
+
+struct CmdJob {
+  CmdEngine            *engine;
+  CmdKey                key;
+  CmdEngine::RetFormat  retFmt;
+  void                 *userdata;
+  bool                  correlated;
+  CmdCorrelation        correlation;
+  int64_t               startMicro;
+  size_t                argsSize;
+  int8_t                large;      // slot of args over CMD_JOB_ARGS_SIZE, -1 if none
+  uint8_t               args[CMD_JOB_ARGS_SIZE];
+};
 
-    case GetStaSsidPass:
-    case GetApSsidPass: {
-      const char *ssid = NULL;
-      const char *pass = NULL;
-      if (cmdKey == GetStaSsidPass) {
-        ssid = Wifi::instance()->staSsid();
-        pass = Wifi::instance()->staPassword();
-      }
-      else if (cmdKey == GetApSsidPass) {
-        ssid = Wifi::instance()->apSsid();
-        pass = Wifi::instance()->apPassword();
-      }
-      if (retFmt == JSON) {
-        sprintf(_strBuf, "{\"ret\":{\"ssid\":\"%s\",\"pass\":\"%s\"}, \"cmd\":\"%s\"}",
-                ssid, pass, cmdKeyToStr(cmdKey));
-        _delegate->replyMessage(_strBuf, strlen(_strBuf), userdata);
-      }
-      else {
-        _strBuf[0] = strlen(ssid);
-        sprintf(_strBuf + 1, "%s%s", ssid, pass);
-        _delegate->replyMessage(_strBuf, 1 + strlen(_strBuf + 1), userdata);
-      }
-      break;
-    }
+// fifo, head is running on the worker if it is a write; reactor task only
+static CmdJob _jobs[CMD_QUEUE_LENGTH];
+static uint8_t _jobHead = 0;
+static uint8_t _jobCount = 0;
+// head job handed to the worker
+static QueueHandle_t _workerQueue = NULL;
+// args of the few jobs that do not fit theirs, a batch of writes mostly
+static uint8_t _largeArgs[CMD_JOB_LARGE_COUNT][CMD_JOB_LARGE_ARGS_SIZE];
+static bool _largeArgsUsed[CMD_JOB_LARGE_COUNT];
+// worker replies go through the reactor, which takes one as large as the message buffer
+static char _workerReply[NET_JOB_LARGE_DATA_SIZE];
+
+static const uint8_t * jobArgs(const CmdJob &job)
+{
+  return job.large >= 0 ? _largeArgs[job.large] : job.args;
+}
 
-    case GetAltApSsidPassList: {
-      SsidPasswd *list = NULL;
-      uint8_t head, count;
-      Wifi::instance()->getAltApConnectionSsidPassword(list, head, count);
-      if (retFmt == JSON) {
-        size_t offset = 0;
-        sprintf(_strBuf + offset, "{\"cmd\":\"%s\",\"ret\":[", cmdKeyToStr(cmdKey));
-        offset += strlen(_strBuf + offset);
-        uint8_t index = 0;
-        for (uint8_t i = 0; i < count; ++i) {
-          index = (head + i) % count;
-          sprintf(_strBuf + offset, "{\"ssid\":\"%s\",\"pass\":\"%s\"}%s",
-                  list[index].ssid, list[index].password, (i<count-1)?",":"");
-          offset += strlen(_strBuf + offset);
-        }
-        sprintf(_strBuf + offset, "]}");
-        offset += strlen(_strBuf + offset);
-        _delegate->replyMessage(_strBuf, offset, userdata);
-      }
-      break;
+static int8_t takeLargeArgs()
+{
+  for (int8_t i = 0; i < CMD_JOB_LARGE_COUNT; ++i) {
+    if (!_largeArgsUsed[i]) {
+      _largeArgsUsed[i] = true;
+      return i;
     }
+  }
+  return -1;
+}
 
-    case SetStaSsidPass:
-    case SetApSsidPass:
-    case AppendAltApSsidPass: {
-      uint8_t offset = 9;
-      uint8_t ssidLen = args[offset];
-      char ssid[32] = {0};
-      char pass[64] = {0};
-      strncat(ssid, (const char*)(args + offset + 1),           ssidLen);
-      strncat(pass, (const char*)(args + offset + 1 + ssidLen), argsSize - 1 - ssidLen - offset);
-      if      (cmdKey == SetStaSsidPass)      Wifi::instance()->setStaConfig(ssid, pass, true);
-      else if (cmdKey == SetApSsidPass)       Wifi::instance()->setApConfig(ssid, pass, true);
-      else if (cmdKey == AppendAltApSsidPass) Wifi::instance()->appendAltApConnectionSsidPassword(ssid, pass);
-      Wifi::instance()->saveConfig();
-      // if (args[0]) {  // sih sil
-      //   uint32_t sih, sil;
-      //   memcpy(&sih, args + 1, 4);
-      //   memcpy(&sil, args + 5, 4);
-      //   System::instance()->setConnectionSi(sih, sil);
-      // }
-      break;
-    }
+// head is done
+static void popJob()
+{
+  CmdJob &job = _jobs[_jobHead];
+  if (job.large >= 0) _largeArgsUsed[job.large] = false;
+  _jobHead = (_jobHead + 1) % CMD_QUEUE_LENGTH;
+  --_jobCount;
+}
 
-    case ClearAltApSsidPassList:
-      Wifi::instance()->clearAltApConnectionSsidPassword();
-      Wifi::instance()->saveConfig();
-      break;
+static CmdLatency _latency[CmdKeyMaxValue];
 
-    case GetSystemDeployMode: {
-      const char * modeStr = deployModeStr(System::instance()->deployMode());
-      if (retFmt == JSON) {
-        replyJsonResult(_delegate, modeStr, cmdKey, userdata);
-      }
-      else {
-        _delegate->replyMessage(modeStr, strlen(modeStr), userdata);
-      }
-      break;
+uint32_t CmdEngine::_queuedCount = 0;
+uint32_t CmdEngine::_rejectCount = 0;
+
+int CmdEngine::execCmd(CmdKey cmdKey, RetFormat retFmt, uint8_t *args, size_t argsSize, void *userdata,
+                       const CmdCorrelation *correlation)
+{
+  // binary keys come off the wire unchecked
+  if ((unsigned)cmdKey >= CmdKeyMaxValue) return 0;
+  int64_t startMicro = esp_timer_get_time();
+  if (_readOnly) {
+    uint8_t costs[CmdLimitClassCount];
+    if (limitClassOf(cmdKey, args, argsSize, costs) > CmdLimitStream) {
+      APP_LOGE("[CmdEngine]", "%s not allowed", cmdKeyToStr(cmdKey));
+      _replyRefusal(cmdKey, retFmt, CMD_STATUS_NOT_ALLOWED, userdata, correlation);
+      return -1;
     }
+  }
+  if (!_admit(cmdKey, retFmt, args, argsSize, userdata, correlation)) return -1;
+
+  // inline unless a write has a worker to go to or earlier writes are still queued
+  NetReactor *reactor = _delegate->reactor();
+  CmdRun run = cmdRun(cmdKey, args, argsSize);
+  bool queue = _workerQueue && run != CmdRunNet && (run == CmdRunWrite || _jobCount > 0);
+  if (!queue) {
+    _execute(cmdKey, retFmt, args, argsSize, userdata, correlation, _strBuf, SharedBuffer::msgBufferSize());
+    _record(cmdKey, startMicro);
+    return 0;
+  }
 
-    case SetSystemDeployMode:
-      System::instance()->setDeployMode((DeployMode)args[0]);
-      break;
+  // a protocol without reactor can not take the worker's reply, nor may the command
+  // overtake the writes queued before it
+  int8_t large = -1;
+  const char *refusal = !reactor ? "no late reply"
+                      : _jobCount >= CMD_QUEUE_LENGTH ? "queue full"
+                      : argsSize > CMD_JOB_LARGE_ARGS_SIZE ? "args too large"
+                      : argsSize > CMD_JOB_ARGS_SIZE && (large = takeLargeArgs()) < 0 ? "large args slots taken"
+                      : NULL;
+  if (refusal) {
+    ++_rejectCount;
+    APP_LOGE("[CmdEngine]", "%s rejected, %s", cmdKeyToStr(cmdKey), refusal);
+    _delegate->replyStatus(userdata, CMD_STATUS_BUSY);
+    return -1;
+  }
+  CmdJob &job = _jobs[(_jobHead + _jobCount) % CMD_QUEUE_LENGTH];
+  job.engine = this;
+  job.key = cmdKey;
+  job.retFmt = retFmt;
+  job.userdata = userdata;
+  job.correlated = correlation != NULL;
+  if (correlation) job.correlation = *correlation;
+  job.startMicro = startMicro;
+  job.argsSize = argsSize;
+  job.large = large;
+  if (argsSize > 0) memcpy(large >= 0 ? _largeArgs[large] : job.args, args, argsSize);
+  ++_queuedCount;
+  if (++_jobCount == 1) _dispatch();
+  return 0;
+}
 
-    case SetSensorType:
-      System::instance()->setSensorType((SensorType)args[0], (SensorType)args[1]);
-      break;
+void CmdEngine::_execute(CmdKey cmdKey, RetFormat retFmt, const uint8_t *args, size_t argsSize, void *userdata,
+                         const CmdCorrelation *correlation, char *buf, size_t size)
+{
+  const CmdHandler &handler = _cmdHandlers[cmdKey];
+  CmdCall call = { cmdKey, retFmt, args, argsSize, userdata, _delegate, NULL, NULL, 0, NULL };
+  CmdFormatter format = retFmt == JSON ? handler.json : handler.binary;
+
+  // cached reply, versioned if the requester tells the version it holds
+  bool cached = handler.cache != CmdCacheNone && format;
+  uint32_t generation = cached ? cacheGeneration(handler.cache) : 0;
+  bool versioned = cached && argsSize == CMD_VERSION_SIZE;
+  bool notModified = versioned && memcmp(args, &generation, CMD_VERSION_SIZE) == 0;
+
+  // binary reply of a correlated command leaves room for the id ahead, versioned for the version
+  size_t prefix = correlation && retFmt == Binary ? 1 + correlation->idLength : 0;
+  size_t head = prefix + (versioned && retFmt == Binary ? CMD_VERSIONED_RET_HEADER_SIZE : 0);
+  size_t count = 0;
+  if (notModified) {
+    ++_notModifiedCount;
+    if (retFmt == JSON)
+      appendf(buf, size, count, "{\"cmd\":\"%s\",\"status\":%d}", cmdKeyToStr(cmdKey), CMD_STATUS_NOT_MODIFIED);
+  }
+  else {
+    CmdCacheEntry *entry = cached ? cacheFind(cmdKey, retFmt) : NULL;
+    if (entry && entry->generation == generation) {
+      ++_cacheHitCount;
+      call.reply = entry->data;
+      count = entry->length;
+    }
+    else {
+      if (cached) ++_cacheMissCount;
+      if (handler.exec) handler.exec(call);
+      if (!format) return;
+      count = format(call, buf + head, size - head);
+      if (count == 0) return;
+      if (cached && count < size - head) cacheStore(cmdKey, retFmt, generation, call.reply ? call.reply : buf + head, count);
+    }
+  }
 
-    case SetAlertEnableConfig:
-      System::instance()->setAlertPnEnabled(args[0] == 1);
-      System::instance()->setAlertSoundEnabled(args[1] == 1);
-      break;
+  bool echoId = correlation && correlation->idLength > 0;
+  if (!call.reply || head > 0 || (retFmt == JSON && (cached || echoId))) {
+    if (count >= size - head) {
+      APP_LOGE("[CmdEngine]", "%s reply exceeds %d bytes", cmdKeyToStr(cmdKey), (int)size);
+      return;
+    }
+    if (call.reply) memmove(buf + head, call.reply, count);
+    call.reply = buf;
+  }
 
-    case SetSensorAlertConfig: {
-      FloatBytes fbl, fbg;
-      size_t bLen = FloatLen * 2 + 2;
-      System *sys = System::instance();
-      for (int i=0; i<SensorDataTypeCount; ++i) {
-        SensorDataType sdt = (SensorDataType)i;
-        memcpy(fbl.bytes, args+i*bLen+2,          FloatLen);
-        memcpy(fbg.bytes, args+i*bLen+2+FloatLen, FloatLen);
-        sys->setAlert(sdt, args[i*bLen+0]==1, args[i*bLen+1]==1, fbl.v, fbg.v);
-      }
-      sys->resetAlertReactiveCounter();
-      break;
+  if (retFmt == Binary) {
+    if (prefix > 0) {
+      buf[0] = correlation->idLength;
+      memcpy(buf + 1, correlation->id, correlation->idLength);
+    }
+    if (head > prefix) {
+      buf[prefix] = notModified ? CMD_STATUS_NOT_MODIFIED : CMD_STATUS_OK;
+      memcpy(buf + prefix + 1, &generation, CMD_VERSION_SIZE);
     }
+    count += head;
+  }
+  else if (cached || echoId) {
+    // json reply object gets version and id as last members
+    count -= 1;
+    if (cached) appendf(buf, size, count, ",\"ver\":%u", (unsigned)generation);
+    if (echoId) appendf(buf, size, count, ",\"id\":\"%s\"", correlation->id);
+    appendf(buf, size, count, "}");
+    if (count >= size) {
+      APP_LOGE("[CmdEngine]", "%s reply exceeds %d bytes", cmdKeyToStr(cmdKey), (int)size);
+      return;
+    }
+  }
 
-    case GetAlertConfig:
-      if (retFmt == JSON) {
-        System *sys = System::instance();
-        size_t packCount = 0;
-        sprintf(_strBuf + packCount, "{\"cmd\":\"%s\",\"ret\":{\"enpn\":%s,\"ensnd\":%s,\"vals\":{",
-                cmdKeyToStr(cmdKey),
-                sys->alertPnEnabled() ? "true" : "false",
-                sys->alertSoundEnabled() ? "true" : "false");
-        packCount += strlen(_strBuf + packCount);
-
-        Alerts *alerts = sys->alerts();
-        for (int i=0; i<SensorDataTypeCount; ++i) {
-          sprintf(_strBuf + packCount, "\"%s\":{\"len\":%s,\"gen\":%s,\"lval\":%.2f,\"gval\":%.2f}%s",
-                  sensorDataTypeStr((SensorDataType)i),
-                  alerts->sensors[i].lEnabled ? "true" : "false",
-                  alerts->sensors[i].gEnabled ? "true" : "false",
-                  alerts->sensors[i].lValue,
-                  alerts->sensors[i].gValue,
-                  i < SensorDataTypeCount - 1 ? "," : "");
-          packCount += strlen(_strBuf + packCount);
-        }
-        sprintf(_strBuf + packCount, "}}}");
-        packCount += strlen(_strBuf + packCount);
-        _delegate->replyMessage(_strBuf, packCount, userdata);
-      }
-      break;
+  _reply(call.reply, count, userdata, correlation);
+}
 
-    case CheckPNTokenEnabled:
-      if (retFmt == JSON) {
-        sprintf(_strBuf, "{\"ret\":{\"en\":%s}, \"cmd\":\"%s\"}",
-                System::instance()->tokenEnabled((MobileOS)args[0], (const char*)(args+1)) ? "true" : "false",
-                cmdKeyToStr(cmdKey));
-        _delegate->replyMessage(_strBuf, strlen(_strBuf), userdata);
-      }
-      break;
+void CmdEngine::_reply(const void *data, size_t length, void *userdata, const CmdCorrelation *correlation)
+{
+  // mqtt delegates take the topic to publish on as userdata
+  char topic[NET_JOB_TOPIC_MAX_LEN + 1];
+  if (correlation && correlation->replyTo[0] && _delegate->topicRouter()) {
+    snprintf(topic, sizeof(topic), "%s/%s", MqttClientDelegate::cmdRetTopic(), correlation->replyTo);
+    userdata = topic;
+  }
+  _delegate->replyMessage(data, length, userdata);
+}
 
-    case SetPNToken:
-      System::instance()->setPnToken(args[0]==1, (MobileOS)args[1], (const char*)(args+2));
-      break;
+void CmdEngine::_dispatch()
+{
+  // reads at the head have waited for the writes before them only
+  while (_jobCount > 0) {
+    CmdJob &job = _jobs[_jobHead];
+    if (cmdRun(job.key, jobArgs(job), job.argsSize) == CmdRunWrite) {
+      CmdJob *head = &job;
+      xQueueSend(_workerQueue, &head, portMAX_DELAY);    // worker is idle, never blocks
+      return;
+    }
+    job.engine->_execute(job.key, job.retFmt, jobArgs(job), job.argsSize, job.userdata,
+                         job.correlated ? &job.correlation : NULL, _strBuf, SharedBuffer::msgBufferSize());
+    _record(job.key, job.startMicro);
+    popJob();
+  }
+}
 
-    case SetDebugFlag:
-      System::instance()->setDebugFlag(args[0]);
-      break;
+void CmdEngine::onNetJob(NetJob *netJob)
+{
+  CmdJob &job = _jobs[_jobHead];
+  _record(job.key, job.startMicro);
+  popJob();
+  _dispatch();
+}
 
-    default:
-      break;
+void CmdEngine::runWorker()
+{
+  _configLock = xSemaphoreCreateMutex();
+  _workerQueue = xQueueCreate(1, sizeof(CmdJob *));
+  NetJob done;
+  CmdJob *job;
+  while (true) {
+    if (xQueueReceive(_workerQueue, &job, portMAX_DELAY) != pdTRUE) continue;
+    CmdEngine *engine = job->engine;
+    takeConfigLock(portMAX_DELAY);
+    engine->_execute(job->key, job->retFmt, jobArgs(*job), job->argsSize, job->userdata,
+                     job->correlated ? &job->correlation : NULL, _workerReply, sizeof(_workerReply));
+    giveConfigLock();
+
+    // completion queues after the reply, so the reactor sends it before anything later
+    done.client = engine;
+    done.length = 0;
+    NetReactor *reactor = engine->_delegate->reactor();
+    while (!reactor->submit(&done)) vTaskDelay(10 / portTICK_PERIOD_MS);
   }
+}
 
-  return 0;
+void CmdEngine::_record(CmdKey cmdKey, int64_t startMicro)
+{
+  int64_t micro = esp_timer_get_time() - startMicro;
+  CmdLatency &latency = _latency[cmdKey];
+  int bucket = 0;
+  while (bucket < CMD_LATENCY_BUCKETS - 1 && micro > (1000LL << bucket)) ++bucket;
+  ++latency.buckets[bucket];
+  ++latency.count;
+  latency.sumMicro += micro;
+}
+
+bool CmdEngine::latency(CmdKey cmdKey, CmdLatency &latency)
+{
+  if ((unsigned)cmdKey >= CmdKeyMaxValue || _latency[cmdKey].count == 0) return false;
+  latency = _latency[cmdKey];
+  return true;
 }
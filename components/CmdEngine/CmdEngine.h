@@ -9,9 +9,50 @@
 
 #include "ProtocolMessageInterpreter.h"
 #include "ProtocolDelegate.h"
+#include "TopicRouter.h"
+#include "HttpRouter.h"
+#include "LiveStream.h"
+#include "NetReactor.h"
 #include "CmdKey.h"
+#include "CmdFormat.h"
+#include "CmdLimiter.h"
 
-class CmdEngine : public ProtocolMessageInterpreter
+// Commands that write config (CmdKey.h run column Write) leave the network task: they
+// queue in arrival order and run one at a time on the command worker, replies going out
+// through the delegate from there. Reads run inline, after the writes queued before them.
+// The queue is shared by all engines and only touched on the reactor task. Http routes
+// and coap resources read config outside the queue, so a write holds the config lock
+// while it runs and they wait for it, 503 past CMD_CONFIG_LOCK_WAIT.
+#define CMD_QUEUE_LENGTH        8
+#define CMD_JOB_ARGS_SIZE       256     // args kept in the job up to this
+#define CMD_JOB_LARGE_ARGS_SIZE 1024    // as SharedBuffer's command buffer, the largest args
+#define CMD_JOB_LARGE_COUNT     2       // queued jobs with args over CMD_JOB_ARGS_SIZE
+#define CMD_CONFIG_LOCK_WAIT    500     // ms
+
+// per command latency from receipt to reply, buckets up to 1, 2, 4 .. 512 ms and +Inf
+#define CMD_LATENCY_BUCKETS     11
+
+// correlation a request came with, echoed in its reply (CmdFormat.h)
+struct CmdCorrelation
+{
+  uint8_t   idLength;
+  char      id[CMD_CORRELATION_ID_MAX_LEN + 1];
+  char      replyTo[CMD_CORRELATION_REPLY_TO_MAX_LEN + 1];   // empty for cmdRetTopic
+};
+
+// Admission (CmdLimiter.h) of a command is checked before it is run or queued; a refused
+// one gets a rate limited reply, the first one after an admitted command only, unless
+// the protocol answers each with a status code of its own.
+
+struct CmdLatency
+{
+  uint32_t  buckets[CMD_LATENCY_BUCKETS];   // not cumulative
+  uint32_t  count;
+  uint64_t  sumMicro;
+};
+
+class CmdEngine : public ProtocolMessageInterpreter, public TopicMessageHandler, public HttpRouteHandler,
+                  public LiveStreamSource, public NetReactorClient
 {
 public:
   enum RetFormat {
@@ -26,7 +67,13 @@ public:
 
   void enableUpdate(bool enabled = true);
 
-  int execCmd(CmdKey cmdKey, RetFormat retFmt = Binary, uint8_t *args = NULL, size_t argsSize = 0, void *userdata = NULL);
+  // read and stream class commands only, others are refused with CMD_STATUS_NOT_ALLOWED;
+  // for protocols whose requesters are not authenticated
+  void setReadOnly(bool readOnly = true) { _readOnly = readOnly; }
+
+  // -1 if the command is not allowed, over quota, or had to queue and could not
+  int execCmd(CmdKey cmdKey, RetFormat retFmt = Binary, uint8_t *args = NULL, size_t argsSize = 0, void *userdata = NULL,
+              const CmdCorrelation *correlation = NULL);
 
   void setProtocolDelegate(ProtocolDelegate *delegate);
 
@@ -34,9 +81,53 @@ public:
   virtual void interpreteMqttMsg(const char* topic, size_t topicLen, const char* msg, size_t msgLen);
   virtual void interpreteSocketMsg(const void* msg, size_t msgLen, void *userdata);
 
+  // TopicMessageHandler interface, context carries the RetFormat of topic payload
+  virtual void onTopicMessage(const char* topic, size_t topicLen, const char* msg, size_t msgLen, void *context);
+
+  // HttpRouteHandler interface, context carries the CmdKey of the Get command behind the route
+  virtual int onHttpRoute(HttpResponse &response, void *context);
+
+  // LiveStreamSource interface, same content as GetSensorData reply
+  virtual size_t liveStreamFrame(uint8_t *buf, size_t size, int format);
+
+  // NetReactorClient interface, worker finished the queue head
+  virtual void onNetJob(NetJob *job);
+
+  // command worker task body, never returns; writes run inline while it is not started
+  static void runWorker();
+
+  // stats, reactor task only
+  static bool latency(CmdKey cmdKey, CmdLatency &latency);   // false if never run
+  static uint32_t queuedCount() { return _queuedCount; }
+  static uint32_t rejectCount() { return _rejectCount; }
+  static uint32_t cacheHitCount() { return _cacheHitCount; }
+  static uint32_t cacheMissCount() { return _cacheMissCount; }
+  static uint32_t notModifiedCount() { return _notModifiedCount; }
+  static uint32_t limitedCount(CmdLimitClass limitClass);
+  static const char * limitClassStr(CmdLimitClass limitClass);
+
+protected:
+  void _execute(CmdKey cmdKey, RetFormat retFmt, const uint8_t *args, size_t argsSize, void *userdata,
+                const CmdCorrelation *correlation, char *buf, size_t size);
+  bool _admit(CmdKey cmdKey, RetFormat retFmt, const uint8_t *args, size_t argsSize, void *userdata,
+              const CmdCorrelation *correlation);
+  void _reply(const void *data, size_t length, void *userdata, const CmdCorrelation *correlation);
+  // status of a command refused before it ran, through the protocol or as a reply
+  void _replyRefusal(CmdKey cmdKey, RetFormat retFmt, int status, void *userdata,
+                     const CmdCorrelation *correlation, bool statusReply = true);
+  static void _dispatch();
+  static void _record(CmdKey cmdKey, int64_t startMicro);
+
 protected:
   bool                   _updateEnabled;
+  bool                   _readOnly;
   ProtocolDelegate      *_delegate;
+
+  static uint32_t        _queuedCount;
+  static uint32_t        _rejectCount;
+  static uint32_t        _cacheHitCount;
+  static uint32_t        _cacheMissCount;
+  static uint32_t        _notModifiedCount;
 };
 
 #endif // _CMD_ENGINE_H
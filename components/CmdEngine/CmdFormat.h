@@ -25,6 +25,25 @@
 #define CMD_DATA_KEY_OFFSET          0
 #define CMD_DATA_ARG_OFFSET          2
 
+// ----------------- correlated cmd data content ------------------
+// cmd key with CMD_KEY_CORRELATED_FLAG set is followed by the correlation, args after it:
+//              ++--------------+-----------+--------------+-------------+-----------++
+//  byte No.:   ||    0 ~ 1     |     2     |  3 ~ 2 + n   |   3 + n     |  m bytes  ||
+//              ++--------------+-----------+--------------+-------------+-----------++
+//  byte name:  || key | flag   | id len n  |      id      | reply to m  | reply to  ||
+//              ++--------------+-----------+--------------+-------------+-----------++
+//
+//  Note: id and reply to are optional (length 0), both made of letters, digits and
+//        - _ . :  Reply to names a sub topic of cmdRetTopic the reply is published
+//        on instead of cmdRetTopic itself (mqtt only). Json commands carry them as
+//        "id" and "replyto" strings.
+//        Replies of correlated commands echo the id: binary return data is preceded
+//        by id length and id, json replies get an "id" member.
+
+#define CMD_KEY_CORRELATED_FLAG             0x8000
+#define CMD_CORRELATION_ID_MAX_LEN          32
+#define CMD_CORRELATION_REPLY_TO_MAX_LEN    24
+
 // ----------------- cmd return data ------------------
 // command return data formate:
 //              ++----------------+-------------------------------------++
@@ -42,4 +61,49 @@
 #define CMD_RET_DATA_STATUS_CODE_OFFSET     0
 #define CMD_RET_DATA_CONTENT_OFFSET         1
 
+// ----------------- batch cmd args ------------------
+// args of cmd key Batch, sub commands each in cmd data content format:
+//              ++----------------+----------------+------------------------++
+//  byte No.:   ||       0        |     1 ~ 2      |      3 ~ 2 + size      || ...
+//              ++----------------+----------------+------------------------++
+//  byte name:  ||     count      |  sub cmd size  |  sub cmd data content  || next sub cmd
+//              ++----------------+----------------+------------------------++
+//
+// ----------------- batch return data ------------------
+// one reply for the batch, sub command results in request order:
+//              ++--------+------------+---------+--------------+-------------++
+//  byte No.:   ||   0    |   1 ~ 2    |    3    |    4 ~ 5     | 6 ~ 5 + len || ...
+//              ++--------+------------+---------+--------------+-------------++
+//  byte name:  || count  |  cmd key   | status  |  ret len     |  ret data   || next sub cmd
+//              ++--------+------------+---------+--------------+-------------++
+//
+//  Note: sizes and keys are little endian as the cmd key is; json batches carry the
+//        sub commands as a "cmds" array of command objects and get a "ret" array of
+//        their replies, each with a "status" member added
+
+#define CMD_BATCH_MAX_COUNT                 16
+#define CMD_BATCH_COUNT_SIZE                1
+#define CMD_BATCH_SUB_SIZE_SIZE             2
+#define CMD_BATCH_RET_HEADER_SIZE           5
+
+// sub command status, CMD_STATUS_* of CmdStatus.h
+#include "CmdStatus.h"
+
+// ----------------- versioned cmd ------------------
+// Get commands with a cached reply (CmdKey.h cache column) take the version of the reply
+// the requester holds as 4 byte args, "ver" number in json. The binary reply then starts
+// with a status byte and the current version:
+//              ++----------------+----------------+------------------------++
+//  byte No.:   ||       0        |     1 ~ 4      |      5 ~ retsize - 1   ||
+//              ++----------------+----------------+------------------------++
+//  byte name:  ||  status code   |    version     |      return data       ||
+//              ++----------------+----------------+------------------------++
+//
+//  Note: status CMD_STATUS_NOT_MODIFIED comes without return data. Json replies of
+//        cached commands always carry "ver", a not modified one is just
+//        {"cmd":...,"status":4,"ver":...}. Versions do not survive a restart.
+
+#define CMD_VERSION_SIZE                    4
+#define CMD_VERSIONED_RET_HEADER_SIZE       5
+
 #endif // _CMD_FORMAT_H_INCLUDED
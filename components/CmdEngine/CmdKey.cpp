@@ -7,57 +7,60 @@
 #include "CmdKey.h"
 
 #include <string.h>
+#include <stdint.h>
 
 static const char * const CmdKeyStr[] = {
-    "DoNothing",                // 0
-    "GetSensorData",            // 1
-    "GetSensorCapability",      // 2
-    "GetDeviceInfo",            // 3
-    "GetUID",                   // 4
-    "GetFirmwareVersion",       // 5
-    "GetIdfVersion",            // 6
-    "GetHostname",              // 7
-    "SetHostname",              // 8
-    "GetDeviceName",            // 9
-    "SetDeviceName",            // 10
-    "GetStaSsidPass",           // 11
-    "SetStaSsidPass",           // 12
-    "GetApSsidPass",            // 13
-    "SetApSsidPass",            // 14
-    "GetAltApSsidPassList",     // 15
-    "AppendAltApSsidPass",      // 16
-    "ClearAltApSsidPassList",   // 17
-    "GetSystemDeployMode",      // 18
-    "SetSystemDeployMode",      // 19
-    "SetSensorType",            // 20
-    "TurnOnDisplay",            // 21
-    "TurnOnAutoAdjustDisplay",  // 22
-    "GetAlertConfig",           // 23
-    "CheckPNTokenEnabled",      // 24
-    "SetAlertEnableConfig",     // 25
-    "SetSensorAlertConfig",     // 26
-    "SetPNToken",               // 27
-    "UpdateFirmware",           // 28
-    "Restart",                  // 29
-    "RestoreFactory",           // 30
-    "SetDebugFlag"              // 31
+#define CMD_KEY_STR(name, ...) #name,
+    CMD_KEY_LIST(CMD_KEY_STR)
+#undef CMD_KEY_STR
 };
 
-CmdKey strToCmdKey(const char *str)
+static const uint8_t CmdKeyLen[] = {
+#define CMD_KEY_LEN(name, ...) sizeof(#name) - 1,
+    CMD_KEY_LIST(CMD_KEY_LEN)
+#undef CMD_KEY_LEN
+};
+
+// Perfect hash of the command names: seeded fnv-1a, top CMD_KEY_HASH_BITS bits as slot.
+// Slots are the case labels of the lookup switch, so a command added onto a taken slot
+// fails to compile with a duplicate case value; pick another seed then (any that leaves
+// the names on distinct slots).
+#define CMD_KEY_HASH_SEED       0x8121c14du
+#define CMD_KEY_HASH_BITS       6
+
+static constexpr uint32_t cmdKeyHash(const char *str, size_t len, uint32_t hash = CMD_KEY_HASH_SEED)
 {
-    size_t len = strlen(str);
+    return len == 0 ? hash : cmdKeyHash(str + 1, len - 1, (hash ^ (uint8_t)*str) * 16777619u);
+}
 
+static constexpr uint32_t cmdKeySlot(const char *str, size_t len)
+{
+    return cmdKeyHash(str, len) >> (32 - CMD_KEY_HASH_BITS);
+}
+
+CmdKey strToCmdKey(const char *str, size_t len)
+{
     if (!str || len == 0) return DoNothing;
 
-    for (int i = 0; i < CmdKeyMaxValue; ++i) {
-        if (strlen(CmdKeyStr[i]) == len && strcmp(CmdKeyStr[i], str) == 0)
-            return CmdKey(i);
+    CmdKey cmdKey;
+    switch (cmdKeySlot(str, len)) {
+#define CMD_KEY_CASE(name, ...) case cmdKeySlot(#name, sizeof(#name) - 1): cmdKey = name; break;
+        CMD_KEY_LIST(CMD_KEY_CASE)
+#undef CMD_KEY_CASE
+        default: return DoNothing;
     }
 
-    return DoNothing;
+    // any string lands on some slot, only its own name is a match
+    if (CmdKeyLen[cmdKey] != len || memcmp(CmdKeyStr[cmdKey], str, len) != 0) return DoNothing;
+    return cmdKey;
+}
+
+CmdKey strToCmdKey(const char *str)
+{
+    return str ? strToCmdKey(str, strlen(str)) : DoNothing;
 }
 
 const char* cmdKeyToStr(CmdKey cmdKey)
 {
-    return CmdKeyStr[cmdKey];
+    return (unsigned)cmdKey < CmdKeyMaxValue ? CmdKeyStr[cmdKey] : CmdKeyStr[DoNothing];
 }
@@ -7,45 +7,78 @@
 #ifndef _CMD_KEY_H_INCLUDED
 #define _CMD_KEY_H_INCLUDED
 
+#include <stddef.h>
+
+// Every command once, the one list the key enum, the name table, the name lookup and
+// CmdEngine's handler registry are expanded from. Position is the key value carried by
+// the binary protocol, so new commands go to the end.
+//
+// Columns after the name are how CmdEngine runs the command and its handlers
+// (CmdEngine.cpp), NULL where it has none:
+//   run         Read: inline on the network task, behind pending writes of its engine
+//               Write: on the command worker, in arrival order
+//               Net: inline on the network task always, touches connection state
+//               Batch: as Write if any sub-command is a write, as Read otherwise
+//   cache       config section the reply is made of, cached and versioned by its
+//               generation; None if not cached
+//   parser      json command args into the binary args layout
+//   executor    does the work, leaves results for the formatters
+//   binary      reply to a binary format request
+//   json        reply to a json format request
+//
+//  name                       run     cache    parser              executor                    binary              json
+#define CMD_KEY_LIST(X) \
+    X(DoNothing,               Read,   None,    NULL,               NULL,                       NULL,               NULL)                \
+    X(GetSensorData,           Net,    None,    NULL,               NULL,                       binSensorData,      jsonSensorData)      \
+    X(GetSensorCapability,     Read,   Config2, NULL,               execGetSensorCapability,    binUint,            jsonUint)            \
+    X(GetDeviceInfo,           Read,   None,    NULL,               NULL,                       NULL,               jsonDeviceInfo)      \
+    X(GetUID,                  Read,   None,    NULL,               execGetUID,                 binString,          jsonString)          \
+    X(GetFirmwareVersion,      Read,   None,    NULL,               execGetFirmwareVersion,     binString,          jsonString)          \
+    X(GetIdfVersion,           Read,   None,    NULL,               execGetIdfVersion,          binString,          jsonString)          \
+    X(GetHostname,             Read,   Wifi,    NULL,               execGetHostname,            binString,          jsonString)          \
+    X(SetHostname,             Write,  None,    parseName,          execSetHostname,            NULL,               NULL)                \
+    X(GetDeviceName,           Read,   Config2, NULL,               execGetDeviceName,          binString,          jsonString)          \
+    X(SetDeviceName,           Write,  None,    parseName,          execSetDeviceName,          NULL,               NULL)                \
+    X(GetStaSsidPass,          Read,   Wifi,    NULL,               execGetStaSsidPass,         binSsidPass,        jsonSsidPass)        \
+    X(SetStaSsidPass,          Write,  None,    parseSsidPass,      execSetStaSsidPass,         NULL,               NULL)                \
+    X(GetApSsidPass,           Read,   Wifi,    NULL,               execGetApSsidPass,          binSsidPass,        jsonSsidPass)        \
+    X(SetApSsidPass,           Write,  None,    parseSsidPass,      execSetApSsidPass,          NULL,               NULL)                \
+    X(GetAltApSsidPassList,    Read,   Wifi,    NULL,               NULL,                       NULL,               jsonAltApList)       \
+    X(AppendAltApSsidPass,     Write,  None,    parseSsidPass,      execAppendAltApSsidPass,    NULL,               NULL)                \
+    X(ClearAltApSsidPassList,  Write,  None,    NULL,               execClearAltApList,         NULL,               NULL)                \
+    X(GetSystemDeployMode,     Read,   Config1, NULL,               execGetDeployMode,          binString,          jsonString)          \
+    X(SetSystemDeployMode,     Write,  None,    parseDeployMode,    execSetDeployMode,          NULL,               NULL)                \
+    X(SetSensorType,           Write,  None,    parseSensorType,    execSetSensorType,          NULL,               NULL)                \
+    X(TurnOnDisplay,           Write,  None,    parseOn,            execTurnOnDisplay,          NULL,               NULL)                \
+    X(TurnOnAutoAdjustDisplay, Write,  None,    parseOn,            execTurnOnAutoAdjust,       NULL,               NULL)                \
+    X(GetAlertConfig,          Read,   Alerts,  NULL,               NULL,                       NULL,               jsonAlertConfig)     \
+    X(CheckPNTokenEnabled,     Read,   None,    parsePNTokenCheck,  NULL,                       NULL,               jsonPNTokenEnabled)  \
+    X(SetAlertEnableConfig,    Write,  None,    parseAlertEnable,   execSetAlertEnable,         NULL,               NULL)                \
+    X(SetSensorAlertConfig,    Write,  None,    parseSensorAlert,   execSetSensorAlert,         NULL,               NULL)                \
+    X(SetPNToken,              Write,  None,    parsePNToken,       execSetPNToken,             NULL,               NULL)                \
+    X(UpdateFirmware,          Net,    None,    NULL,               execUpdateFirmware,         NULL,               NULL)                \
+    X(Restart,                 Write,  None,    NULL,               execRestart,                NULL,               NULL)                \
+    X(RestoreFactory,          Write,  None,    NULL,               execRestoreFactory,         NULL,               NULL)                \
+    X(SetDebugFlag,            Write,  None,    parseDebugFlag,     execSetDebugFlag,           NULL,               NULL)                \
+    X(SubscribeSensorData,     Net,    None,    parseSubscribe,     execSubscribe,              NULL,               jsonString)          \
+    X(UnsubscribeSensorData,   Net,    None,    NULL,               execUnsubscribe,            NULL,               jsonString)          \
+    X(GetLiveStreamStats,      Net,    None,    NULL,               NULL,                       NULL,               jsonLiveStreamStats) \
+    X(Batch,                   Batch,  None,    parseBatch,         NULL,                       binBatch,           jsonBatch)           \
+    X(GetEdgeBrokers,          Net,    None,    NULL,               NULL,                       binEdgeBrokers,     jsonEdgeBrokers)     \
+    X(SetEdgeBrokers,          Write,  None,    parseEdgeBrokers,   execSetEdgeBrokers,         binString,          jsonString)
+
 typedef enum CmdKey {
 
-    DoNothing               = 0,
-    GetSensorData           ,//= 1,
-    GetSensorCapability     ,//= 2,
-    GetDeviceInfo           ,//= 3,
-    GetUID                  ,//= 4,
-    GetFirmwareVersion      ,//= 5,
-    GetIdfVersion           ,//= 6,
-    GetHostname             ,//= 7,
-    SetHostname             ,//= 8,
-    GetDeviceName           ,//= 9,
-    SetDeviceName           ,//= 10,
-    GetStaSsidPass          ,//= 11
-    SetStaSsidPass          ,//= 12,
-    GetApSsidPass           ,//= 13,
-    SetApSsidPass           ,//= 14,
-    GetAltApSsidPassList    ,//= 15,
-    AppendAltApSsidPass     ,//= 16,
-    ClearAltApSsidPassList  ,//= 17,
-    GetSystemDeployMode     ,//= 18,
-    SetSystemDeployMode     ,//= 19,
-    SetSensorType           ,//= 20,
-    TurnOnDisplay           ,//= 21,
-    TurnOnAutoAdjustDisplay ,//= 22,
-    GetAlertConfig          ,//= 23,
-    CheckPNTokenEnabled     ,//= 24,
-    SetAlertEnableConfig    ,//= 25,
-    SetSensorAlertConfig    ,//= 26,
-    SetPNToken              ,//= 27,
-    UpdateFirmware          ,//= 28,
-    Restart                 ,//= 29,
-    RestoreFactory          ,//= 30,
-    SetDebugFlag            ,//= 31,
+#define CMD_KEY_ENUM(name, ...) name,
+    CMD_KEY_LIST(CMD_KEY_ENUM)
+#undef CMD_KEY_ENUM
     CmdKeyMaxValue
 
 } CmdKey;
 
+// DoNothing if str names no command
 CmdKey strToCmdKey(const char *str);
+CmdKey strToCmdKey(const char *str, size_t len);
 const char* cmdKeyToStr(CmdKey cmdKey);
 
 #endif // _CMD_KEY_H_INCLUDED
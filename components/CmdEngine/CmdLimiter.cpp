@@ -0,0 +1,122 @@
+/*
+ * CmdLimiter: token bucket admission of inbound commands
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "CmdLimiter.h"
+
+#include <string.h>
+
+// per source and over all sources
+static const CmdQuota _sourceQuotas[CmdLimitClassCount] = {
+  { 600, 30 },    // read
+  { 240, 10 },    // stream
+  { 30,  5 },     // write
+  { 2,   1 }      // strict
+};
+
+static const CmdQuota _totalQuotas[CmdLimitClassCount] = {
+  { 1200, 60 },
+  { 480,  20 },
+  { 60,   10 },
+  { 4,    2 }
+};
+
+static const char * const _classStr[CmdLimitClassCount] = { "read", "stream", "write", "strict" };
+
+// tokens in 1/60000, a quota refills perMinute of them each ms
+#define CMD_LIMIT_TOKEN_UNIT    60000
+
+template <typename Source>
+static void refill(Source &source, const CmdQuota *quotas, uint32_t nowMilli)
+{
+  uint32_t elapsed = nowMilli - source.refillMilli;
+  source.refillMilli = nowMilli;
+  for (int i = 0; i < CmdLimitClassCount; ++i) {
+    uint32_t capacity = quotas[i].burst * CMD_LIMIT_TOKEN_UNIT;
+    uint64_t tokens = source.buckets[i].tokens + (uint64_t)elapsed * quotas[i].perMinute;
+    source.buckets[i].tokens = tokens < capacity ? tokens : capacity;
+  }
+}
+
+CmdLimiter::CmdLimiter()
+{
+  memset(_sources, 0, sizeof(_sources));
+  memset(&_total, 0, sizeof(_total));
+  memset(_limitedCounts, 0, sizeof(_limitedCounts));
+  _total.id = 1;
+  for (int i = 0; i < CmdLimitClassCount; ++i) _total.buckets[i].tokens = _totalQuotas[i].burst * CMD_LIMIT_TOKEN_UNIT;
+}
+
+const char * CmdLimiter::classStr(CmdLimitClass limitClass)
+{
+  return _classStr[limitClass];
+}
+
+const CmdQuota & CmdLimiter::sourceQuota(CmdLimitClass limitClass)
+{
+  return _sourceQuotas[limitClass];
+}
+
+const CmdQuota & CmdLimiter::totalQuota(CmdLimitClass limitClass)
+{
+  return _totalQuotas[limitClass];
+}
+
+CmdLimiter::Source & CmdLimiter::_source(uint32_t id, uint32_t nowMilli)
+{
+  Source *oldest = &_sources[0];
+  for (int i = 0; i < CMD_LIMIT_SOURCE_CAPACITY; ++i) {
+    Source &source = _sources[i];
+    if (source.id == id) return source;
+    if (!source.id || (oldest->id && nowMilli - source.usedMilli > nowMilli - oldest->usedMilli)) oldest = &source;
+  }
+  // new or evicted source starts with full buckets, the totals still hold
+  memset(oldest, 0, sizeof(*oldest));
+  oldest->id = id;
+  oldest->refillMilli = nowMilli;
+  for (int i = 0; i < CmdLimitClassCount; ++i) oldest->buckets[i].tokens = _sourceQuotas[i].burst * CMD_LIMIT_TOKEN_UNIT;
+  return *oldest;
+}
+
+CmdLimiter::Result CmdLimiter::admit(uint32_t sourceId, const uint8_t costs[CmdLimitClassCount], uint32_t nowMilli)
+{
+  Source &source = _source(sourceId, nowMilli);
+  refill(source, _sourceQuotas, nowMilli);
+  refill(_total, _totalQuotas, nowMilli);
+  source.usedMilli = nowMilli;
+
+  // more than a full bucket could never be admitted
+  uint32_t tokens[CmdLimitClassCount];
+  int limitClass = CmdLimitRead;
+  bool admitted = true;
+  for (int i = 0; i < CmdLimitClassCount; ++i) {
+    uint16_t burst = _sourceQuotas[i].burst < _totalQuotas[i].burst ? _sourceQuotas[i].burst : _totalQuotas[i].burst;
+    tokens[i] = (costs[i] < burst ? costs[i] : burst) * CMD_LIMIT_TOKEN_UNIT;
+    if (costs[i] > 0) limitClass = i;
+    if (source.buckets[i].tokens < tokens[i] || _total.buckets[i].tokens < tokens[i]) admitted = false;
+  }
+
+  Bucket &bucket = source.buckets[limitClass];
+  if (admitted) {
+    for (int i = 0; i < CmdLimitClassCount; ++i) {
+      source.buckets[i].tokens -= tokens[i];
+      _total.buckets[i].tokens -= tokens[i];
+    }
+    bucket.refused = false;
+    return Admitted;
+  }
+
+  ++_limitedCounts[limitClass];
+  if (bucket.refused) return RefusedAgain;
+  bucket.refused = true;
+  return Refused;
+}
+
+CmdLimiter::Result CmdLimiter::admit(uint32_t sourceId, CmdLimitClass limitClass, uint8_t cost, uint32_t nowMilli)
+{
+  uint8_t costs[CmdLimitClassCount] = { 0 };
+  costs[limitClass] = cost;
+  return admit(sourceId, costs, nowMilli);
+}
@@ -0,0 +1,79 @@
+/*
+ * CmdLimiter: token bucket admission of inbound commands
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _CMD_LIMITER_H
+#define _CMD_LIMITER_H
+
+#include <stdint.h>
+
+// Token buckets per command source and class, and one per class over all sources so
+// fresh sources do not lift the bound. Sources are websocket connections, coap peers by
+// address, mqtt requesters by reply to name, all other mqtt requesters share one; the
+// least recently used of them makes room for a new one. Commands over quota are not run.
+// Reactor task only.
+#define CMD_LIMIT_SOURCE_CAPACITY   8
+
+enum CmdLimitClass
+{
+  CmdLimitRead,
+  CmdLimitStream,       // network task work: sensor data, live stream
+  CmdLimitWrite,        // flash writes
+  CmdLimitStrict,       // restart, factory restore, firmware update
+  CmdLimitClassCount
+};
+
+// tokens per minute and burst
+struct CmdQuota
+{
+  uint16_t  perMinute;
+  uint16_t  burst;
+};
+
+class CmdLimiter
+{
+public:
+  enum Result {
+    Admitted,
+    Refused,            // first refusal of the source and class since it was last admitted
+    RefusedAgain
+  };
+
+public:
+  CmdLimiter();
+
+  // sourceId not 0; cost in commands of each class, a batch charges each sub-command to
+  // its own class, no class more than its burst; refusals count to the most limited
+  // class charged
+  Result admit(uint32_t sourceId, const uint8_t costs[CmdLimitClassCount], uint32_t nowMilli);
+  Result admit(uint32_t sourceId, CmdLimitClass limitClass, uint8_t cost, uint32_t nowMilli);
+
+  uint32_t limitedCount(CmdLimitClass limitClass) const { return _limitedCounts[limitClass]; }
+  static const char * classStr(CmdLimitClass limitClass);
+  static const CmdQuota & sourceQuota(CmdLimitClass limitClass);
+  static const CmdQuota & totalQuota(CmdLimitClass limitClass);
+
+protected:
+  struct Bucket {
+    uint32_t  tokens;
+    bool      refused;      // refusal told since last admitted command
+  };
+
+  struct Source {
+    uint32_t  id;           // 0 if unused
+    uint32_t  usedMilli;
+    uint32_t  refillMilli;
+    Bucket    buckets[CmdLimitClassCount];
+  };
+
+  Source & _source(uint32_t id, uint32_t nowMilli);
+
+protected:
+  Source      _sources[CMD_LIMIT_SOURCE_CAPACITY];
+  Source      _total;
+  uint32_t    _limitedCounts[CmdLimitClassCount];
+};
+
+#endif // _CMD_LIMITER_H
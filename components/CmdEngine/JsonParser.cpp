@@ -0,0 +1,343 @@
+/*
+ * JsonParser: in-place JSON tokenizer for string commands
+ * Copyright (c) 2016 Shenghua Su
+ *
+ */
+
+#include "JsonParser.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#define JSON_NUMBER_MAX_LEN     31
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool readHex4(const char *p, uint32_t &value)
+{
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+        int v = hexValue(p[i]);
+        if (v < 0) return false;
+        value = (value << 4) | v;
+    }
+    return true;
+}
+
+// unescape [p, end) of a tokenized string, escapes already validated, into buf with
+// terminator; utf-16 escapes (surrogate pairs included) become utf-8. False if buf is
+// too small.
+static bool unescape(const char *p, const char *end, char *buf, size_t size, size_t &length)
+{
+    length = 0;
+    while (p < end) {
+        if (*p != '\\') {
+            if (length + 1 >= size) return false;
+            buf[length++] = *p++;
+            continue;
+        }
+
+        uint32_t cp;
+        switch (*++p) {
+            case 'b': cp = '\b'; break;
+            case 'f': cp = '\f'; break;
+            case 'n': cp = '\n'; break;
+            case 'r': cp = '\r'; break;
+            case 't': cp = '\t'; break;
+            case 'u':
+                readHex4(p + 1, cp);
+                p += 4;
+                if (cp >= 0xd800 && cp <= 0xdbff) {
+                    uint32_t low;
+                    readHex4(p + 3, low);
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                    p += 6;
+                }
+                break;
+            default: cp = (uint8_t)*p; break;   // " \ /
+        }
+        ++p;
+
+        size_t n = cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+        if (length + n >= size) return false;
+        char *out = buf + length;
+        switch (n) {
+            case 1: out[0] = cp; break;
+            case 2: out[0] = 0xc0 | (cp >> 6);  out[1] = 0x80 | (cp & 0x3f); break;
+            case 3: out[0] = 0xe0 | (cp >> 12); out[1] = 0x80 | ((cp >> 6) & 0x3f);
+                    out[2] = 0x80 | (cp & 0x3f); break;
+            case 4: out[0] = 0xf0 | (cp >> 18); out[1] = 0x80 | ((cp >> 12) & 0x3f);
+                    out[2] = 0x80 | ((cp >> 6) & 0x3f); out[3] = 0x80 | (cp & 0x3f); break;
+        }
+        length += n;
+    }
+    buf[length] = '\0';
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ JsonParser class
+/////////////////////////////////////////////////////////////////////////////////////////
+JsonParser::JsonParser(JsonToken *tokens, uint16_t capacity)
+: _tokens(tokens)
+, _capacity(capacity)
+, _count(0)
+, _json(NULL)
+, _length(0)
+{}
+
+bool JsonParser::parse(const char *json, size_t length)
+{
+    _json = json;
+    _length = length;
+    _count = 0;
+    if (!json || length > UINT16_MAX) return false;
+
+    size_t pos = _skipSpace(0);
+    if (!_value(pos, 0)) {
+        _count = 0;
+        return false;
+    }
+    return true;
+}
+
+int JsonParser::_addToken(JsonType type, size_t start, size_t end)
+{
+    if (_count >= _capacity) return -1;
+    JsonToken &token = _tokens[_count];
+    token.type = type;
+    token.start = start;
+    token.end = end;
+    return _count++;
+}
+
+size_t JsonParser::_skipSpace(size_t pos) const
+{
+    // any control char counts as space, as for cJSON
+    while (pos < _length && _json[pos] > 0 && _json[pos] <= ' ') ++pos;
+    return pos;
+}
+
+bool JsonParser::_value(size_t &pos, uint8_t depth)
+{
+    if (pos >= _length) return false;
+    char c = _json[pos];
+    if (c == '{' || c == '[') return _container(pos, depth);
+    if (c == '"') return _string(pos);
+    return _primitive(pos);
+}
+
+bool JsonParser::_container(size_t &pos, uint8_t depth)
+{
+    if (depth >= JSON_PARSER_DEPTH_MAX) return false;
+    bool object = _json[pos] == '{';
+    char close = object ? '}' : ']';
+    int index = _addToken(object ? JsonObject : JsonArray, pos, 0);
+    if (index < 0) return false;
+
+    pos = _skipSpace(pos + 1);
+    if (pos < _length && _json[pos] == close) {
+        _tokens[index].end = ++pos;
+        return true;
+    }
+
+    while (true) {
+        if (object) {
+            if (pos >= _length || _json[pos] != '"' || !_string(pos)) return false;
+            pos = _skipSpace(pos);
+            if (pos >= _length || _json[pos] != ':') return false;
+            pos = _skipSpace(pos + 1);
+        }
+        if (!_value(pos, depth + 1)) return false;
+
+        pos = _skipSpace(pos);
+        if (pos >= _length) return false;
+        if (_json[pos] == ',') {
+            pos = _skipSpace(pos + 1);
+            continue;
+        }
+        if (_json[pos] != close) return false;
+        _tokens[index].end = ++pos;
+        return true;
+    }
+}
+
+bool JsonParser::_string(size_t &pos)
+{
+    size_t start = ++pos;
+    while (pos < _length) {
+        char c = _json[pos];
+        if (c == '"') {
+            if (_addToken(JsonString, start, pos) < 0) return false;
+            ++pos;
+            return true;
+        }
+        if (c == '\0') return false;
+        if (c == '\\') {
+            if (++pos >= _length) return false;
+            c = _json[pos];
+            if (c == 'u') {
+                // rejected here as cJSON does, unescape relies on it
+                uint32_t cp, low;
+                if (_length - pos <= 4 || !readHex4(_json + pos + 1, cp)) return false;
+                pos += 4;
+                if (cp == 0 || (cp >= 0xdc00 && cp <= 0xdfff)) return false;
+                if (cp >= 0xd800 && cp <= 0xdbff) {
+                    if (_length - pos <= 6 || _json[pos + 1] != '\\' || _json[pos + 2] != 'u'
+                        || !readHex4(_json + pos + 3, low) || low < 0xdc00 || low > 0xdfff) return false;
+                    pos += 6;
+                }
+            }
+            else if (!c || !strchr("\"\\/bfnrt", c)) return false;
+        }
+        ++pos;
+    }
+    return false;
+}
+
+bool JsonParser::_primitive(size_t &pos)
+{
+    const char *p = _json + pos;
+    size_t left = _length - pos;
+    if (left >= 4 && memcmp(p, "true", 4) == 0) {
+        pos += 4;
+        return _addToken(JsonTrue, pos - 4, pos) >= 0;
+    }
+    if (left >= 5 && memcmp(p, "false", 5) == 0) {
+        pos += 5;
+        return _addToken(JsonFalse, pos - 5, pos) >= 0;
+    }
+    if (left >= 4 && memcmp(p, "null", 4) == 0) {
+        pos += 4;
+        return _addToken(JsonNull, pos - 4, pos) >= 0;
+    }
+
+    // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+    size_t start = pos;
+    if (pos < _length && _json[pos] == '-') ++pos;
+    if (pos < _length && _json[pos] == '0') ++pos;
+    else if (pos < _length && _json[pos] >= '1' && _json[pos] <= '9') {
+        while (pos < _length && isdigit((uint8_t)_json[pos])) ++pos;
+    }
+    else return false;
+    if (pos < _length && _json[pos] == '.') {
+        if (++pos >= _length || !isdigit((uint8_t)_json[pos])) return false;
+        while (pos < _length && isdigit((uint8_t)_json[pos])) ++pos;
+    }
+    if (pos < _length && (_json[pos] == 'e' || _json[pos] == 'E')) {
+        ++pos;
+        if (pos < _length && (_json[pos] == '+' || _json[pos] == '-')) ++pos;
+        if (pos >= _length || !isdigit((uint8_t)_json[pos])) return false;
+        while (pos < _length && isdigit((uint8_t)_json[pos])) ++pos;
+    }
+    // cJSON reads on as far as strtod does ("01" is 1), refused rather than read otherwise
+    if (pos < _length && _json[pos] && strchr("0123456789+-.eE", _json[pos])) return false;
+    return _addToken(JsonNumber, start, pos) >= 0;
+}
+
+int JsonParser::_next(int token) const
+{
+    uint16_t end = _tokens[token].end;
+    int next = token + 1;
+    while (next < _count && _tokens[next].start < end) ++next;
+    return next;
+}
+
+bool JsonParser::_keyEquals(int token, const char *key) const
+{
+    const JsonToken &t = _tokens[token];
+    const char *raw = _json + t.start;
+    size_t rawLength = t.end - t.start;
+    if (!memchr(raw, '\\', rawLength)) {
+        if (strlen(key) != rawLength) return false;
+        for (size_t i = 0; i < rawLength; ++i) {
+            if (tolower((uint8_t)raw[i]) != tolower((uint8_t)key[i])) return false;
+        }
+        return true;
+    }
+
+    char buf[JSON_PARSER_COMPARE_MAX];
+    size_t length;
+    if (!unescape(raw, raw + rawLength, buf, sizeof(buf), length)) return false;
+    for (size_t i = 0; i <= length; ++i) {
+        if (tolower((uint8_t)buf[i]) != tolower((uint8_t)key[i])) return false;
+    }
+    return true;
+}
+
+int JsonParser::find(const char *key, int object) const
+{
+    if (object < 0 || object >= _count || _tokens[object].type != JsonObject) return -1;
+    uint16_t end = _tokens[object].end;
+    int member = object + 1;
+    while (member + 1 < _count && _tokens[member].start < end) {
+        if (_keyEquals(member, key)) return member + 1;
+        member = _next(member + 1);
+    }
+    return -1;
+}
+
+int JsonParser::element(int array, int index) const
+{
+    if (type(array) != JsonArray || index < 0) return -1;
+    uint16_t end = _tokens[array].end;
+    int token = array + 1;
+    while (token < _count && _tokens[token].start < end) {
+        if (index-- == 0) return token;
+        token = _next(token);
+    }
+    return -1;
+}
+
+JsonType JsonParser::type(int token) const
+{
+    if (token < 0 || token >= _count) return JsonNone;
+    return (JsonType)_tokens[token].type;
+}
+
+bool JsonParser::boolean(int token, bool &value) const
+{
+    JsonType t = type(token);
+    if (t != JsonTrue && t != JsonFalse) return false;
+    value = t == JsonTrue;
+    return true;
+}
+
+bool JsonParser::number(int token, double &value) const
+{
+    if (type(token) != JsonNumber) return false;
+    size_t length = _tokens[token].end - _tokens[token].start;
+    if (length > JSON_NUMBER_MAX_LEN) return false;
+    char buf[JSON_NUMBER_MAX_LEN + 1];
+    memcpy(buf, _json + _tokens[token].start, length);
+    buf[length] = '\0';
+    value = strtod(buf, NULL);
+    return true;
+}
+
+bool JsonParser::copyString(int token, char *buf, size_t size, size_t &length) const
+{
+    if (type(token) != JsonString) return false;
+    const char *raw = _json + _tokens[token].start;
+    return unescape(raw, _json + _tokens[token].end, buf, size, length);
+}
+
+bool JsonParser::stringEquals(int token, const char *str) const
+{
+    if (type(token) != JsonString) return false;
+    const char *raw = _json + _tokens[token].start;
+    size_t rawLength = _tokens[token].end - _tokens[token].start;
+    if (!memchr(raw, '\\', rawLength))
+        return strlen(str) == rawLength && memcmp(raw, str, rawLength) == 0;
+
+    char buf[JSON_PARSER_COMPARE_MAX];
+    size_t length;
+    return unescape(raw, raw + rawLength, buf, sizeof(buf), length) && strcmp(buf, str) == 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * JsonParser: in-place JSON tokenizer for string commands
+ * Copyright (c) 2016 Shenghua Su
+ *
+ */
+
+#ifndef _JSON_PARSER_H
+#define _JSON_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Tokens reference the text they were parsed from, nothing is copied or allocated.
+// Token 0 is the root value, containers are followed by their members in text order,
+// object members as key token then value token.
+
+#define JSON_PARSER_DEPTH_MAX       8
+#define JSON_PARSER_COMPARE_MAX     64      // escaped strings compared by value up to this
+
+enum JsonType
+{
+    JsonNone = 0,
+    JsonObject,
+    JsonArray,
+    JsonString,
+    JsonNumber,
+    JsonTrue,
+    JsonFalse,
+    JsonNull
+};
+
+struct JsonToken
+{
+    uint8_t     type;
+    uint16_t    start;      // strings: after the opening quote
+    uint16_t    end;        // strings: at the closing quote, containers: past the closing bracket
+};
+
+class JsonParser
+{
+public:
+    JsonParser(JsonToken *tokens, uint16_t capacity);
+
+    // false on malformed text, too many tokens or nesting deeper than JSON_PARSER_DEPTH_MAX;
+    // text after the root value is ignored, as cJSON_Parse does
+    bool parse(const char *json, size_t length);
+    uint16_t tokenCount() const { return _count; }
+
+    // value token of key in object (root by default), -1 if none. Keys are matched case
+    // insensitively and the first of duplicates wins, as cJSON_GetObjectItem does.
+    int find(const char *key, int object = 0) const;
+    // index-th value token of array, -1 if none
+    int element(int array, int index) const;
+
+    // accessors take -1 (key not found) and fail then
+    JsonType type(int token) const;
+    bool boolean(int token, bool &value) const;
+    bool number(int token, double &value) const;
+    // unescaped and null terminated into buf, false if not a string or buf too small
+    bool copyString(int token, char *buf, size_t size, size_t &length) const;
+    // unescaped string equal to str
+    bool stringEquals(int token, const char *str) const;
+
+protected:
+    int  _addToken(JsonType type, size_t start, size_t end);
+    bool _value(size_t &pos, uint8_t depth);
+    bool _container(size_t &pos, uint8_t depth);
+    bool _string(size_t &pos);
+    bool _primitive(size_t &pos);
+    size_t _skipSpace(size_t pos) const;
+    int  _next(int token) const;
+    bool _keyEquals(int token, const char *key) const;
+
+protected:
+    JsonToken      *_tokens;
+    uint16_t        _capacity;
+    uint16_t        _count;
+    const char     *_json;
+    size_t          _length;
+};
+
+#endif // _JSON_PARSER_H
@@ -19,11 +19,21 @@ char * SharedBuffer::msgBuffer()
   return _strBuf;
 }
 
+size_t SharedBuffer::msgBufferSize()
+{
+  return STR_BUFFER_SIZE;
+}
+
 uint8_t * SharedBuffer::cmdBuffer()
 {
   return _cmdBuf;
 }
 
+size_t SharedBuffer::cmdBufferSize()
+{
+  return CMD_BUFFER_SIZE;
+}
+
 char* SharedBuffer::updaterMsgBuffer()
 {
   return _qrStrBuf;
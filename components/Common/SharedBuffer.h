@@ -8,12 +8,15 @@
 #define _SHARED_BUFFER_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 class SharedBuffer
 {
 public:
   static char*     msgBuffer();
+  static size_t    msgBufferSize();
   static uint8_t * cmdBuffer();
+  static size_t    cmdBufferSize();
   static char*     updaterMsgBuffer();
   static char*     qrStrBuffer();
 };
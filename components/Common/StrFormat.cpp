@@ -0,0 +1,18 @@
+/*
+ * StrFormat: bounded string formatting helpers
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "StrFormat.h"
+#include <stdio.h>
+#include <stdarg.h>
+
+void appendf(char *buf, size_t size, size_t &length, const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  int n = vsnprintf(buf + (length < size ? length : size), length < size ? size - length : 0, format, ap);
+  va_end(ap);
+  if (n > 0) length += n;
+}
@@ -0,0 +1,16 @@
+/*
+ * StrFormat: bounded string formatting helpers
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _STR_FORMAT_H
+#define _STR_FORMAT_H
+
+#include <stddef.h>
+
+// bounded append at buf + length, length keeps counting past size so truncation shows
+void appendf(char *buf, size_t size, size_t &length, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+#endif // _STR_FORMAT_H
@@ -43,4 +43,10 @@
 
 // #define DEBUG_BATTERY_LIFE
 
+// coap server (udp 5683) with the read only api, only in deploy modes serving http
+#define COAP_SERVER_ENABLED
+
+// every sensor sample published on api/sensor/<uid>/<type>, coalesced, in mqtt mode
+// #define SENSOR_TELEMETRY_ENABLED
+
 #endif // _CONF_H_INCLUDED
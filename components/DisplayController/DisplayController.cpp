@@ -92,7 +92,7 @@ void DisplayController::init(int displayInitMode)
     _notConnectedIcon = nowifiIcon;
 
   }
-  else if (deployMode == HTTPServerMode) {
+  else if (deployMode == HTTPServerMode || deployMode == MQTTBrokerMode) {
     _connectedIcon = apConnectedIcon;
     _notConnectedIcon = apNotConnectedIcon;
   }
@@ -0,0 +1,146 @@
+/*
+ * BrokerSelector: ordered broker list with latency and health tracking
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "BrokerSelector.h"
+#include <string.h>
+
+// wrap-safe deadline compare
+inline static bool timePassed(uint32_t nowMilli, uint32_t deadline)
+{
+    return (int32_t)(nowMilli - deadline) >= 0;
+}
+
+// 1/4 weight for new sample
+inline static uint32_t smooth(uint32_t value, uint32_t sample)
+{
+    return value == 0 ? sample : (value * 3 + sample) / 4;
+}
+
+BrokerSelector::BrokerSelector()
+: _count(0)
+{
+    memset(_brokers, 0, sizeof(_brokers));
+}
+
+bool BrokerSelector::addBroker(const char *address)
+{
+    if (indexOf(address) >= 0) return true;
+    size_t length = strlen(address);
+    if (_count >= BROKER_LIST_CAPACITY || length == 0 || length > BROKER_ADDRESS_MAX_LEN) return false;
+    memset(&_brokers[_count], 0, sizeof(BrokerHealth));
+    memcpy(_brokers[_count].address, address, length + 1);
+    ++_count;
+    return true;
+}
+
+int BrokerSelector::indexOf(const char *address)
+{
+    for (uint8_t i = 0; i < _count; ++i) {
+        if (strcmp(_brokers[i].address, address) == 0) return i;
+    }
+    return -1;
+}
+
+void BrokerSelector::clear()
+{
+    memset(_brokers, 0, sizeof(_brokers));
+    _count = 0;
+}
+
+bool BrokerSelector::_healthy(uint8_t index, uint32_t nowMilli)
+{
+    BrokerHealth &broker = _brokers[index];
+    if (broker.coolingDown && timePassed(nowMilli, broker.coolDownUntil)) {
+        // cool-down over, competes again with a clean failure record
+        broker.coolingDown = false;
+        broker.connectFailStreak = 0;
+        broker.rttSpikeStreak = 0;
+    }
+    return !broker.coolingDown;
+}
+
+uint32_t BrokerSelector::_latency(uint8_t index)
+{
+    return _brokers[index].connectMilli + _brokers[index].rttMilli;
+}
+
+uint8_t BrokerSelector::select(uint32_t nowMilli)
+{
+    int best = -1;
+    for (uint8_t i = 0; i < _count; ++i) {
+        if (!_healthy(i, nowMilli)) continue;
+        if (best < 0 || _latency(i) < _latency(best)) best = i;
+    }
+    if (best >= 0) return best;
+
+    // all cooling down, the one that recovers first
+    best = 0;
+    for (uint8_t i = 1; i < _count; ++i) {
+        if ((int32_t)(_brokers[i].coolDownUntil - _brokers[best].coolDownUntil) < 0) best = i;
+    }
+    return best;
+}
+
+void BrokerSelector::_coolDown(uint8_t index, uint32_t nowMilli)
+{
+    BrokerHealth &broker = _brokers[index];
+    broker.coolingDown = true;
+    broker.coolDownUntil = nowMilli + BROKER_COOL_DOWN;
+    ++broker.failOverCount;
+}
+
+void BrokerSelector::onConnected(uint8_t index, uint32_t connectMilli, uint32_t nowMilli)
+{
+    if (index >= _count) return;
+    BrokerHealth &broker = _brokers[index];
+    broker.connectMilli = smooth(broker.connectMilli, connectMilli > 0 ? connectMilli : 1);
+    broker.connectFailStreak = 0;
+    broker.rttSpikeStreak = 0;
+    broker.coolingDown = false;
+    ++broker.connectCount;
+}
+
+void BrokerSelector::onConnectFailed(uint8_t index, uint32_t nowMilli)
+{
+    if (index >= _count) return;
+    BrokerHealth &broker = _brokers[index];
+    ++broker.failCount;
+    if (++broker.connectFailStreak >= BROKER_CONNECT_FAIL_LIMIT && !broker.coolingDown) {
+        _coolDown(index, nowMilli);
+    }
+}
+
+void BrokerSelector::markUnavailable(uint8_t index, uint32_t nowMilli)
+{
+    if (index >= _count) return;
+    ++_brokers[index].failCount;
+    if (!_brokers[index].coolingDown) _coolDown(index, nowMilli);
+}
+
+bool BrokerSelector::onPingRtt(uint8_t index, uint32_t rttMilli, uint32_t nowMilli)
+{
+    if (index >= _count) return false;
+    BrokerHealth &broker = _brokers[index];
+    bool spike = broker.rttMilli > 0 && rttMilli >= BROKER_RTT_SPIKE_MIN &&
+                 rttMilli > broker.rttMilli * BROKER_RTT_SPIKE_FACTOR;
+    if (!spike) {
+        broker.rttMilli = smooth(broker.rttMilli, rttMilli > 0 ? rttMilli : 1);
+        broker.rttSpikeStreak = 0;
+        return false;
+    }
+    // spikes are not folded into the average
+    if (++broker.rttSpikeStreak < BROKER_RTT_SPIKE_LIMIT) return false;
+    _coolDown(index, nowMilli);
+    return select(nowMilli) != index;
+}
+
+bool BrokerSelector::shouldSwitch(uint8_t index, uint32_t connectedMilli, uint32_t nowMilli)
+{
+    if (index >= _count || connectedMilli < BROKER_SWITCH_MIN_CONNECTED) return false;
+    uint8_t best = select(nowMilli);
+    if (best == index) return false;
+    return (uint64_t)_latency(best) * 100 < (uint64_t)_latency(index) * (100 - BROKER_SWITCH_MARGIN_PERCENT);
+}
@@ -0,0 +1,85 @@
+/*
+ * BrokerSelector: ordered broker list with latency and health tracking
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _BROKER_SELECTOR_H
+#define _BROKER_SELECTOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ BrokerSelector class
+/////////////////////////////////////////////////////////////////////////////////////////
+// Brokers are kept in preference order (e.g. local edge broker first, cloud second).
+// Connect time (until CONNACK) and PINGRESP round trip are smoothed per broker, and the
+// healthy broker with the lowest latency is selected; a broker never measured counts as
+// fastest so it gets probed once, ties go to list order. Repeated connect failures or
+// round trip spikes mark a broker unhealthy for a cool-down, after which it competes
+// again, so the client fails back once it is reachable. Time is passed in. Addresses
+// are copied, so the list does not depend on the caller's buffers.
+
+#define BROKER_LIST_CAPACITY                4
+#define BROKER_ADDRESS_MAX_LEN              63      // host:port
+#define BROKER_CONNECT_FAIL_LIMIT           3       // consecutive, then cool-down
+#define BROKER_RTT_SPIKE_MIN                500     // ms, spikes below never count
+#define BROKER_RTT_SPIKE_FACTOR             4       // times smoothed rtt
+#define BROKER_RTT_SPIKE_LIMIT              3       // consecutive, then cool-down
+#define BROKER_COOL_DOWN                    600000  // ms, unhealthy period
+#define BROKER_SWITCH_MIN_CONNECTED         600000  // ms on a broker before switching back
+#define BROKER_SWITCH_MARGIN_PERCENT        30      // better broker must be this much faster
+
+struct BrokerHealth
+{
+    char            address[BROKER_ADDRESS_MAX_LEN + 1];
+    uint32_t        connectMilli;       // smoothed, 0 if never measured
+    uint32_t        rttMilli;           // smoothed, 0 if never measured
+    uint16_t        connectFailStreak;
+    uint16_t        rttSpikeStreak;
+    bool            coolingDown;
+    uint32_t        coolDownUntil;
+    uint32_t        connectCount;
+    uint32_t        failCount;
+    uint32_t        failOverCount;      // times this broker was left for another
+};
+
+class BrokerSelector
+{
+public:
+    BrokerSelector();
+
+    // list in preference order, false if full or address too long
+    bool addBroker(const char *address);
+    void clear();
+    uint8_t count() { return _count; }
+    int indexOf(const char *address);
+    const char * address(uint8_t index) { return index < _count ? _brokers[index].address : NULL; }
+    const BrokerHealth * health(uint8_t index) { return index < _count ? &_brokers[index] : NULL; }
+
+    // broker to connect to now
+    uint8_t select(uint32_t nowMilli);
+
+    // connect result, connectMilli from connect start until CONNACK accepted
+    void onConnected(uint8_t index, uint32_t connectMilli, uint32_t nowMilli);
+    void onConnectFailed(uint8_t index, uint32_t nowMilli);
+    void markUnavailable(uint8_t index, uint32_t nowMilli);
+
+    // ping round trip on connected broker, true if client should fail over now
+    bool onPingRtt(uint8_t index, uint32_t rttMilli, uint32_t nowMilli);
+
+    // true if a healthy broker is clearly faster than the connected one
+    bool shouldSwitch(uint8_t index, uint32_t connectedMilli, uint32_t nowMilli);
+
+protected:
+    void _coolDown(uint8_t index, uint32_t nowMilli);
+    bool _healthy(uint8_t index, uint32_t nowMilli);
+    uint32_t _latency(uint8_t index);
+
+protected:
+    uint8_t                     _count;
+    BrokerHealth                _brokers[BROKER_LIST_CAPACITY];
+};
+
+#endif // _BROKER_SELECTOR_H
@@ -0,0 +1,25 @@
+/*
+ * CmdStatus: status codes of command replies
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _CMD_STATUS_H
+#define _CMD_STATUS_H
+
+// Sub command statuses of batch replies (CmdFormat.h), and of commands refused before
+// they ran, which ProtocolDelegate::replyStatus may answer with a code of the protocol.
+
+#define CMD_STATUS_OK                       0
+#define CMD_STATUS_INVALID                  1   // unknown key or bad args
+#define CMD_STATUS_NOT_BATCHABLE            2   // stream, update and nested batch commands
+#define CMD_STATUS_NO_SPACE                 3   // ret data left out, batch reply full
+#define CMD_STATUS_NOT_MODIFIED             4   // versioned request, version still current
+#define CMD_STATUS_RATE_LIMITED             5   // over quota, command not run; this and not
+                                                //   allowed replied in binary only to
+                                                //   correlated commands: id, status
+#define CMD_STATUS_BUSY                     6   // worker queue full or the protocol takes no
+                                                //   late reply, command not run
+#define CMD_STATUS_NOT_ALLOWED              7   // not open to this engine's requesters
+
+#endif // _CMD_STATUS_H
@@ -0,0 +1,710 @@
+/*
+ * CoapServer: CoAP over UDP with Observe and block-wise transfer
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "CoapServer.h"
+#include "AppLog.h"
+#include "mongoose/mongoose.h"
+#include <string.h>
+
+// RFC 7252, 7641, 7959
+#define COAP_TYPE_CON               0
+#define COAP_TYPE_NON               1
+#define COAP_TYPE_ACK               2
+#define COAP_TYPE_RST               3
+
+#define COAP_CODE(c, d)             (((c) << 5) | (d))
+#define COAP_CODE_EMPTY             COAP_CODE(0, 0)
+#define COAP_CODE_CHANGED           COAP_CODE(2, 4)
+#define COAP_CODE_CONTENT           COAP_CODE(2, 5)
+#define COAP_CODE_BAD_REQUEST       COAP_CODE(4, 0)
+#define COAP_CODE_BAD_OPTION        COAP_CODE(4, 2)
+#define COAP_CODE_FORBIDDEN         COAP_CODE(4, 3)
+#define COAP_CODE_NOT_FOUND         COAP_CODE(4, 4)
+#define COAP_CODE_NOT_ALLOWED       COAP_CODE(4, 5)
+#define COAP_CODE_TOO_MANY_REQUESTS COAP_CODE(4, 29)    // RFC 8516
+#define COAP_CODE_INTERNAL_ERROR    COAP_CODE(5, 0)
+#define COAP_CODE_UNAVAILABLE       COAP_CODE(5, 3)
+
+#define COAP_METHOD_GET             1
+#define COAP_METHOD_POST            2
+
+#define COAP_OPTION_ETAG            4
+#define COAP_OPTION_OBSERVE         6
+#define COAP_OPTION_URI_PATH        11
+#define COAP_OPTION_CONTENT_FORMAT  12
+#define COAP_OPTION_MAX_AGE         14
+#define COAP_OPTION_BLOCK2          23
+
+#define COAP_FORMAT_TEXT            0
+#define COAP_FORMAT_OCTET_STREAM    42
+#define COAP_FORMAT_JSON            50
+
+#define COAP_HEAD_MAX_LEN           64
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ message composing
+/////////////////////////////////////////////////////////////////////////////////////////
+// outgoing message, payload is what the connection send buffer holds
+struct CoapOut
+{
+    uint8_t         type;
+    uint8_t         code;
+    uint16_t        msgId;
+    const uint8_t  *token;
+    uint8_t         tokenLength;
+    int32_t         observe;        // -1 if none
+    int             contentFormat;  // -1 if none
+    bool            hasEtag;
+    uint32_t        etag;
+    bool            hasBlock2;
+    uint32_t        block2;
+    uint32_t        maxAge;         // 0 if none
+
+    CoapOut(uint8_t t, uint8_t c, uint16_t id, const uint8_t *tk = NULL, uint8_t tkLen = 0)
+    : type(t), code(c), msgId(id), token(tk), tokenLength(tkLen), observe(-1), contentFormat(-1)
+    , hasEtag(false), etag(0), hasBlock2(false), block2(0), maxAge(0) {}
+};
+
+inline static uint32_t nowMilli()
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+// wrap-safe deadline compare
+inline static bool timePassed(uint32_t nowMilli, uint32_t deadline)
+{
+    return (int32_t)(nowMilli - deadline) >= 0;
+}
+
+// fnv-1a, same as the http etag
+static uint32_t bodyHash(const char *data, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// uint option value, big endian without leading zero bytes
+static size_t uintOption(uint32_t value, uint8_t *out)
+{
+    size_t length = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if (length > 0 || (value >> shift) & 0xFF) out[length++] = (value >> shift) & 0xFF;
+    }
+    return length;
+}
+
+static uint32_t uintOptionValue(const struct mg_str &value)
+{
+    uint32_t v = 0;
+    for (size_t i = 0; i < value.len && i < 4; ++i) v = (v << 8) | (uint8_t)value.p[i];
+    return v;
+}
+
+// delta and length nibbles with their extended bytes, option numbers ascending
+static uint8_t * putOption(uint8_t *p, uint16_t &lastNumber, uint16_t number, const uint8_t *value, size_t length)
+{
+    uint16_t delta = number - lastNumber;
+    lastNumber = number;
+    uint8_t *head = p++;
+    uint8_t deltaNibble = delta < 13 ? delta : 13;
+    if (delta >= 13) *p++ = delta - 13;
+    uint8_t lengthNibble = length < 13 ? length : 13;
+    if (length >= 13) *p++ = length - 13;
+    *head = (deltaNibble << 4) | lengthNibble;
+    memcpy(p, value, length);
+    return p + length;
+}
+
+static uint8_t * putUintOption(uint8_t *p, uint16_t &lastNumber, uint16_t number, uint32_t value)
+{
+    uint8_t bytes[4];
+    return putOption(p, lastNumber, number, bytes, uintOption(value, bytes));
+}
+
+// header and options go in front of the payload already in the send buffer
+static bool sendMessage(struct mg_connection *nc, const CoapOut &out)
+{
+    uint8_t head[COAP_HEAD_MAX_LEN];
+    uint8_t *p = head;
+    *p++ = 0x40 | (out.type << 4) | out.tokenLength;
+    *p++ = out.code;
+    *p++ = out.msgId >> 8;
+    *p++ = out.msgId & 0xFF;
+    memcpy(p, out.token, out.tokenLength);
+    p += out.tokenLength;
+
+    uint16_t lastNumber = 0;
+    if (out.hasEtag) {
+        uint8_t etag[4] = { (uint8_t)(out.etag >> 24), (uint8_t)(out.etag >> 16),
+                            (uint8_t)(out.etag >> 8), (uint8_t)out.etag };
+        p = putOption(p, lastNumber, COAP_OPTION_ETAG, etag, sizeof(etag));
+    }
+    if (out.observe >= 0) p = putUintOption(p, lastNumber, COAP_OPTION_OBSERVE, out.observe);
+    if (out.contentFormat >= 0) p = putUintOption(p, lastNumber, COAP_OPTION_CONTENT_FORMAT, out.contentFormat);
+    if (out.maxAge > 0) p = putUintOption(p, lastNumber, COAP_OPTION_MAX_AGE, out.maxAge);
+    if (out.hasBlock2) p = putUintOption(p, lastNumber, COAP_OPTION_BLOCK2, out.block2);
+    if (nc->send_mbuf.len > 0) *p++ = 0xFF;
+
+    size_t length = p - head;
+    if (mbuf_insert(&nc->send_mbuf, 0, head, length) != length) {
+        nc->send_mbuf.len = 0;
+        return false;
+    }
+    return true;
+}
+
+static void sendEmpty(struct mg_connection *nc, uint8_t type, uint16_t msgId)
+{
+    nc->send_mbuf.len = 0;
+    sendMessage(nc, CoapOut(type, COAP_CODE_EMPTY, msgId));
+}
+
+// keep block num of size 2^(szx+4) of the body in the send buffer, false if out of range
+static bool sliceBlock(struct mg_connection *nc, uint32_t num, uint8_t szx, bool &more)
+{
+    struct mbuf &mb = nc->send_mbuf;
+    size_t blockSize = 1 << (szx + 4);
+    size_t offset = num * blockSize;
+    if (offset > 0 && offset >= mb.len) return false;
+    size_t length = mb.len - offset < blockSize ? mb.len - offset : blockSize;
+    more = offset + length < mb.len;
+    memmove(mb.buf, mb.buf + offset, length);
+    mb.len = length;
+    return true;
+}
+
+static uint8_t statusToCode(int status)
+{
+    switch (status) {
+        case 200: return COAP_CODE_CONTENT;
+        case 400: return COAP_CODE_BAD_REQUEST;
+        case 404: return COAP_CODE_NOT_FOUND;
+        case 405: return COAP_CODE_NOT_ALLOWED;
+        case 503: return COAP_CODE_UNAVAILABLE;
+        default:  return status < 500 ? COAP_CODE_BAD_REQUEST : COAP_CODE_INTERNAL_ERROR;
+    }
+}
+
+static int contentFormat(const char *contentType)
+{
+    if (strncmp(contentType, "application/json", 16) == 0) return COAP_FORMAT_JSON;
+    if (strncmp(contentType, "text/plain", 10) == 0) return COAP_FORMAT_TEXT;
+    return -1;
+}
+
+static struct mg_coap_option * findOption(struct mg_coap_message *cm, uint32_t number)
+{
+    for (struct mg_coap_option *opt = cm->options; opt; opt = opt->next) {
+        if (opt->number == number) return opt;
+    }
+    return NULL;
+}
+
+// Uri-Path segments joined as "/a/b", false if too long
+static bool requestPath(struct mg_coap_message *cm, char *path, size_t size)
+{
+    size_t length = 0;
+    for (struct mg_coap_option *opt = cm->options; opt; opt = opt->next) {
+        if (opt->number != COAP_OPTION_URI_PATH) continue;
+        if (length + 1 + opt->value.len >= size) return false;
+        path[length++] = '/';
+        memcpy(path + length, opt->value.p, opt->value.len);
+        length += opt->value.len;
+    }
+    if (length == 0) path[length++] = '/';
+    path[length] = '\0';
+    return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ mongoose coap event handler
+/////////////////////////////////////////////////////////////////////////////////////////
+static void mongoose_coap_event_handler(struct mg_connection *nc, int event, void *p)
+{
+    CoapServer *coapServer = static_cast<CoapServer*>(nc->user_data);
+
+    switch (event) {
+
+        case MG_EV_COAP_CON:
+        case MG_EV_COAP_NOC:
+            coapServer->onRequest(nc, (struct mg_coap_message *)p);
+            break;
+
+        case MG_EV_COAP_ACK:
+            coapServer->onAck(nc, (struct mg_coap_message *)p);
+            break;
+
+        case MG_EV_COAP_RST:
+            coapServer->onReset(nc, (struct mg_coap_message *)p);
+            break;
+
+        case MG_EV_CLOSE:
+            coapServer->onClose(nc);
+            break;
+    }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ CoapServer class
+/////////////////////////////////////////////////////////////////////////////////////////
+CoapServer::CoapServer()
+: _inited(false)
+, _reactor(NULL)
+, _listener(NULL)
+, _msgId(0)
+, _nextCheckMilli(0)
+, _requestCount(0)
+{
+    memset(_observers, 0, sizeof(_observers));
+    memset(&_exchange, 0, sizeof(_exchange));
+}
+
+void CoapServer::init(NetReactor *reactor)
+{
+    if (!_inited) {
+        APP_LOGI("[CoapServer]", "init");
+        _reactor = reactor;
+        _reactor->init();
+        _reactor->addClient(this);
+        // message ids of a previous run are unlikely to be reused right away
+        _msgId = (uint16_t)nowMilli();
+        _inited = true;
+    }
+}
+
+void CoapServer::deinit()
+{
+    if (_inited) {
+        for (int i = 0; i < COAP_OBSERVER_CAPACITY; ++i) {
+            if (_observers[i].nc) _dropObserver(_observers[i]);
+        }
+        if (_listener) _listener->flags |= MG_F_CLOSE_IMMEDIATELY;
+        _listener = NULL;
+        _inited = false;
+    }
+}
+
+void CoapServer::start()
+{
+    if (_inited) {
+        struct mg_bind_opts opts;
+        memset(&opts, 0, sizeof(opts));
+        opts.user_data = static_cast<void*>(this);
+        struct mg_connection *nc = mg_bind_opt(_reactor->manager(), COAP_LISTEN_ADDR, mongoose_coap_event_handler, opts);
+        if (nc == NULL) {
+            APP_LOGE("[CoapServer]", "bind %s failed", COAP_LISTEN_ADDR);
+            return;
+        }
+        mg_set_protocol_coap(nc);
+        _listener = nc;
+    }
+}
+
+void CoapServer::setup()
+{}
+
+uint8_t CoapServer::observerCount()
+{
+    uint8_t count = 0;
+    for (int i = 0; i < COAP_OBSERVER_CAPACITY; ++i) {
+        if (_observers[i].nc) ++count;
+    }
+    return count;
+}
+
+bool CoapServer::observerStats(uint8_t index, CoapObserverStats &stats)
+{
+    if (index >= COAP_OBSERVER_CAPACITY || !_observers[index].nc) return false;
+    stats.path = _observers[index].path;
+    stats.notifyCount = _observers[index].notifyCount;
+    stats.retransmit = _observers[index].retransmit;
+    return true;
+}
+
+bool CoapServer::_observed(struct mg_connection *nc)
+{
+    for (int i = 0; i < COAP_OBSERVER_CAPACITY; ++i) {
+        if (_observers[i].nc == nc) return true;
+    }
+    return false;
+}
+
+void CoapServer::_settle(struct mg_connection *nc)
+{
+    // mongoose closes a udp peer once its reply is out, observers must stay
+    if (_observed(nc)) nc->flags &= ~MG_F_SEND_AND_CLOSE;
+    else nc->flags |= MG_F_SEND_AND_CLOSE;
+}
+
+void CoapServer::_prepareReply(struct mg_connection *nc)
+{
+    // a notification still queued would share the datagram, it goes out next check
+    if (nc->send_mbuf.len == 0) return;
+    nc->send_mbuf.len = 0;
+    for (int i = 0; i < COAP_OBSERVER_CAPACITY; ++i) {
+        Observer &observer = _observers[i];
+        if (observer.nc != nc) continue;
+        observer.etag = 0;
+        observer.conPending = false;
+    }
+}
+
+int CoapServer::_render(struct mg_connection *nc, HttpRouteHandler *handler, void *context, int &format)
+{
+    HttpResponse response(nc);
+    int status = handler->onHttpRoute(response, context);
+    format = contentFormat(response.contentType());
+    return status;
+}
+
+void CoapServer::onRequest(struct mg_connection *nc, struct mg_coap_message *cm)
+{
+    bool confirmable = cm->msg_type == MG_COAP_MSG_CON;
+    if ((cm->flags & MG_COAP_ERROR) || cm->code_class != MG_COAP_CODECLASS_REQUEST || cm->code_detail == 0) {
+        // malformed, stray response or ping
+        if (confirmable) sendEmpty(nc, COAP_TYPE_RST, cm->msg_id);
+        _settle(nc);
+        return;
+    }
+    ++_requestCount;
+
+    _prepareReply(nc);
+    char path[COAP_PATH_MAX_LEN + 1];
+    if (!requestPath(cm, path, sizeof(path))) {
+        _reply(nc, cm, CoapOut(0, COAP_CODE_BAD_REQUEST, 0));
+    }
+    else if (cm->code_detail == COAP_METHOD_GET) {
+        _get(nc, cm, path);
+    }
+    else if (cm->code_detail == COAP_METHOD_POST && strcmp(path, COAP_CMD_PATH) == 0) {
+        _post(nc, cm);
+    }
+    else {
+        _reply(nc, cm, CoapOut(0, COAP_CODE_NOT_ALLOWED, 0));
+    }
+    _settle(nc);
+}
+
+void CoapServer::_reply(struct mg_connection *nc, struct mg_coap_message *cm, CoapOut out)
+{
+    // piggybacked on the ACK of a CON request, own message for a NON one
+    out.type = cm->msg_type == MG_COAP_MSG_CON ? COAP_TYPE_ACK : COAP_TYPE_NON;
+    out.msgId = out.type == COAP_TYPE_ACK ? cm->msg_id : _nextMsgId();
+    out.token = (const uint8_t *)cm->token.p;
+    out.tokenLength = cm->token.len;
+    if (out.code != COAP_CODE_CONTENT && out.code != COAP_CODE_CHANGED) nc->send_mbuf.len = 0;
+    sendMessage(nc, out);
+}
+
+void CoapServer::_get(struct mg_connection *nc, struct mg_coap_message *cm, const char *path)
+{
+    HttpRouteHandler *handler;
+    void *context;
+    const char *routePath = _resources.lookup(path, handler, context);
+    if (!routePath) {
+        _reply(nc, cm, CoapOut(0, COAP_CODE_NOT_FOUND, 0));
+        return;
+    }
+
+    uint32_t blockNum = 0;
+    uint8_t blockSzx = COAP_BLOCK_SZX_MAX;
+    struct mg_coap_option *block2 = findOption(cm, COAP_OPTION_BLOCK2);
+    if (block2) {
+        uint32_t value = uintOptionValue(block2->value);
+        blockNum = value >> 4;
+        if ((value & 0x07) == 7) {
+            _reply(nc, cm, CoapOut(0, COAP_CODE_BAD_OPTION, 0));
+            return;
+        }
+        if ((value & 0x07) < blockSzx) blockSzx = value & 0x07;
+    }
+
+    int format;
+    int status = _render(nc, handler, context, format);
+    if (status != 200) {
+        _reply(nc, cm, CoapOut(0, statusToCode(status), 0));
+        return;
+    }
+
+    CoapOut out(0, COAP_CODE_CONTENT, 0);
+    out.contentFormat = format;
+    out.hasEtag = true;
+    out.etag = bodyHash(nc->send_mbuf.buf, nc->send_mbuf.len);
+
+    // registration and cancellation, only on the first block
+    struct mg_coap_option *observe = findOption(cm, COAP_OPTION_OBSERVE);
+    if (observe && blockNum == 0) {
+        if (uintOptionValue(observe->value) == 0) {
+            Observer *observer = _observe(nc, cm, handler, context, routePath);
+            if (observer) {
+                observer->etag = out.etag;
+                out.observe = ++observer->sequence & 0xFFFFFF;
+                out.maxAge = COAP_OBSERVE_MAX_AGE;
+            }
+        }
+        else {
+            int index = _findObserver(nc, (const uint8_t *)cm->token.p, cm->token.len);
+            if (index >= 0) _dropObserver(_observers[index]);
+        }
+    }
+
+    if (block2 || nc->send_mbuf.len > ((size_t)1 << (blockSzx + 4))) {
+        bool more;
+        if (!sliceBlock(nc, blockNum, blockSzx, more)) {
+            _reply(nc, cm, CoapOut(0, COAP_CODE_BAD_OPTION, 0));
+            return;
+        }
+        out.hasBlock2 = true;
+        out.block2 = (blockNum << 4) | (more ? 0x08 : 0) | blockSzx;
+    }
+    _reply(nc, cm, out);
+}
+
+void CoapServer::_post(struct mg_connection *nc, struct mg_coap_message *cm)
+{
+    if (!_msgInterpreter || cm->payload.len == 0) {
+        _reply(nc, cm, CoapOut(0, _msgInterpreter ? COAP_CODE_BAD_REQUEST : COAP_CODE_UNAVAILABLE, 0));
+        return;
+    }
+
+    // command replies made during interpretation ride on this exchange
+    _exchange.nc = nc;
+    _exchange.cm = cm;
+    _exchange.replied = false;
+    _msgInterpreter->interpreteSocketMsg(cm->payload.p, cm->payload.len, nc);
+    if (!_exchange.replied) _reply(nc, cm, CoapOut(0, COAP_CODE_CHANGED, 0));
+    memset(&_exchange, 0, sizeof(_exchange));
+}
+
+void CoapServer::replyMessage(const void *data, size_t length, void *userdata, int flag)
+{
+    if (!_reactor->inReactorTask() || _exchange.nc != userdata || _exchange.replied) {
+        // no exchange left to answer, a coap client asks again instead
+        APP_LOGE("[CoapServer]", "reply outside request dropped (%d bytes)", (int)length);
+        return;
+    }
+    struct mg_connection *nc = _exchange.nc;
+    nc->send_mbuf.len = 0;
+    mg_send(nc, data, length);
+    CoapOut out(0, COAP_CODE_CONTENT, 0);
+    out.contentFormat = flag == PROTOCOL_MSG_FORMAT_BINARY ? COAP_FORMAT_OCTET_STREAM : COAP_FORMAT_JSON;
+    _reply(nc, _exchange.cm, out);
+    _exchange.replied = true;
+}
+
+uint32_t CoapServer::requesterId(void *userdata)
+{
+    // peer connections last one exchange, the address stays
+    struct mg_connection *nc = static_cast<struct mg_connection *>(userdata);
+    return nc ? ntohl(nc->sa.sin.sin_addr.s_addr) : 0;
+}
+
+bool CoapServer::replyStatus(void *userdata, int status)
+{
+    if (_exchange.nc != userdata || _exchange.replied) return false;
+    CoapOut out(0, COAP_CODE_UNAVAILABLE, 0);
+    switch (status) {
+        case CMD_STATUS_RATE_LIMITED:
+            out.code = COAP_CODE_TOO_MANY_REQUESTS;
+            out.maxAge = COAP_RETRY_MAX_AGE;
+            break;
+        case CMD_STATUS_BUSY:
+            out.maxAge = COAP_RETRY_MAX_AGE;
+            break;
+        case CMD_STATUS_NOT_ALLOWED:
+            out.code = COAP_CODE_FORBIDDEN;
+            break;
+        default:
+            return false;
+    }
+    _reply(_exchange.nc, _exchange.cm, out);
+    _exchange.replied = true;
+    return true;
+}
+
+CoapServer::Observer * CoapServer::_observe(struct mg_connection *nc, struct mg_coap_message *cm,
+                                            HttpRouteHandler *handler, void *context, const char *path)
+{
+    if (cm->token.len > sizeof(_observers[0].token)) return NULL;
+
+    // same token again refreshes the registration, a new token for the same resource replaces it
+    int index = _findObserver(nc, (const uint8_t *)cm->token.p, cm->token.len);
+    for (int i = 0; index < 0 && i < COAP_OBSERVER_CAPACITY; ++i) {
+        if (_observers[i].nc == nc && _observers[i].path == path) index = i;
+    }
+    for (int i = 0; index < 0 && i < COAP_OBSERVER_CAPACITY; ++i) {
+        if (!_observers[i].nc) index = i;
+    }
+    if (index < 0) return NULL;
+
+    Observer &observer = _observers[index];
+    if (observer.nc != nc || observer.path != path) {
+        memset(&observer, 0, sizeof(Observer));
+        observer.sequence = 1;
+    }
+    observer.nc = nc;
+    observer.path = path;
+    observer.handler = handler;
+    observer.context = context;
+    memcpy(observer.token, cm->token.p, cm->token.len);
+    observer.tokenLength = cm->token.len;
+    observer.notifiedMilli = nowMilli();
+    observer.conPending = false;
+    observer.retransmit = 0;
+
+    if (observerCount() == 1) _nextCheckMilli = nowMilli() + COAP_OBSERVE_CHECK_INTERVAL;
+    return &observer;
+}
+
+int CoapServer::_findObserver(struct mg_connection *nc, const uint8_t *token, size_t tokenLength)
+{
+    for (int i = 0; i < COAP_OBSERVER_CAPACITY; ++i) {
+        const Observer &observer = _observers[i];
+        if (observer.nc == nc && observer.tokenLength == tokenLength &&
+            memcmp(observer.token, token, tokenLength) == 0) return i;
+    }
+    return -1;
+}
+
+void CoapServer::_dropObserver(Observer &observer)
+{
+    struct mg_connection *nc = observer.nc;
+    memset(&observer, 0, sizeof(Observer));
+    _settle(nc);
+}
+
+void CoapServer::onAck(struct mg_connection *nc, struct mg_coap_message *cm)
+{
+    for (int i = 0; i < COAP_OBSERVER_CAPACITY; ++i) {
+        Observer &observer = _observers[i];
+        if (observer.nc == nc && observer.conPending && observer.msgId == cm->msg_id) {
+            observer.conPending = false;
+            observer.retransmit = 0;
+        }
+    }
+    _settle(nc);
+}
+
+void CoapServer::onReset(struct mg_connection *nc, struct mg_coap_message *cm)
+{
+    // observer rejects the notification, observation over
+    for (int i = 0; i < COAP_OBSERVER_CAPACITY; ++i) {
+        Observer &observer = _observers[i];
+        if (observer.nc == nc && observer.msgId == cm->msg_id) _dropObserver(observer);
+    }
+    _settle(nc);
+}
+
+void CoapServer::onClose(struct mg_connection *nc)
+{
+    if (nc == _listener) _listener = NULL;
+    for (int i = 0; i < COAP_OBSERVER_CAPACITY; ++i) {
+        if (_observers[i].nc == nc) memset(&_observers[i], 0, sizeof(Observer));
+    }
+    if (_exchange.nc == nc) memset(&_exchange, 0, sizeof(_exchange));
+}
+
+void CoapServer::_notify(Observer &observer, uint32_t nowMilli, bool force)
+{
+    struct mg_connection *nc = observer.nc;
+    // one message per datagram, wait until the last one is out
+    if (nc->send_mbuf.len > 0) return;
+
+    int format;
+    int status = _render(nc, observer.handler, observer.context, format);
+    if (status != 200) {
+        // error notification ends the observation
+        nc->send_mbuf.len = 0;
+        sendMessage(nc, CoapOut(COAP_TYPE_NON, statusToCode(status), _nextMsgId(), observer.token, observer.tokenLength));
+        _dropObserver(observer);
+        return;
+    }
+
+    uint32_t etag = bodyHash(nc->send_mbuf.buf, nc->send_mbuf.len);
+    bool refresh = timePassed(nowMilli, observer.notifiedMilli + COAP_OBSERVE_MAX_AGE * 1000);
+    if (!force && !refresh && etag == observer.etag) {
+        nc->send_mbuf.len = 0;
+        return;
+    }
+
+    // at most one CON outstanding
+    bool confirmable = force || observer.retransmit > 0 ||
+                       (!observer.conPending && (refresh || (observer.notifyCount + 1) % COAP_OBSERVE_CON_EVERY == 0));
+    CoapOut out(confirmable ? COAP_TYPE_CON : COAP_TYPE_NON, COAP_CODE_CONTENT, _nextMsgId(),
+                observer.token, observer.tokenLength);
+    out.observe = ++observer.sequence & 0xFFFFFF;
+    out.contentFormat = format;
+    out.hasEtag = true;
+    out.etag = etag;
+    out.maxAge = COAP_OBSERVE_MAX_AGE;
+    bool more;
+    if (nc->send_mbuf.len > ((size_t)1 << (COAP_BLOCK_SZX_MAX + 4))) {
+        // first block only, the observer fetches the rest
+        sliceBlock(nc, 0, COAP_BLOCK_SZX_MAX, more);
+        out.hasBlock2 = true;
+        out.block2 = 0x08 | COAP_BLOCK_SZX_MAX;
+    }
+    if (!sendMessage(nc, out)) return;
+
+    observer.msgId = out.msgId;
+    observer.etag = etag;
+    observer.notifiedMilli = nowMilli;
+    ++observer.notifyCount;
+    if (confirmable) {
+        observer.conPending = true;
+        observer.conSentMilli = nowMilli;
+    }
+}
+
+uint32_t CoapServer::nextPollTimeout()
+{
+    uint32_t now = nowMilli();
+    uint32_t next = UINT32_MAX;
+    for (int i = 0; i < COAP_OBSERVER_CAPACITY; ++i) {
+        const Observer &observer = _observers[i];
+        if (!observer.nc) continue;
+        uint32_t deadline = _nextCheckMilli;
+        uint32_t ackDeadline = observer.conSentMilli + (COAP_ACK_TIMEOUT << observer.retransmit);
+        if (observer.conPending && timePassed(_nextCheckMilli, ackDeadline)) deadline = ackDeadline;
+        if (timePassed(now, deadline)) return 0;
+        if (deadline - now < next) next = deadline - now;
+    }
+    return next;
+}
+
+void CoapServer::onPolled()
+{
+    uint32_t now = nowMilli();
+    bool check = timePassed(now, _nextCheckMilli);
+    if (check) _nextCheckMilli = now + COAP_OBSERVE_CHECK_INTERVAL;
+
+    for (int i = 0; i < COAP_OBSERVER_CAPACITY; ++i) {
+        Observer &observer = _observers[i];
+        if (!observer.nc) continue;
+        if (observer.conPending &&
+            timePassed(now, observer.conSentMilli + (COAP_ACK_TIMEOUT << observer.retransmit))) {
+            if (observer.retransmit >= COAP_MAX_RETRANSMIT) {
+                APP_LOGI("[CoapServer]", "observer of %s gone", observer.path);
+                _dropObserver(observer);
+                continue;
+            }
+            // current state instead of a plain copy of the lost one, as CON until acked
+            ++observer.retransmit;
+            observer.conPending = false;
+            observer.etag = 0;
+            _notify(observer, now, true);
+        }
+        else if (check) {
+            _notify(observer, now, false);
+        }
+    }
+}
@@ -0,0 +1,147 @@
+/*
+ * CoapServer: CoAP over UDP with Observe and block-wise transfer
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _COAP_SERVER_H
+#define _COAP_SERVER_H
+
+#include "ProtocolDelegate.h"
+#include "NetReactor.h"
+#include "HttpRouter.h"
+
+// mongoose is built with private flags, keep its coap types out of this header
+struct mg_coap_message;
+struct CoapOut;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ CoapServer class
+/////////////////////////////////////////////////////////////////////////////////////////
+// Resources are the http routes (same paths, handlers and bodies), read with GET, so
+// whatever CmdEngine registers for http is served here too. POST to COAP_CMD_PATH takes
+// a JSON command, its reply comes back piggybacked on the ACK, 2.04 if it has none.
+// Peer connections come and go with the exchanges, requesters are told apart by address.
+// Requesters are not authenticated, so the engine behind is read only and refuses
+// writes with 4.03. Without a reactor for late replies every command runs inline; one
+// that would have to wait for the command worker gets 5.03, one over quota 4.29, both
+// with Max-Age COAP_RETRY_MAX_AGE for the retry.
+//
+// GET with Observe 0 registers the requester. Observed resources are rendered every
+// COAP_OBSERVE_CHECK_INTERVAL and a NON notification goes out when the body changed,
+// every COAP_OBSERVE_CON_EVERY-th one as CON so a vanished observer is dropped after
+// COAP_MAX_RETRANSMIT unanswered tries; a RST drops it at once.
+//
+// A body larger than the block size is sent block-wise (Block2), the client asks for
+// the following blocks by number. Every 2.05 carries an ETag over the whole body so
+// the client can tell if blocks were taken from different versions.
+//
+// Mongoose sends all bytes queued on a UDP connection as one datagram, so each peer
+// gets at most one message per poll. Reactor task only.
+
+#define COAP_LISTEN_ADDR                "udp://5683"
+#define COAP_CMD_PATH                   "/api/v1/cmd"
+#define COAP_OBSERVER_CAPACITY          4
+#define COAP_OBSERVE_CHECK_INTERVAL     1000    // ms
+#define COAP_OBSERVE_MAX_AGE            60      // s, notification sent at least this often
+#define COAP_OBSERVE_CON_EVERY          10
+#define COAP_ACK_TIMEOUT                2000    // ms, doubled on each retransmit
+#define COAP_MAX_RETRANSMIT             4
+#define COAP_BLOCK_SZX_MAX              6       // 1024 bytes
+#define COAP_PATH_MAX_LEN               63
+#define COAP_RETRY_MAX_AGE              1       // s, of 4.29 and 5.03
+
+struct CoapObserverStats
+{
+    const char     *path;
+    uint32_t        notifyCount;
+    uint8_t         retransmit;     // current CON retries
+};
+
+class CoapServer : public ProtocolDelegate, public NetReactorClient
+{
+public:
+    // constructor
+    CoapServer();
+
+    // NetReactorClient
+    virtual uint32_t nextPollTimeout();
+    virtual void onPolled();
+
+    // config, init and deinit, listener runs on reactor manager
+    void init(NetReactor *reactor);
+    void deinit();
+    void start();
+
+    // ProtocolDelegate virtual
+    virtual void setup();
+    virtual void replyMessage(const void *data, size_t length, void *userdata, int flag);
+    virtual HttpRouter * httpRouter() { return &_resources; }
+    virtual bool replyStatus(void *userdata, int status);
+    virtual uint32_t requesterId(void *userdata);
+
+    // stats
+    uint8_t observerCount();
+    bool observerStats(uint8_t index, CoapObserverStats &stats);    // false if slot unused
+    uint32_t requestCount() { return _requestCount; }
+
+public:
+    // for event handler
+    void onRequest(struct mg_connection *nc, struct mg_coap_message *cm);
+    void onAck(struct mg_connection *nc, struct mg_coap_message *cm);
+    void onReset(struct mg_connection *nc, struct mg_coap_message *cm);
+    void onClose(struct mg_connection *nc);
+
+protected:
+    struct Observer {
+        struct mg_connection   *nc;
+        const char             *path;           // route path, static
+        HttpRouteHandler       *handler;
+        void                   *context;
+        uint8_t                 token[8];
+        uint8_t                 tokenLength;
+        uint32_t                sequence;       // observe option value
+        uint32_t                etag;           // of last notified body
+        uint32_t                notifiedMilli;
+        uint32_t                notifyCount;
+        uint16_t                msgId;          // of last notification
+        bool                    conPending;
+        uint32_t                conSentMilli;
+        uint8_t                 retransmit;
+    };
+
+    // POST being interpreted, its first command reply is piggybacked
+    struct Exchange {
+        struct mg_connection   *nc;
+        struct mg_coap_message *cm;
+        bool                    replied;
+    };
+
+    void _get(struct mg_connection *nc, struct mg_coap_message *cm, const char *path);
+    void _post(struct mg_connection *nc, struct mg_coap_message *cm);
+    void _reply(struct mg_connection *nc, struct mg_coap_message *cm, CoapOut out);
+    void _prepareReply(struct mg_connection *nc);
+    void _settle(struct mg_connection *nc);
+    int  _render(struct mg_connection *nc, HttpRouteHandler *handler, void *context, int &format);
+
+    Observer * _observe(struct mg_connection *nc, struct mg_coap_message *cm, HttpRouteHandler *handler,
+                        void *context, const char *path);
+    void _notify(Observer &observer, uint32_t nowMilli, bool force);
+    void _dropObserver(Observer &observer);
+    int  _findObserver(struct mg_connection *nc, const uint8_t *token, size_t tokenLength);
+    bool _observed(struct mg_connection *nc);
+    uint16_t _nextMsgId() { return ++_msgId; }
+
+protected:
+    bool                     _inited;
+    NetReactor              *_reactor;
+    struct mg_connection    *_listener;
+    HttpRouter               _resources;
+    Observer                 _observers[COAP_OBSERVER_CAPACITY];
+    Exchange                 _exchange;
+    uint16_t                 _msgId;
+    uint32_t                 _nextCheckMilli;
+    uint32_t                 _requestCount;
+};
+
+#endif // _COAP_SERVER_H
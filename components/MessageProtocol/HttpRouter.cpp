@@ -0,0 +1,297 @@
+/*
+ * HttpRouter: HTTP/1.1 route table with ETag and keep-alive handling
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "HttpRouter.h"
+#include "mongoose/mongoose.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#define HTTP_HEADER_MAX_LEN     256
+
+static const char * statusText(int status)
+{
+    switch (status) {
+        case 200: return "OK";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 406: return "Not Acceptable";
+        case 503: return "Service Unavailable";
+        default:  return status < 500 ? "Bad Request" : "Internal Server Error";
+    }
+}
+
+bool HttpRouter::keepAlive(struct http_message *hm)
+{
+    struct mg_str *conn = mg_get_http_header(hm, "Connection");
+    if (conn && mg_vcasecmp(conn, "close") == 0) return false;
+    // HTTP/1.0 closes unless asked otherwise
+    if (mg_vcmp(&hm->proto, "HTTP/1.1") != 0)
+        return conn && mg_vcasecmp(conn, "keep-alive") == 0;
+    return true;
+}
+
+void HttpRouter::finishResponse(struct mg_connection *nc, bool alive)
+{
+    if (alive) mg_set_timer(nc, mg_time() + HTTP_KEEP_ALIVE_IDLE_TIMEOUT);
+    else nc->flags |= MG_F_SEND_AND_CLOSE;
+}
+
+// fnv-1a, quoted as strong etag
+static void makeEtag(const char *data, size_t length, char *etag, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+    snprintf(etag, size, "\"%08x\"", hash);
+}
+
+bool HttpRouter::etagMatched(struct http_message *hm, const char *etag)
+{
+    struct mg_str *inm = mg_get_http_header(hm, "If-None-Match");
+    if (!inm) return false;
+    if (mg_vcmp(inm, "*") == 0) return true;
+    // list of tags, possibly weak (W/"...")
+    return mg_strstr(*inm, mg_mk_str(etag)) != NULL;
+}
+
+// q=weight among params is zero if all its digits are 0
+static bool zeroWeight(struct mg_str params)
+{
+    const char *q = mg_strstr(params, mg_mk_str("q="));
+    if (!q) return false;
+    for (q += 2; q < params.p + params.len; ++q) {
+        if (*q >= '1' && *q <= '9') return false;
+        if (*q != '0' && *q != '.') break;
+    }
+    return true;
+}
+
+bool HttpRouter::gzipAccepted(struct http_message *hm)
+{
+    struct mg_str *ae = mg_get_http_header(hm, "Accept-Encoding");
+    if (!ae) return false;
+    // list of coding[;q=weight], gzip or * not weighted 0
+    struct mg_str list = *ae, entry;
+    while (list.len > 0) {
+        list = mg_next_comma_list_entry_n(list, &entry, NULL);
+        const char *semi = mg_strchr(entry, ';');
+        struct mg_str coding = mg_strstrip(mg_mk_str_n(entry.p, semi ? semi - entry.p : entry.len));
+        if (mg_vcasecmp(&coding, "gzip") != 0 && mg_vcmp(&coding, "*") != 0) continue;
+        return !semi || !zeroWeight(mg_mk_str_n(semi + 1, entry.p + entry.len - semi - 1));
+    }
+    return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ HttpResponse class
+/////////////////////////////////////////////////////////////////////////////////////////
+HttpResponse::HttpResponse(struct mg_connection *nc)
+: _nc(nc)
+, _bodyOffset(nc->send_mbuf.len)
+, _contentType("application/json")
+{}
+
+char * HttpResponse::reserve(size_t size)
+{
+    struct mbuf &mb = _nc->send_mbuf;
+    if (mb.size - mb.len < size) {
+        mbuf_resize(&mb, mb.len + size);
+        if (mb.size - mb.len < size) return NULL;
+    }
+    return mb.buf + mb.len;
+}
+
+void HttpResponse::commit(size_t length)
+{
+    struct mbuf &mb = _nc->send_mbuf;
+    if (length > mb.size - mb.len) length = mb.size - mb.len;
+    mb.len += length;
+}
+
+int HttpResponse::printf(const char *format, ...)
+{
+    struct mbuf &mb = _nc->send_mbuf;
+    va_list ap;
+    va_start(ap, format);
+    int length = vsnprintf(mb.buf + mb.len, mb.size - mb.len, format, ap);
+    va_end(ap);
+    if (length < 0) return -1;
+
+    if ((size_t)length >= mb.size - mb.len) {
+        // did not fit, grow once and format again
+        if (!reserve(length + 1)) return -1;
+        va_start(ap, format);
+        vsnprintf(mb.buf + mb.len, mb.size - mb.len, format, ap);
+        va_end(ap);
+    }
+    mb.len += length;
+    return length;
+}
+
+const char * HttpResponse::body()
+{
+    return _nc->send_mbuf.buf + _bodyOffset;
+}
+
+size_t HttpResponse::bodyLength()
+{
+    return _nc->send_mbuf.len - _bodyOffset;
+}
+
+void HttpResponse::discard()
+{
+    _nc->send_mbuf.len = _bodyOffset;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ HttpRouter class
+/////////////////////////////////////////////////////////////////////////////////////////
+HttpRouter::HttpRouter()
+: _count(0)
+{
+    memset(_routes, 0, sizeof(_routes));
+}
+
+bool HttpRouter::addRoute(const char *path, HttpRouteHandler *handler, void *context, uint32_t maxAge)
+{
+    for (uint8_t i = 0; i < _count; ++i) {
+        if (strcmp(_routes[i].path, path) == 0) {
+            _routes[i].handler = handler;
+            _routes[i].context = context;
+            _routes[i].maxAge = maxAge;
+            return true;
+        }
+    }
+    if (_count >= HTTP_ROUTER_ROUTE_CAPACITY) return false;
+    Route &route = _routes[_count++];
+    route.path = path;
+    route.handler = handler;
+    route.context = context;
+    route.maxAge = maxAge;
+    return true;
+}
+
+void HttpRouter::clear()
+{
+    memset(_routes, 0, sizeof(_routes));
+    _count = 0;
+}
+
+int HttpRouter::_findRoute(struct http_message *hm)
+{
+    // uri excludes the query string
+    for (uint8_t i = 0; i < _count; ++i) {
+        if (mg_vcmp(&hm->uri, _routes[i].path) == 0) return i;
+    }
+    return -1;
+}
+
+const char * HttpRouter::lookup(const char *path, HttpRouteHandler *&handler, void *&context)
+{
+    for (uint8_t i = 0; i < _count; ++i) {
+        if (strcmp(_routes[i].path, path) == 0) {
+            handler = _routes[i].handler;
+            context = _routes[i].context;
+            return _routes[i].path;
+        }
+    }
+    return NULL;
+}
+
+bool HttpRouter::dispatch(struct mg_connection *nc, struct http_message *hm)
+{
+    int index = _findRoute(hm);
+    if (index < 0) return false;
+
+    bool head = mg_vcmp(&hm->method, "HEAD") == 0;
+    if (!head && mg_vcmp(&hm->method, "GET") != 0) {
+        sendResponse(nc, hm, 405, "application/json", "{\"err\":\"method not allowed\"}",
+                     "Allow: GET, HEAD\r\n");
+        return true;
+    }
+
+    Route &route = _routes[index];
+    HttpResponse response(nc);
+    int status = route.handler->onHttpRoute(response, route.context);
+    bool alive = keepAlive(hm);
+
+    char etag[12];
+    char cacheControl[24];
+    char header[HTTP_HEADER_MAX_LEN];
+    int headerLen;
+    if (status == 200) {
+        makeEtag(response.body(), response.bodyLength(), etag, sizeof(etag));
+        if (route.maxAge > 0) snprintf(cacheControl, sizeof(cacheControl), "max-age=%u", route.maxAge);
+        else strcpy(cacheControl, "no-cache");
+
+        if (etagMatched(hm, etag)) {
+            response.discard();
+            mg_printf(nc, "HTTP/1.1 304 Not Modified\r\n"
+                          "Cache-Control: %s\r\n"
+                          "ETag: %s\r\n"
+                          "Connection: %s\r\n"
+                          "\r\n",
+                          cacheControl, etag, alive ? "keep-alive" : "close");
+            finishResponse(nc, alive);
+            return true;
+        }
+        headerLen = snprintf(header, sizeof(header),
+                             "HTTP/1.1 200 OK\r\n"
+                             "Content-Type: %s\r\n"
+                             "Content-Length: %u\r\n"
+                             "Cache-Control: %s\r\n"
+                             "ETag: %s\r\n"
+                             "Connection: %s\r\n"
+                             "\r\n",
+                             response.contentType(), (unsigned)response.bodyLength(), cacheControl, etag,
+                             alive ? "keep-alive" : "close");
+    }
+    else {
+        headerLen = snprintf(header, sizeof(header),
+                             "HTTP/1.1 %d %s\r\n"
+                             "Content-Type: %s\r\n"
+                             "Content-Length: %u\r\n"
+                             "Cache-Control: no-store\r\n"
+                             "Connection: %s\r\n"
+                             "\r\n",
+                             status, statusText(status), response.contentType(), (unsigned)response.bodyLength(),
+                             alive ? "keep-alive" : "close");
+    }
+
+    // HEAD gets the headers of the GET response without its body
+    size_t bodyOffset = nc->send_mbuf.len - response.bodyLength();
+    if (head) response.discard();
+    if (mbuf_insert(&nc->send_mbuf, bodyOffset, header, headerLen) != (size_t)headerLen) {
+        // out of memory, half a response must not go out
+        response.discard();
+        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        return true;
+    }
+    finishResponse(nc, alive);
+    return true;
+}
+
+void HttpRouter::sendResponse(struct mg_connection *nc, struct http_message *hm, int status,
+                              const char *contentType, const char *body, const char *extraHeaders)
+{
+    bool alive = keepAlive(hm);
+    size_t bodyLen = strlen(body);
+    mg_printf(nc, "HTTP/1.1 %d %s\r\n"
+                  "Content-Type: %s\r\n"
+                  "Content-Length: %u\r\n"
+                  "%s"
+                  "Connection: %s\r\n"
+                  "\r\n",
+                  status, statusText(status), contentType, (unsigned)bodyLen,
+                  extraHeaders ? extraHeaders : "", alive ? "keep-alive" : "close");
+    if (mg_vcmp(&hm->method, "HEAD") != 0) mg_send(nc, body, bodyLen);
+    finishResponse(nc, alive);
+}
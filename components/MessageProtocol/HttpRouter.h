@@ -0,0 +1,115 @@
+/*
+ * HttpRouter: HTTP/1.1 route table with ETag and keep-alive handling
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _HTTP_ROUTER_H
+#define _HTTP_ROUTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// mongoose is built with private flags, keep its types out of this header
+struct mg_connection;
+struct http_message;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ HttpResponse class
+/////////////////////////////////////////////////////////////////////////////////////////
+// Body writer on the connection's send buffer. Handlers write the body in place, the
+// router inserts the status line and headers in front of it once the length is known.
+class HttpResponse
+{
+public:
+    HttpResponse(struct mg_connection *nc);
+
+    // writable space of at least size bytes after the body, NULL if out of memory
+    char * reserve(size_t size);
+    // body grows by length bytes written into the reserved space
+    void commit(size_t length);
+    // formatted append, returns bytes appended or -1
+    int printf(const char *format, ...);
+
+    const char * body();
+    size_t bodyLength();
+    // drop the body written so far
+    void discard();
+
+    // application/json unless handler sets another, string must outlive the response
+    void setContentType(const char *contentType) { _contentType = contentType; }
+    const char * contentType() { return _contentType; }
+
+protected:
+    struct mg_connection   *_nc;
+    size_t                  _bodyOffset;
+    const char             *_contentType;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ HttpRouteHandler class
+/////////////////////////////////////////////////////////////////////////////////////////
+class HttpRouteHandler
+{
+public:
+    // write body for the route, return http status code
+    virtual int onHttpRoute(HttpResponse &response, void *context) = 0;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ HttpRouter class
+/////////////////////////////////////////////////////////////////////////////////////////
+// Routes match the request path exactly, GET and HEAD only. Every 200 response carries
+// an ETag over its body, so a conditional GET with a matching If-None-Match is answered
+// with 304 and no body. Connections are kept alive unless the client asks otherwise,
+// an idle one is closed after HTTP_KEEP_ALIVE_IDLE_TIMEOUT.
+
+#define HTTP_ROUTER_ROUTE_CAPACITY          8
+#define HTTP_KEEP_ALIVE_IDLE_TIMEOUT        30      // s
+
+class HttpRouter
+{
+public:
+    HttpRouter();
+
+    // maxAge in seconds clients may reuse a body, 0 to revalidate on every use
+    bool addRoute(const char *path, HttpRouteHandler *handler, void *context = NULL, uint32_t maxAge = 0);
+    void clear();
+
+    // false if no route matches the request path, nothing sent then
+    bool dispatch(struct mg_connection *nc, struct http_message *hm);
+    // route of path for other transports, its stored path or NULL if none
+    const char * lookup(const char *path, HttpRouteHandler *&handler, void *&context);
+
+    // complete response with a fixed body, for replies outside the route table
+    static void sendResponse(struct mg_connection *nc, struct http_message *hm, int status,
+                             const char *contentType, const char *body, const char *extraHeaders = NULL);
+
+    // HTTP/1.1 keeps the connection unless asked to close, HTTP/1.0 only if asked to keep
+    static bool keepAlive(struct http_message *hm);
+    // If-None-Match lists etag (quoted) or is *
+    static bool etagMatched(struct http_message *hm, const char *etag);
+    // Accept-Encoding lists gzip or * with a weight above 0; false without the header,
+    // a client that did not ask for gzip may not be able to decode it
+    static bool gzipAccepted(struct http_message *hm);
+    // response complete, arm idle timer or close once sent
+    static void finishResponse(struct mg_connection *nc, bool alive);
+
+protected:
+    struct Route {
+        const char          *path;
+        HttpRouteHandler    *handler;
+        void                *context;
+        uint32_t             maxAge;
+    };
+
+    int _findRoute(struct http_message *hm);
+
+protected:
+    uint8_t                     _count;
+    Route                       _routes[HTTP_ROUTER_ROUTE_CAPACITY];
+};
+
+#endif // _HTTP_ROUTER_H
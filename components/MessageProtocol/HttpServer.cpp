@@ -5,10 +5,10 @@
  */
 
 #include "HttpServer.h"
+#include "www/web_assets.h"
 
 #include "esp_system.h"
 #include "AppLog.h"
-#include "Wifi.h"
 
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -41,6 +41,14 @@ static void mongoose_http_event_handler(struct mg_connection *nc, int event, voi
             httpServer->onWebsocketFrame(nc, (struct websocket_message *)p);
             break;
 
+        case MG_EV_SEND:
+            httpServer->onSend(nc);
+            break;
+
+        case MG_EV_TIMER:
+            httpServer->onTimer(nc);
+            break;
+
         case MG_EV_CLOSE:
             httpServer->onClose(nc);
             break;
@@ -51,20 +59,31 @@ static void mongoose_http_event_handler(struct mg_connection *nc, int event, voi
 /////////////////////////////////////////////////////////////////////////////////////////
 // ------ HttpServer class
 /////////////////////////////////////////////////////////////////////////////////////////
-#define MG_HTTP_LISTEN_ADDR "80"
+inline static uint32_t nowMilli()
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
 
 HttpServer::HttpServer()
 : _inited(false)
-, _websocketConnected(false)
-{}
+, _websocketCount(0)
+, _websocketSerial(0)
+, _reactor(NULL)
+, _listener(NULL)
+{
+    memset(_websockets, 0, sizeof(_websockets));
+    _webAssets.setAssets(webAssets, WEB_ASSET_COUNT);
+}
 
-void HttpServer::init()
+void HttpServer::init(NetReactor *reactor)
 {
     if (!_inited) {
         // APP_LOGI("[HttpServer]", "init server (Mongoose version: %s, Free RAM: %d bytes)",
         //                           MG_VERSION, esp_get_free_heap_size());
         APP_LOGI("[HttpServer]", "init, free RAM: %d bytes", esp_get_free_heap_size());
-        mg_mgr_init(&_manager, NULL);
+        _reactor = reactor;
+        _reactor->init();
+        _reactor->addClient(this);
 
         _inited = true;
     }
@@ -73,7 +92,9 @@ void HttpServer::init()
 void HttpServer::deinit()
 {
     if (_inited) {
-        mg_mgr_free(&_manager);
+        if (_listener) _listener->flags |= MG_F_CLOSE_IMMEDIATELY;
+        _listener = NULL;
+        _liveStream.clear();
         _inited = false;
     }
 }
@@ -91,12 +112,13 @@ void HttpServer::start()
 #endif
         struct mg_connection *nc;
         APP_LOGI("[HttpServer]", "init http server");
-        nc = mg_bind_opt(&_manager, MG_HTTP_LISTEN_ADDR, mongoose_http_event_handler, opts);
+        nc = mg_bind_opt(_reactor->manager(), HTTP_LISTEN_ADDR, mongoose_http_event_handler, opts);
         if (nc == NULL) {
             APP_LOGE("[HttpServer]", "init http server failed");
             return;
         }
         mg_set_protocol_http_websocket(nc);
+        _listener = nc;
     }
 }
 
@@ -104,12 +126,68 @@ void HttpServer::setup()
 {}
 
 void HttpServer::replyMessage(const void *data, size_t length, void *userdata, int flag)
+{
+    if (_reactor->inReactorTask()) {
+        struct mg_connection *nc = connection(userdata);
+        if (nc) _sendReply(nc, data, length, flag);
+        return;
+    }
+
+    // other tasks hand reply over to reactor task
+    NetJob job;
+    job.client = this;
+    job.type = NetJobReply;
+    job.qos = 0;
+    job.flag = flag;
+    job.userdata = userdata;
+    job.topic[0] = '\0';
+    _reactor->submit(&job, data, length);
+}
+
+uint32_t HttpServer::nextPollTimeout()
+{
+    return _liveStream.nextDueMilli(nowMilli());
+}
+
+void HttpServer::onPolled()
+{
+    _liveStream.process(nowMilli());
+}
+
+void HttpServer::onNetJob(NetJob *job)
+{
+    // connection may have closed while job was queued
+    struct mg_connection *nc = connection(job->userdata);
+    if (job->type == NetJobReply && nc) {
+        _sendReply(nc, job->payload(), job->length, job->flag);
+    }
+}
+
+struct mg_connection * HttpServer::connection(void *userdata)
+{
+    uint32_t id = (uint32_t)(uintptr_t)userdata;
+    if (id == 0) return NULL;
+    for (int i = 0; i < HTTP_WEBSOCKET_CAPACITY; ++i) {
+        if (_websockets[i].id == id) return _websockets[i].nc;
+    }
+    return NULL;
+}
+
+uint32_t HttpServer::_websocketId(struct mg_connection *nc)
+{
+    for (int i = 0; i < HTTP_WEBSOCKET_CAPACITY; ++i) {
+        if (_websockets[i].id && _websockets[i].nc == nc) return _websockets[i].id;
+    }
+    return 0;
+}
+
+void HttpServer::_sendReply(struct mg_connection *nc, const void *data, size_t length, int flag)
 {
     // WEBSOCKET_OP_TEXT 1,   WEBSOCKET_OP_BINARY 2
     if (flag == PROTOCOL_MSG_FORMAT_BINARY)
-        mg_send_websocket_frame((mg_connection *)userdata, WEBSOCKET_OP_BINARY, data, length);
+        mg_send_websocket_frame(nc, WEBSOCKET_OP_BINARY, data, length);
     else if (flag == PROTOCOL_MSG_FORMAT_TEXT)
-        mg_send_websocket_frame((mg_connection *)userdata, WEBSOCKET_OP_TEXT, data, length);
+        mg_send_websocket_frame(nc, WEBSOCKET_OP_TEXT, data, length);
 }
 
 static char addr[32];
@@ -125,20 +203,15 @@ void HttpServer::onAccept(struct mg_connection *nc)
 
 void HttpServer::onHttpRequest(struct mg_connection *nc, struct http_message *hm)
 {
-    static const char *reply_fmt =
-        "HTTP/1.0 200 OK\r\n"
-        "Connection: close\r\n"
-        "Content-Type: text/plain\r\n"
-        "\r\n"
-        "Sensor %s\n";
+#ifdef LOG_HTTP
     mg_sock_addr_to_str(&nc->sa, addr, sizeof(addr),
                         MG_SOCK_STRINGIFY_IP | MG_SOCK_STRINGIFY_PORT);
-#ifdef LOG_HTTP
     APP_LOGI("[HttpServer]", "http request from %s: %.*s %.*s", addr, (int) hm->method.len,
                               hm->method.p, (int) hm->uri.len, hm->uri.p);
 #endif
-    mg_printf(nc, reply_fmt, addr);
-    nc->flags |= MG_F_SEND_AND_CLOSE;
+    if (_httpRouter.dispatch(nc, hm)) return;
+    if (_webAssets.serve(nc, hm)) return;
+    HttpRouter::sendResponse(nc, hm, 404, "application/json", "{\"err\":\"not found\"}");
 }
 
 void HttpServer::onWebsocketHandshakeRequest(struct mg_connection *nc)
@@ -153,7 +226,19 @@ void HttpServer::onWebsocketHandshakeDone(struct mg_connection *nc)
 #ifdef LOG_WEBSOCKET
     APP_LOGI("[HttpServer]", "websocket connection opened");
 #endif
-    _websocketConnected = true;
+    // keep-alive idle timer does not apply to websocket
+    mg_set_timer(nc, 0);
+    for (int i = 0; i < HTTP_WEBSOCKET_CAPACITY; ++i) {
+        if (_websockets[i].id == 0) {
+            if (++_websocketSerial == 0) ++_websocketSerial;
+            _websockets[i].nc = nc;
+            _websockets[i].id = _websocketSerial;
+            ++_websocketCount;
+            return;
+        }
+    }
+    APP_LOGE("[HttpServer]", "websocket connections full, closing new one");
+    nc->flags |= MG_F_SEND_AND_CLOSE;
 }
 
 void HttpServer::onWebsocketFrame(struct mg_connection *nc, struct websocket_message *wm)
@@ -162,22 +247,42 @@ void HttpServer::onWebsocketFrame(struct mg_connection *nc, struct websocket_mes
 #ifdef LOG_WEBSOCKET_MSG
     APP_LOGI("[HttpServer]", "got message: %.*s (nc: %p)", wm->size, wm->data, nc);
 #endif
-    if (_msgInterpreter) {
-        _msgInterpreter->interpreteSocketMsg(wm->data, wm->size, nc);
+    uint32_t id = _websocketId(nc);
+    if (_msgInterpreter && id) {
+        _msgInterpreter->interpreteSocketMsg(wm->data, wm->size, (void *)(uintptr_t)id);
     }
 }
 
+void HttpServer::onSend(struct mg_connection *nc)
+{
+    if (nc->flags & MG_F_IS_WEBSOCKET) _liveStream.onSent(nc, nowMilli());
+    else _webAssets.onSent(nc);
+}
+
+void HttpServer::onTimer(struct mg_connection *nc)
+{
+    // keep-alive connection idle since last response
+    if (!(nc->flags & MG_F_IS_WEBSOCKET)) nc->flags |= MG_F_SEND_AND_CLOSE;
+}
+
 void HttpServer::onClose(struct mg_connection *nc)
 {
     if (nc->flags & MG_F_IS_WEBSOCKET) {
 #ifdef LOG_WEBSOCKET
         APP_LOGI("[HttpServer]", "websocket connection closed (nc: %p)", nc);
 #endif
-        _websocketConnected = false;
+        _liveStream.unsubscribe(nc);
+        for (int i = 0; i < HTTP_WEBSOCKET_CAPACITY; ++i) {
+            if (_websockets[i].id && _websockets[i].nc == nc) {
+                _websockets[i].id = 0;
+                --_websocketCount;
+            }
+        }
     }
     else {
 #ifdef LOG_HTTP
         APP_LOGI("[HttpServer]", "http connection closed (nc: %p)", nc);
 #endif
+        _webAssets.onClose(nc);
     }
 }
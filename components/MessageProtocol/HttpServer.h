@@ -9,32 +9,48 @@
 
 #include "ProtocolMessageInterpreter.h"
 #include "ProtocolDelegate.h"
+#include "NetReactor.h"
+#include "HttpRouter.h"
+#include "LiveStream.h"
+#include "WebAssetServer.h"
 
 #include "mongoose/mongoose.h"
 
-#define MONGOOSE_HTTP_DEFAULT_POLL_SLEEP 1000
+// websocket requesters are known to the interpreter by an id never reused, so a reply
+// arriving after its connection closed can not reach a new one at the same address
+#define HTTP_WEBSOCKET_CAPACITY     8
 
-class HttpServer : public ProtocolDelegate
+// host tools build with a port of their own
+#ifndef HTTP_LISTEN_ADDR
+#define HTTP_LISTEN_ADDR            "80"
+#endif
+
+class HttpServer : public ProtocolDelegate, public NetReactorClient
 {
 public:
     // constructor
     HttpServer();
 
-    // loop poll
-    void poll(int sleepMilli = MONGOOSE_HTTP_DEFAULT_POLL_SLEEP) {
-        mg_mgr_poll(&_manager, sleepMilli);
-    }
+    // NetReactorClient
+    virtual uint32_t nextPollTimeout();
+    virtual void onPolled();
+    virtual void onNetJob(NetJob *job);
 
-    // config, init and deinit
-    void init();
+    // config, init and deinit, listener runs on reactor manager
+    void init(NetReactor *reactor);
     void deinit();
 
     void start();
-    bool websocketConnected() { return _websocketConnected; }
+    bool websocketConnected() { return _websocketCount > 0; }
+    uint8_t websocketCount() { return _websocketCount; }
 
     // ProtocolDelegate virtual
     virtual void setup();
     virtual void replyMessage(const void *data, size_t length, void *userdata, int flag);
+    virtual HttpRouter * httpRouter() { return &_httpRouter; }
+    virtual LiveStream * liveStream() { return &_liveStream; }
+    virtual struct mg_connection * connection(void *userdata);
+    virtual NetReactor * reactor() { return _reactor; }
 
 public:
     // for event handler
@@ -43,12 +59,33 @@ public:
     void onWebsocketHandshakeRequest(struct mg_connection *nc);
     void onWebsocketHandshakeDone(struct mg_connection *nc);
     void onWebsocketFrame(struct mg_connection *nc, struct websocket_message *wm);
+    void onSend(struct mg_connection *nc);
+    void onTimer(struct mg_connection *nc);
     void onClose(struct mg_connection *nc);
 
+protected:
+    enum NetJobType {
+        NetJobReply
+    };
+
+    struct Websocket {
+        struct mg_connection   *nc;
+        uint32_t                id;     // 0 if slot free
+    };
+
+    uint32_t _websocketId(struct mg_connection *nc);
+    void _sendReply(struct mg_connection *nc, const void *data, size_t length, int flag);
+
 protected:
     bool                     _inited;
-    bool                     _websocketConnected;
-    struct mg_mgr            _manager;
+    uint8_t                  _websocketCount;
+    uint32_t                 _websocketSerial;
+    Websocket                _websockets[HTTP_WEBSOCKET_CAPACITY];
+    NetReactor              *_reactor;
+    struct mg_connection    *_listener;
+    HttpRouter               _httpRouter;
+    LiveStream               _liveStream;
+    WebAssetServer           _webAssets;
 };
 
 #endif // _HTTPSERVER_H
\ No newline at end of file
@@ -0,0 +1,155 @@
+/*
+ * LiveStream: periodic sensor push to subscribed websocket clients
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "LiveStream.h"
+#include "ProtocolDelegate.h"
+#include "mongoose/mongoose.h"
+#include <string.h>
+
+// wrap-safe deadline compare
+inline static bool timePassed(uint32_t nowMilli, uint32_t deadline)
+{
+    return (int32_t)(nowMilli - deadline) >= 0;
+}
+
+LiveStream::LiveStream()
+: _source(NULL)
+, _serializeCount(0)
+{
+    memset(_clients, 0, sizeof(_clients));
+    memset(_frames, 0, sizeof(_frames));
+}
+
+int LiveStream::_findClient(struct mg_connection *nc)
+{
+    for (int i = 0; i < LIVE_STREAM_CLIENT_CAPACITY; ++i) {
+        if (_clients[i].nc == nc) return i;
+    }
+    return -1;
+}
+
+bool LiveStream::subscribe(struct mg_connection *nc, uint32_t intervalMilli, int format, uint32_t nowMilli)
+{
+    if (intervalMilli < LIVE_STREAM_INTERVAL_MIN) intervalMilli = LIVE_STREAM_INTERVAL_MIN;
+    if (intervalMilli > LIVE_STREAM_INTERVAL_MAX) intervalMilli = LIVE_STREAM_INTERVAL_MAX;
+
+    int index = _findClient(nc);
+    if (index < 0) {
+        index = _findClient(NULL);
+        if (index < 0) return false;
+        memset(&_clients[index], 0, sizeof(Client));
+        _clients[index].nc = nc;
+    }
+    Client &client = _clients[index];
+    client.intervalMilli = intervalMilli;
+    client.format = format == PROTOCOL_MSG_FORMAT_BINARY ? PROTOCOL_MSG_FORMAT_BINARY : PROTOCOL_MSG_FORMAT_TEXT;
+    client.skipped = false;
+    // first frame after this poll, then on the interval grid
+    client.dueMilli = nowMilli;
+    return true;
+}
+
+void LiveStream::unsubscribe(struct mg_connection *nc)
+{
+    int index = _findClient(nc);
+    if (index >= 0) memset(&_clients[index], 0, sizeof(Client));
+}
+
+void LiveStream::clear()
+{
+    memset(_clients, 0, sizeof(_clients));
+}
+
+bool LiveStream::_congested(const Client &client)
+{
+    return client.nc->send_mbuf.len > LIVE_STREAM_BACKPRESSURE_BYTES;
+}
+
+const LiveStream::Frame * LiveStream::_frame(int format, uint32_t nowMilli)
+{
+    Frame &frame = _frames[format == PROTOCOL_MSG_FORMAT_BINARY ? 0 : 1];
+    if (frame.valid && !timePassed(nowMilli, frame.serializedMilli + LIVE_STREAM_FRAME_REUSE))
+        return &frame;
+
+    frame.length = _source ? _source->liveStreamFrame(frame.data, sizeof(frame.data), format) : 0;
+    frame.valid = frame.length > 0 && frame.length <= sizeof(frame.data);
+    frame.serializedMilli = nowMilli;
+    if (frame.valid) ++_serializeCount;
+    return frame.valid ? &frame : NULL;
+}
+
+void LiveStream::_send(Client &client, uint32_t nowMilli)
+{
+    const Frame *frame = _frame(client.format, nowMilli);
+    if (!frame) return;
+    mg_send_websocket_frame(client.nc,
+                            client.format == PROTOCOL_MSG_FORMAT_BINARY ? WEBSOCKET_OP_BINARY : WEBSOCKET_OP_TEXT,
+                            frame->data, frame->length);
+    client.skipped = false;
+    ++client.sentFrames;
+}
+
+void LiveStream::_due(Client &client, uint32_t nowMilli)
+{
+    client.dueMilli = nowMilli - nowMilli % client.intervalMilli + client.intervalMilli;
+    if (_congested(client)) {
+        // newest frame goes out once the buffer drains, this one is dropped
+        client.skipped = true;
+        ++client.droppedFrames;
+        return;
+    }
+    _send(client, nowMilli);
+}
+
+void LiveStream::process(uint32_t nowMilli)
+{
+    for (int i = 0; i < LIVE_STREAM_CLIENT_CAPACITY; ++i) {
+        Client &client = _clients[i];
+        if (client.nc && timePassed(nowMilli, client.dueMilli)) _due(client, nowMilli);
+    }
+}
+
+void LiveStream::onSent(struct mg_connection *nc, uint32_t nowMilli)
+{
+    int index = _findClient(nc);
+    if (index < 0) return;
+    Client &client = _clients[index];
+    if (client.skipped && !_congested(client)) _send(client, nowMilli);
+}
+
+uint32_t LiveStream::nextDueMilli(uint32_t nowMilli)
+{
+    uint32_t next = UINT32_MAX;
+    for (int i = 0; i < LIVE_STREAM_CLIENT_CAPACITY; ++i) {
+        const Client &client = _clients[i];
+        if (!client.nc) continue;
+        if (timePassed(nowMilli, client.dueMilli)) return 0;
+        uint32_t remain = client.dueMilli - nowMilli;
+        if (remain < next) next = remain;
+    }
+    return next;
+}
+
+uint8_t LiveStream::clientCount()
+{
+    uint8_t count = 0;
+    for (int i = 0; i < LIVE_STREAM_CLIENT_CAPACITY; ++i) {
+        if (_clients[i].nc) ++count;
+    }
+    return count;
+}
+
+bool LiveStream::clientStats(uint8_t index, LiveStreamClientStats &stats)
+{
+    if (index >= LIVE_STREAM_CLIENT_CAPACITY || !_clients[index].nc) return false;
+    const Client &client = _clients[index];
+    stats.intervalMilli = client.intervalMilli;
+    stats.format = client.format;
+    stats.queuedBytes = client.nc->send_mbuf.len;
+    stats.sentFrames = client.sentFrames;
+    stats.droppedFrames = client.droppedFrames;
+    return true;
+}
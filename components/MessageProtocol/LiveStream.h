@@ -0,0 +1,110 @@
+/*
+ * LiveStream: periodic sensor push to subscribed websocket clients
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _LIVE_STREAM_H
+#define _LIVE_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// mongoose is built with private flags, keep its types out of this header
+struct mg_connection;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ LiveStreamSource class
+/////////////////////////////////////////////////////////////////////////////////////////
+class LiveStreamSource
+{
+public:
+    // current snapshot in format (PROTOCOL_MSG_FORMAT_*) into buf, return length, 0 if none
+    virtual size_t liveStreamFrame(uint8_t *buf, size_t size, int format) = 0;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ LiveStream class
+/////////////////////////////////////////////////////////////////////////////////////////
+// Each subscribed client gets a frame every interval it asked for. Due times are aligned
+// to multiples of the interval, so clients with the same interval fall due together, and
+// a frame serialized once is sent to every client due within LIVE_STREAM_FRAME_REUSE.
+// A client whose send buffer holds more than LIVE_STREAM_BACKPRESSURE_BYTES is skipped
+// and its drop count grows; once the buffer drains it gets the newest frame only, so a
+// slow client never grows the heap beyond the threshold or holds up the others.
+// Reactor task only.
+
+#define LIVE_STREAM_CLIENT_CAPACITY         4
+#define LIVE_STREAM_FRAME_SIZE              512
+#define LIVE_STREAM_FRAME_REUSE             100     // ms
+#define LIVE_STREAM_INTERVAL_MIN            200     // ms
+#define LIVE_STREAM_INTERVAL_MAX            60000   // ms
+#define LIVE_STREAM_INTERVAL_DEFAULT        1000    // ms
+#define LIVE_STREAM_BACKPRESSURE_BYTES      2048
+
+struct LiveStreamClientStats
+{
+    uint32_t        intervalMilli;
+    int             format;
+    uint32_t        queuedBytes;        // in send buffer now
+    uint32_t        sentFrames;
+    uint32_t        droppedFrames;
+};
+
+class LiveStream
+{
+public:
+    LiveStream();
+
+    void setSource(LiveStreamSource *source) { _source = source; }
+
+    // subscribing again changes interval and format, false if no free slot
+    bool subscribe(struct mg_connection *nc, uint32_t intervalMilli, int format, uint32_t nowMilli);
+    void unsubscribe(struct mg_connection *nc);
+    void clear();
+
+    // push frames due by now
+    void process(uint32_t nowMilli);
+    // send buffer of nc went down, a skipped client catches up with the newest frame
+    void onSent(struct mg_connection *nc, uint32_t nowMilli);
+    // ms until next frame is due, UINT32_MAX if no client
+    uint32_t nextDueMilli(uint32_t nowMilli);
+
+    // stats
+    uint8_t clientCount();
+    bool clientStats(uint8_t index, LiveStreamClientStats &stats);  // false if slot unused
+    uint32_t serializeCount() { return _serializeCount; }
+
+protected:
+    struct Client {
+        struct mg_connection   *nc;
+        uint32_t                intervalMilli;
+        int                     format;
+        uint32_t                dueMilli;
+        bool                    skipped;
+        uint32_t                sentFrames;
+        uint32_t                droppedFrames;
+    };
+
+    struct Frame {
+        bool        valid;
+        uint32_t    serializedMilli;
+        size_t      length;
+        uint8_t     data[LIVE_STREAM_FRAME_SIZE];
+    };
+
+    int  _findClient(struct mg_connection *nc);
+    bool _congested(const Client &client);
+    const Frame * _frame(int format, uint32_t nowMilli);
+    void _send(Client &client, uint32_t nowMilli);
+    void _due(Client &client, uint32_t nowMilli);
+
+protected:
+    LiveStreamSource           *_source;
+    Client                      _clients[LIVE_STREAM_CLIENT_CAPACITY];
+    Frame                       _frames[2];     // by format, binary and text
+    uint32_t                    _serializeCount;
+};
+
+#endif // _LIVE_STREAM_H
@@ -0,0 +1,95 @@
+/*
+ * LoopWaker: wake a blocking mongoose poll from other tasks
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "LoopWaker.h"
+#include "AppLog.h"
+
+LoopWaker::LoopWaker()
+: _txSock(INVALID_SOCKET)
+, _rxConn(NULL)
+, _pending(false)
+, _wakeCount(0)
+{
+    memset(&_rxAddr, 0, sizeof(_rxAddr));
+}
+
+bool LoopWaker::init(struct mg_mgr *manager)
+{
+    if (_rxConn) return true;
+
+    sock_t rxSock = socket(AF_INET, SOCK_DGRAM, 0);
+    _txSock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (rxSock == INVALID_SOCKET || _txSock == INVALID_SOCKET) {
+        APP_LOGE("[LoopWaker]", "create socket failed");
+        if (rxSock != INVALID_SOCKET) closesocket(rxSock);
+        deinit();
+        return false;
+    }
+
+    // rx side bound to loopback with system chosen port
+    socklen_t len = sizeof(_rxAddr);
+    _rxAddr.sin_family = AF_INET;
+    _rxAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    _rxAddr.sin_port = 0;
+    if (bind(rxSock, (struct sockaddr *) &_rxAddr, sizeof(_rxAddr)) != 0 ||
+        getsockname(rxSock, (struct sockaddr *) &_rxAddr, &len) != 0) {
+        APP_LOGE("[LoopWaker]", "bind loopback socket failed");
+        closesocket(rxSock);
+        deinit();
+        return false;
+    }
+
+    // tx side never blocks the caller
+    fcntl(_txSock, F_SETFL, fcntl(_txSock, F_GETFL, 0) | O_NONBLOCK);
+
+    // manager owns rx socket from now on, closed by mg_mgr_free
+    _rxConn = mg_add_sock(manager, rxSock, _eventHandler);
+    if (!_rxConn) {
+        closesocket(rxSock);
+        deinit();
+        return false;
+    }
+    _rxConn->user_data = this;
+    return true;
+}
+
+void LoopWaker::deinit()
+{
+    if (_txSock != INVALID_SOCKET) {
+        closesocket(_txSock);
+        _txSock = INVALID_SOCKET;
+    }
+    _rxConn = NULL;
+    _pending = false;
+}
+
+void LoopWaker::wake()
+{
+    if (_txSock == INVALID_SOCKET || _pending.exchange(true)) return;
+    char b = 0;
+    if (sendto(_txSock, &b, 1, 0, (struct sockaddr *) &_rxAddr, sizeof(_rxAddr)) != 1) {
+        // nothing in flight to clear it, the next wake tries again
+        _pending = false;
+        return;
+    }
+    ++_wakeCount;
+}
+
+void LoopWaker::_eventHandler(struct mg_connection *nc, int ev, void *p)
+{
+    LoopWaker *waker = static_cast<LoopWaker*>(nc->user_data);
+    switch (ev) {
+        case MG_EV_RECV:
+            // clear pending before drain, later wakes send a new datagram
+            if (waker) waker->_pending = false;
+            mbuf_remove(&nc->recv_mbuf, nc->recv_mbuf.len);
+            break;
+
+        case MG_EV_CLOSE:
+            if (waker && waker->_rxConn == nc) waker->_rxConn = NULL;
+            break;
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * LoopWaker: wake a blocking mongoose poll from other tasks
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _LOOP_WAKER_H
+#define _LOOP_WAKER_H
+
+#include <atomic>
+#include "mongoose/mongoose.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ LoopWaker class
+/////////////////////////////////////////////////////////////////////////////////////////
+// A loopback udp socket is added to the mongoose manager, so the select() inside
+// mg_mgr_poll returns as soon as another task sends a byte to it. Wakes requested
+// while one is still pending are merged into that one.
+// Note: requires lwip loopback (CONFIG_LWIP_NETIF_LOOPBACK), on by default.
+
+class LoopWaker
+{
+public:
+    LoopWaker();
+
+    bool init(struct mg_mgr *manager);
+    void deinit();
+    bool inited() { return _rxConn != NULL; }
+
+    // safe to call from any task, never blocks
+    void wake();
+
+    // stats
+    uint32_t wakeCount() { return _wakeCount; }
+
+protected:
+    static void _eventHandler(struct mg_connection *nc, int ev, void *p);
+
+protected:
+    int                         _txSock;
+    struct sockaddr_in          _rxAddr;
+    struct mg_connection       *_rxConn;
+    std::atomic<bool>           _pending;       // set by any task, cleared by the poll
+    uint32_t                    _wakeCount;
+};
+
+#endif // _LOOP_WAKER_H
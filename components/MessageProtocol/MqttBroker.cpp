@@ -0,0 +1,499 @@
+/*
+ * MqttBroker: lightweight local MQTT broker for direct app connections
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "MqttBroker.h"
+
+#include "esp_system.h"
+#include "Config.h"
+#include "AppLog.h"
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ helper functions
+/////////////////////////////////////////////////////////////////////////////////////////
+// MQTT topic filter match, '+' one level, '#' rest levels (including parent level)
+static bool topicMatch(const char *filter, const char *topic, size_t topicLen)
+{
+    const char *end = topic + topicLen;
+    while (*filter) {
+        if (*filter == '#') return true;
+        if (*filter == '+') {
+            while (topic < end && *topic != '/') ++topic;
+            ++filter;
+        }
+        else {
+            if (topic >= end || *filter != *topic) {
+                // "a/#" also matches "a"
+                return topic >= end && filter[0] == '/' && filter[1] == '#' && filter[2] == '\0';
+            }
+            ++filter;
+            ++topic;
+        }
+    }
+    return topic == end;
+}
+
+// copy mg_str to null terminated buffer, false if too long
+static bool copyStr(char *target, size_t capacity, const char *p, size_t len)
+{
+    if (len >= capacity) return false;
+    memcpy(target, p, len);
+    target[len] = '\0';
+    return true;
+}
+
+inline static uint16_t getu16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ mongoose mqtt broker event handler
+/////////////////////////////////////////////////////////////////////////////////////////
+static void mongoose_mqtt_broker_event_handler(struct mg_connection *nc, int ev, void *p)
+{
+    struct mg_mqtt_message *msg = (struct mg_mqtt_message *) p;
+    MqttBroker *broker = static_cast<MqttBroker*>(nc->user_data);
+
+    switch (ev) {
+        case MG_EV_MQTT_CONNECT:
+            broker->onConnect(nc, msg);
+            break;
+
+        case MG_EV_MQTT_SUBSCRIBE:
+            broker->onSubscribe(nc, msg);
+            break;
+
+        case MG_EV_MQTT_UNSUBSCRIBE:
+            broker->onUnsubscribe(nc, msg);
+            break;
+
+        case MG_EV_MQTT_PUBLISH:
+            broker->onPublish(nc, msg);
+            break;
+
+        case MG_EV_MQTT_PUBREL:  // for QoS(2)
+            broker->onPubRel(nc, msg);
+            break;
+
+        case MG_EV_MQTT_PINGREQ:
+            broker->onPingReq(nc);
+            break;
+
+        case MG_EV_MQTT_DISCONNECT:
+            broker->onDisconnect(nc);
+            break;
+
+        case MG_EV_CLOSE:
+            broker->onClose(nc);
+            break;
+    }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ MqttBroker class
+/////////////////////////////////////////////////////////////////////////////////////////
+MqttBroker::MqttBroker()
+: _inited(false)
+, _reactor(NULL)
+, _listener(NULL)
+, _keepAliveCheckTick(0)
+{
+    for (int i = 0; i < MQTT_BROKER_SESSION_CAPACITY; ++i) {
+        _clearSession(&_sessions[i]);
+    }
+    for (int i = 0; i < MQTT_BROKER_RETAINED_CAPACITY; ++i) {
+        _retained[i].used = false;
+    }
+}
+
+void MqttBroker::init(NetReactor *reactor)
+{
+    if (!_inited) {
+        APP_LOGI("[MqttBroker]", "init, free RAM: %d bytes", esp_get_free_heap_size());
+        _reactor = reactor;
+        _reactor->init();
+        _reactor->addClient(this);
+        _inited = true;
+    }
+}
+
+void MqttBroker::deinit()
+{
+    if (_inited) {
+        if (_listener) _listener->flags |= MG_F_CLOSE_IMMEDIATELY;
+        _listener = NULL;
+        for (int i = 0; i < MQTT_BROKER_SESSION_CAPACITY; ++i) {
+            if (_sessions[i].conn) _sessions[i].conn->flags |= MG_F_CLOSE_IMMEDIATELY;
+            _clearSession(&_sessions[i]);
+        }
+        _inited = false;
+    }
+}
+
+void MqttBroker::start()
+{
+    if (_inited) {
+        struct mg_bind_opts opts;
+        memset(&opts, 0, sizeof(opts));
+        opts.user_data = static_cast<void*>(this);
+        struct mg_connection *nc;
+        APP_LOGI("[MqttBroker]", "listen on port %s", MQTT_BROKER_LISTEN_ADDR);
+        nc = mg_bind_opt(_reactor->manager(), MQTT_BROKER_LISTEN_ADDR, mongoose_mqtt_broker_event_handler, opts);
+        if (nc == NULL) {
+            APP_LOGE("[MqttBroker]", "listen failed");
+            return;
+        }
+        // accepted connections inherit mqtt protocol
+        mg_set_protocol_mqtt(nc);
+        _listener = nc;
+        _keepAliveCheckTick = xTaskGetTickCount();
+    }
+}
+
+size_t MqttBroker::sessionCount()
+{
+    size_t count = 0;
+    for (int i = 0; i < MQTT_BROKER_SESSION_CAPACITY; ++i) {
+        if (_sessions[i].conn) ++count;
+    }
+    return count;
+}
+
+MqttBroker::Session * MqttBroker::_session(struct mg_connection *nc)
+{
+    for (int i = 0; i < MQTT_BROKER_SESSION_CAPACITY; ++i) {
+        if (_sessions[i].conn == nc) return &_sessions[i];
+    }
+    return NULL;
+}
+
+void MqttBroker::_clearSession(Session *session)
+{
+    session->conn = NULL;
+    session->keepAlive = 0;
+    session->nextMsgId = 1;
+    session->clientId[0] = '\0';
+    for (int i = 0; i < MQTT_BROKER_SESSION_SUB_CAPACITY; ++i) {
+        session->subs[i].used = false;
+    }
+}
+
+uint32_t MqttBroker::nextPollTimeout()
+{
+    if (sessionCount() == 0) return UINT32_MAX;
+    TickType_t elapsed = xTaskGetTickCount() - _keepAliveCheckTick;
+    uint32_t elapsedMilli = elapsed * portTICK_PERIOD_MS;
+    return elapsedMilli >= MQTT_BROKER_KEEP_ALIVE_CHECK_INTERVAL ? 0 : MQTT_BROKER_KEEP_ALIVE_CHECK_INTERVAL - elapsedMilli;
+}
+
+void MqttBroker::onPolled()
+{
+    TickType_t now = xTaskGetTickCount();
+    if ((now - _keepAliveCheckTick) * portTICK_PERIOD_MS < MQTT_BROKER_KEEP_ALIVE_CHECK_INTERVAL) return;
+    _keepAliveCheckTick = now;
+
+    // drop sessions silent for 1.5 keep alive periods
+    for (int i = 0; i < MQTT_BROKER_SESSION_CAPACITY; ++i) {
+        Session &s = _sessions[i];
+        if (s.conn && s.keepAlive > 0 &&
+            (now - s.activeTick) * portTICK_PERIOD_MS > (uint32_t)s.keepAlive * 1500) {
+            APP_LOGI("[MqttBroker]", "session %s keep alive timeout", s.clientId);
+            s.conn->flags |= MG_F_CLOSE_IMMEDIATELY;
+        }
+    }
+}
+
+void MqttBroker::onNetJob(NetJob *job)
+{
+    if (job->type == NetJobPublish) {
+        publish(job->topic, job->payload(), job->length, job->qos, job->flag & MG_MQTT_RETAIN);
+    }
+}
+
+void MqttBroker::onConnect(struct mg_connection *nc, struct mg_mqtt_message *msg)
+{
+    Session *session = NULL;
+    char clientId[MQTT_BROKER_CLIENT_ID_MAX_LEN + 1];
+    if (!copyStr(clientId, sizeof(clientId), msg->client_id.p, msg->client_id.len)) {
+        mg_mqtt_connack(nc, MG_EV_MQTT_CONNACK_IDENTIFIER_REJECTED);
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+        return;
+    }
+
+    for (int i = 0; i < MQTT_BROKER_SESSION_CAPACITY; ++i) {
+        // same client id takes over old session
+        if (_sessions[i].conn && clientId[0] != '\0' && strcmp(_sessions[i].clientId, clientId) == 0) {
+            _sessions[i].conn->flags |= MG_F_CLOSE_IMMEDIATELY;
+            _clearSession(&_sessions[i]);
+        }
+        if (!session && !_sessions[i].conn) session = &_sessions[i];
+    }
+
+    if (!session) {
+        APP_LOGE("[MqttBroker]", "session table full, connection refused");
+        mg_mqtt_connack(nc, MG_EV_MQTT_CONNACK_SERVER_UNAVAILABLE);
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+        return;
+    }
+
+    _clearSession(session);
+    session->conn = nc;
+    session->keepAlive = msg->keep_alive_timer;
+    session->activeTick = xTaskGetTickCount();
+    strcpy(session->clientId, clientId);
+    mg_mqtt_connack(nc, MG_EV_MQTT_CONNACK_ACCEPTED);
+    APP_LOGI("[MqttBroker]", "session %s connected (nc: %p)", clientId, nc);
+}
+
+void MqttBroker::onSubscribe(struct mg_connection *nc, struct mg_mqtt_message *msg)
+{
+    Session *session = _session(nc);
+    if (!session) {
+        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        return;
+    }
+    session->activeTick = xTaskGetTickCount();
+
+    uint8_t granted[MQTT_BROKER_SESSION_SUB_CAPACITY];
+    int grantedSlot[MQTT_BROKER_SESSION_SUB_CAPACITY];
+    size_t count = 0;
+    struct mg_str topic;
+    uint8_t qos;
+    int pos = 0;
+    while (count < MQTT_BROKER_SESSION_SUB_CAPACITY &&
+           (pos = mg_mqtt_next_subscribe_topic(msg, &topic, &qos, pos)) != -1) {
+        granted[count] = 0x80;  // failure
+        grantedSlot[count] = -1;
+        int slot = -1;
+        for (int i = 0; i < MQTT_BROKER_SESSION_SUB_CAPACITY; ++i) {
+            Subscription &sub = session->subs[i];
+            if (sub.used && strlen(sub.filter) == topic.len && strncmp(sub.filter, topic.p, topic.len) == 0) {
+                slot = i;
+                break;
+            }
+            if (slot == -1 && !sub.used) slot = i;
+        }
+        if (slot != -1 && copyStr(session->subs[slot].filter, MQTT_BROKER_TOPIC_MAX_LEN + 1, topic.p, topic.len)) {
+            session->subs[slot].used = true;
+            session->subs[slot].qos = qos > 1 ? 1 : qos;
+            granted[count] = session->subs[slot].qos;
+            grantedSlot[count] = slot;
+        }
+        ++count;
+    }
+    mg_mqtt_suback(nc, granted, count, msg->message_id);
+
+    // retained messages for filters of this request only
+    for (size_t i = 0; i < count; ++i) {
+        if (grantedSlot[i] != -1) _sendRetained(session, session->subs[grantedSlot[i]].filter);
+    }
+}
+
+void MqttBroker::onUnsubscribe(struct mg_connection *nc, struct mg_mqtt_message *msg)
+{
+    Session *session = _session(nc);
+    if (!session) {
+        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        return;
+    }
+    session->activeTick = xTaskGetTickCount();
+
+    // mongoose leaves unsubscribe payload unparsed, message still at head of recv buffer
+    const uint8_t *p = (const uint8_t *) nc->recv_mbuf.buf;
+    const uint8_t *end = p + msg->len;
+    ++p;
+    while (p < end && (*p & 0x80)) ++p;
+    ++p;
+    if (end - p < 2) return;
+    uint16_t msgId = getu16(p);
+    p += 2;
+    while (end - p >= 2) {
+        uint16_t len = getu16(p);
+        p += 2;
+        if (end - p < len) break;
+        for (int i = 0; i < MQTT_BROKER_SESSION_SUB_CAPACITY; ++i) {
+            Subscription &sub = session->subs[i];
+            if (sub.used && strlen(sub.filter) == len && strncmp(sub.filter, (const char *)p, len) == 0)
+                sub.used = false;
+        }
+        p += len;
+    }
+    mg_mqtt_unsuback(nc, msgId);
+}
+
+void MqttBroker::onPublish(struct mg_connection *nc, struct mg_mqtt_message *msg)
+{
+    Session *session = _session(nc);
+    if (!session) {
+        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        return;
+    }
+    session->activeTick = xTaskGetTickCount();
+    bool retain = nc->recv_mbuf.buf[0] & MG_MQTT_RETAIN;
+
+#ifdef LOG_MQTT_RX
+    APP_LOGC("[MqttBroker]", "got incoming message (msg_id: %d) %.*s: %.*s", msg->message_id,
+             (int) msg->topic.len, msg->topic.p, (int) msg->payload.len, msg->payload.p);
+#endif
+
+    if (msg->qos == 1) mg_mqtt_puback(nc, msg->message_id);
+    else if (msg->qos == 2) mg_mqtt_pubrec(nc, msg->message_id);
+
+    // device side first, payload used in place
+    int handled = _topicRouter.dispatch(msg->topic.p, msg->topic.len, msg->payload.p, msg->payload.len);
+    if (handled == 0 && _msgInterpreter) {
+        _msgInterpreter->interpreteMqttMsg(msg->topic.p, msg->topic.len, msg->payload.p, msg->payload.len);
+    }
+
+    // then other app sessions
+    uint8_t qos = msg->qos > 1 ? 1 : msg->qos;
+    if (retain) _retain(msg->topic.p, msg->topic.len, msg->payload.p, msg->payload.len, qos);
+    _deliver(nc, msg->topic.p, msg->topic.len, msg->payload.p, msg->payload.len, qos);
+}
+
+void MqttBroker::onPubRel(struct mg_connection *nc, struct mg_mqtt_message *msg)
+{
+    mg_mqtt_pubcomp(nc, msg->message_id);
+}
+
+void MqttBroker::onPingReq(struct mg_connection *nc)
+{
+    Session *session = _session(nc);
+    if (session) session->activeTick = xTaskGetTickCount();
+    mg_mqtt_pong(nc);
+}
+
+void MqttBroker::onDisconnect(struct mg_connection *nc)
+{
+    nc->flags |= MG_F_SEND_AND_CLOSE;
+}
+
+void MqttBroker::onClose(struct mg_connection *nc)
+{
+    if (nc == _listener) {
+        _listener = NULL;
+        return;
+    }
+    Session *session = _session(nc);
+    if (session) {
+        APP_LOGI("[MqttBroker]", "session %s closed (nc: %p)", session->clientId, nc);
+        _clearSession(session);
+    }
+}
+
+void MqttBroker::publish(const char *topic, const void *data, size_t len, uint8_t qos, bool retain, bool dup)
+{
+    if (!_inited) return;
+
+    // other tasks hand publish over to reactor task
+    if (!_reactor->inReactorTask()) {
+        size_t topicLen = strlen(topic);
+        if (topicLen > NET_JOB_TOPIC_MAX_LEN) {
+            APP_LOGE("[MqttBroker]", "publish topic from other task too long (%s), dropped", topic);
+            return;
+        }
+        NetJob job;
+        job.client = this;
+        job.type = NetJobPublish;
+        job.qos = qos;
+        job.flag = retain ? MG_MQTT_RETAIN : 0;
+        job.userdata = NULL;
+        memcpy(job.topic, topic, topicLen + 1);
+        _reactor->submit(&job, data, len);
+        return;
+    }
+
+    size_t topicLen = strlen(topic);
+    if (qos > 1) qos = 1;
+    if (retain) _retain(topic, topicLen, data, len, qos);
+    _deliver(NULL, topic, topicLen, data, len, qos);
+#ifdef LOG_MQTT_TX
+    APP_LOGC("[MqttBroker]", "pub message (qos: %d) %s: %.*s", qos, topic, (int)len, (const char*)data);
+#endif
+}
+
+int MqttBroker::_subscriptionQos(Session *session, const char *topic, size_t topicLen)
+{
+    int qos = -1;
+    for (int i = 0; i < MQTT_BROKER_SESSION_SUB_CAPACITY; ++i) {
+        Subscription &sub = session->subs[i];
+        if (sub.used && sub.qos > qos && topicMatch(sub.filter, topic, topicLen)) qos = sub.qos;
+    }
+    return qos;
+}
+
+void MqttBroker::_deliver(struct mg_connection *from, const char *topic, size_t topicLen,
+                          const void *data, size_t len, uint8_t qos)
+{
+    char topicBuf[MQTT_BROKER_TOPIC_MAX_LEN + 1];
+    if (!copyStr(topicBuf, sizeof(topicBuf), topic, topicLen)) return;
+
+    for (int i = 0; i < MQTT_BROKER_SESSION_CAPACITY; ++i) {
+        Session *session = &_sessions[i];
+        if (!session->conn || session->conn == from) continue;
+        int subQos = _subscriptionQos(session, topic, topicLen);
+        if (subQos < 0) continue;
+        _sendTo(session, topicBuf, data, len, subQos < qos ? subQos : qos);
+    }
+}
+
+void MqttBroker::_sendTo(Session *session, const char *topic, const void *data, size_t len, uint8_t qos)
+{
+    // local link: QoS(1) acked by app but never retransmitted
+    uint16_t msgId = 0;
+    int flag = 0;
+    if (qos > 0) {
+        msgId = session->nextMsgId++;
+        if (session->nextMsgId == 0) session->nextMsgId = 1;
+    }
+    MG_MQTT_SET_QOS(flag, qos);
+    mg_mqtt_publish(session->conn, topic, msgId, flag, data, len);
+}
+
+void MqttBroker::_retain(const char *topic, size_t topicLen, const void *data, size_t len, uint8_t qos)
+{
+    if (topicLen > MQTT_BROKER_TOPIC_MAX_LEN || len > MQTT_BROKER_RETAINED_DATA_SIZE) return;
+
+    int slot = -1;
+    for (int i = 0; i < MQTT_BROKER_RETAINED_CAPACITY; ++i) {
+        if (_retained[i].used && strlen(_retained[i].topic) == topicLen &&
+            strncmp(_retained[i].topic, topic, topicLen) == 0) {
+            slot = i;
+            break;
+        }
+        if (slot == -1 && !_retained[i].used) slot = i;
+    }
+    if (slot == -1) {
+        APP_LOGE("[MqttBroker]", "retained table full, %.*s not retained", (int)topicLen, topic);
+        return;
+    }
+
+    // empty payload clears retained message
+    if (len == 0) {
+        _retained[slot].used = false;
+        return;
+    }
+    Retained &r = _retained[slot];
+    r.used = true;
+    r.qos = qos;
+    r.length = len;
+    copyStr(r.topic, sizeof(r.topic), topic, topicLen);
+    memcpy(r.data, data, len);
+}
+
+void MqttBroker::_sendRetained(Session *session, const char *filter)
+{
+    for (int i = 0; i < MQTT_BROKER_RETAINED_CAPACITY; ++i) {
+        Retained &r = _retained[i];
+        if (r.used && topicMatch(filter, r.topic, strlen(r.topic))) {
+            int qos = _subscriptionQos(session, r.topic, strlen(r.topic));
+            _sendTo(session, r.topic, r.data, r.length, qos < r.qos ? qos : r.qos);
+        }
+    }
+}
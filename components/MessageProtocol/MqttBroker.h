@@ -0,0 +1,126 @@
+/*
+ * MqttBroker: lightweight local MQTT broker for direct app connections
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _MQTT_BROKER_H
+#define _MQTT_BROKER_H
+
+#include "MqttClientDelegate.h"
+#include "NetReactor.h"
+
+#include "mongoose/mongoose.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ MqttBroker class
+/////////////////////////////////////////////////////////////////////////////////////////
+// Apps on the local network (AP mode) connect to the device itself and use the same
+// topics and binary command format as with the cloud broker. Messages published by
+// apps are routed straight into the topic router (no re-serialization), and device
+// publishes are delivered to subscribed app sessions. Sessions, subscriptions and
+// retained messages live in fixed in-memory tables; QoS is capped at 1.
+
+#define MQTT_BROKER_LISTEN_ADDR                 "1883"
+#define MQTT_BROKER_SESSION_CAPACITY            4
+#define MQTT_BROKER_SESSION_SUB_CAPACITY        8
+#define MQTT_BROKER_CLIENT_ID_MAX_LEN           23
+#define MQTT_BROKER_TOPIC_MAX_LEN               63
+#define MQTT_BROKER_RETAINED_CAPACITY           8
+#define MQTT_BROKER_RETAINED_DATA_SIZE          256
+#define MQTT_BROKER_KEEP_ALIVE_CHECK_INTERVAL   1000    // ms
+
+class MqttBroker : public MqttClientDelegate, public NetReactorClient
+{
+public:
+    MqttBroker();
+
+    // init and deinit, listener runs on reactor manager
+    void init(NetReactor *reactor);
+    void deinit();
+    void start();
+    size_t sessionCount();
+
+    // NetReactorClient
+    virtual uint32_t nextPollTimeout();
+    virtual void onPolled();
+    virtual void onNetJob(NetJob *job);
+
+    // ProtocolDelegate, publish is safe from other tasks
+    virtual NetReactor * reactor() { return _reactor; }
+
+    // MqttClientDelegate interface, device receives every routed topic, no subscription needed
+    virtual void addSubTopic(const char *topic, uint8_t qos = 0) {}
+    virtual void subscribeTopics() {}
+    virtual bool hasTopicsToSubscribe() { return false; }
+
+    virtual void addUnsubTopic(const char *topic) {}
+    virtual void unsubscribeTopics() {}
+    virtual bool hasTopicsToUnsubscribe() { return false; }
+
+    virtual void publish(const char *topic,
+                         const void *data,
+                         size_t      len,
+                         uint8_t     qos,
+                         bool        retain = false,
+                         bool        dup = false);
+    virtual bool hasUnackPub() { return false; }
+
+public:
+    // for event handler
+    void onConnect(struct mg_connection *nc, struct mg_mqtt_message *msg);
+    void onSubscribe(struct mg_connection *nc, struct mg_mqtt_message *msg);
+    void onUnsubscribe(struct mg_connection *nc, struct mg_mqtt_message *msg);
+    void onPublish(struct mg_connection *nc, struct mg_mqtt_message *msg);
+    void onPubRel(struct mg_connection *nc, struct mg_mqtt_message *msg);
+    void onPingReq(struct mg_connection *nc);
+    void onDisconnect(struct mg_connection *nc);
+    void onClose(struct mg_connection *nc);
+
+protected:
+    enum NetJobType {
+        NetJobPublish
+    };
+
+    struct Subscription {
+        bool        used;
+        uint8_t     qos;
+        char        filter[MQTT_BROKER_TOPIC_MAX_LEN + 1];
+    };
+
+    struct Session {
+        struct mg_connection   *conn;
+        TickType_t              activeTick;
+        uint16_t                keepAlive;      // seconds
+        uint16_t                nextMsgId;
+        char                    clientId[MQTT_BROKER_CLIENT_ID_MAX_LEN + 1];
+        Subscription            subs[MQTT_BROKER_SESSION_SUB_CAPACITY];
+    };
+
+    struct Retained {
+        bool        used;
+        uint8_t     qos;
+        uint16_t    length;
+        char        topic[MQTT_BROKER_TOPIC_MAX_LEN + 1];
+        uint8_t     data[MQTT_BROKER_RETAINED_DATA_SIZE];
+    };
+
+    Session * _session(struct mg_connection *nc);
+    void _clearSession(Session *session);
+    int  _subscriptionQos(Session *session, const char *topic, size_t topicLen);
+    void _deliver(struct mg_connection *from, const char *topic, size_t topicLen,
+                  const void *data, size_t len, uint8_t qos);
+    void _sendTo(Session *session, const char *topic, const void *data, size_t len, uint8_t qos);
+    void _retain(const char *topic, size_t topicLen, const void *data, size_t len, uint8_t qos);
+    void _sendRetained(Session *session, const char *filter);
+
+protected:
+    bool                        _inited;
+    NetReactor                 *_reactor;
+    struct mg_connection       *_listener;
+    TickType_t                  _keepAliveCheckTick;
+    Session                     _sessions[MQTT_BROKER_SESSION_CAPACITY];
+    Retained                    _retained[MQTT_BROKER_RETAINED_CAPACITY];
+};
+
+#endif // _MQTT_BROKER_H
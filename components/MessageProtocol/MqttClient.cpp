@@ -11,6 +11,8 @@
 #include "Wifi.h"
 #include "SNTP.h"
 #include "System.h"
+#include "SessionCache.h"
+#include "NvsFlash.h"
 
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -37,19 +39,26 @@ void printTopics(const char **topics, uint16_t count)
 static uint16_t _mqttMsgId = 0;
 inline static uint16_t createMsgId() { return _mqttMsgId++; }
 
-/////////////////////////////////////////////////////////////////////////////////////////
-// ------ mongoose mqtt event handler
-/////////////////////////////////////////////////////////////////////////////////////////
-void reconnectCountDelay(TickType_t ticks)
+// ms from now until tick deadline, 0 if passed
+inline static uint32_t milliUntil(TickType_t deadline)
 {
-    int seconds = ticks / 1000;
-    while (seconds > 0) {
-        APP_LOGI("[MqttClient]", "reconnect in %d second%s", seconds, seconds > 1 ? "s" : "");
-        vTaskDelay(1000/portTICK_RATE_MS);
-        --seconds;
-    }
+    TickType_t now = xTaskGetTickCount();
+    return (int32_t)(deadline - now) > 0 ? (deadline - now) * portTICK_PERIOD_MS : 0;
 }
 
+inline static uint32_t nowMilli()
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+inline static bool tickPassed(TickType_t deadline)
+{
+    return (int32_t)(xTaskGetTickCount() - deadline) >= 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ mongoose mqtt event handler
+/////////////////////////////////////////////////////////////////////////////////////////
 static void mongoose_mqtt_event_handler(struct mg_connection *nc, int ev, void *p)
 {
     struct mg_mqtt_message *msg = (struct mg_mqtt_message *) p;
@@ -57,11 +66,11 @@ static void mongoose_mqtt_event_handler(struct mg_connection *nc, int ev, void *
 
     switch (ev) {
         case MG_EV_CONNECT:
-            mqttClient->onConnect(nc);
+            mqttClient->onConnect(nc, *(int *) p);
             break;
 
         case MG_EV_MQTT_CONNACK:
-            mqttClient->onConnAck(msg);
+            mqttClient->onConnAck(nc, msg);
             break;
 
         case MG_EV_MQTT_PUBACK:  // for QoS(1)
@@ -103,44 +112,14 @@ static void mongoose_mqtt_event_handler(struct mg_connection *nc, int ev, void *
 }
 
 
-/////////////////////////////////////////////////////////////////////////////////////////
-// alive guard check task
-/////////////////////////////////////////////////////////////////////////////////////////
-#define ALIVE_GUARD_TASK_PRIORITY  3
-static xSemaphoreHandle _closeProcessSemaphore = 0;
-static TaskHandle_t _aliveGuardTaskHandle = 0;
-static void alive_guard_task(void *pvParams)
-{
-    MqttClient *client = static_cast<MqttClient*>(pvParams);
-    TickType_t delayTicks = client->aliveGuardInterval() * 1000;
-    while (true) {
-        client->aliveGuardCheck();
-        vTaskDelay(delayTicks / portTICK_PERIOD_MS);
-    }
-}
-
-
-/////////////////////////////////////////////////////////////////////////////////////////
-// Message pub pool process loop task
-/////////////////////////////////////////////////////////////////////////////////////////
-#define MSG_POOL_TASK_PRIORITY     3
-static TaskHandle_t _msgTaskHandle = 0;
-static void msg_pool_task(void *pvParams)
-{
-    MessagePubPool *pool = static_cast<MessagePubPool*>(pvParams);
-    while (true) {
-        pool->processLoop();
-        vTaskDelay(pool->loopInterval() / portTICK_PERIOD_MS);
-    }
-}
-
-
 /////////////////////////////////////////////////////////////////////////////////////////
 // MQTT over TSL
 /////////////////////////////////////////////////////////////////////////////////////////
 #if MG_ENABLE_SSL
 
 #include "certs/mqtt_crt.h"
+#include "certs/mqtt_user.h"
+#include "certs/mqtt_passwd.h"
 #include "certs/ski.h"
 #include "Crypto.h"
 
@@ -152,11 +131,19 @@ static void msg_pool_task(void *pvParams)
 
 #define CRT_CACHE_SIZE 2048
 #define VSIZE 32
-char            _crtCache[CRT_CACHE_SIZE];
-size_t          _crtLength = 0;
+#define CREDENTIAL_CACHE_SIZE 32
+
+// decrypted once per boot, file local, reused by every reconnect
+static char     _crtCache[CRT_CACHE_SIZE];
+static size_t   _crtLength = 0;
+static char     _userCache[CREDENTIAL_CACHE_SIZE];
+static char     _passCache[CREDENTIAL_CACHE_SIZE];
+static bool     _credentialsDecrypted = false;
 
-void _decryptCrt()
+static void _decryptCredentials()
 {
+    if (_credentialsDecrypted) return;
+
     uint32_t sih = 1027434326;
     uint32_t sil = 1027424597;
 
@@ -189,6 +176,12 @@ void _decryptCrt()
     // APP_LOGC("[decryptCrt]", "mqttKey len: %d, crtCahe len: %d", strlen(mqttKey), strlen(_crtCache));
     // APP_LOGC("[decryptCrt]", "decrypted crt: \n%s", _crtCache);
 #endif
+
+    unsigned char u1[] = "CkECr+xGO4YKbicw";
+    unsigned char u2[] = "cBh++uagobC8s1bK";
+    decryptBase64(mqttUser,   strlen(mqttUser),   '\0', u1, u2, _userCache, &len);
+    decryptBase64(mqttPasswd, strlen(mqttPasswd), '\0', u1, u2, _passCache, &len);
+    _credentialsDecrypted = true;
 }
 
 #endif
@@ -197,17 +190,19 @@ void _decryptCrt()
 /////////////////////////////////////////////////////////////////////////////////////////
 // ------ MqttClient class
 /////////////////////////////////////////////////////////////////////////////////////////
-// FreeRTOS semaphore
-static xSemaphoreHandle _pubSemaphore = 0;
-
 // --- default values
 #define MQTT_KEEP_ALIVE_DEFAULT_VALUE                           60     // 60 seconds
 #define MQTT_ALIVE_GUARD_REGULAR_INTERVAL_DEFAULT               (MQTT_KEEP_ALIVE_DEFAULT_VALUE / 2)
 #define MQTT_ALIVE_GUARD_OFFLINE_INTERVAL_DEFAULT               5
 #define MQTT_RECONNECT_DEFAULT_DELAY_TICKS                      10000   // 1 second
 #define MQTT_SERVER_UNAVAILABLE_RECONNECT_DEFAULT_DELAY_TICKS   300000 // 5 minutes
+#define MQTT_WIFI_WAIT_RECONNECT_DELAY_TICKS                    1000   // 1 second
 // static const char* MQTT_SERVER_ADDR =                           "192.168.0.99:8883";
 static const char* MQTT_SERVER_ADDR =                           "appsgenuine.com:8883";
+// local edge broker, preferred over cloud broker while healthy and faster; build time
+// default until a site sets its own with SetEdgeBrokers command
+// #define MQTT_EDGE_SERVER_ADDR                                   "192.168.0.99:8883"
+#define MQTT_EDGE_SERVERS_TAG                                   "mqttEdges"
 
 MqttClient::MqttClient()
 : _inited(false)
@@ -217,9 +212,26 @@ MqttClient::MqttClient()
 , _reconnectTicksOnDisconnection(MQTT_RECONNECT_DEFAULT_DELAY_TICKS)
 , _aliveGuardInterval(MQTT_ALIVE_GUARD_REGULAR_INTERVAL_DEFAULT)
 , _serverAddress(MQTT_SERVER_ADDR)
+, _brokerIndex(0)
+, _connectStartTick(0)
+, _connectedTick(0)
+, _pingSentTick(0)
+, _pingPending(false)
+, _connAckReceived(false)
+, _connectCount(0)
 , _clientId(System::instance()->uid())
-{
-    // init hand shake option
+, _reactor(NULL)
+, _connection(NULL)
+, _reconnectPending(false)
+, _reconnectTick(0)
+, _aliveGuardTick(0)
+, _msgPoolTick(0)
+, _publishCount(0)
+, _pubAckCount(0)
+, _retransmitCount(0)
+{
+    // init hand shake option, persistent session (clean session off) so broker keeps
+    // subscriptions and queued QoS 1 messages across reconnects
     _handShakeOpt.flags = 0;
     _handShakeOpt.keep_alive = MQTT_KEEP_ALIVE_DEFAULT_VALUE;
     _handShakeOpt.will_topic = NULL;
@@ -227,6 +239,13 @@ MqttClient::MqttClient()
     _handShakeOpt.user_name = NULL;
     _handShakeOpt.password = NULL;
 
+    memset(&_edgeServers, 0, sizeof(_edgeServers));
+#ifdef MQTT_EDGE_SERVER_ADDR
+    _edgeServers.count = 1;
+    strncpy(_edgeServers.addresses[0], MQTT_EDGE_SERVER_ADDR, BROKER_ADDRESS_MAX_LEN);
+#endif
+    _applyBrokers(_edgeServers, MQTT_SERVER_ADDR);
+
     // init topic cache
     _topicsSubscribed.clear();
     _topicsToSubscribe.clear();
@@ -235,15 +254,95 @@ MqttClient::MqttClient()
     // message publish pool
     _msgPubPool.setPubDelegate(this);
 
+    // coalesced publish
+    _pubCoalescer.setDelegate(this);
+    _pubCoalescer.setBatchTopic(MqttClientDelegate::batchTopic());
+
 #if MG_ENABLE_SSL
-    // crt
-    _decryptCrt();
+    // crt and user/password
+    _decryptCredentials();
+    _handShakeOpt.user_name = _userCache;
+    _handShakeOpt.password = _passCache;
 #endif
 }
 
 void MqttClient::setServerAddress(const char* serverAddress)
 {
-    _serverAddress = serverAddress;
+    _applyBrokers(_edgeServers, serverAddress);
+}
+
+bool MqttClient::addServerAddress(const char* serverAddress)
+{
+    return _brokers.addBroker(serverAddress);
+}
+
+bool MqttClient::setEdgeServerAddresses(const char * const *addresses, uint8_t count)
+{
+    if (count > MQTT_EDGE_SERVER_CAPACITY) return false;
+    MqttEdgeServers edges;
+    memset(&edges, 0, sizeof(edges));
+    for (uint8_t i = 0; i < count; ++i) {
+        size_t length = strlen(addresses[i]);
+        if (length == 0 || length > BROKER_ADDRESS_MAX_LEN) return false;
+        memcpy(edges.addresses[edges.count++], addresses[i], length + 1);
+    }
+    if (!NvsFlash::saveData(MQTT_EDGE_SERVERS_TAG, &edges, sizeof(edges))) {
+        APP_LOGE("[MqttClient]", "save edge brokers failed");
+    }
+    if (_inited && !_reactor->inReactorTask()) {
+        NetJob job;
+        job.client = this;
+        job.type = NetJobEdgeServers;
+        job.qos = 0;
+        job.flag = 0;
+        job.userdata = NULL;
+        job.topic[0] = '\0';
+        return _reactor->submit(&job, &edges, sizeof(edges));
+    }
+    _applyBrokers(edges, _brokers.address(_brokers.count() - 1));
+    return true;
+}
+
+void MqttClient::_loadEdgeServers()
+{
+    // none saved keeps the build time default
+    MqttEdgeServers edges;
+    if (!NvsFlash::loadData(MQTT_EDGE_SERVERS_TAG, &edges, sizeof(edges))) return;
+    if (edges.count > MQTT_EDGE_SERVER_CAPACITY) return;
+    for (uint8_t i = 0; i < edges.count; ++i) edges.addresses[i][BROKER_ADDRESS_MAX_LEN] = '\0';
+    _applyBrokers(edges, _brokers.address(_brokers.count() - 1));
+}
+
+void MqttClient::_applyBrokers(const MqttEdgeServers &edges, const char *cloudAddress)
+{
+    // both may point into the list rebuilt here, copy first
+    char cloud[BROKER_ADDRESS_MAX_LEN + 1] = {0};
+    char current[BROKER_ADDRESS_MAX_LEN + 1] = {0};
+    strncpy(cloud, cloudAddress, BROKER_ADDRESS_MAX_LEN);
+    if (_serverAddress) strncpy(current, _serverAddress, BROKER_ADDRESS_MAX_LEN);
+    if (&edges != &_edgeServers) memcpy(&_edgeServers, &edges, sizeof(_edgeServers));
+
+    // health and latency start over
+    _brokers.clear();
+    for (uint8_t i = 0; i < _edgeServers.count; ++i) {
+        if (!_brokers.addBroker(_edgeServers.addresses[i])) {
+            APP_LOGE("[MqttClient]", "edge broker %d not added", i);
+        }
+    }
+    if (!_brokers.addBroker(cloud)) APP_LOGE("[MqttClient]", "cloud broker address too long");
+
+    int index = _brokers.indexOf(current);
+    if (index < 0) {
+        // broker in use no longer listed, reconnect to a listed one
+        index = _brokers.count() > 0 ? _brokers.count() - 1 : 0;
+        if (_connection) {
+            APP_LOGI("[MqttClient]", "broker in use removed, reconnect");
+            _connAckReceived = true;    // not a connect failure of any listed broker
+            _connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+        }
+    }
+    _brokerIndex = index;
+    _serverAddress = _brokers.address(_brokerIndex);
 }
 
 void MqttClient::setOnServerUnavailableReconnectDelay(TickType_t delayTicks)
@@ -300,13 +399,17 @@ void MqttClient::setLastWill(const char* topic, uint8_t qos, const char* msg, bo
     MG_MQTT_SET_WILL_QOS(_handShakeOpt.flags, qos);
 }
 
-void MqttClient::init()
+void MqttClient::init(NetReactor *reactor)
 {
     if (!_inited) {
         // APP_LOGI("[MqttClient]", "init client (Mongoose version: %s, Free RAM: %d bytes)",
         //                           MG_VERSION, esp_get_free_heap_size());
         APP_LOGI("[MqttClient]", "init, free RAM: %d bytes", esp_get_free_heap_size());
-        mg_mgr_init(&_manager, NULL);
+        _reactor = reactor;
+        _reactor->init();
+        _reactor->addClient(this);
+        _loadEdgeServers();
+        _pubCoalescer.init();
         _inited = true;
     }
 }
@@ -315,15 +418,35 @@ void MqttClient::deinit()
 {
     if (_inited) {
         APP_LOGI("[MqttClient]", "deinit client");
-        mg_mgr_free(&_manager);
+        if (_connection) _connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+        _connection = NULL;
+        _reconnectPending = false;
         _inited = false;
     }
 }
 
+void MqttClient::_scheduleReconnect(TickType_t delayTicks)
+{
+    APP_LOGI("[MqttClient]", "reconnect in %d seconds", delayTicks / 1000);
+    _reconnectTick = xTaskGetTickCount() + delayTicks / portTICK_PERIOD_MS;
+    _reconnectPending = true;
+}
+
 bool MqttClient::_makeConnection()
 {
     if (_inited) {
-        Wifi::instance()->waitConnected(); // block wait wifi
+        // shared loop must not block on wifi, retry later instead
+        if (!Wifi::instance()->connected()) {
+            _reconnectTick = xTaskGetTickCount() + MQTT_WIFI_WAIT_RECONNECT_DELAY_TICKS / portTICK_PERIOD_MS;
+            _reconnectPending = true;
+            return false;
+        }
+        // healthy broker with lowest latency
+        _brokerIndex = _brokers.select(nowMilli());
+        _serverAddress = _brokers.address(_brokerIndex);
+        _connectStartTick = xTaskGetTickCount();
+        _connAckReceived = false;
+        _pingPending = false;
         // set connect opts
         struct mg_connect_opts opts;
         memset(&opts, 0, sizeof(opts));
@@ -333,15 +456,28 @@ bool MqttClient::_makeConnection()
         // opts.ssl_key = mqttKey;
         opts.ssl_ca_cert = _crtCache;
 #endif
+        // cached broker ip skips dns, host name still used for tls server name check
+        const char *address = _serverAddress;
+        char resolved[24];
+        char host[BROKER_HOST_MAX_LEN + 1];
+        if (SessionCache::instance()->resolvedBrokerAddress(_serverAddress, resolved, sizeof(resolved),
+                                                            host, sizeof(host))) {
+            address = resolved;
+            opts.ssl_server_name = host;
+        }
         // create connection
         struct mg_connection *nc;
         // APP_LOGI("[MqttClient]", "try to connect to server: %s", _serverAddress);
-        APP_LOGI("[MqttClient]", "try to connect to server: ***");
-        nc = mg_connect_opt(&_manager, _serverAddress, mongoose_mqtt_event_handler, opts);
+        APP_LOGI("[MqttClient]", "try to connect to server: *** (broker %d)%s", _brokerIndex,
+                 address == resolved ? " (cached address)" : "");
+        nc = mg_connect_opt(_reactor->manager(), address, mongoose_mqtt_event_handler, opts);
         if (nc == NULL) {
             APP_LOGE("[MqttClient]", "connect to server failed");
             return false;
         }
+        // abbreviated handshake if a previous tls session is cached
+        SessionCache::instance()->restoreTlsSession(nc, _serverAddress);
+        _connection = nc;
         return true;
     }
     APP_LOGE("[MqttClient]", "must be inited before connection");
@@ -352,10 +488,53 @@ void MqttClient::start()
 {
     // SNTP::waitSynced();    // block wait time sync
     _makeConnection();
-    _pubSemaphore = xSemaphoreCreateMutex();
-    _closeProcessSemaphore = xSemaphoreCreateMutex();
-    xTaskCreate(&alive_guard_task, "alive_guard_task", 4096, this, ALIVE_GUARD_TASK_PRIORITY, &_aliveGuardTaskHandle);
-    xTaskCreate(&msg_pool_task, "msg_pool_task", 4096, &_msgPubPool, MSG_POOL_TASK_PRIORITY, &_msgTaskHandle);
+    // alive guard and pub pool checks run in reactor loop
+    _aliveGuardTick = xTaskGetTickCount() + _aliveGuardInterval * 1000 / portTICK_PERIOD_MS;
+    _msgPoolTick = xTaskGetTickCount() + _msgPubPool.loopInterval() / portTICK_PERIOD_MS;
+}
+
+uint32_t MqttClient::nextPollTimeout()
+{
+    uint32_t timeout = _pubCoalescer.nextFlushMilli();
+    uint32_t milli = milliUntil(_aliveGuardTick);
+    if (milli < timeout) timeout = milli;
+    milli = milliUntil(_msgPoolTick);
+    if (milli < timeout) timeout = milli;
+    if (_reconnectPending) {
+        milli = milliUntil(_reconnectTick);
+        if (milli < timeout) timeout = milli;
+    }
+    return timeout;
+}
+
+void MqttClient::onPolled()
+{
+    if (!_inited) return;
+    _pubCoalescer.processLoop();
+    if (_reconnectPending && tickPassed(_reconnectTick)) {
+        _reconnectPending = false;
+        _makeConnection();
+    }
+    if (tickPassed(_aliveGuardTick)) {
+        aliveGuardCheck();
+        _aliveGuardTick = xTaskGetTickCount() + _aliveGuardInterval * 1000 / portTICK_PERIOD_MS;
+    }
+    if (tickPassed(_msgPoolTick)) {
+        _msgPubPool.processLoop();
+        _msgPoolTick = xTaskGetTickCount() + _msgPubPool.loopInterval() / portTICK_PERIOD_MS;
+    }
+}
+
+void MqttClient::onNetJob(NetJob *job)
+{
+    if (job->type == NetJobPublish) {
+        publish(job->topic, job->payload(), job->length, job->qos, job->flag & MG_MQTT_RETAIN);
+    }
+    else if (job->type == NetJobEdgeServers && job->length == sizeof(MqttEdgeServers)) {
+        MqttEdgeServers edges;
+        memcpy(&edges, job->payload(), sizeof(edges));
+        _applyBrokers(edges, _brokers.address(_brokers.count() - 1));
+    }
 }
 
 const SubTopics & MqttClient::topicsSubscribed()
@@ -373,7 +552,7 @@ void MqttClient::subscribeTopics()
     if (_connected && _topicsToSubscribe.count > 0) {
         APP_LOGI("[MqttClient]", "subscribe to topics:");
         printTopics(_topicsToSubscribe.topics, _topicsToSubscribe.count);
-        mg_mqtt_subscribe(_manager.active_connections,
+        mg_mqtt_subscribe(_connection,
                           _topicsToSubscribe.topics,
                           _topicsToSubscribe.count,
                           createMsgId());
@@ -390,34 +569,54 @@ void MqttClient::unsubscribeTopics()
     if (_connected && _topicsToUnsubscribe.count > 0) {
         APP_LOGI("[MqttClient]", "unsubscribe to topics:");
         printTopics(_topicsToUnsubscribe.topics, _topicsToUnsubscribe.count);
-        mg_mqtt_unsubscribe(_manager.active_connections,
+        mg_mqtt_unsubscribe(_connection,
                             const_cast<char**>(_topicsToUnsubscribe.topics),
                             _topicsToUnsubscribe.count,
                             createMsgId());
     }
 }
 
-#define MSG_PUB_SEMAPHORE_TAKE_WAIT_TICKS  5000   /// TickType_t
-
 void MqttClient::publish(const char *topic, const void *data, size_t len, uint8_t qos, bool retain, bool dup)
 {
     if (!_connected) return;
-    if (xSemaphoreTake(_pubSemaphore, MSG_PUB_SEMAPHORE_TAKE_WAIT_TICKS)) {
-        uint16_t msgId = qos > 0 ? createMsgId() : 0;
-        int flag = 0;
-        if (retain) flag |= MG_MQTT_RETAIN;
-        if (dup) flag |= MG_MQTT_DUP;
-        MG_MQTT_SET_QOS(flag, qos);
-        mg_mqtt_publish(_manager.active_connections, topic, msgId, flag, data, len);
-        if (qos > 0) {
-            _msgPubPool.addMessage(msgId, topic, data, len, qos, retain);
-        }
-        xSemaphoreGive(_pubSemaphore);
+
+    // other tasks hand publish over to reactor task
+    if (!_reactor->inReactorTask()) {
+        _submitPublish(topic, data, len, qos, retain);
+        return;
+    }
+
+    uint16_t msgId = qos > 0 ? createMsgId() : 0;
+    int flag = 0;
+    if (retain) flag |= MG_MQTT_RETAIN;
+    if (dup) flag |= MG_MQTT_DUP;
+    MG_MQTT_SET_QOS(flag, qos);
+    mg_mqtt_publish(_connection, topic, msgId, flag, data, len);
+    ++_publishCount;
+    if (qos > 0) {
+        _msgPubPool.addMessage(msgId, topic, data, len, qos, retain);
+    }
 #ifdef LOG_MQTT_TX
-        APP_LOGC("[MqttClient]", "pub message (msg_id: %d, qos: %d) %s: %.*s", msgId, qos, topic,
-                 len, (const char*)data);
+    APP_LOGC("[MqttClient]", "pub message (msg_id: %d, qos: %d) %s: %.*s", msgId, qos, topic,
+             len, (const char*)data);
 #endif
+}
+
+bool MqttClient::_submitPublish(const char *topic, const void *data, size_t len, uint8_t qos, bool retain)
+{
+    size_t topicLen = strlen(topic);
+    if (topicLen > NET_JOB_TOPIC_MAX_LEN) {
+        APP_LOGE("[MqttClient]", "publish topic from other task too long (%s), dropped", topic);
+        return false;
     }
+    NetJob job;
+    job.client = this;
+    job.type = NetJobPublish;
+    job.qos = qos;
+    job.flag = retain ? MG_MQTT_RETAIN : 0;
+    job.userdata = NULL;
+    memcpy(job.topic, topic, topicLen + 1);
+    return _reactor->submit(&job, data, len);
 }
 
 bool MqttClient::hasUnackPub()
@@ -426,30 +625,54 @@ bool MqttClient::hasUnackPub()
     return _msgPubPool.poolMessageCount() > 0;
 }
 
+bool MqttClient::coalescePublish(const char *topic, const void *data, size_t len, uint8_t qos)
+{
+    if (_pubCoalescer.add(topic, data, len, qos)) {
+        // let loop pick up new window end
+        if (_reactor) _reactor->wake();
+        return true;
+    }
+    // not coalescable (too large or slots full): publish right away
+    publish(topic, data, len, qos);
+    return false;
+}
+
+void MqttClient::publishCoalesced(const char *topic, const void *data, size_t len, uint8_t qos)
+{
+    publish(topic, data, len, qos);
+}
+
 void MqttClient::repubMessage(PoolMessage *message)
 {
     if (!_connected) return;
-    if (xSemaphoreTake(_pubSemaphore, MSG_PUB_SEMAPHORE_TAKE_WAIT_TICKS)) {
-        int flag = MG_MQTT_DUP;
-        if (message->retain) flag |= MG_MQTT_RETAIN;
-        MG_MQTT_SET_QOS(flag, message->qos);
-        mg_mqtt_publish(_manager.active_connections,
-                        message->topic,
-                        message->msgId,
-                        flag,
-                        message->data,
-                        message->length);
-        message->pubCount++;
-        xSemaphoreGive(_pubSemaphore);
+    int flag = MG_MQTT_DUP;
+    if (message->retain) flag |= MG_MQTT_RETAIN;
+    MG_MQTT_SET_QOS(flag, message->qos);
+    mg_mqtt_publish(_connection,
+                    message->topic,
+                    message->msgId,
+                    flag,
+                    message->data,
+                    message->length);
+    message->pubCount++;
+    ++_retransmitCount;
 #ifdef LOG_MQTT_RETX
-        APP_LOGE("[MqttClient]", "repub message (msg_id: %d) %s: %.*s", message->msgId,
-                 message->topic, message->length, (const char*)message->data);
+    APP_LOGE("[MqttClient]", "repub message (msg_id: %d) %s: %.*s", message->msgId,
+             message->topic, message->length, (const char*)message->data);
 #endif
-    }
 }
 
-void MqttClient::onConnect(struct mg_connection *nc)
+void MqttClient::onConnect(struct mg_connection *nc, int status)
 {
+    if (status != 0) {
+        APP_LOGE("[MqttClient]", "connect to server failed: %d", status);
+        // a stale cached session or address may be the cause, next attempt starts over
+        SessionCache::instance()->invalidateTlsSession(_serverAddress);
+        SessionCache::instance()->invalidateBrokerAddress(_serverAddress);
+        return;
+    }
+    SessionCache::instance()->saveTlsSession(nc, _serverAddress);
+    SessionCache::instance()->saveBrokerAddress(_serverAddress, nc->sa.sin.sin_addr.s_addr);
     // APP_LOGI("[MqttClient]", "... connecting to server: %s (client id: %s, nc: %p)",
     //                          _serverAddress, _clientId, nc);
     APP_LOGI("[MqttClient]", "... connecting to server: *** (client id: uid, nc: %p)", nc);
@@ -458,11 +681,18 @@ void MqttClient::onConnect(struct mg_connection *nc)
     mg_send_mqtt_handshake_opt(nc, _clientId, _handShakeOpt);
 }
 
-void MqttClient::onConnAck(struct mg_mqtt_message *msg)
+void MqttClient::onConnAck(struct mg_connection *nc, struct mg_mqtt_message *msg)
 {
+    _connAckReceived = true;
     if (msg->connack_ret_code == MG_EV_MQTT_CONNACK_ACCEPTED) {
-        APP_LOGI("[MqttClient]", "connection established");
+        _connectedTick = xTaskGetTickCount();
+        ++_connectCount;
+        _brokers.onConnected(_brokerIndex, (_connectedTick - _connectStartTick) * portTICK_PERIOD_MS, nowMilli());
+        // connack frame still at head of recv buffer: header, length, ack flags
+        bool sessionPresent = nc->recv_mbuf.len > 2 && (nc->recv_mbuf.buf[2] & 0x01);
+        APP_LOGI("[MqttClient]", "connection established (session present: %d)", sessionPresent);
         _connected = true;
+        _restoreSubscriptions(sessionPresent);
         if (_subscribeImmediatelyOnConnected) {
             subscribeTopics();
         }
@@ -471,8 +701,13 @@ void MqttClient::onConnAck(struct mg_mqtt_message *msg)
     else {
         APP_LOGE("[MqttClient]", "connection error: %d", msg->connack_ret_code);
         if (msg->connack_ret_code == MG_EV_MQTT_CONNACK_SERVER_UNAVAILABLE) {
-            reconnectCountDelay(_reconnectTicksOnServerUnavailable);
-            _makeConnection();
+            // long wait only if there is no other broker to fail over to
+            _brokers.markUnavailable(_brokerIndex, nowMilli());
+            bool failOver = _brokers.select(nowMilli()) != _brokerIndex;
+            _scheduleReconnect(failOver ? _reconnectTicksOnDisconnection : _reconnectTicksOnServerUnavailable);
+        }
+        else {
+            _brokers.onConnectFailed(_brokerIndex, nowMilli());
         }
     }
 }
@@ -481,6 +716,7 @@ void MqttClient::onPubAck(struct mg_mqtt_message *msg)
 {
     // APP_LOGI("[MqttClient]", "message QoS(1) Pub acknowledged (msg_id: %d)", msg->message_id);
     _msgPubPool.drainPoolMessage(msg->message_id);
+    ++_pubAckCount;
     _recentActiveTime = time(NULL);
 }
 
@@ -503,6 +739,7 @@ void MqttClient::onSubAck(struct mg_mqtt_message *msg)
     APP_LOGI("[MqttClient]", "subscription acknowledged");
     _topicsSubscribed.addSubTopics(_topicsToSubscribe);
     _topicsToSubscribe.clear();
+    SessionCache::instance()->setMqttSubDigest(_subscribedDigest());
     APP_LOGI("[MqttClient]", "all subscribed topics:");
     printTopics(_topicsSubscribed.topics, _topicsSubscribed.count);
     _recentActiveTime = time(NULL);
@@ -513,6 +750,7 @@ void MqttClient::onUnsubAct(struct mg_mqtt_message *msg)
     APP_LOGI("[MqttClient]", "unsubscription acknowledged");
     _topicsSubscribed.removeUnsubTopics(_topicsToUnsubscribe);
     _topicsToUnsubscribe.clear();
+    SessionCache::instance()->setMqttSubDigest(_subscribedDigest());
     _recentActiveTime = time(NULL);
 }
 
@@ -523,7 +761,8 @@ void MqttClient::onRxPubMessage(struct mg_mqtt_message *msg)
     APP_LOGC("[MqttClient]", "got incoming message (msg_id: %d) %.*s: %.*s", msg->message_id,
              (int) msg->topic.len, msg->topic.p, (int) msg->payload.len, msg->payload.p);
 #endif
-    if (_msgInterpreter) {
+    int handled = _topicRouter.dispatch(msg->topic.p, msg->topic.len, msg->payload.p, msg->payload.len);
+    if (handled == 0 && _msgInterpreter) {
         _msgInterpreter->interpreteMqttMsg(msg->topic.p, msg->topic.len, msg->payload.p, msg->payload.len);
     }
     _recentActiveTime = time(NULL);
@@ -535,6 +774,14 @@ void MqttClient::onPingResp(struct mg_mqtt_message *msg)
     APP_LOGI("[MqttClient]", "got ping response");
 #endif
     _recentActiveTime = time(NULL);
+    if (_pingPending) {
+        _pingPending = false;
+        uint32_t rtt = (xTaskGetTickCount() - _pingSentTick) * portTICK_PERIOD_MS;
+        if (_brokers.onPingRtt(_brokerIndex, rtt, nowMilli()) && _connection) {
+            APP_LOGI("[MqttClient]", "broker %d round trip spikes (%d ms), fail over", _brokerIndex, rtt);
+            _connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+        }
+    }
 }
 
 void MqttClient::onTimeout(struct mg_connection *nc)
@@ -543,27 +790,60 @@ void MqttClient::onTimeout(struct mg_connection *nc)
     nc->flags |= MG_F_CLOSE_IMMEDIATELY;
 }
 
-#define CLOSE_SEMAPHORE_TAKE_WAIT_TICKS    1000
-
 void MqttClient::onClose(struct mg_connection *nc)
 {
-    // APP_LOGI("[MqttClient]", "connection to server %s closed (nc: %p) (alive nc: %p)", _serverAddress, nc, _manager.active_connections);
-    APP_LOGI("[MqttClient]", "connection to server *** closed (nc: %p) (alive nc: %p)", nc, _manager.active_connections);
+    // APP_LOGI("[MqttClient]", "connection to server %s closed (nc: %p) (alive nc: %p)", _serverAddress, nc, _connection);
+    APP_LOGI("[MqttClient]", "connection to server *** closed (nc: %p) (alive nc: %p)", nc, _connection);
+
+    if (_connection && _connection != nc) return;
+    _connection = NULL;
+    // closed before any CONNACK: tcp, tls or protocol level connect failure
+    if (!_connAckReceived) _brokers.onConnectFailed(_brokerIndex, nowMilli());
+
+    _closeProcess();
+}
 
-    if (_manager.active_connections && _manager.active_connections != nc) return;
+void MqttClient::_restoreSubscriptions(bool sessionPresent)
+{
+    if (!sessionPresent) {
+        // broker has no session (first connect or expired), subscribe everything again
+        if (_topicsSubscribed.count > 0) {
+            _topicsToSubscribe.addSubTopics(_topicsSubscribed);
+            _topicsSubscribed.clear();
+        }
+        return;
+    }
+    // after deep sleep topics are added again at boot, broker still has them if the
+    // set is the same as last subscribed, no SUBSCRIBE round trip needed
+    if (_topicsSubscribed.count == 0 && _topicsToSubscribe.count > 0) {
+        _topicsSubscribed.addSubTopics(_topicsToSubscribe);
+        if (_subscribedDigest() == SessionCache::instance()->mqttSubDigest()) {
+            APP_LOGI("[MqttClient]", "topics restored from persistent session");
+            _topicsToSubscribe.clear();
+        }
+        else {
+            _topicsSubscribed.clear();
+        }
+    }
+}
 
-    if (xSemaphoreTake(_closeProcessSemaphore, CLOSE_SEMAPHORE_TAKE_WAIT_TICKS)) {
-        _closeProcess();
-        xSemaphoreGive(_closeProcessSemaphore);
+uint32_t MqttClient::_subscribedDigest()
+{
+    // FNV-1a over topics and qos, topics are added in the same order each boot
+    uint32_t hash = 2166136261u;
+    for (uint16_t i = 0; i < _topicsSubscribed.count; ++i) {
+        const char *p = _topicsSubscribed.topics[i].topic;
+        while (p && *p) { hash ^= (uint8_t)*p++; hash *= 16777619u; }
+        hash ^= _topicsSubscribed.topics[i].qos; hash *= 16777619u;
     }
+    return hash;
 }
 
 void MqttClient::_closeProcess()
 {
     _connected = false;
-    //vTaskDelete(_aliveGuardTaskHandle);
-    reconnectCountDelay(_reconnectTicksOnDisconnection);
-    _makeConnection();
+    // keep a reconnect already scheduled by connack handling
+    if (_inited && !_reconnectPending) _scheduleReconnect(_reconnectTicksOnDisconnection);
 }
 
 void MqttClient::aliveGuardCheck()
@@ -574,20 +854,25 @@ void MqttClient::aliveGuardCheck()
         if (timeNow - _recentActiveTime > _handShakeOpt.keep_alive) {
             // server does not response, connection dead
             APP_LOGI("[MqttClient]", "client has received no response for a while, connection considered to be lost");
-            if (xSemaphoreTake(_closeProcessSemaphore, CLOSE_SEMAPHORE_TAKE_WAIT_TICKS)) {
-                if (_connected) {
-                    // mg_mqtt_disconnect(_manager.active_connections);
-                    mg_set_timer(_manager.active_connections, mg_time() + 1);
-                    // _manager.active_connections->flags |= MG_F_SEND_AND_CLOSE;
-                }
-                xSemaphoreGive(_closeProcessSemaphore);
-            }
+            // mg_mqtt_disconnect(_connection);
+            mg_set_timer(_connection, mg_time() + 1);
+            // _connection->flags |= MG_F_SEND_AND_CLOSE;
         }
         else if (_connected && timeNow - _recentActiveTime > _aliveGuardInterval) {
 #ifdef LOG_MQTT_PING_PONG
             APP_LOGI("[MqttClient]", "no activity recently, ping to server");
 #endif
-            mg_mqtt_ping(_manager.active_connections);
+            mg_mqtt_ping(_connection);
+            _pingSentTick = xTaskGetTickCount();
+            _pingPending = true;
+        }
+        else if (_brokers.count() > 1 &&
+                 _brokers.shouldSwitch(_brokerIndex, (xTaskGetTickCount() - _connectedTick) * portTICK_PERIOD_MS,
+                                       nowMilli())) {
+            // preferred broker healthy again and faster, fail back
+            APP_LOGI("[MqttClient]", "switch from broker %d to faster broker", _brokerIndex);
+            mg_mqtt_disconnect(_connection);
+            _connection->flags |= MG_F_SEND_AND_CLOSE;
         }
     }
 }
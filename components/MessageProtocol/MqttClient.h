@@ -10,6 +10,9 @@
 #include "ProtocolMessageInterpreter.h"
 #include "MqttClientDelegate.h"
 #include "MessagePubPool.h"
+#include "PubCoalescer.h"
+#include "NetReactor.h"
+#include "BrokerSelector.h"
 
 #include "mongoose/mongoose.h"
 
@@ -113,11 +116,24 @@ struct SubTopics
 
 
 /////////////////////////////////////////////////////////////////////////////////////////
-// ------ MqttClient class
+// ------ MqttEdgeServers
 /////////////////////////////////////////////////////////////////////////////////////////
-#define MONGOOSE_MQTT_DEFAULT_POLL_SLEEP     0
+// site local brokers listed ahead of the cloud broker, kept in nvs so each site sets its
+// own at runtime; the cloud broker always takes the last place of the broker list
+#define MQTT_EDGE_SERVER_CAPACITY       (BROKER_LIST_CAPACITY - 1)
+
+struct MqttEdgeServers
+{
+    uint8_t         count;
+    char            addresses[MQTT_EDGE_SERVER_CAPACITY][BROKER_ADDRESS_MAX_LEN + 1];
+};
 
-class MqttClient : public MessagePubDelegate, public MqttClientDelegate
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ MqttClient class
+/////////////////////////////////////////////////////////////////////////////////////////
+class MqttClient : public MessagePubDelegate, public PubCoalescerDelegate, public NetReactorClient,
+                   public MqttClientDelegate
 {
 public:
     // constructor
@@ -126,13 +142,28 @@ public:
     // MessagePubDelegate
     virtual void repubMessage(PoolMessage *message);
 
-    // loop poll
-    void poll(int sleepMilli = MONGOOSE_MQTT_DEFAULT_POLL_SLEEP) {
-        mg_mgr_poll(&_manager, sleepMilli);
-    }
+    // PubCoalescerDelegate
+    virtual void publishCoalesced(const char *topic, const void *data, size_t len, uint8_t qos);
+
+    // NetReactorClient, alive guard, pub pool, reconnect and coalesce deadlines
+    virtual uint32_t nextPollTimeout();
+    virtual void onPolled();
+    virtual void onNetJob(NetJob *job);
+    void wakeLoop() { if (_reactor) _reactor->wake(); }
 
-    // config connection
+    // ProtocolDelegate, publish is safe from other tasks
+    virtual NetReactor * reactor() { return _reactor; }
+
+    // config connection, brokers in preference order, failover by health and latency;
+    // setServerAddress replaces the cloud broker, edge brokers stay ahead of it
     void setServerAddress(const char* serverAddress);
+    bool addServerAddress(const char* serverAddress);
+    BrokerSelector * brokers() { return &_brokers; }
+
+    // edge brokers, saved to nvs and applied in reactor task, safe from other tasks;
+    // false if too many or an address too long. Read them in reactor task.
+    bool setEdgeServerAddresses(const char * const *addresses, uint8_t count);
+    const MqttEdgeServers & edgeServers() { return _edgeServers; }
     void setAliveGuardInterval(time_t interval) { _aliveGuardInterval = interval; }
     time_t aliveGuardInterval() { return _aliveGuardInterval; }
     void setOnServerUnavailableReconnectDelay(TickType_t delayTicks);
@@ -146,8 +177,8 @@ public:
     void setKeepAlive(uint16_t value);
     void setLastWill(const char* topic, uint8_t qos, const char* msg, bool retain);
 
-    // init and deinit
-    void init();
+    // init and deinit, connection runs on reactor manager
+    void init(NetReactor *reactor);
     void deinit();
 
     // connection
@@ -173,13 +204,25 @@ public:
                          bool        dup = false);
     virtual bool hasUnackPub();
 
-    // for alive guard check task
+    // coalesced publish: updates within window merged per topic, multiple topics batched
+    void setCoalesceWindow(uint32_t windowMilli) { _pubCoalescer.setWindow(windowMilli); }
+    void setCoalesceMaxBatchSize(uint8_t size) { _pubCoalescer.setMaxBatchSize(size); }
+    bool coalescePublish(const char *topic, const void *data, size_t len, uint8_t qos = 0);
+    PubCoalescer * pubCoalescer() { return &_pubCoalescer; }
+
+    // for alive guard check, in reactor loop
     void aliveGuardCheck();
 
+    // stats
+    uint32_t publishCount() { return _publishCount; }
+    uint32_t pubAckCount() { return _pubAckCount; }
+    uint32_t retransmitCount() { return _retransmitCount; }
+    uint32_t connectCount() { return _connectCount; }
+
 public:
     // for event handler
-    void onConnect(struct mg_connection *nc);
-    void onConnAck(struct mg_mqtt_message *msg);
+    void onConnect(struct mg_connection *nc, int status);
+    void onConnAck(struct mg_connection *nc, struct mg_mqtt_message *msg);
     void onPubAck(struct mg_mqtt_message *msg);
     void onPubRec(struct mg_connection *nc, struct mg_mqtt_message *msg);
     void onPubComp(struct mg_mqtt_message *msg);
@@ -191,8 +234,19 @@ public:
     void onClose(struct mg_connection *nc);
 
 protected:
+    enum NetJobType {
+        NetJobPublish,
+        NetJobEdgeServers
+    };
+
+    void _loadEdgeServers();
+    void _applyBrokers(const MqttEdgeServers &edges, const char *cloudAddress);
     bool _makeConnection();
+    void _scheduleReconnect(TickType_t delayTicks);
+    void _restoreSubscriptions(bool sessionPresent);
+    uint32_t _subscribedDigest();
     void _closeProcess();
+    bool _submitPublish(const char *topic, const void *data, size_t len, uint8_t qos, bool retain);
 
 protected:
     // init and connection
@@ -204,10 +258,24 @@ protected:
     time_t                              _aliveGuardInterval;
     time_t                              _recentActiveTime;
     const char                         *_serverAddress;
+    BrokerSelector                      _brokers;
+    MqttEdgeServers                     _edgeServers;
+    uint8_t                             _brokerIndex;
+    TickType_t                          _connectStartTick;
+    TickType_t                          _connectedTick;
+    TickType_t                          _pingSentTick;
+    bool                                _pingPending;
+    bool                                _connAckReceived;
+    uint32_t                            _connectCount;
 
     // mqtt connection protocol
     const char                         *_clientId;
-    struct mg_mgr                       _manager;
+    NetReactor                         *_reactor;
+    struct mg_connection               *_connection;
+    bool                                _reconnectPending;
+    TickType_t                          _reconnectTick;
+    TickType_t                          _aliveGuardTick;
+    TickType_t                          _msgPoolTick;
     struct mg_send_mqtt_handshake_opts  _handShakeOpt;
 
     // mqtt topics
@@ -219,6 +287,12 @@ protected:
 
     // message publish pool
     MessagePubPool                      _msgPubPool;
+    uint32_t                            _publishCount;
+    uint32_t                            _pubAckCount;
+    uint32_t                            _retransmitCount;
+
+    // coalesced publish
+    PubCoalescer                        _pubCoalescer;
 };
 
 #endif // _MQTT_CLIENT_H
@@ -14,11 +14,13 @@
 #define TOPIC_API_STR_CMD_HEAD       "api/strcmd/"
 
 #define CMD_RET_MSG_TOPIC_HEAD       "api/cmdret/"
+#define BATCH_MSG_TOPIC_HEAD         "api/batch/"
 #define PUB_MSG_QOS                  1
 
 static char _cmdTopic[32];
 static char _strCmdTopic[32];
 static char _cmdRetTopic[32];
+static char _batchTopic[32];
 
 const char * MqttClientDelegate::cmdTopic()
 {
@@ -35,6 +37,11 @@ const char * MqttClientDelegate::cmdRetTopic()
     return _cmdRetTopic;
 }
 
+const char * MqttClientDelegate::batchTopic()
+{
+    return _batchTopic;
+}
+
 inline void catenateTopic(char * target, const char * head, const char * tail)
 {
     strcpy(target, head);
@@ -48,6 +55,7 @@ void MqttClientDelegate::setup()
     catenateTopic(_cmdTopic, TOPIC_API_CMD_HEAD, uid);
     catenateTopic(_strCmdTopic, TOPIC_API_STR_CMD_HEAD, uid);
     catenateTopic(_cmdRetTopic, CMD_RET_MSG_TOPIC_HEAD, uid);
+    catenateTopic(_batchTopic, BATCH_MSG_TOPIC_HEAD, uid);
 
     this->addSubTopic(_cmdTopic);
     this->addSubTopic(_strCmdTopic);
@@ -56,7 +64,8 @@ void MqttClientDelegate::setup()
 
 void MqttClientDelegate::replyMessage(const void *data, size_t length, void *userdata, int flag)
 {
-    (void)userdata;
     (void)flag;
-    this->publish(_cmdRetTopic, data, length, PUB_MSG_QOS);
+    // userdata is the reply to topic of a correlated command, if it asked for one
+    const char *topic = userdata ? (const char *)userdata : _cmdRetTopic;
+    this->publish(topic, data, length, PUB_MSG_QOS);
 }
@@ -18,11 +18,13 @@ public:
     static const char * cmdTopic();
     static const char * strCmdTopic();
     static const char * cmdRetTopic();
+    static const char * batchTopic();
 
 public:
-    // ProtocolDelegate virtual
+    // ProtocolDelegate virtual, userdata is the topic to reply on, cmdRetTopic if NULL
     virtual void setup();
     virtual void replyMessage(const void *data, size_t length, void *userdata, int flag);
+    virtual TopicRouter * topicRouter() { return &_topicRouter; }
 
     // mqtt sepcific vritual
     virtual void addSubTopic(const char *topic, uint8_t qos = 0) = 0;
@@ -40,6 +42,9 @@ public:
                          bool        retain = false,
                          bool        dup = false) = 0;
     virtual bool hasUnackPub() = 0;
+
+protected:
+    TopicRouter _topicRouter;
 };
 
 #endif // _MQTT_CLIENT_H
@@ -0,0 +1,122 @@
+/*
+ * NetReactor: single mongoose manager shared by network protocols
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "NetReactor.h"
+#include "esp_system.h"
+#include "AppLog.h"
+
+#define NET_JOB_SUBMIT_WAIT_TICKS   0
+
+NetReactor::NetReactor()
+: _inited(false)
+, _taskHandle(NULL)
+, _jobQueue(NULL)
+, _largeQueue(NULL)
+, _clientCount(0)
+, _jobCount(0)
+, _largeJobCount(0)
+, _jobDropCount(0)
+{
+    for (int i = 0; i < NET_REACTOR_CLIENT_CAPACITY; ++i) _clients[i] = NULL;
+}
+
+void NetReactor::init()
+{
+    if (!_inited) {
+        APP_LOGI("[NetReactor]", "init, free RAM: %d bytes", esp_get_free_heap_size());
+        mg_mgr_init(&_manager, NULL);
+        _loopWaker.init(&_manager);
+        if (!_jobQueue) _jobQueue = xQueueCreate(NET_JOB_QUEUE_LENGTH, sizeof(NetJob));
+        if (!_largeQueue) {
+            _largeQueue = xQueueCreate(NET_JOB_LARGE_COUNT, sizeof(uint8_t *));
+            for (int i = 0; i < NET_JOB_LARGE_COUNT; ++i) {
+                uint8_t *large = _largeData[i];
+                xQueueSend(_largeQueue, &large, 0);
+            }
+        }
+        // reactor runs in the task that inits it
+        _taskHandle = xTaskGetCurrentTaskHandle();
+        _inited = true;
+    }
+}
+
+void NetReactor::deinit()
+{
+    if (_inited) {
+        APP_LOGI("[NetReactor]", "deinit");
+        mg_mgr_free(&_manager);
+        _loopWaker.deinit();
+        _inited = false;
+    }
+}
+
+bool NetReactor::addClient(NetReactorClient *client)
+{
+    for (int i = 0; i < _clientCount; ++i) {
+        if (_clients[i] == client) return true;
+    }
+    if (_clientCount >= NET_REACTOR_CLIENT_CAPACITY) return false;
+    _clients[_clientCount++] = client;
+    return true;
+}
+
+bool NetReactor::inReactorTask()
+{
+    return _taskHandle == xTaskGetCurrentTaskHandle();
+}
+
+bool NetReactor::submit(NetJob *job, const void *data, size_t length)
+{
+    if (!_jobQueue) return false;
+    job->length = length;
+    job->large = NULL;
+    if (length > NET_JOB_LARGE_DATA_SIZE) {
+        ++_jobDropCount;
+        APP_LOGE("[NetReactor]", "job data too large (%d bytes), job dropped", length);
+        return false;
+    }
+    if (length > NET_JOB_DATA_SIZE) {
+        if (xQueueReceive(_largeQueue, &job->large, NET_JOB_SUBMIT_WAIT_TICKS) != pdTRUE) {
+            ++_jobDropCount;
+            APP_LOGE("[NetReactor]", "no large job buffer free, job dropped");
+            return false;
+        }
+        ++_largeJobCount;
+    }
+    if (length > 0) memcpy(job->large ? job->large : job->data, data, length);
+    if (xQueueSend(_jobQueue, job, NET_JOB_SUBMIT_WAIT_TICKS) != pdTRUE) {
+        if (job->large) xQueueSend(_largeQueue, &job->large, 0);
+        ++_jobDropCount;
+        APP_LOGE("[NetReactor]", "job queue full, job dropped");
+        return false;
+    }
+    _loopWaker.wake();
+    return true;
+}
+
+void NetReactor::_runJobs()
+{
+    if (!_jobQueue) return;
+    while (xQueueReceive(_jobQueue, &_job, 0) == pdTRUE) {
+        if (_job.client) _job.client->onNetJob(&_job);
+        if (_job.large) xQueueSend(_largeQueue, &_job.large, 0);
+        ++_jobCount;
+    }
+}
+
+void NetReactor::poll(int sleepMilli)
+{
+    // never sleep past earliest client deadline
+    for (int i = 0; i < _clientCount; ++i) {
+        uint32_t timeout = _clients[i]->nextPollTimeout();
+        if (timeout < (uint32_t)sleepMilli) sleepMilli = timeout;
+    }
+    mg_mgr_poll(&_manager, sleepMilli);
+    _runJobs();
+    for (int i = 0; i < _clientCount; ++i) {
+        _clients[i]->onPolled();
+    }
+}
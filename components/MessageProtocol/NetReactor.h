@@ -0,0 +1,113 @@
+/*
+ * NetReactor: single mongoose manager shared by network protocols
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _NET_REACTOR_H
+#define _NET_REACTOR_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "LoopWaker.h"
+
+#include "mongoose/mongoose.h"
+
+class NetReactorClient;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ NetJob
+/////////////////////////////////////////////////////////////////////////////////////////
+// work submitted from other tasks, executed by reactor task; data copied, into the job
+// itself when it fits, else into a large buffer the reactor takes back after the job ran
+#define NET_JOB_QUEUE_LENGTH        8
+#define NET_JOB_DATA_SIZE           384
+#define NET_JOB_LARGE_DATA_SIZE     1024    // as SharedBuffer's message buffer, the largest reply
+#define NET_JOB_LARGE_COUNT         2
+#define NET_JOB_TOPIC_MAX_LEN       63
+
+struct NetJob
+{
+    NetReactorClient   *client;
+    uint8_t             type;       // client defined
+    uint8_t             qos;
+    int                 flag;
+    void               *userdata;
+    size_t              length;
+    uint8_t            *large;      // data if longer than NET_JOB_DATA_SIZE, set by submit
+    char                topic[NET_JOB_TOPIC_MAX_LEN + 1];
+    uint8_t             data[NET_JOB_DATA_SIZE];
+
+    const uint8_t * payload() const { return large ? large : data; }
+};
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ NetReactorClient class
+/////////////////////////////////////////////////////////////////////////////////////////
+class NetReactorClient
+{
+public:
+    // ms until client needs onPolled() at latest, UINT32_MAX if no deadline
+    virtual uint32_t nextPollTimeout() { return UINT32_MAX; }
+    // called after each mg_mgr_poll, in reactor task
+    virtual void onPolled() {}
+    // submitted job, in reactor task
+    virtual void onNetJob(NetJob *job) {}
+};
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ NetReactor class
+/////////////////////////////////////////////////////////////////////////////////////////
+#define NET_REACTOR_CLIENT_CAPACITY     5       // protocols and the app updater
+#define NET_REACTOR_DEFAULT_POLL_SLEEP  5000    // ms, upper bound of blocking poll
+
+class NetReactor
+{
+public:
+    NetReactor();
+
+    void init();
+    void deinit();
+    bool inited() { return _inited; }
+    struct mg_mgr * manager() { return &_manager; }
+
+    bool addClient(NetReactorClient *client);
+
+    // reactor task loop, blocks until network event, client deadline, or wake()
+    void poll(int sleepMilli = NET_REACTOR_DEFAULT_POLL_SLEEP);
+
+    // safe from any task
+    void wake() { _loopWaker.wake(); }
+    bool inReactorTask();
+    // job fields but data and length are the caller's; false if dropped, counted and logged
+    bool submit(NetJob *job, const void *data = NULL, size_t length = 0);
+
+    // stats
+    uint32_t wakeCount() { return _loopWaker.wakeCount(); }
+    uint32_t jobCount() { return _jobCount; }
+    uint32_t largeJobCount() { return _largeJobCount; }
+    uint32_t jobDropCount() { return _jobDropCount; }
+
+protected:
+    void _runJobs();
+
+protected:
+    bool                        _inited;
+    struct mg_mgr               _manager;
+    LoopWaker                   _loopWaker;
+    TaskHandle_t                _taskHandle;
+    QueueHandle_t               _jobQueue;
+    QueueHandle_t               _largeQueue; // free large buffers
+    NetJob                      _job;        // rx copy, reactor task only
+    uint8_t                     _clientCount;
+    NetReactorClient           *_clients[NET_REACTOR_CLIENT_CAPACITY];
+    uint32_t                    _jobCount;
+    uint32_t                    _largeJobCount;
+    uint32_t                    _jobDropCount;
+    uint8_t                     _largeData[NET_JOB_LARGE_COUNT][NET_JOB_LARGE_DATA_SIZE];
+};
+
+#endif // _NET_REACTOR_H
@@ -9,10 +9,16 @@
 
 #include <stdint.h>
 #include "ProtocolMessageInterpreter.h"
+#include "TopicRouter.h"
+#include "HttpRouter.h"
+#include "LiveStream.h"
+#include "CmdStatus.h"
 
 #define PROTOCOL_MSG_FORMAT_BINARY  0
 #define PROTOCOL_MSG_FORMAT_TEXT    1
 
+class NetReactor;
+
 class ProtocolDelegate
 {
 public:
@@ -22,6 +28,22 @@ public:
     void setMessageInterpreter(ProtocolMessageInterpreter *interpreter) {
         _msgInterpreter = interpreter;
     }
+    // topic router, only protocols with topics provide one
+    virtual TopicRouter * topicRouter() { return NULL; }
+    // http router, only protocols serving http provide one
+    virtual HttpRouter * httpRouter() { return NULL; }
+    // live stream, only protocols pushing to websocket clients provide one
+    virtual LiveStream * liveStream() { return NULL; }
+    // connection of a requester's userdata, NULL if closed since or not one
+    virtual struct mg_connection * connection(void *userdata) { return NULL; }
+    // reactor of protocols taking replies from other tasks, NULL if replies must be inline
+    virtual NetReactor * reactor() { return NULL; }
+    // rate limiting source of a requester's userdata, 0 if it has none; userdata itself
+    // unless it changes between requests of one requester
+    virtual uint32_t requesterId(void *userdata) { return (uint32_t)(uintptr_t)userdata; }
+    // command refused before it ran with a CMD_STATUS_* (CmdStatus.h), true if the protocol
+    // answered the requester with a status of its own and no reply is to follow
+    virtual bool replyStatus(void *userdata, int status) { return false; }
     // virtual functions
     virtual void setup() = 0;
     virtual void replyMessage(const void *data,
@@ -0,0 +1,172 @@
+/*
+ * PubCoalescer: merge frequent publishes into windowed batches
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "PubCoalescer.h"
+#include "freertos/task.h"
+#include <string.h>
+
+#define COALESCE_MAX_BATCH_SIZE_DEFAULT      COALESCE_SLOT_CAPACITY
+#define COALESCE_SEMAPHORE_TAKE_WAIT_TICKS   1000
+
+PubCoalescer::PubCoalescer()
+: _delegate(NULL)
+, _semaphore(0)
+, _windowMilli(COALESCE_WINDOW_DEFAULT)
+, _maxBatchSize(COALESCE_MAX_BATCH_SIZE_DEFAULT)
+, _batchTopic(NULL)
+, _windowStartTick(0)
+, _pendingCount(0)
+, _mergedCount(0)
+, _flushCount(0)
+{
+    _clearLocked();
+}
+
+void PubCoalescer::init()
+{
+    if (!_semaphore) _semaphore = xSemaphoreCreateMutex();
+}
+
+void PubCoalescer::setWindow(uint32_t windowMilli)
+{
+    if (windowMilli < COALESCE_WINDOW_MIN) windowMilli = COALESCE_WINDOW_MIN;
+    else if (windowMilli > COALESCE_WINDOW_MAX) windowMilli = COALESCE_WINDOW_MAX;
+    _windowMilli = windowMilli;
+}
+
+void PubCoalescer::setMaxBatchSize(uint8_t size)
+{
+    if (size == 0) size = 1;
+    else if (size > COALESCE_SLOT_CAPACITY) size = COALESCE_SLOT_CAPACITY;
+    _maxBatchSize = size;
+}
+
+int PubCoalescer::_findSlot(const char *topic, size_t topicLen)
+{
+    for (int i = 0; i < COALESCE_SLOT_CAPACITY; ++i) {
+        if (_slots[i].used && _slots[i].topicLen == topicLen &&
+            memcmp(_slots[i].topic, topic, topicLen) == 0)
+            return i;
+    }
+    return -1;
+}
+
+bool PubCoalescer::add(const char *topic, const void *data, size_t len, uint8_t qos)
+{
+    size_t topicLen = strlen(topic);
+    if (topicLen > COALESCE_TOPIC_MAX_LEN || len > COALESCE_SLOT_DATA_SIZE) return false;
+    if (!_semaphore || !xSemaphoreTake(_semaphore, COALESCE_SEMAPHORE_TAKE_WAIT_TICKS)) return false;
+
+    bool added = false;
+    int slot = _findSlot(topic, topicLen);
+    if (slot != -1) {
+        // same topic within window: newest data wins
+        ++_mergedCount;
+    }
+    else {
+        for (int i = 0; i < COALESCE_SLOT_CAPACITY; ++i) {
+            if (!_slots[i].used) { slot = i; break; }
+        }
+        if (slot != -1) {
+            if (_pendingCount == 0) _windowStartTick = xTaskGetTickCount();
+            _slots[slot].used = true;
+            _slots[slot].topicLen = topicLen;
+            memcpy(_slots[slot].topic, topic, topicLen);
+            _slots[slot].topic[topicLen] = '\0';
+            _slots[slot].qos = 0;
+            ++_pendingCount;
+        }
+    }
+
+    if (slot != -1) {
+        memcpy(_slots[slot].data, data, len);
+        _slots[slot].length = len;
+        if (qos > _slots[slot].qos) _slots[slot].qos = qos;
+        added = true;
+    }
+
+    xSemaphoreGive(_semaphore);
+    return added;
+}
+
+void PubCoalescer::processLoop()
+{
+    if (_pendingCount == 0) return;
+    bool windowDue = (xTaskGetTickCount() - _windowStartTick) * portTICK_PERIOD_MS >= _windowMilli;
+    if (windowDue || _pendingCount >= _maxBatchSize) flush();
+}
+
+uint32_t PubCoalescer::nextFlushMilli()
+{
+    if (_pendingCount == 0) return UINT32_MAX;
+    if (_pendingCount >= _maxBatchSize) return 0;
+    uint32_t elapsed = (xTaskGetTickCount() - _windowStartTick) * portTICK_PERIOD_MS;
+    return elapsed >= _windowMilli ? 0 : _windowMilli - elapsed;
+}
+
+void PubCoalescer::flush()
+{
+    if (!_semaphore || !xSemaphoreTake(_semaphore, COALESCE_SEMAPHORE_TAKE_WAIT_TICKS)) return;
+    _flushLocked();
+    xSemaphoreGive(_semaphore);
+}
+
+void PubCoalescer::_flushLocked()
+{
+    if (_pendingCount == 0 || !_delegate) return;
+
+    // single topic pending or no batch topic: publish on topic itself
+    if (_pendingCount == 1 || !_batchTopic || _batchTopic[0] == '\0' || _maxBatchSize == 1) {
+        for (int i = 0; i < COALESCE_SLOT_CAPACITY; ++i) {
+            if (_slots[i].used) {
+                _delegate->publishCoalesced(_slots[i].topic, _slots[i].data, _slots[i].length, _slots[i].qos);
+            }
+        }
+    }
+    else {
+        // multiple topics pending: frame into envelopes of at most _maxBatchSize entries
+        size_t packCount = COALESCE_ENVELOPE_COUNT_SIZE;
+        uint8_t entryCount = 0;
+        uint8_t qos = 0;
+        for (int i = 0; i < COALESCE_SLOT_CAPACITY; ++i) {
+            if (!_slots[i].used) continue;
+            size_t entrySize = COALESCE_ENVELOPE_TOPIC_LEN_SIZE + _slots[i].topicLen +
+                               COALESCE_ENVELOPE_DATA_LEN_SIZE + _slots[i].length;
+            if (entryCount == _maxBatchSize || packCount + entrySize > COALESCE_BATCH_BUF_SIZE) {
+                _batchBuf[0] = entryCount;
+                _delegate->publishCoalesced(_batchTopic, _batchBuf, packCount, qos);
+                packCount = COALESCE_ENVELOPE_COUNT_SIZE;
+                entryCount = 0;
+                qos = 0;
+            }
+            _batchBuf[packCount++] = _slots[i].topicLen;
+            memcpy(_batchBuf + packCount, _slots[i].topic, _slots[i].topicLen);
+            packCount += _slots[i].topicLen;
+            _batchBuf[packCount++] = _slots[i].length & 0xFF;
+            _batchBuf[packCount++] = (_slots[i].length >> 8) & 0xFF;
+            memcpy(_batchBuf + packCount, _slots[i].data, _slots[i].length);
+            packCount += _slots[i].length;
+            if (_slots[i].qos > qos) qos = _slots[i].qos;
+            ++entryCount;
+        }
+        if (entryCount > 0) {
+            _batchBuf[0] = entryCount;
+            _delegate->publishCoalesced(_batchTopic, _batchBuf, packCount, qos);
+        }
+    }
+
+    ++_flushCount;
+    _clearLocked();
+}
+
+void PubCoalescer::_clearLocked()
+{
+    for (int i = 0; i < COALESCE_SLOT_CAPACITY; ++i) {
+        _slots[i].used = false;
+        _slots[i].length = 0;
+    }
+    _pendingCount = 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * PubCoalescer: merge frequent publishes into windowed batches
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _PUB_COALESCER_H
+#define _PUB_COALESCER_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ batch envelope format
+/////////////////////////////////////////////////////////////////////////////////////////
+// batch envelope published on batch topic when more than one topic is pending:
+//              ++-------+-----------+---------+-----------+--------------+-----++
+//  byte name:  || count | topic len |  topic  | data len  |     data     | ... ||
+//              ++-------+-----------+---------+-----------+--------------+-----++
+//  byte size:  ||   1   |     1     |    n    | 2 (LE)    |      m       | ... ||
+//              ++-------+-----------+---------+-----------+--------------+-----++
+//
+//  Note: when only one topic is pending on flush, its data is published on the
+//        topic itself without envelope
+
+#define COALESCE_ENVELOPE_COUNT_SIZE         1
+#define COALESCE_ENVELOPE_TOPIC_LEN_SIZE     1
+#define COALESCE_ENVELOPE_DATA_LEN_SIZE      2
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ PubCoalescerDelegate class
+/////////////////////////////////////////////////////////////////////////////////////////
+class PubCoalescerDelegate
+{
+public:
+    virtual void publishCoalesced(const char *topic, const void *data, size_t len, uint8_t qos) = 0;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ PubCoalescer class
+/////////////////////////////////////////////////////////////////////////////////////////
+#define COALESCE_SLOT_CAPACITY               8
+#define COALESCE_SLOT_DATA_SIZE              256
+#define COALESCE_TOPIC_MAX_LEN               63
+#define COALESCE_BATCH_BUF_SIZE              1024
+#define COALESCE_WINDOW_MIN                  200     // ms
+#define COALESCE_WINDOW_MAX                  5000    // ms
+#define COALESCE_WINDOW_DEFAULT              1000    // ms
+
+class PubCoalescer
+{
+public:
+    PubCoalescer();
+
+    // config
+    void init();
+    void setDelegate(PubCoalescerDelegate *delegate) { _delegate = delegate; }
+    void setWindow(uint32_t windowMilli);
+    uint32_t window() { return _windowMilli; }
+    void setMaxBatchSize(uint8_t size);
+    void setBatchTopic(const char *topic) { _batchTopic = topic; }
+
+    // used by publisher, data copied
+    bool add(const char *topic, const void *data, size_t len, uint8_t qos);
+
+    // used by network loop
+    void processLoop();
+    void flush();
+    size_t pendingCount() { return _pendingCount; }
+    uint32_t nextFlushMilli();  // ms until window end, UINT32_MAX if nothing pending
+
+    // stats
+    uint32_t mergedCount() { return _mergedCount; }
+    uint32_t flushCount() { return _flushCount; }
+
+protected:
+    struct Slot {
+        bool      used;
+        uint8_t   qos;
+        uint8_t   topicLen;
+        uint16_t  length;
+        char      topic[COALESCE_TOPIC_MAX_LEN + 1];
+        uint8_t   data[COALESCE_SLOT_DATA_SIZE];
+    };
+
+    int  _findSlot(const char *topic, size_t topicLen);
+    void _flushLocked();
+    void _clearLocked();
+
+protected:
+    PubCoalescerDelegate       *_delegate;
+    xSemaphoreHandle            _semaphore;
+    uint32_t                    _windowMilli;
+    uint8_t                     _maxBatchSize;
+    const char                 *_batchTopic;
+    TickType_t                  _windowStartTick;
+    size_t                      _pendingCount;
+    uint32_t                    _mergedCount;
+    uint32_t                    _flushCount;
+    Slot                        _slots[COALESCE_SLOT_CAPACITY];
+    uint8_t                     _batchBuf[COALESCE_BATCH_BUF_SIZE];
+};
+
+#endif // _PUB_COALESCER_H
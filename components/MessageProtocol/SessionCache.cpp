@@ -0,0 +1,259 @@
+/*
+ * SessionCache: TLS and MQTT session state kept across deep sleep
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "SessionCache.h"
+#include "esp_attr.h"
+#include "AppLog.h"
+#include <string.h>
+#include <stdio.h>
+
+#if MG_ENABLE_SSL
+#include "mbedtls/ssl.h"
+#endif
+
+#define SESSION_CACHE_MAGIC     0x53455354      // "SESS", bumped with the layout
+
+// plain data only, no pointers, so it stays valid across deep sleep
+struct RtcBroker
+{
+    // keyed by configured "host:port", empty if unused
+    char            address[BROKER_HOST_MAX_LEN + 8];
+    uint32_t        usedSeq;            // least recently used makes room
+    uint32_t        ip;                 // 0 if not resolved
+    // tls
+    bool            tlsValid;
+    int             ciphersuite;
+    int             compression;
+    uint32_t        verifyResult;
+    uint8_t         idLen;
+    uint8_t         id[TLS_SESSION_ID_MAX_LEN];
+    uint8_t         master[TLS_SESSION_MASTER_LEN];
+    uint16_t        ticketLen;
+    uint32_t        ticketLifetime;
+    uint8_t         ticket[TLS_SESSION_TICKET_MAX_LEN];
+    uint8_t         mflCode;
+    int             truncHmac;
+    int             encryptThenMac;
+};
+
+struct RtcSession
+{
+    uint32_t        magic;
+    uint32_t        seq;
+    RtcBroker       brokers[SESSION_CACHE_BROKER_CAPACITY];
+    // mqtt
+    uint32_t        mqttSubDigest;
+};
+
+static RTC_DATA_ATTR RtcSession _rtcSession;
+static SessionCache _sessionCacheInstance;
+static uint32_t _tlsResumeCount = 0;
+static uint32_t _tlsFullHandshakeCount = 0;
+static bool _tlsOffered = false;
+
+static void _checkMagic()
+{
+    // rtc data is reloaded on cold boot, magic only set once something is saved
+    if (_rtcSession.magic != SESSION_CACHE_MAGIC) {
+        memset(&_rtcSession, 0, sizeof(_rtcSession));
+        _rtcSession.magic = SESSION_CACHE_MAGIC;
+    }
+}
+
+// entry of the broker, or with create a new one in place of the least recently used
+static RtcBroker * _broker(const char *serverAddress, bool create)
+{
+    _checkMagic();
+    if (!serverAddress || strlen(serverAddress) >= sizeof(_rtcSession.brokers[0].address)) return NULL;
+    RtcBroker *oldest = &_rtcSession.brokers[0];
+    for (int i = 0; i < SESSION_CACHE_BROKER_CAPACITY; ++i) {
+        RtcBroker &broker = _rtcSession.brokers[i];
+        if (strcmp(broker.address, serverAddress) == 0) {
+            broker.usedSeq = ++_rtcSession.seq;
+            return &broker;
+        }
+        if (oldest->address[0] && (!broker.address[0] || broker.usedSeq < oldest->usedSeq)) oldest = &broker;
+    }
+    if (!create) return NULL;
+    memset(oldest, 0, sizeof(*oldest));
+    strcpy(oldest->address, serverAddress);
+    oldest->usedSeq = ++_rtcSession.seq;
+    return oldest;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ SessionCache class
+/////////////////////////////////////////////////////////////////////////////////////////
+SessionCache * SessionCache::instance()
+{
+    return &_sessionCacheInstance;
+}
+
+bool SessionCache::restoreTlsSession(struct mg_connection *nc, const char *serverAddress)
+{
+    _tlsOffered = false;
+#if MG_ENABLE_SSL
+    RtcBroker *cached = _broker(serverAddress, false);
+    if (!cached || !cached->tlsValid || !(nc->flags & MG_F_SSL)) return false;
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    session.ciphersuite = cached->ciphersuite;
+    session.compression = cached->compression;
+    session.verify_result = cached->verifyResult;
+    session.id_len = cached->idLen;
+    memcpy(session.id, cached->id, cached->idLen);
+    memcpy(session.master, cached->master, TLS_SESSION_MASTER_LEN);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    // set_session copies the ticket, rtc buffer is never handed over
+    session.ticket = cached->ticketLen > 0 ? cached->ticket : NULL;
+    session.ticket_len = cached->ticketLen;
+    session.ticket_lifetime = cached->ticketLifetime;
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    session.mfl_code = cached->mflCode;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+    session.trunc_hmac = cached->truncHmac;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+    session.encrypt_then_mac = cached->encryptThenMac;
+#endif
+    _tlsOffered = mg_ssl_if_set_session(nc, &session) == MG_SSL_OK;
+    // no mbedtls_ssl_session_free, nothing in session was allocated
+    memset(&session, 0, sizeof(session));
+    if (!_tlsOffered) invalidateTlsSession(serverAddress);
+#endif
+    return _tlsOffered;
+}
+
+void SessionCache::saveTlsSession(struct mg_connection *nc, const char *serverAddress)
+{
+#if MG_ENABLE_SSL
+    if (!(nc->flags & MG_F_SSL)) return;
+    RtcBroker *cached = _broker(serverAddress, true);
+    if (!cached) return;
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if (mg_ssl_if_get_session(nc, &session) != MG_SSL_OK) {
+        mbedtls_ssl_session_free(&session);
+        return;
+    }
+
+    // server accepting the offered session echoes its id (or ticket-time random id)
+    bool resumed = _tlsOffered && cached->tlsValid && session.id_len > 0 &&
+                   session.id_len == cached->idLen &&
+                   memcmp(session.id, cached->id, session.id_len) == 0;
+    if (resumed) ++_tlsResumeCount;
+    else ++_tlsFullHandshakeCount;
+    _tlsOffered = false;
+
+    size_t ticketLen = 0;
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    ticketLen = session.ticket ? session.ticket_len : 0;
+#endif
+    if (session.id_len > TLS_SESSION_ID_MAX_LEN || ticketLen > TLS_SESSION_TICKET_MAX_LEN ||
+        (session.id_len == 0 && ticketLen == 0)) {
+        // nothing resumable, or ticket too large for rtc memory
+        cached->tlsValid = false;
+        mbedtls_ssl_session_free(&session);
+        return;
+    }
+
+    cached->ciphersuite = session.ciphersuite;
+    cached->compression = session.compression;
+    cached->verifyResult = session.verify_result;
+    cached->idLen = session.id_len;
+    memcpy(cached->id, session.id, session.id_len);
+    memcpy(cached->master, session.master, TLS_SESSION_MASTER_LEN);
+    cached->ticketLen = ticketLen;
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    if (ticketLen > 0) memcpy(cached->ticket, session.ticket, ticketLen);
+    cached->ticketLifetime = session.ticket_lifetime;
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    cached->mflCode = session.mfl_code;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+    cached->truncHmac = session.trunc_hmac;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+    cached->encryptThenMac = session.encrypt_then_mac;
+#endif
+    cached->tlsValid = true;
+    mbedtls_ssl_session_free(&session);
+
+    APP_LOGI("[SessionCache]", "tls session %s (resumed: %d, full: %d)",
+             resumed ? "resumed" : "cached", _tlsResumeCount, _tlsFullHandshakeCount);
+#endif
+}
+
+void SessionCache::invalidateTlsSession(const char *serverAddress)
+{
+    _tlsOffered = false;
+    RtcBroker *cached = _broker(serverAddress, false);
+    if (!cached) return;
+    if (cached->tlsValid) APP_LOGI("[SessionCache]", "tls session invalidated");
+    cached->tlsValid = false;
+    memset(cached->master, 0, TLS_SESSION_MASTER_LEN);
+}
+
+bool SessionCache::hasTlsSession(const char *serverAddress)
+{
+    RtcBroker *cached = _broker(serverAddress, false);
+    return cached && cached->tlsValid;
+}
+
+bool SessionCache::resolvedBrokerAddress(const char *serverAddress, char *address, size_t addressSize,
+                                         char *host, size_t hostSize)
+{
+    RtcBroker *cached = _broker(serverAddress, false);
+    if (!cached || cached->ip == 0) return false;
+
+    const char *port = strrchr(serverAddress, ':');
+    if (!port || (size_t)(port - serverAddress) >= hostSize) return false;
+    memcpy(host, serverAddress, port - serverAddress);
+    host[port - serverAddress] = '\0';
+
+    const uint8_t *ip = (const uint8_t *)&cached->ip;
+    int len = snprintf(address, addressSize, "%d.%d.%d.%d%s", ip[0], ip[1], ip[2], ip[3], port);
+    return len > 0 && (size_t)len < addressSize;
+}
+
+void SessionCache::saveBrokerAddress(const char *serverAddress, uint32_t ip)
+{
+    RtcBroker *cached = _broker(serverAddress, true);
+    if (cached) cached->ip = ip;
+}
+
+void SessionCache::invalidateBrokerAddress(const char *serverAddress)
+{
+    RtcBroker *cached = _broker(serverAddress, false);
+    if (cached) cached->ip = 0;
+}
+
+void SessionCache::setMqttSubDigest(uint32_t digest)
+{
+    _checkMagic();
+    _rtcSession.mqttSubDigest = digest;
+}
+
+uint32_t SessionCache::mqttSubDigest()
+{
+    _checkMagic();
+    return _rtcSession.mqttSubDigest;
+}
+
+uint32_t SessionCache::tlsResumeCount()
+{
+    return _tlsResumeCount;
+}
+
+uint32_t SessionCache::tlsFullHandshakeCount()
+{
+    return _tlsFullHandshakeCount;
+}
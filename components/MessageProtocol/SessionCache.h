@@ -0,0 +1,60 @@
+/*
+ * SessionCache: TLS and MQTT session state kept across deep sleep
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _SESSION_CACHE_H
+#define _SESSION_CACHE_H
+
+#include <stdint.h>
+#include "mongoose/mongoose.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ SessionCache class
+/////////////////////////////////////////////////////////////////////////////////////////
+// The negotiated TLS session (session id, master secret and ticket) is kept in RTC slow
+// memory, so a reconnect after deep sleep or a dropped link resumes the session with an
+// abbreviated handshake instead of a full certificate exchange. Together with a
+// persistent MQTT session, a digest of the subscribed topic set lets the client skip
+// SUBSCRIBE when the broker reports the session still present. The resolved broker
+// address is cached as well, so a reconnect needs no DNS round trip. Sessions and
+// addresses are kept per broker, keyed by its configured "host:port", so failing over
+// and back resumes with each broker its own session.
+// RTC memory survives deep sleep but not power loss; a cold boot starts empty.
+
+#define TLS_SESSION_ID_MAX_LEN          32
+#define TLS_SESSION_MASTER_LEN          48
+#define TLS_SESSION_TICKET_MAX_LEN      512
+#define BROKER_HOST_MAX_LEN             63
+#define SESSION_CACHE_BROKER_CAPACITY   2       // edge and cloud, rtc memory is scarce
+
+class SessionCache
+{
+public:
+    static SessionCache * instance();
+
+    // tls of the broker at serverAddress, client connection only; restore before the
+    // handshake, true if offered, save after it
+    bool restoreTlsSession(struct mg_connection *nc, const char *serverAddress);
+    void saveTlsSession(struct mg_connection *nc, const char *serverAddress);
+    void invalidateTlsSession(const char *serverAddress);
+    bool hasTlsSession(const char *serverAddress);
+
+    // broker "host:port" resolved before: fills "a.b.c.d:port" and host (for SNI and
+    // cert check) and returns true
+    bool resolvedBrokerAddress(const char *serverAddress, char *address, size_t addressSize,
+                               char *host, size_t hostSize);
+    void saveBrokerAddress(const char *serverAddress, uint32_t ip);    // network order
+    void invalidateBrokerAddress(const char *serverAddress);
+
+    // mqtt persistent session
+    void setMqttSubDigest(uint32_t digest);
+    uint32_t mqttSubDigest();
+
+    // stats
+    uint32_t tlsResumeCount();
+    uint32_t tlsFullHandshakeCount();
+};
+
+#endif // _SESSION_CACHE_H
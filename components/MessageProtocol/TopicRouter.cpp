@@ -0,0 +1,192 @@
+/*
+ * TopicRouter: segment trie dispatch of incoming MQTT messages
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "TopicRouter.h"
+#include <string.h>
+
+#define ROOT_NODE       0
+#define NULL_NODE       -1
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ helper functions
+/////////////////////////////////////////////////////////////////////////////////////////
+inline static size_t segmentLen(const char *seg, size_t remainLen)
+{
+    size_t len = 0;
+    while (len < remainLen && seg[len] != '/') ++len;
+    return len;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ TopicRouter class
+/////////////////////////////////////////////////////////////////////////////////////////
+TopicRouter::TopicRouter()
+{
+    clear();
+}
+
+void TopicRouter::clear()
+{
+    memset(_nodes, 0, sizeof(_nodes));
+    _nodes[ROOT_NODE].firstChild = NULL_NODE;
+    _nodes[ROOT_NODE].nextSibling = NULL_NODE;
+    _nodeCount = 1;
+    _segPoolUsed = 0;
+}
+
+int16_t TopicRouter::_findChild(int16_t parent, const char *seg, size_t segLen)
+{
+    for (int16_t c = _nodes[parent].firstChild; c != NULL_NODE; c = _nodes[c].nextSibling) {
+        if (_nodes[c].segLen == segLen && memcmp(_segPool + _nodes[c].segOffset, seg, segLen) == 0)
+            return c;
+    }
+    return NULL_NODE;
+}
+
+int16_t TopicRouter::_addChild(int16_t parent, const char *seg, size_t segLen)
+{
+    if (_nodeCount >= TOPIC_ROUTER_NODE_CAPACITY || segLen > UINT8_MAX ||
+        _segPoolUsed + segLen > TOPIC_ROUTER_SEGMENT_POOL_SIZE)
+        return NULL_NODE;
+
+    int16_t node = _nodeCount++;
+    memcpy(_segPool + _segPoolUsed, seg, segLen);
+    _nodes[node].segOffset = _segPoolUsed;
+    _nodes[node].segLen = segLen;
+    _segPoolUsed += segLen;
+    _nodes[node].firstChild = NULL_NODE;
+    _nodes[node].nextSibling = NULL_NODE;
+    int16_t *link = &_nodes[parent].firstChild;
+    while (*link != NULL_NODE) link = &_nodes[*link].nextSibling;
+    *link = node;
+    return node;
+}
+
+int16_t TopicRouter::_findNode(const char *pattern)
+{
+    size_t remainLen = strlen(pattern);
+    int16_t node = ROOT_NODE;
+    const char *seg = pattern;
+    while (node != NULL_NODE) {
+        size_t segLen = segmentLen(seg, remainLen);
+        node = _findChild(node, seg, segLen);
+        if (segLen == remainLen) break;
+        seg += segLen + 1;
+        remainLen -= segLen + 1;
+    }
+    return node;
+}
+
+bool TopicRouter::_isWildcard(int16_t node, char wildcard)
+{
+    return _nodes[node].segLen == 1 && _segPool[_nodes[node].segOffset] == wildcard;
+}
+
+bool TopicRouter::addRoute(const char *pattern, TopicMessageHandler *handler, void *context)
+{
+    if (!pattern || !handler) return false;
+
+    size_t remainLen = strlen(pattern);
+    int16_t node = ROOT_NODE;
+    const char *seg = pattern;
+    while (true) {
+        size_t segLen = segmentLen(seg, remainLen);
+        bool last = segLen == remainLen;
+        // wildcards must occupy a whole level, '#' only the last one
+        for (size_t i = 0; i < segLen; ++i) {
+            if ((seg[i] == '+' || seg[i] == '#') && segLen != 1) return false;
+        }
+        if (segLen == 1 && seg[0] == '#' && !last) return false;
+
+        int16_t child = _findChild(node, seg, segLen);
+        if (child == NULL_NODE) child = _addChild(node, seg, segLen);
+        if (child == NULL_NODE) return false;
+        node = child;
+
+        if (last) break;
+        seg += segLen + 1;
+        remainLen -= segLen + 1;
+    }
+
+    Route *routes = _nodes[node].routes;
+    for (int i = 0; i < TOPIC_ROUTER_NODE_HANDLER_CAPACITY; ++i) {
+        if (routes[i].handler == handler) {
+            routes[i].context = context;
+            return true;
+        }
+    }
+    for (int i = 0; i < TOPIC_ROUTER_NODE_HANDLER_CAPACITY; ++i) {
+        if (routes[i].handler == NULL) {
+            routes[i].handler = handler;
+            routes[i].context = context;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TopicRouter::removeRoute(const char *pattern, TopicMessageHandler *handler)
+{
+    int16_t node = _findNode(pattern);
+    if (node == NULL_NODE) return false;
+
+    Route *routes = _nodes[node].routes;
+    for (int i = 0; i < TOPIC_ROUTER_NODE_HANDLER_CAPACITY; ++i) {
+        if (routes[i].handler == handler) {
+            routes[i].handler = NULL;
+            routes[i].context = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+int TopicRouter::_invoke(int16_t node, const Message &message)
+{
+    int count = 0;
+    Route *routes = _nodes[node].routes;
+    for (int i = 0; i < TOPIC_ROUTER_NODE_HANDLER_CAPACITY; ++i) {
+        if (routes[i].handler) {
+            routes[i].handler->onTopicMessage(message.topic, message.topicLen,
+                                              message.msg, message.msgLen, routes[i].context);
+            ++count;
+        }
+    }
+    return count;
+}
+
+int TopicRouter::_match(int16_t parent, const char *seg, size_t remainLen, const Message &message)
+{
+    size_t segLen = segmentLen(seg, remainLen);
+    bool last = segLen == remainLen;
+    int count = 0;
+
+    for (int16_t c = _nodes[parent].firstChild; c != NULL_NODE; c = _nodes[c].nextSibling) {
+        if (_isWildcard(c, '#')) {
+            count += _invoke(c, message);
+        }
+        else if (_isWildcard(c, '+') ||
+                 (_nodes[c].segLen == segLen && memcmp(_segPool + _nodes[c].segOffset, seg, segLen) == 0)) {
+            if (last) {
+                count += _invoke(c, message);
+                // "a/#" also matches "a"
+                for (int16_t g = _nodes[c].firstChild; g != NULL_NODE; g = _nodes[g].nextSibling) {
+                    if (_isWildcard(g, '#')) count += _invoke(g, message);
+                }
+            }
+            else {
+                count += _match(c, seg + segLen + 1, remainLen - segLen - 1, message);
+            }
+        }
+    }
+    return count;
+}
+
+int TopicRouter::dispatch(const char *topic, size_t topicLen, const char *msg, size_t msgLen)
+{
+    Message message = { topic, topicLen, msg, msgLen };
+    return _match(ROOT_NODE, topic, topicLen, message);
+}
@@ -0,0 +1,83 @@
+/*
+ * TopicRouter: segment trie dispatch of incoming MQTT messages
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _TOPIC_ROUTER_H
+#define _TOPIC_ROUTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ TopicMessageHandler class
+/////////////////////////////////////////////////////////////////////////////////////////
+class TopicMessageHandler
+{
+public:
+    virtual void onTopicMessage(const char *topic, size_t topicLen,
+                                const char *msg,   size_t msgLen, void *context) = 0;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ TopicRouter class
+/////////////////////////////////////////////////////////////////////////////////////////
+// Route patterns follow MQTT topic filter syntax: '+' matches exactly one level,
+// '#' (last level only) matches the parent level and any number of levels below.
+// Each pattern level is a trie node, so dispatch walks the topic once and only
+// branches where wildcard routes exist.
+
+#define TOPIC_ROUTER_NODE_CAPACITY          32
+#define TOPIC_ROUTER_NODE_HANDLER_CAPACITY  2
+#define TOPIC_ROUTER_SEGMENT_POOL_SIZE      512
+
+class TopicRouter
+{
+public:
+    TopicRouter();
+
+    bool addRoute(const char *pattern, TopicMessageHandler *handler, void *context = NULL);
+    bool removeRoute(const char *pattern, TopicMessageHandler *handler);
+    void clear();
+
+    // return the number of handlers invoked
+    int dispatch(const char *topic, size_t topicLen, const char *msg, size_t msgLen);
+
+protected:
+    struct Route {
+        TopicMessageHandler *handler;
+        void                *context;
+    };
+
+    struct Node {
+        uint16_t    segOffset;
+        uint8_t     segLen;
+        int16_t     firstChild;
+        int16_t     nextSibling;
+        Route       routes[TOPIC_ROUTER_NODE_HANDLER_CAPACITY];
+    };
+
+    struct Message {
+        const char *topic;
+        size_t      topicLen;
+        const char *msg;
+        size_t      msgLen;
+    };
+
+    int16_t _findChild(int16_t parent, const char *seg, size_t segLen);
+    int16_t _addChild(int16_t parent, const char *seg, size_t segLen);
+    int16_t _findNode(const char *pattern);
+    bool    _isWildcard(int16_t node, char wildcard);
+    int     _invoke(int16_t node, const Message &message);
+    int     _match(int16_t parent, const char *seg, size_t remainLen, const Message &message);
+
+protected:
+    int16_t                     _nodeCount;
+    uint16_t                    _segPoolUsed;
+    Node                        _nodes[TOPIC_ROUTER_NODE_CAPACITY];
+    char                        _segPool[TOPIC_ROUTER_SEGMENT_POOL_SIZE];
+};
+
+#endif // _TOPIC_ROUTER_H
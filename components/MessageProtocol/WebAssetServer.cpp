@@ -0,0 +1,148 @@
+/*
+ * WebAssetServer: precompressed static files served from flash
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "WebAssetServer.h"
+#include "HttpRouter.h"
+#include "mongoose/mongoose.h"
+#include <string.h>
+
+WebAssetServer::WebAssetServer()
+: _assets(NULL)
+, _assetCount(0)
+{
+    memset(_transfers, 0, sizeof(_transfers));
+}
+
+void WebAssetServer::setAssets(const WebAsset *assets, size_t count)
+{
+    _assets = assets;
+    _assetCount = count;
+}
+
+const WebAsset * WebAssetServer::_findAsset(struct http_message *hm)
+{
+    for (size_t i = 0; i < _assetCount; ++i) {
+        if (mg_vcmp(&hm->uri, _assets[i].path) == 0) return &_assets[i];
+    }
+    return NULL;
+}
+
+int WebAssetServer::_findTransfer(struct mg_connection *nc)
+{
+    for (int i = 0; i < WEB_ASSET_TRANSFER_CAPACITY; ++i) {
+        if (_transfers[i].nc == nc) return i;
+    }
+    return -1;
+}
+
+bool WebAssetServer::serve(struct mg_connection *nc, struct http_message *hm)
+{
+    const WebAsset *asset = _findAsset(hm);
+    if (!asset) return false;
+    if (_findTransfer(nc) >= 0) {
+        // pipelined behind an unfinished body, responses would interleave
+        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        return true;
+    }
+
+    bool head = mg_vcmp(&hm->method, "HEAD") == 0;
+    if (!head && mg_vcmp(&hm->method, "GET") != 0) {
+        HttpRouter::sendResponse(nc, hm, 405, "application/json", "{\"err\":\"method not allowed\"}",
+                                 "Allow: GET, HEAD\r\n");
+        return true;
+    }
+
+    bool alive = HttpRouter::keepAlive(hm);
+    if (HttpRouter::etagMatched(hm, asset->etag)) {
+        mg_printf(nc, "HTTP/1.1 304 Not Modified\r\n"
+                      "Cache-Control: max-age=%u\r\n"
+                      "ETag: %s\r\n"
+                      "Connection: %s\r\n"
+                      "\r\n",
+                      WEB_ASSET_MAX_AGE, asset->etag, alive ? "keep-alive" : "close");
+        HttpRouter::finishResponse(nc, alive);
+        return true;
+    }
+
+    // only the gzip bytes are in flash, nothing to fall back on
+    if (!HttpRouter::gzipAccepted(hm)) {
+        HttpRouter::sendResponse(nc, hm, 406, "application/json", "{\"err\":\"gzip encoding required\"}",
+                                 "Vary: Accept-Encoding\r\n");
+        return true;
+    }
+
+    int index = -1;
+    if (!head) {
+        index = _findTransfer(NULL);
+        if (index < 0) {
+            HttpRouter::sendResponse(nc, hm, 503, "application/json", "{\"err\":\"busy\"}", "Retry-After: 1\r\n");
+            return true;
+        }
+    }
+
+    mg_printf(nc, "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: %s\r\n"
+                  "Content-Encoding: gzip\r\n"
+                  "Content-Length: %u\r\n"
+                  "Cache-Control: max-age=%u\r\n"
+                  "ETag: %s\r\n"
+                  "Vary: Accept-Encoding\r\n"
+                  "Connection: %s\r\n"
+                  "\r\n",
+                  asset->contentType, (unsigned)asset->length, WEB_ASSET_MAX_AGE, asset->etag,
+                  alive ? "keep-alive" : "close");
+    if (head) {
+        HttpRouter::finishResponse(nc, alive);
+        return true;
+    }
+
+    // idle timer of a kept-alive connection must not cut the transfer short
+    mg_set_timer(nc, 0);
+    Transfer &transfer = _transfers[index];
+    transfer.nc = nc;
+    transfer.asset = asset;
+    transfer.offset = 0;
+    transfer.keepAlive = alive;
+    _pump(transfer);
+    return true;
+}
+
+void WebAssetServer::_pump(Transfer &transfer)
+{
+    struct mg_connection *nc = transfer.nc;
+    const WebAsset *asset = transfer.asset;
+    while (transfer.offset < asset->length && nc->send_mbuf.len < WEB_ASSET_CHUNK_SIZE) {
+        uint32_t length = asset->length - transfer.offset;
+        if (length > WEB_ASSET_CHUNK_SIZE) length = WEB_ASSET_CHUNK_SIZE;
+        mg_send(nc, asset->data + transfer.offset, length);
+        transfer.offset += length;
+    }
+    if (transfer.offset >= asset->length) {
+        HttpRouter::finishResponse(nc, transfer.keepAlive);
+        memset(&transfer, 0, sizeof(Transfer));
+    }
+}
+
+void WebAssetServer::onSent(struct mg_connection *nc)
+{
+    int index = _findTransfer(nc);
+    if (index >= 0) _pump(_transfers[index]);
+}
+
+void WebAssetServer::onClose(struct mg_connection *nc)
+{
+    int index = _findTransfer(nc);
+    if (index >= 0) memset(&_transfers[index], 0, sizeof(Transfer));
+}
+
+uint8_t WebAssetServer::transferCount()
+{
+    uint8_t count = 0;
+    for (int i = 0; i < WEB_ASSET_TRANSFER_CAPACITY; ++i) {
+        if (_transfers[i].nc) ++count;
+    }
+    return count;
+}
@@ -0,0 +1,74 @@
+/*
+ * WebAssetServer: precompressed static files served from flash
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _WEB_ASSET_SERVER_H
+#define _WEB_ASSET_SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// mongoose is built with private flags, keep its types out of this header
+struct mg_connection;
+struct http_message;
+
+// entry of the table generated by tools/webAssets2Header.cpp
+struct WebAsset
+{
+    const char          *path;
+    const char          *contentType;
+    const char          *etag;          // quoted, over the compressed bytes
+    const uint8_t       *data;          // gzip, const so it stays in memory-mapped flash
+    uint32_t             length;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ WebAssetServer class
+/////////////////////////////////////////////////////////////////////////////////////////
+// Assets are gzipped at build time and sent as is with Content-Encoding: gzip, a strong
+// ETag and WEB_ASSET_MAX_AGE; a client whose Accept-Encoding lacks gzip gets 406. The body is read straight from flash and handed to the
+// connection WEB_ASSET_CHUNK_SIZE at a time as its send buffer drains, so a transfer
+// never holds more than about two chunks of heap however large the asset is.
+// Reactor task only.
+
+#define WEB_ASSET_TRANSFER_CAPACITY         4
+#define WEB_ASSET_CHUNK_SIZE                1460    // one tcp segment
+#define WEB_ASSET_MAX_AGE                   86400   // s
+
+class WebAssetServer
+{
+public:
+    WebAssetServer();
+
+    void setAssets(const WebAsset *assets, size_t count);
+
+    // false if no asset matches the request path, nothing sent then
+    bool serve(struct mg_connection *nc, struct http_message *hm);
+    // send buffer of nc went down, next chunk of its transfer
+    void onSent(struct mg_connection *nc);
+    void onClose(struct mg_connection *nc);
+
+    uint8_t transferCount();
+
+protected:
+    struct Transfer {
+        struct mg_connection   *nc;
+        const WebAsset         *asset;
+        uint32_t                offset;
+        bool                    keepAlive;
+    };
+
+    const WebAsset * _findAsset(struct http_message *hm);
+    int  _findTransfer(struct mg_connection *nc);
+    void _pump(Transfer &transfer);
+
+protected:
+    const WebAsset             *_assets;
+    size_t                      _assetCount;
+    Transfer                    _transfers[WEB_ASSET_TRANSFER_CAPACITY];
+};
+
+#endif // _WEB_ASSET_SERVER_H
@@ -5234,6 +5234,28 @@ enum mg_ssl_if_result mg_ssl_if_handshake(struct mg_connection *nc) {
   return MG_SSL_OK;
 }
 
+#ifdef MONGOOSE_ESP32_ADAPTION
+/* Offer a cached session to the server, client only, before handshake */
+enum mg_ssl_if_result mg_ssl_if_set_session(
+    struct mg_connection *nc, const struct mbedtls_ssl_session *session) {
+  struct mg_ssl_if_ctx *ctx = (struct mg_ssl_if_ctx *) nc->ssl_if_data;
+  if (ctx == NULL || ctx->ssl == NULL || session == NULL) return MG_SSL_ERROR;
+  if (mbedtls_ssl_set_session(ctx->ssl, session) != 0) return MG_SSL_ERROR;
+  return MG_SSL_OK;
+}
+
+/* Copy negotiated session out, after handshake; free with
+ * mbedtls_ssl_session_free() */
+enum mg_ssl_if_result mg_ssl_if_get_session(
+    struct mg_connection *nc, struct mbedtls_ssl_session *session) {
+  struct mg_ssl_if_ctx *ctx = (struct mg_ssl_if_ctx *) nc->ssl_if_data;
+  if (ctx == NULL || ctx->ssl == NULL || session == NULL) return MG_SSL_ERROR;
+  if (!(nc->flags & MG_F_SSL_HANDSHAKE_DONE)) return MG_SSL_ERROR;
+  if (mbedtls_ssl_get_session(ctx->ssl, session) != 0) return MG_SSL_ERROR;
+  return MG_SSL_OK;
+}
+#endif
+
 int mg_ssl_if_read(struct mg_connection *nc, void *buf, size_t len) {
   struct mg_ssl_if_ctx *ctx = (struct mg_ssl_if_ctx *) nc->ssl_if_data;
   int n = mbedtls_ssl_read(ctx->ssl, (unsigned char *) buf, len);
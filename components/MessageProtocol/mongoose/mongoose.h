@@ -3778,6 +3778,15 @@ enum mg_ssl_if_result mg_ssl_if_handshake(struct mg_connection *nc);
 int mg_ssl_if_read(struct mg_connection *nc, void *buf, size_t buf_size);
 int mg_ssl_if_write(struct mg_connection *nc, const void *data, size_t len);
 
+#ifdef MONGOOSE_ESP32_ADAPTION
+/* TLS session resumption, mbedTLS only */
+struct mbedtls_ssl_session;
+enum mg_ssl_if_result mg_ssl_if_set_session(
+    struct mg_connection *nc, const struct mbedtls_ssl_session *session);
+enum mg_ssl_if_result mg_ssl_if_get_session(
+    struct mg_connection *nc, struct mbedtls_ssl_session *session);
+#endif
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
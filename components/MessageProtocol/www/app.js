@@ -0,0 +1,65 @@
+(function () {
+  var UNITS = { temp: '°C', humid: '%', lumi: 'lux', 'pm1.0': 'µg/m³', 'pm2.5': 'µg/m³',
+                pm10: 'µg/m³', hcho: 'mg/m³', co2: 'ppm' };
+  var INTERVAL = 2000;
+  var cards = {};
+
+  function $(id) { return document.getElementById(id); }
+
+  function card(name) {
+    if (cards[name]) return cards[name];
+    var el = document.createElement('div');
+    el.className = 'card';
+    el.innerHTML = '<div class="name"></div><div><span class="value">-</span><span class="unit"></span></div>';
+    el.querySelector('.name').textContent = name;
+    el.querySelector('.unit').textContent = UNITS[name] || '';
+    $('values').appendChild(el);
+    return (cards[name] = el);
+  }
+
+  function render(data) {
+    for (var key in data) {
+      // level fields (templvl, pm2.5uslvl, ...) color the card of their value
+      if (/lvl$/.test(key) || !(key in UNITS)) continue;
+      var el = card(key);
+      el.querySelector('.value').textContent = data[key];
+      var lvl = data[key + 'lvl'];
+      el.className = 'card' + (lvl > 1 ? ' lvl' + lvl : '');
+    }
+  }
+
+  function setOnline(on) {
+    $('state').textContent = on ? 'live' : 'offline';
+    $('state').className = on ? '' : 'off';
+  }
+
+  function getJson(url, done) {
+    var xhr = new XMLHttpRequest();
+    xhr.onload = function () { if (xhr.status == 200) done(JSON.parse(xhr.responseText)); };
+    xhr.open('GET', url);
+    xhr.send();
+  }
+
+  function connect() {
+    var ws = new WebSocket('ws://' + location.host + '/');
+    ws.onopen = function () {
+      setOnline(true);
+      ws.send(JSON.stringify({ cmd: 'SubscribeSensorData', interval: INTERVAL }));
+    };
+    ws.onmessage = function (e) {
+      var msg = JSON.parse(e.data);
+      if (msg.cmd == 'GetSensorData' && typeof msg.ret == 'object') render(msg.ret);
+    };
+    ws.onclose = function () {
+      setOnline(false);
+      setTimeout(connect, 3000);
+    };
+  }
+
+  getJson('/api/v1/device', function (d) {
+    if (d.devname) $('devname').textContent = d.devname;
+    $('device').textContent = d.model + ' · firmware ' + d.firmv + ' · ' + d.uid;
+  });
+  getJson('/api/v1/sensors', render);
+  connect();
+})();
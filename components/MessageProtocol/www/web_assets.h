@@ -0,0 +1,141 @@
+/*
+ * WebAsset table header
+ * Copyright (c) 2018 Shenghua Su
+ *
+ * This file is generated by script, should not be modified
+ */
+
+#ifndef _WEB_ASSETS_H
+#define _WEB_ASSETS_H
+
+#include "WebAssetServer.h"
+
+// index.html, 401 -> 264 bytes
+static const uint8_t webAssetData0[] = {
+  0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x3d,0x90,0xbb,0x52,0xc4,0x30,
+  0x0c,0x45,0xfb,0x7c,0x85,0x71,0x4d,0x36,0x93,0x8e,0xc2,0x4e,0x03,0xd4,0x30,0x03,
+  0x0d,0xa5,0x70,0x94,0xb1,0xc1,0xb1,0x33,0x96,0x36,0x3b,0xfb,0xf7,0xc8,0x79,0xd0,
+  0x58,0xa3,0xab,0xc7,0x3d,0xb2,0x79,0x78,0x79,0x7b,0xfe,0xfc,0x7a,0x7f,0x55,0x9e,
+  0xe7,0x38,0x34,0xe6,0x0c,0x08,0xa3,0x84,0x19,0x19,0x94,0xf3,0x50,0x08,0xd9,0xea,
+  0x2b,0x4f,0xed,0x93,0x3e,0xe5,0x04,0x33,0x5a,0xbd,0x06,0xbc,0x2d,0xb9,0xb0,0x56,
+  0x2e,0x27,0xc6,0x24,0x6d,0xb7,0x30,0xb2,0xb7,0x23,0xae,0xc1,0x61,0xbb,0x25,0x8f,
+  0x2a,0xa4,0xc0,0x01,0x62,0x4b,0x0e,0x22,0xda,0xbe,0x2e,0xe1,0xc0,0x11,0x87,0x0f,
+  0x4c,0x94,0x8b,0xe9,0xf6,0xac,0x31,0x31,0xa4,0x5f,0x55,0x30,0x5a,0x4d,0x7c,0x8f,
+  0x48,0x1e,0x51,0x76,0xfb,0x82,0x93,0xd5,0xdd,0x26,0x5d,0x1c,0x51,0x9d,0xef,0x0e,
+  0xc6,0xef,0x3c,0xde,0x0f,0x62,0x2c,0x43,0xa3,0x94,0xf1,0xbd,0x0a,0xa3,0xd5,0x42,
+  0x50,0x19,0xf5,0xbf,0x87,0xef,0xb7,0x32,0x2d,0x90,0xb6,0x06,0x62,0x60,0x14,0xf0,
+  0x08,0x44,0x56,0xe7,0x69,0xd2,0x83,0x3c,0x42,0x80,0xa6,0xab,0x4d,0xa7,0x49,0x5d,
+  0x6b,0x66,0x08,0xfb,0xd4,0x0a,0xf1,0x8a,0x42,0x60,0xba,0x2a,0x49,0x65,0xca,0x99,
+  0xb1,0x9c,0x96,0x72,0x74,0xad,0xed,0xa2,0x54,0xc9,0x95,0xb0,0xb0,0xa2,0xe2,0xe4,
+  0x00,0x58,0x96,0xcb,0xcf,0x36,0xbb,0xcb,0xd5,0xe1,0xe0,0xef,0xf6,0x9f,0xff,0x03,
+  0x18,0xc4,0xe0,0x6e,0x91,0x01,0x00,0x00
+};
+
+// app.js, 2155 -> 979 bytes
+static const uint8_t webAssetData1[] = {
+  0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x85,0x55,0x5f,0x6f,0xdb,0x36,
+  0x10,0x7f,0xef,0xa7,0xb8,0x15,0x59,0x49,0x61,0x99,0xe4,0x64,0xd8,0x4b,0x9c,0x66,
+  0xd8,0xb2,0xa0,0x4d,0xd1,0xa6,0x40,0xed,0xfd,0x01,0x8a,0x3c,0x28,0xd2,0xd9,0xe6,
+  0x4a,0x91,0x1a,0x49,0xc9,0x31,0x52,0x7f,0xa7,0x01,0xc3,0xb0,0xf7,0x7c,0xb2,0xdd,
+  0xd1,0x92,0x2d,0xcf,0x19,0xe6,0x07,0x83,0xbc,0xbf,0xbf,0xbb,0xfb,0xf1,0x24,0x67,
+  0x8d,0x29,0x82,0xb2,0x06,0x64,0x02,0x0f,0xcf,0x00,0xda,0xdc,0xc1,0x4f,0x37,0xd7,
+  0xd3,0x09,0xbc,0x84,0x07,0x08,0x58,0xd5,0x67,0x20,0x1e,0xff,0xb8,0x14,0xc7,0xb0,
+  0x68,0x2a,0x55,0xd2,0xed,0x4b,0x3a,0x6b,0x3a,0xd3,0x51,0x37,0xf7,0x74,0x11,0x75,
+  0x75,0x92,0x8e,0x04,0x1b,0xfe,0x35,0xcf,0xaa,0xc7,0x3f,0x37,0xb2,0xd3,0xf4,0xdb,
+  0x3d,0x19,0x45,0xdf,0xff,0x91,0xdb,0x68,0xcf,0x69,0x51,0x2c,0x2c,0x09,0xaa,0xfe,
+  0x5e,0xd8,0x53,0xba,0xd6,0x75,0x25,0x60,0x3d,0xee,0xc0,0x5d,0xdf,0x4c,0xaf,0x3e,
+  0xfc,0xfc,0xfd,0x5b,0xc2,0x77,0x3a,0x1a,0x8d,0x7a,0x71,0x91,0xbb,0xd2,0x33,0x66,
+  0x32,0x24,0xd1,0xb6,0xac,0x23,0xa9,0x4a,0xaa,0x0c,0x1c,0x86,0xc6,0x19,0x28,0x6d,
+  0xd1,0x54,0x68,0x42,0x3a,0xc7,0x70,0xa5,0x91,0x8f,0x3f,0xac,0xae,0x4b,0x36,0x1a,
+  0xc3,0x7a,0xcf,0x93,0x23,0x4a,0x93,0x57,0xb8,0x69,0x0c,0x80,0x9a,0x81,0x8c,0x69,
+  0x3e,0xb2,0xf4,0x36,0xe9,0x63,0x0e,0x64,0xe3,0x68,0xc8,0x78,0x50,0x13,0x98,0x6d,
+  0xb6,0xc2,0x61,0x1e,0xb0,0x4b,0x28,0x45,0xa9,0x5a,0x91,0x6c,0x6c,0x51,0xa7,0x85,
+  0xce,0xbd,0xbf,0x21,0x77,0xf2,0x10,0x1c,0x4c,0x6c,0x55,0xca,0x18,0x74,0xaf,0xa7,
+  0xef,0xb8,0x5a,0x71,0x4e,0x6e,0x10,0x8d,0x5f,0x3e,0xe7,0x6c,0xcf,0x2f,0xce,0x33,
+  0x12,0x5d,0x9c,0xc7,0x3f,0x5f,0xe7,0xa6,0xd7,0xb6,0xb9,0x6e,0x48,0xfd,0xf5,0x79,
+  0xc6,0xd2,0x7d,0x5d,0x63,0x54,0x60,0xcf,0x8d,0x26,0x06,0xd8,0xe5,0xfb,0xbd,0x41,
+  0xb7,0x9a,0xa0,0xc6,0x22,0x58,0x27,0x45,0xca,0x69,0x44,0x92,0x06,0xbc,0x0f,0x97,
+  0xd6,0x04,0x02,0x4f,0x40,0x58,0xf8,0x9f,0x1e,0x1c,0xfe,0xc0,0x23,0x12,0x6a,0xd3,
+  0x21,0xf8,0xfc,0x19,0x44,0x97,0xf0,0x48,0x8a,0x88,0xd4,0x93,0x43,0x5e,0xd7,0x68,
+  0xca,0xcb,0x85,0xd2,0xa5,0x44,0xdd,0x35,0xa7,0x6b,0xf0,0xb0,0xeb,0x14,0xad,0x53,
+  0xef,0x4f,0xcb,0x91,0x37,0x3a,0x59,0xe6,0x21,0xef,0xe7,0x35,0xb3,0x0e,0x24,0xcf,
+  0xe2,0x13,0xae,0x40,0xd1,0xec,0x07,0x3a,0x80,0x2c,0x03,0x8d,0x2d,0x8d,0x69,0xa6,
+  0x50,0x13,0x75,0x24,0x73,0x5d,0xb7,0xfa,0x18,0x22,0x73,0x1b,0x1f,0xcf,0x69,0x9a,
+  0x26,0x44,0x43,0x4d,0xa1,0xc2,0x02,0xe3,0xa8,0xc1,0xce,0xf8,0xac,0x1c,0x44,0xf0,
+  0x5d,0x38,0x26,0x47,0x46,0x2e,0x47,0x19,0xd5,0xee,0x83,0xa4,0x9c,0x09,0xd7,0xfa,
+  0x85,0xec,0xb2,0xc7,0x1e,0x24,0x1c,0xcc,0x04,0x65,0x9a,0xae,0x83,0x03,0xb2,0x44,
+  0xbe,0xb1,0x5b,0xaf,0x79,0xa2,0xbb,0x31,0xe3,0x41,0x7b,0xb9,0xb0,0x8f,0xe4,0x79,
+  0x3b,0x8c,0x49,0x58,0x06,0x2a,0xf8,0x8a,0x1e,0x6b,0xab,0xc5,0xed,0x20,0xf8,0x21,
+  0xef,0xc8,0x4a,0xb2,0xdf,0x05,0x9c,0xc0,0x77,0x20,0x38,0x06,0xcb,0x58,0x44,0xef,
+  0xb0,0xa7,0xec,0xfa,0xa0,0xf9,0x1e,0xc3,0x7b,0xa3,0x95,0x41,0x69,0x4d,0xdf,0x61,
+  0x1a,0xae,0x0f,0x44,0xfa,0x03,0xb4,0x64,0x4f,0xb1,0xb5,0x6a,0x51,0x70,0x54,0x3b,
+  0x9b,0xb1,0xe7,0x8e,0x12,0xbd,0xd7,0x10,0xde,0xc6,0xa7,0xb7,0x17,0x87,0xe3,0xa7,
+  0xe7,0xfc,0xc6,0x5b,0x23,0x1b,0x47,0x43,0x2b,0xad,0xd9,0x3e,0x5a,0x6e,0xc5,0xfd,
+  0xc2,0x31,0x6d,0x71,0x09,0xbf,0xbe,0x7b,0xfb,0x3a,0x84,0xfa,0x03,0x52,0x63,0x69,
+  0x48,0x5d,0x41,0xa4,0x4f,0xad,0xd1,0x36,0x2f,0xc9,0x6c,0x6f,0x21,0xc6,0xb1,0xb2,
+  0x9a,0x41,0x35,0xb4,0x5f,0xe2,0xd2,0x49,0x62,0x06,0xf9,0x66,0xf2,0xfe,0x26,0xad,
+  0x73,0xe7,0x31,0x9a,0x38,0xf4,0xb5,0x35,0x1e,0xa7,0x54,0x6d,0xc2,0xdb,0x64,0x10,
+  0x9c,0xb8,0x2d,0xc5,0xab,0xab,0x29,0xed,0x34,0x42,0x38,0x48,0xeb,0x89,0xb6,0xf2,
+  0x09,0x3a,0x13,0x4b,0x0c,0x0d,0x5d,0x0e,0xcb,0x58,0xfa,0xae,0x8a,0x5f,0xf0,0x6e,
+  0x62,0x8b,0x4f,0x48,0x9b,0x64,0xe9,0xcf,0xb2,0x2c,0xce,0xc8,0x16,0x39,0x7b,0xa6,
+  0x0b,0xeb,0x03,0x4f,0x3b,0xeb,0xc7,0xb5,0xf4,0x54,0x1c,0x23,0xf8,0x77,0x71,0x1d,
+  0x13,0x76,0xc3,0x0b,0xae,0xc1,0x2d,0xfb,0xc8,0x2d,0x82,0x8b,0x55,0xfa,0xe0,0x94,
+  0x99,0xab,0xd9,0x4a,0x3e,0x40,0x51,0xf1,0x47,0x60,0xd2,0xdc,0xf9,0xc2,0xa9,0x3b,
+  0x9c,0xa0,0xf1,0xd6,0xfd,0x48,0x3c,0xa3,0xe2,0x14,0x0d,0xd9,0x11,0x49,0xcf,0x76,
+  0x6b,0x7a,0x9d,0xf4,0xb4,0x19,0xc0,0xa9,0xd0,0xfb,0x7c,0x8e,0x7b,0x88,0x70,0x07,
+  0x89,0xab,0xad,0xfc,0x9c,0xd4,0x83,0x1e,0x63,0x1a,0x1f,0xf0,0x78,0xf0,0xe0,0xc8,
+  0x26,0x25,0x38,0x3c,0x16,0xf1,0x0a,0xc3,0x00,0x0a,0xbc,0x78,0x01,0x61,0x55,0x23,
+  0xbd,0x55,0x36,0xa2,0x45,0x12,0x8d,0xec,0xdd,0x6f,0xd4,0x55,0x91,0xf4,0xeb,0xa2,
+  0xd3,0x3d,0x81,0xb0,0xd0,0xd6,0xe3,0xff,0x76,0x6c,0x96,0x6b,0xbf,0x6b,0x19,0xc9,
+  0xa7,0xaa,0x42,0xdb,0x04,0xd9,0xcd,0xef,0x18,0xbe,0xa1,0x6f,0xd4,0x30,0x7c,0x1c,
+  0x73,0xcf,0x56,0x91,0xe5,0xb5,0xca,0xda,0x93,0xac,0xc4,0x56,0x15,0x48,0x0d,0xdc,
+  0xa5,0x2b,0x87,0x9f,0x9d,0x32,0x25,0x8b,0xcd,0xb7,0x88,0x5e,0x48,0x77,0x3e,0xdc,
+  0x03,0xbd,0xd5,0xf6,0x2d,0x75,0x71,0x0f,0x0d,0x2b,0x5b,0xd2,0xd2,0x21,0x9a,0xc0,
+  0xe3,0xdf,0xb4,0x01,0x5d,0xb5,0xcc,0x1d,0x02,0x13,0xa9,0x4c,0xf9,0xda,0xf6,0xba,
+  0x8d,0xa8,0x51,0x65,0x04,0x1f,0x2b,0x39,0x40,0xef,0x63,0xdf,0x3d,0xc1,0xdf,0xb4,
+  0x35,0x5a,0x6d,0x19,0x3c,0x7e,0xb6,0x4e,0xf8,0xff,0x1f,0x1e,0x96,0xc9,0xa6,0x6b,
+  0x08,0x00,0x00
+};
+
+// style.css, 1017 -> 444 bytes
+static const uint8_t webAssetData2[] = {
+  0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x85,0x53,0xdb,0x8e,0xdb,0x20,
+  0x10,0x7d,0xcf,0x57,0x8c,0xb4,0xaf,0x21,0xda,0xd8,0xd9,0xd4,0xc6,0x4f,0x7d,0xeb,
+  0x6f,0x4c,0xf0,0xe0,0xa5,0xc5,0x80,0x00,0xe7,0xd2,0x2a,0xff,0x5e,0x70,0x36,0x8e,
+  0x93,0xcd,0xb6,0xb2,0x84,0x64,0x74,0xe6,0x5c,0x66,0x98,0x9d,0x6d,0x4f,0xf0,0x07,
+  0x7a,0xf4,0x9d,0x32,0x1c,0x5e,0x1b,0x90,0xd6,0x44,0x26,0xb1,0x57,0xfa,0xc4,0x81,
+  0xa1,0x73,0x9a,0x58,0x38,0x85,0x48,0xfd,0x12,0x7e,0x90,0xde,0x53,0x54,0x02,0x97,
+  0xf0,0xdd,0x2b,0xd4,0x4b,0x08,0x68,0x02,0x0b,0xe4,0x95,0x6c,0x60,0x87,0xe2,0x57,
+  0xe7,0xed,0x60,0x5a,0x0e,0x2f,0xb2,0xc8,0x5f,0x03,0xc2,0x6a,0xeb,0xd3,0x7f,0x59,
+  0x96,0x0d,0x9c,0x17,0xef,0x84,0x2d,0xf9,0xa4,0xd8,0xaa,0xe0,0x34,0x26,0x09,0xa9,
+  0xe9,0xd8,0x00,0x6a,0xd5,0x19,0xa6,0x92,0x4a,0xe0,0x20,0xc8,0x44,0xf2,0x0d,0xfc,
+  0x1c,0x42,0x54,0xf2,0xc4,0x44,0xb2,0x94,0xae,0x38,0x04,0x87,0x82,0xd8,0x8e,0xe2,
+  0x81,0xc8,0x34,0xe0,0xb0,0x6d,0x95,0xe9,0x38,0xac,0x0b,0x77,0x84,0xf5,0xd6,0x1d,
+  0x1f,0x4c,0x14,0x58,0xca,0xb7,0xcd,0xcd,0x84,0x94,0x72,0x34,0xb1,0x7e,0x12,0x39,
+  0xa8,0xdf,0xc4,0xa1,0x78,0xcd,0x24,0xe3,0xc5,0x81,0x54,0xf7,0x9e,0x44,0x8d,0xf5,
+  0x3d,0xea,0x5c,0xf7,0x12,0x22,0x46,0x4a,0xb5,0xb3,0x82,0x2c,0x3d,0x73,0x92,0x8d,
+  0x54,0xa3,0x0f,0xeb,0x53,0x50,0xe6,0xb1,0x55,0x43,0x8a,0x54,0x7d,0xf2,0x56,0x8a,
+  0xfa,0xc6,0xb9,0xb2,0x52,0x26,0xde,0x3b,0x40,0x5d,0x8f,0x80,0x1e,0x95,0xf9,0xdc,
+  0xaf,0x7c,0xb2,0x83,0x47,0xc7,0x21,0x9f,0x33,0x07,0xa3,0xd2,0x79,0xb1,0x12,0xe8,
+  0xdb,0x6c,0x35,0x01,0x93,0xcb,0xfc,0x6d,0xc6,0x6c,0xd7,0xdc,0xd5,0x9d,0xef,0x4b,
+  0x8c,0xfb,0x09,0xe6,0x66,0x3d,0xc4,0xd8,0xce,0xa2,0x45,0x9b,0xc4,0x37,0x29,0x6f,
+  0xb0,0x5a,0xb5,0x53,0xa0,0x8b,0xf0,0xca,0x60,0xff,0xb4,0x53,0xd7,0x51,0x54,0x55,
+  0xd5,0x40,0xa4,0x63,0x64,0xd1,0xa7,0x37,0x24,0x53,0x93,0x39,0x0c,0xce,0x91,0x17,
+  0x18,0x68,0x46,0xb4,0x47,0x3d,0x3c,0x30,0x15,0xd5,0x2d,0xc8,0x64,0x63,0x56,0x32,
+  0x18,0x15,0xff,0xab,0xfd,0x51,0xae,0x49,0xc6,0x5b,0xbd,0xde,0xeb,0x22,0xcf,0x61,
+  0x4a,0xc8,0xa6,0xa7,0x23,0xf2,0xfb,0x85,0x8c,0x28,0xbf,0x40,0xd4,0x13,0x62,0xf3,
+  0x05,0xe2,0xb2,0x03,0x19,0xf1,0xf6,0x1c,0x51,0x97,0xf5,0x95,0x63,0xfb,0x1c,0xf1,
+  0xed,0xc2,0x21,0xad,0x8d,0xe3,0x1e,0xcd,0xe7,0x3e,0xae,0xc0,0xc7,0x1e,0xfc,0x3b,
+  0xfc,0x79,0xf1,0x17,0xfa,0x77,0xdf,0xd2,0xf9,0x03,0x00,0x00
+};
+
+static const WebAsset webAssets[] = {
+  { "/", "text/html; charset=utf-8", "\"990c3dd3\"", webAssetData0, 264 },
+  { "/index.html", "text/html; charset=utf-8", "\"990c3dd3\"", webAssetData0, 264 },
+  { "/app.js", "application/javascript; charset=utf-8", "\"f649b08e\"", webAssetData1, 979 },
+  { "/style.css", "text/css; charset=utf-8", "\"f55961e6\"", webAssetData2, 444 }
+};
+
+#define WEB_ASSET_COUNT (sizeof(webAssets) / sizeof(webAssets[0]))
+
+#endif // _WEB_ASSETS_H
@@ -6,8 +6,10 @@
 
 #include "SensorDataPacker.h"
 #include <string.h>
+#include <stdio.h>
 #include "System.h"
 #include "SharedBuffer.h"
+#include "StrFormat.h"
 
 static SensorDataPacker _sharedSensorDataPacker;
 
@@ -102,59 +104,115 @@ const uint8_t* SensorDataPacker::dataBlock(size_t &size)
   return _dataBlockBuf;
 }
 
-const char* SensorDataPacker::dataJsonString(size_t &size)
+static void addValue(SensorValue *values, size_t capacity, size_t &count,
+                     const char *name, float value, int level)
 {
-  size_t packCount = 0;
-  bool commaPreceded = false;
+  if (count >= capacity) return;
+  values[count].name = name;
+  values[count].value = value;
+  values[count].level = level;
+  ++count;
+}
 
-  sprintf(_dataStringBuf + packCount, "{\"ret\":{");
-  packCount += strlen(_dataStringBuf + packCount);
+size_t SensorDataPacker::values(SensorValue *values, size_t capacity)
+{
+  size_t count = 0;
 
   if (_thSensor && _sensorCapability & TEMP_HUMID_CAPABILITY_MASK) {
     TempHumidData th = _thSensor->tempHumidData();
-    sprintf(_dataStringBuf + packCount,
+    addValue(values, capacity, count, "temp", th.temp, th.levelTemp);
+    addValue(values, capacity, count, "humid", th.humid, th.levelHumid);
+  }
+
+  if (_lmSensor && _sensorCapability & LUMINOSITY_CAPABILITY_MASK) {
+    LuminosityData lm = _lmSensor->luminosityData();
+    addValue(values, capacity, count, "lumi", lm.luminosity, lm.level);
+  }
+
+  if (_pmSensor) {
+    if (_sensorCapability & PM_CAPABILITY_MASK) {
+      PMData& pm = _pmSensor->pmData();
+      addValue(values, capacity, count, "pm1.0", pm.pm1d0, -1);
+      addValue(values, capacity, count, "pm2.5", pm.pm2d5, -1);
+      addValue(values, capacity, count, "pm10", pm.pm10, -1);
+      addValue(values, capacity, count, "pm2.5us", pm.aqiPm2d5US, pm.levelPm2d5US);
+      addValue(values, capacity, count, "pm2.5cn", pm.aqiPm2d5CN, pm.levelPm2d5CN);
+      addValue(values, capacity, count, "pm10us", pm.aqiPm10US, pm.levelPm10US);
+    }
+    if (_sensorCapability & HCHO_CAPABILITY_MASK) {
+      HchoData hcho = _pmSensor->hchoData();
+      addValue(values, capacity, count, "hcho", hcho.hcho, hcho.level);
+    }
+  }
+
+  if (_co2Sensor && (_sensorCapability & CO2_CAPABILITY_MASK)) {
+    CO2Data co2Data = _co2Sensor->co2Data();
+    addValue(values, capacity, count, "co2", co2Data.co2, co2Data.level);
+  }
+
+  return count;
+}
+
+size_t SensorDataPacker::dataJsonFields(char *buf, size_t size)
+{
+  size_t length = 0;
+  bool commaPreceded = false;
+
+  if (_thSensor && _sensorCapability & TEMP_HUMID_CAPABILITY_MASK) {
+    TempHumidData th = _thSensor->tempHumidData();
+    appendf(buf, size, length,
         "\"temp\":%.1f,\"templvl\":%d,\"humid\":%.1f,\"humidlvl\":%d",
         th.temp, th.levelTemp, th.humid, th.levelHumid);
-    packCount += strlen(_dataStringBuf + packCount);
     commaPreceded = true;
   }
 
   if (_lmSensor && _sensorCapability & LUMINOSITY_CAPABILITY_MASK) {
     LuminosityData lm = _lmSensor->luminosityData();
-    sprintf(_dataStringBuf + packCount,
+    appendf(buf, size, length,
         "%s\"lumi\":%d,\"lumilvl\":%d",
         commaPreceded ? "," : "", lm.luminosity, lm.level);
-    packCount += strlen(_dataStringBuf + packCount);
     commaPreceded = true;
   }
 
   if (_pmSensor) {
     if (_sensorCapability & PM_CAPABILITY_MASK) {
       PMData& pm = _pmSensor->pmData();
-      sprintf(_dataStringBuf + packCount,
+      appendf(buf, size, length,
           "%s\"pm1.0\":%.1f,\"pm2.5\":%.1f,\"pm10\":%.1f,\"pm2.5us\":%d,\"pm2.5uslvl\":%d,"\
           "\"pm2.5cn\":%d,\"pm2.5cnlvl\":%d,\"pm10us\":%d,\"pm10uslvl\":%d",
           commaPreceded ? "," : "",
           pm.pm1d0, pm.pm2d5, pm.pm10, pm.aqiPm2d5US, pm.levelPm2d5US,
           pm.aqiPm2d5CN, pm.levelPm2d5CN, pm.aqiPm10US, pm.levelPm10US);
-      packCount += strlen(_dataStringBuf + packCount);
       commaPreceded = true;
     }
     if (_sensorCapability & HCHO_CAPABILITY_MASK) {
       HchoData hcho = _pmSensor->hchoData();
-      sprintf(_dataStringBuf + packCount, "%s\"hcho\":%.3f,\"hcholvl\":%d",
+      appendf(buf, size, length, "%s\"hcho\":%.3f,\"hcholvl\":%d",
               commaPreceded ? "," : "", hcho.hcho, hcho.level);
-      packCount += strlen(_dataStringBuf + packCount);
       commaPreceded = true;
     }
   }
   if (_co2Sensor && (_sensorCapability & CO2_CAPABILITY_MASK)) {
     CO2Data co2Data = _co2Sensor->co2Data();
-    sprintf(_dataStringBuf + packCount, "%s\"co2\":%d,\"co2lvl\":%d",
+    appendf(buf, size, length, "%s\"co2\":%d,\"co2lvl\":%d",
             commaPreceded ? "," : "", (int)co2Data.co2, co2Data.level);
-    packCount += strlen(_dataStringBuf + packCount);
   }
 
+  return length;
+}
+
+const char* SensorDataPacker::dataJsonString(size_t &size)
+{
+  size_t packCount = 0;
+
+  sprintf(_dataStringBuf + packCount, "{\"ret\":{");
+  packCount += strlen(_dataStringBuf + packCount);
+
+  // room left for closing braces and the cmd key appended by caller
+  size_t avail = SharedBuffer::msgBufferSize() - packCount - 32;
+  size_t fieldsLen = dataJsonFields(_dataStringBuf + packCount, avail);
+  packCount += fieldsLen < avail ? fieldsLen : avail - 1;
+
   sprintf(_dataStringBuf + packCount, "}}");
   packCount += strlen(_dataStringBuf + packCount);
 
@@ -16,6 +16,15 @@
 
 #define BUF_SIZE (sizeof(PMData) + sizeof(HchoData) + sizeof(TempHumidData) + sizeof(LuminosityData) + sizeof(CO2Data))
 
+#define SENSOR_VALUE_MAX_COUNT 11
+
+struct SensorValue
+{
+    const char  *name;      // same key as in json string
+    float        value;
+    int          level;     // -1 if value has no level
+};
+
 class SensorDataPacker
 {
 public:
@@ -38,6 +47,10 @@ public:
     // get data
     const uint8_t * dataBlock(size_t &size);
     const char*     dataJsonString(size_t &size);
+    // json fields without braces into buf, returns length needed (truncated if >= size)
+    size_t          dataJsonFields(char *buf, size_t size);
+    // values of enabled sensors, returns count
+    size_t          values(SensorValue *values, size_t capacity);
 
 public:
     SensorDataPacker();
@@ -0,0 +1,131 @@
+/*
+ * ApSelector: rank known APs from one scan by signal and history
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "ApSelector.h"
+#include <string.h>
+
+// wrap-safe deadline compare
+inline static bool timePassed(uint32_t nowMilli, uint32_t deadline)
+{
+  return (int32_t)(nowMilli - deadline) >= 0;
+}
+
+ApSelector::ApSelector()
+: _knownCount(0)
+, _lastSuccessIndex(-1)
+, _candidateCount(0)
+, _nextCandidate(0)
+{
+  memset(_history, 0, sizeof(_history));
+}
+
+void ApSelector::setKnownAps(const uint8_t * const *ssids, uint8_t count)
+{
+  if (count > AP_SELECTOR_KNOWN_CAPACITY) count = AP_SELECTOR_KNOWN_CAPACITY;
+  for (uint8_t i = 0; i < count; ++i) {
+    History &history = _history[i];
+    if (strncmp((const char *)history.ssid, (const char *)ssids[i], AP_SELECTOR_SSID_MAX_LEN) != 0) {
+      // new ssid at this index, history does not apply
+      memset(&history, 0, sizeof(history));
+      strncpy((char *)history.ssid, (const char *)ssids[i], AP_SELECTOR_SSID_MAX_LEN);
+      if (_lastSuccessIndex == i) _lastSuccessIndex = -1;
+    }
+  }
+  if (_lastSuccessIndex >= count) _lastSuccessIndex = -1;
+  _knownCount = count;
+  _candidateCount = 0;
+  _nextCandidate = 0;
+}
+
+bool ApSelector::_inBackoff(const History &history, uint32_t nowMilli)
+{
+  return history.failStreak > 0 && !timePassed(nowMilli, history.backoffUntil);
+}
+
+uint8_t ApSelector::rank(const ApScanRecord *records, uint16_t count, uint32_t nowMilli)
+{
+  _candidateCount = 0;
+  _nextCandidate = 0;
+
+  for (uint8_t k = 0; k < _knownCount; ++k) {
+    const History &history = _history[k];
+    if (history.ssid[0] == '\0' || _inBackoff(history, nowMilli)) continue;
+
+    // strongest record of this ssid (several bssids may share it)
+    int best = -1;
+    for (uint16_t r = 0; r < count; ++r) {
+      if (strncmp((const char *)records[r].ssid, (const char *)history.ssid,
+                  AP_SELECTOR_SSID_MAX_LEN) == 0 &&
+          (best < 0 || records[r].rssi > records[best].rssi))
+        best = r;
+    }
+    if (best < 0) continue;
+
+    uint16_t successes = history.successCount < AP_SELECTOR_SUCCESS_BONUS_MAX_COUNT ?
+                         history.successCount : AP_SELECTOR_SUCCESS_BONUS_MAX_COUNT;
+    int16_t score = records[best].rssi
+                  + successes * AP_SELECTOR_SUCCESS_BONUS
+                  + (_lastSuccessIndex == k ? AP_SELECTOR_LAST_SUCCESS_BONUS : 0)
+                  - history.failStreak * AP_SELECTOR_FAIL_PENALTY;
+
+    // insertion by score, descending
+    uint8_t pos = _candidateCount;
+    while (pos > 0 && _candidates[pos - 1].score < score) {
+      _candidates[pos] = _candidates[pos - 1];
+      --pos;
+    }
+    ApCandidate &candidate = _candidates[pos];
+    candidate.knownIndex = k;
+    memcpy(candidate.bssid, records[best].bssid, sizeof(candidate.bssid));
+    candidate.channel = records[best].channel;
+    candidate.rssi = records[best].rssi;
+    candidate.score = score;
+    ++_candidateCount;
+  }
+  return _candidateCount;
+}
+
+bool ApSelector::next(ApCandidate &candidate)
+{
+  if (_nextCandidate >= _candidateCount) return false;
+  candidate = _candidates[_nextCandidate++];
+  return true;
+}
+
+void ApSelector::onSuccess(uint8_t knownIndex, uint32_t nowMilli)
+{
+  if (knownIndex >= _knownCount) return;
+  History &history = _history[knownIndex];
+  if (history.successCount < UINT16_MAX) ++history.successCount;
+  history.failStreak = 0;
+  history.backoffUntil = nowMilli;
+  _lastSuccessIndex = knownIndex;
+}
+
+void ApSelector::onFailure(uint8_t knownIndex, uint32_t nowMilli)
+{
+  if (knownIndex >= _knownCount) return;
+  History &history = _history[knownIndex];
+  if (history.failStreak < UINT16_MAX) ++history.failStreak;
+  // base, 2x base, 4x base ... up to max
+  uint32_t backoff = AP_SELECTOR_BACKOFF_BASE;
+  for (uint16_t i = 1; i < history.failStreak && backoff < AP_SELECTOR_BACKOFF_MAX; ++i) backoff <<= 1;
+  if (backoff > AP_SELECTOR_BACKOFF_MAX) backoff = AP_SELECTOR_BACKOFF_MAX;
+  history.backoffUntil = nowMilli + backoff;
+}
+
+uint32_t ApSelector::backoffRemain(uint32_t nowMilli)
+{
+  uint32_t remain = UINT32_MAX;
+  for (uint8_t k = 0; k < _knownCount; ++k) {
+    const History &history = _history[k];
+    if (history.ssid[0] == '\0') continue;
+    if (!_inBackoff(history, nowMilli)) return 0;
+    uint32_t r = history.backoffUntil - nowMilli;
+    if (r < remain) remain = r;
+  }
+  return remain == UINT32_MAX ? 0 : remain;
+}
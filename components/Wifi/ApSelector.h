@@ -0,0 +1,89 @@
+/*
+ * ApSelector: rank known APs from one scan by signal and history
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _AP_SELECTOR_H
+#define _AP_SELECTOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ ApSelector class
+/////////////////////////////////////////////////////////////////////////////////////////
+// One scan result is intersected with the known AP list, candidates are ranked by RSSI
+// plus a bonus for recent successes and a penalty for consecutive failures, and tried
+// best first. A failed AP backs off exponentially before it becomes a candidate again.
+// Pure policy, no esp api and time passed in, so it can be fed fake scan results.
+
+#define AP_SELECTOR_KNOWN_CAPACITY          5       // matches ALTERNATIVE_AP_LIST_SIZE
+#define AP_SELECTOR_SSID_MAX_LEN            32
+#define AP_SELECTOR_BACKOFF_BASE            5000    // ms
+#define AP_SELECTOR_BACKOFF_MAX             300000  // ms
+#define AP_SELECTOR_LAST_SUCCESS_BONUS      10      // dB equivalent
+#define AP_SELECTOR_SUCCESS_BONUS           2       // per success, capped
+#define AP_SELECTOR_SUCCESS_BONUS_MAX_COUNT 5
+#define AP_SELECTOR_FAIL_PENALTY            10      // per consecutive failure
+
+struct ApScanRecord
+{
+    uint8_t     ssid[AP_SELECTOR_SSID_MAX_LEN + 1];
+    uint8_t     bssid[6];
+    uint8_t     channel;
+    int8_t      rssi;
+};
+
+struct ApCandidate
+{
+    uint8_t     knownIndex;     // index in known list given to setKnownAps
+    uint8_t     bssid[6];
+    uint8_t     channel;
+    int8_t      rssi;
+    int16_t     score;
+};
+
+class ApSelector
+{
+public:
+    ApSelector();
+
+    // known ssids, by index; history of indexes kept as long as ssid stays the same
+    void setKnownAps(const uint8_t * const *ssids, uint8_t count);
+
+    // rank scan result, returns candidate count (APs in backoff are left out)
+    uint8_t rank(const ApScanRecord *records, uint16_t count, uint32_t nowMilli);
+
+    // next candidate in ranked order, false when exhausted
+    bool next(ApCandidate &candidate);
+
+    // connect result of a candidate
+    void onSuccess(uint8_t knownIndex, uint32_t nowMilli);
+    void onFailure(uint8_t knownIndex, uint32_t nowMilli);
+
+    // ms until the earliest backed-off AP is eligible again, 0 if any is eligible now
+    uint32_t backoffRemain(uint32_t nowMilli);
+
+    uint8_t candidateCount() { return _candidateCount; }
+
+protected:
+    struct History {
+        uint8_t     ssid[AP_SELECTOR_SSID_MAX_LEN + 1];
+        uint16_t    successCount;
+        uint16_t    failStreak;
+        uint32_t    backoffUntil;
+    };
+
+    bool _inBackoff(const History &history, uint32_t nowMilli);
+
+protected:
+    uint8_t                     _knownCount;
+    int8_t                      _lastSuccessIndex;
+    History                     _history[AP_SELECTOR_KNOWN_CAPACITY];
+    uint8_t                     _candidateCount;
+    uint8_t                     _nextCandidate;
+    ApCandidate                 _candidates[AP_SELECTOR_KNOWN_CAPACITY];
+};
+
+#endif // _AP_SELECTOR_H
@@ -14,6 +14,7 @@
 #include "esp_event.h"
 #include "esp_system.h"
 #include "esp_netif.h"
+#include "esp_attr.h"
 
 #include "AppLog.h"
 #include "System.h"
@@ -91,6 +92,11 @@ inline void stringAssign(char *target, const char *str, size_t len)
   strncat((char *)target, (const char*)str, len);
 }
 
+inline uint32_t nowMilli()
+{
+  return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // ------ static shared instance
 static Wifi _wifiInstance;
@@ -111,7 +117,14 @@ Wifi::Wifi()
 , _nextAltApIndex(0)
 , _connectionFailCount(0)
 , _altApsConnectionFailRound(0)
-{
+, _fastConnecting(false)
+, _fastConnectCount(0)
+, _fastConnectFallbackCount(0)
+, _scanning(false)
+, _candidateConnecting(false)
+, _configGeneration(0)
+{
+  memset(&_connectStats, 0, sizeof(_connectStats));
   // set default config value
   _config.mode = WIFI_MODE_AP;
   _config.powerSaveType = WIFI_PS_MIN_MODEM;
@@ -400,6 +413,10 @@ static void wifi_app_event_handler( void* ctx, esp_event_base_t eventBase,
     wifi_event_t wifiEvent = static_cast<wifi_event_t>(eventId);
     switch (wifiEvent) {
 
+      case WIFI_EVENT_SCAN_DONE: {
+        Wifi::instance()->onScanDone();
+      } break;
+
       case WIFI_EVENT_STA_START: {
         Wifi::instance()->onStaStart();
       } break;
@@ -454,19 +471,114 @@ static void wifi_app_event_handler( void* ctx, esp_event_base_t eventBase,
 
 /////////////////////////////////////////////////////////////////////////////////////////
 // ------ event handler
+// scan records are large, keep them off the event task stack
+static wifi_ap_record_t _scanApRecords[WIFI_SCAN_RECORD_CAPACITY];
+static ApScanRecord     _scanRecords[WIFI_SCAN_RECORD_CAPACITY];
+
 void Wifi::onScanDone()
 {
+  if (!_scanning) return;
+  _scanning = false;
+  _connectStats.lastScanDoneMilli = nowMilli();
+
+  uint16_t count = WIFI_SCAN_RECORD_CAPACITY;
+  if (esp_wifi_scan_get_ap_records(&count, _scanApRecords) != ESP_OK) count = 0;
+  for (uint16_t i = 0; i < count; ++i) {
+    memcpy(_scanRecords[i].ssid, _scanApRecords[i].ssid, sizeof(_scanRecords[i].ssid));
+    memcpy(_scanRecords[i].bssid, _scanApRecords[i].bssid, sizeof(_scanRecords[i].bssid));
+    _scanRecords[i].channel = _scanApRecords[i].primary;
+    _scanRecords[i].rssi = _scanApRecords[i].rssi;
+  }
+
+  // known index k is alt AP list entry head + k
+  const uint8_t *ssids[ALTERNATIVE_AP_LIST_SIZE];
+  for (uint8_t k = 0; k < _config.altApCount; ++k)
+    ssids[k] = _config.altAps[(_config.altApsHead + k) % ALTERNATIVE_AP_LIST_SIZE].ssid;
+  _apSelector.setKnownAps(ssids, _config.altApCount);
+  uint8_t candidates = _apSelector.rank(_scanRecords, count, nowMilli());
+
+  _connectStats.lastScanApCount = count;
+  _connectStats.lastCandidateCount = candidates;
+  APP_LOGI("[Wifi]", "scan done in %d ms, %d APs, %d known candidates",
+           _connectStats.lastScanDoneMilli - _connectStats.lastScanStartMilli, count, candidates);
+
+  if (!_started || !_autoreconnect || System::instance()->restarting()) return;
+  // nothing known in range (or all backing off): plain connect with current config
+  if (!_connectNextCandidate()) esp_wifi_connect();
 }
 
-void Wifi::onStaStart()
+bool Wifi::_startScan()
 {
+  // one scan ranks all known APs, not worth it with a single AP
+  if (_config.altApCount <= 1) return false;
+  if (!_scanning) {
+    if (esp_wifi_scan_start(NULL, false) != ESP_OK) return false;
+    _scanning = true;
+    ++_connectStats.scanCount;
+    _connectStats.lastScanStartMilli = nowMilli();
+  }
+  return true;
+}
+
+void Wifi::_connectStrategy()
+{
+  _connectStats.lastConnectStartMilli = nowMilli();
+  if (_startScan()) return;
   APP_LOGI("[Wifi]", "try to connect to %s", _config.staConfig.sta.ssid);
-  ESP_ERROR_CHECK( esp_wifi_connect() );
+  esp_wifi_connect();
+}
+
+bool Wifi::_connectNextCandidate()
+{
+  if (!_apSelector.next(_apCandidate)) return false;
+
+  uint8_t index = (_config.altApsHead + _apCandidate.knownIndex) % ALTERNATIVE_AP_LIST_SIZE;
+  _setConfSsidPass(_config.staConfig.sta.ssid,
+                   (const char*)_config.altAps[index].ssid,
+                   sizeof(_config.staConfig.sta.ssid),
+                   _config.staConfig.sta.password,
+                   (const char*)_config.altAps[index].password,
+                   sizeof(_config.staConfig.sta.password));
+
+  // directed to the scanned bssid and channel, saved config stays without them
+  wifi_config_t staConfig = _config.staConfig;
+  staConfig.sta.bssid_set = 1;
+  memcpy(staConfig.sta.bssid, _apCandidate.bssid, sizeof(staConfig.sta.bssid));
+  staConfig.sta.channel = _apCandidate.channel;
+  if (esp_wifi_set_config(ESP_IF_WIFI_STA, &staConfig) != ESP_OK) return false;
+
+  APP_LOGI("[Wifi]", "try to connect to %s (rssi: %d, channel: %d)",
+           _config.staConfig.sta.ssid, _apCandidate.rssi, _apCandidate.channel);
+  _candidateConnecting = true;
+  ++_connectStats.candidateAttemptCount;
+  esp_wifi_connect();
+  return true;
+}
+
+void Wifi::onStaStart()
+{
+  _connectStats.lastConnectStartMilli = nowMilli();
+  if (_fastConnecting) {
+    APP_LOGI("[Wifi]", "try to connect to %s", _config.staConfig.sta.ssid);
+    ESP_ERROR_CHECK( esp_wifi_connect() );
+  }
+  else {
+    _connectStrategy();
+  }
 }
 
 void Wifi::onStaGotIp()
 {
-  APP_LOGI("[Wifi]", "connected, got ip");
+  APP_LOGI("[Wifi]", "connected, got ip%s", _fastConnecting ? " (fast connect)" : "");
+  if (_fastConnecting) {
+    ++_fastConnectCount;
+    _fastConnecting = false;
+  }
+  if (_candidateConnecting) {
+    _apSelector.onSuccess(_apCandidate.knownIndex, nowMilli());
+    _candidateConnecting = false;
+  }
+  _connectStats.lastGotIpMilli = nowMilli();
   xEventGroupSetBits(_wifiEventGroup, CONNECTED_BIT);
   _connectionFailCount = 0;
   _altApsConnectionFailRound = 0;
@@ -483,6 +595,7 @@ void Wifi::onStaStop()
 
 void Wifi::onStaConnected()
 {
+  _saveFastConnect();
 }
 
 #define TRY_OTHER_AP_AFTER_FAIL_COUNT  3
@@ -492,7 +605,28 @@ void Wifi::onStaDisconnected(uint8_t reason)
 {
   APP_LOGI("[Wifi]", "disconnected, reason code: %d", reason);
   xEventGroupClearBits(_wifiEventGroup, CONNECTED_BIT);
+  if (_connected) ++_connectStats.disconnectCount;
   _connected = false;
+
+  // directed connect to cached AP failed, not counted as AP failure, retry with full scan
+  if (_fastConnecting) {
+    _fallbackFromFastConnect();
+    if (_started && _autoreconnect && !System::instance()->restarting()) _connectStrategy();
+    return;
+  }
+
+  // ranked candidate failed: back it off, try next one, rescan when exhausted
+  if (_candidateConnecting) {
+    _candidateConnecting = false;
+    _apSelector.onFailure(_apCandidate.knownIndex, nowMilli());
+    ++_connectStats.candidateFailCount;
+    if (_started && _autoreconnect && !System::instance()->restarting()) {
+      // every candidate of the scan failed, the rescan starts the next round
+      if (!_connectNextCandidate() && ++_altApsConnectionFailRound < MAX_ALT_APS_TRY_ROUND) _connectStrategy();
+    }
+    return;
+  }
+
   bool tryReconnect = true;
   switch(reason) {
     // case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT: // legacy code
@@ -510,12 +644,16 @@ void Wifi::onStaDisconnected(uint8_t reason)
 
   if (!tryReconnect) return;
 
-  if (_connectionFailCount >= TRY_OTHER_AP_AFTER_FAIL_COUNT) {
-    if (_nextAltApIndex == _config.altApCount - 1) ++_altApsConnectionFailRound;
-    if (_altApsConnectionFailRound < MAX_ALT_APS_TRY_ROUND) {
-      loadNextAltSsidPassword();
-      _connectionFailCount = 0;
+  if (_connectionFailCount >= TRY_OTHER_AP_AFTER_FAIL_COUNT && _altApsConnectionFailRound < MAX_ALT_APS_TRY_ROUND) {
+    _connectionFailCount = 0;
+    // rescan and rank known APs instead of walking the list one by one, a scan tries
+    // them all so it counts as a round
+    if (_started && _autoreconnect && !System::instance()->restarting() && _startScan()) {
+      ++_altApsConnectionFailRound;
+      return;
     }
+    if (_nextAltApIndex == _config.altApCount - 1) ++_altApsConnectionFailRound;
+    if (_altApsConnectionFailRound < MAX_ALT_APS_TRY_ROUND) loadNextAltSsidPassword();
   }
   if (!System::instance()->restarting() && _altApsConnectionFailRound < MAX_ALT_APS_TRY_ROUND
       && _autoreconnect) {
@@ -572,6 +710,14 @@ bool Wifi::started()
   return _started;
 }
 
+bool Wifi::staRssi(int8_t &rssi)
+{
+  wifi_ap_record_t apInfo;
+  if (!_connected || esp_wifi_sta_get_ap_info(&apInfo) != ESP_OK) return false;
+  rssi = apInfo.rssi;
+  return true;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // ------ connect, disconnect
 void Wifi::connect(bool autoreconnect)
@@ -692,6 +838,7 @@ void Wifi::start(bool waitConnected)
     _connectionFailCount = 0;
     _altApsConnectionFailRound = 0;
     APP_LOGC("[Wifi]", "start wifi");
+    if (_config.mode == WIFI_MODE_APSTA || _config.mode == WIFI_MODE_STA) _applyFastConnect();
     ESP_ERROR_CHECK( esp_wifi_start() );
     if (waitConnected) this->waitConnected();
     // if ( (_config.mode == WIFI_MODE_APSTA || _config.mode == WIFI_MODE_STA) && _config.hostName[0] != '\0') {
@@ -726,10 +873,74 @@ bool Wifi::loadConfig()
 {
   bool succeeded = NvsFlash::loadData(WIFI_CONFIG_TAG, &_config, sizeof(_config), WIFI_CONFIG_SAVE_COUNT_TAG);
   if (succeeded) _nextAltApIndex = 0; // point to _config.altApsHead (head + nextIndex)
+  // versions handed out before a restart must not match after it
+  _configGeneration = esp_random();
   return succeeded;
 }
 
 bool Wifi::saveConfig()
 {
+  ++_configGeneration;
   return NvsFlash::saveData(WIFI_CONFIG_TAG, &_config, sizeof(_config), WIFI_CONFIG_SAVE_COUNT_TAG);
 }
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ------ fast reconnect
+// A directed connect to the last AP (bssid and channel known) skips the all-channel
+// scan. The cache lives in RTC memory, so it survives deep sleep but not power loss.
+// The DHCP lease is restored by lwip (CONFIG_LWIP_DHCP_RESTORE_LAST_IP), which
+// requests the last address directly instead of a full discover/offer exchange.
+#define WIFI_FAST_CONNECT_MAGIC         0x57464343      // "WFCC"
+
+struct WifiFastConnectCache {
+  uint32_t magic;
+  uint8_t  ssid[32];
+  uint8_t  bssid[6];
+  uint8_t  channel;
+};
+
+static RTC_DATA_ATTR WifiFastConnectCache _fastConnectCache;
+
+bool Wifi::_applyFastConnect()
+{
+  _fastConnecting = false;
+  if (_fastConnectCache.magic != WIFI_FAST_CONNECT_MAGIC ||
+      strncmp((const char*)_fastConnectCache.ssid, (const char*)_config.staConfig.sta.ssid,
+              sizeof(_fastConnectCache.ssid)) != 0)
+    return false;
+
+  // copy, so saved config never carries bssid and channel
+  wifi_config_t staConfig = _config.staConfig;
+  staConfig.sta.bssid_set = 1;
+  memcpy(staConfig.sta.bssid, _fastConnectCache.bssid, sizeof(staConfig.sta.bssid));
+  staConfig.sta.channel = _fastConnectCache.channel;
+  if (esp_wifi_set_config(ESP_IF_WIFI_STA, &staConfig) != ESP_OK) return false;
+
+  APP_LOGI("[Wifi]", "fast connect to cached AP on channel %d", _fastConnectCache.channel);
+  _fastConnecting = true;
+  return true;
+}
+
+void Wifi::_saveFastConnect()
+{
+  wifi_ap_record_t apInfo;
+  if (esp_wifi_sta_get_ap_info(&apInfo) != ESP_OK) return;
+  memcpy(_fastConnectCache.ssid, _config.staConfig.sta.ssid, sizeof(_fastConnectCache.ssid));
+  memcpy(_fastConnectCache.bssid, apInfo.bssid, sizeof(_fastConnectCache.bssid));
+  _fastConnectCache.channel = apInfo.primary;
+  _fastConnectCache.magic = WIFI_FAST_CONNECT_MAGIC;
+}
+
+void Wifi::_fallbackFromFastConnect()
+{
+  APP_LOGI("[Wifi]", "fast connect failed, fall back to full scan");
+  ++_fastConnectFallbackCount;
+  _fastConnecting = false;
+  clearFastConnectCache();
+  esp_wifi_set_config(ESP_IF_WIFI_STA, &_config.staConfig);
+}
+
+void Wifi::clearFastConnectCache()
+{
+  _fastConnectCache.magic = 0;
+}
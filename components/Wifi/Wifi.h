@@ -9,6 +9,7 @@
 
 #include "esp_wifi_types.h"
 #include "esp_event.h"
+#include "ApSelector.h"
 
 /////////////////////////////////////////////////////////////////////////////////////////
 // Wifi config
@@ -62,6 +63,23 @@ struct WifiConfig {
 };
 
 
+// ------ connect strategy stats, times in ms since boot
+#define WIFI_SCAN_RECORD_CAPACITY      16
+
+struct WifiConnectStats {
+    uint16_t                 scanCount;
+    uint16_t                 lastScanApCount;
+    uint8_t                  lastCandidateCount;
+    uint16_t                 candidateAttemptCount;
+    uint16_t                 candidateFailCount;
+    uint32_t                 lastConnectStartMilli;             // sta start or reconnect begins
+    uint32_t                 lastScanStartMilli;
+    uint32_t                 lastScanDoneMilli;
+    uint32_t                 lastGotIpMilli;
+    uint16_t                 disconnectCount;
+};
+
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // Wifi class
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -130,10 +148,21 @@ public:
     bool connected();
     bool apStaConnected();
     bool started();
+    bool staRssi(int8_t &rssi);     // false if not connected
 
     // storage load, save
     bool loadConfig();
     bool saveConfig();
+    // changes with every save, config setters are followed by one
+    uint32_t configGeneration() { return _configGeneration; }
+
+    // fast reconnect: last AP bssid and channel kept in RTC memory across deep sleep
+    void clearFastConnectCache();
+    uint16_t fastConnectCount() { return _fastConnectCount; }
+    uint16_t fastConnectFallbackCount() { return _fastConnectFallbackCount; }
+
+    // ranked connect: one scan, known APs tried by rssi and history, per AP backoff
+    const WifiConnectStats & connectStats() { return _connectStats; }
 
 public:
     // event handler
@@ -147,6 +176,14 @@ public:
     void onApStaConnected();
     void onApStaDisconnected();
 
+protected:
+    bool _applyFastConnect();
+    void _saveFastConnect();
+    void _fallbackFromFastConnect();
+    bool _startScan();
+    void _connectStrategy();
+    bool _connectNextCandidate();
+
 protected:
     // flags
     bool                     _initialized;
@@ -157,8 +194,17 @@ protected:
     uint8_t                  _nextAltApIndex;
     uint16_t                 _connectionFailCount;
     uint16_t                 _altApsConnectionFailRound;
+    bool                     _fastConnecting;
+    uint16_t                 _fastConnectCount;
+    uint16_t                 _fastConnectFallbackCount;
+    bool                     _scanning;
+    bool                     _candidateConnecting;
+    ApCandidate              _apCandidate;
+    ApSelector               _apSelector;
+    WifiConnectStats         _connectStats;
     // config
     WifiConfig               _config;
+    uint32_t                 _configGeneration;
 };
 
 #endif // _WIFI_H
@@ -0,0 +1,189 @@
+/*
+ * apSelectorTest: ApSelector ranking and backoff fed with fake scan results
+ * Copyright (c) 2017 Shenghua Su
+ *
+ * build:  g++ -std=c++11 -O1 -I../components/Wifi -o aptest apSelectorTest.cpp
+ *             ../components/Wifi/ApSelector.cpp
+ * run:    ./aptest
+ *
+ * Known APs are set as Wifi sets its alternative AP list, scan results are made up
+ * records, and time is passed in, so rounds of rank, connect results and backoff run
+ * in order without a radio. Checks ranking by RSSI over the strongest bssid of an ssid,
+ * the last success bonus, the failure penalty, the exponential backoff up to its
+ * maximum and backoffRemain, and that history goes with an ssid, not its index.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <string.h>
+#include "ApSelector.h"
+
+static int _failures = 0;
+
+void check(bool passed, const std::string &what)
+{
+  std::cout << (passed ? "  pass  " : "  FAIL  ") << what << std::endl;
+  if (!passed) ++_failures;
+}
+
+static ApScanRecord record(const char *ssid, uint8_t bssidTail, int8_t rssi, uint8_t channel = 6)
+{
+  ApScanRecord r;
+  memset(&r, 0, sizeof(r));
+  strncpy((char *)r.ssid, ssid, AP_SELECTOR_SSID_MAX_LEN);
+  uint8_t bssid[6] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, bssidTail };
+  memcpy(r.bssid, bssid, sizeof(bssid));
+  r.channel = channel;
+  r.rssi = rssi;
+  return r;
+}
+
+static void setKnown(ApSelector &selector, const std::vector<const char *> &ssids)
+{
+  std::vector<const uint8_t *> list;
+  for (size_t i = 0; i < ssids.size(); ++i) list.push_back((const uint8_t *)ssids[i]);
+  selector.setKnownAps(list.data(), list.size());
+}
+
+// known indexes in ranked order
+static std::vector<int> order(ApSelector &selector, const std::vector<ApScanRecord> &scan, uint32_t nowMilli)
+{
+  std::vector<int> indexes;
+  selector.rank(scan.data(), scan.size(), nowMilli);
+  ApCandidate candidate;
+  while (selector.next(candidate)) indexes.push_back(candidate.knownIndex);
+  return indexes;
+}
+
+static std::vector<int> list(int a = -1, int b = -1, int c = -1)
+{
+  std::vector<int> v;
+  if (a >= 0) v.push_back(a);
+  if (b >= 0) v.push_back(b);
+  if (c >= 0) v.push_back(c);
+  return v;
+}
+
+int main(int argc, const char *argv[])
+{
+  std::vector<ApScanRecord> scan;
+  scan.push_back(record("office", 1, -70, 1));
+  scan.push_back(record("lab", 2, -60, 6));
+  scan.push_back(record("office", 3, -55, 11));     // second bssid of office, stronger
+  scan.push_back(record("cafe", 4, -40));           // not known
+  scan.push_back(record("home", 5, -80));
+
+  std::cout << "ranking" << std::endl;
+  {
+    ApSelector selector;
+    setKnown(selector, { "home", "office", "lab", "attic" });
+    check(order(selector, scan, 0) == list(1, 2, 0), "by rssi, unknown and unseen ssids left out");
+    selector.rank(scan.data(), scan.size(), 0);
+    ApCandidate candidate;
+    selector.next(candidate);
+    check(candidate.bssid[5] == 3 && candidate.channel == 11 && candidate.rssi == -55,
+          "strongest bssid of an ssid taken");
+    check(candidate.score == -55, "score without history is rssi");
+    check(selector.rank(scan.data(), 0, 0) == 0 && !selector.next(candidate), "empty scan, no candidate");
+  }
+
+  std::cout << "last success bonus" << std::endl;
+  {
+    ApSelector selector;
+    setKnown(selector, { "home", "office", "lab" });
+    // lab 5 dB under office, the bonus of one success and the last one lifts it above
+    selector.onSuccess(2, 0);
+    std::vector<int> ranked = order(selector, scan, 1000);
+    check(ranked == list(2, 1, 0), "last successful AP first");
+    selector.rank(scan.data(), scan.size(), 1000);
+    ApCandidate candidate;
+    selector.next(candidate);
+    check(candidate.score == -60 + AP_SELECTOR_SUCCESS_BONUS + AP_SELECTOR_LAST_SUCCESS_BONUS,
+          "score is rssi, success and last success bonus");
+    // office succeeds now, lab keeps the success bonus only
+    selector.onSuccess(1, 2000);
+    check(order(selector, scan, 3000) == list(1, 2, 0), "bonus moves to the latest success");
+    for (int i = 0; i < 20; ++i) selector.onSuccess(0, 4000);
+    selector.onSuccess(1, 5000);
+    selector.rank(scan.data(), scan.size(), 5000);
+    bool capped = false;
+    while (selector.next(candidate)) {
+      if (candidate.knownIndex == 0)
+        capped = candidate.score == -80 + AP_SELECTOR_SUCCESS_BONUS_MAX_COUNT * AP_SELECTOR_SUCCESS_BONUS;
+    }
+    check(capped, "success bonus capped");
+  }
+
+  std::cout << "failure penalty and backoff" << std::endl;
+  {
+    ApSelector selector;
+    setKnown(selector, { "home", "office", "lab" });
+    uint32_t now = 10000;
+    selector.onFailure(1, now);
+    check(order(selector, scan, now) == list(2, 0), "failed AP left out during backoff");
+    check(selector.backoffRemain(now) == 0, "backoffRemain 0 while others are eligible");
+    check(order(selector, scan, now + AP_SELECTOR_BACKOFF_BASE - 1) == list(2, 0), "still out 1 ms before base");
+    std::vector<int> back = order(selector, scan, now + AP_SELECTOR_BACKOFF_BASE);
+    check(back == list(2, 1, 0), "back after base backoff, penalty ranks it under lab");
+    selector.rank(scan.data(), scan.size(), now + AP_SELECTOR_BACKOFF_BASE);
+    ApCandidate candidate;
+    selector.next(candidate);
+    selector.next(candidate);
+    check(candidate.score == -55 - AP_SELECTOR_FAIL_PENALTY, "score is rssi less one penalty");
+
+    // every AP failing: remain is the earliest, backoff doubles with the streak
+    ApSelector all;
+    setKnown(all, { "home", "office" });
+    all.onFailure(0, now);
+    all.onFailure(1, now + 1000);
+    check(all.backoffRemain(now) == AP_SELECTOR_BACKOFF_BASE, "backoffRemain to the earliest eligible");
+    check(all.backoffRemain(now + AP_SELECTOR_BACKOFF_BASE) == 0, "backoffRemain 0 once one is eligible");
+    all.onFailure(0, now);
+    all.onFailure(1, now);
+    check(all.backoffRemain(now) == 2 * AP_SELECTOR_BACKOFF_BASE, "second failure doubles");
+    all.onFailure(0, now);
+    all.onFailure(1, now);
+    check(all.backoffRemain(now) == 4 * AP_SELECTOR_BACKOFF_BASE, "third failure doubles again");
+    for (int i = 0; i < 30; ++i) {
+      all.onFailure(0, now);
+      all.onFailure(1, now);
+    }
+    check(all.backoffRemain(now) == AP_SELECTOR_BACKOFF_MAX, "backoff capped at max");
+    check(order(all, scan, now + AP_SELECTOR_BACKOFF_MAX - 1).empty(), "no candidate while all back off");
+    check(order(all, scan, now + AP_SELECTOR_BACKOFF_MAX) == list(1, 0), "both back after max");
+    // deadline across the 32 bit wrap
+    ApSelector wrap;
+    setKnown(wrap, { "office" });
+    wrap.onFailure(0, UINT32_MAX - 1000);
+    check(wrap.backoffRemain(UINT32_MAX - 1000) == AP_SELECTOR_BACKOFF_BASE &&
+          wrap.backoffRemain(AP_SELECTOR_BACKOFF_BASE - 1001) == 0, "backoff across time wrap");
+    // success clears the streak
+    all.onSuccess(1, now + AP_SELECTOR_BACKOFF_MAX);
+    all.onFailure(1, now + AP_SELECTOR_BACKOFF_MAX);
+    check(all.backoffRemain(now + AP_SELECTOR_BACKOFF_MAX) == 0 &&
+          order(all, scan, now + AP_SELECTOR_BACKOFF_MAX + AP_SELECTOR_BACKOFF_BASE) == list(1, 0),
+          "success resets backoff to base");
+  }
+
+  std::cout << "known list changes" << std::endl;
+  {
+    ApSelector selector;
+    setKnown(selector, { "home", "office", "lab" });
+    selector.onFailure(1, 0);
+    selector.onSuccess(2, 0);
+    setKnown(selector, { "home", "office", "attic" });
+    std::vector<int> ranked = order(selector, scan, 0);
+    check(ranked == list(0), "history kept for the same ssid at an index");
+    setKnown(selector, { "home", "lab", "office" });
+    check(order(selector, scan, 0) == list(2, 1, 0), "history cleared where the ssid changed");
+  }
+
+  if (_failures) {
+    std::cout << _failures << " failed" << std::endl;
+    return 1;
+  }
+  std::cout << "all passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * cmdKeyBench: command name to key lookup, perfect hash against a linear name scan
+ * Copyright (c) 2017 Shenghua Su
+ *
+ * build:  g++ -std=c++11 -O2 -I../components/CmdEngine -o ckbench cmdKeyBench.cpp
+ *             ../components/CmdEngine/CmdKey.cpp
+ * run:    ./ckbench [million lookups]
+ *
+ * Times strToCmdKey as CmdEngine calls it, name and length taken off the json, against
+ * the strcmp scan over the name table it replaced. Names are drawn at random from all
+ * commands, from the first and the last few of CMD_KEY_LIST (where the scan is at its
+ * best and worst), and from names no command has: typos, prefixes and names of other
+ * case. Checks first that every name maps to its own key and none of the others to
+ * one. Prints nanoseconds per lookup of each mix.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <random>
+#include <string.h>
+#include <stdlib.h>
+#include "CmdKey.h"
+
+#define MIX_SIZE            4096
+#define EDGE_COUNT          4
+
+typedef std::chrono::steady_clock Clock;
+
+static const char * const _names[] = {
+#define CMD_KEY_STR(name, ...) #name,
+  CMD_KEY_LIST(CMD_KEY_STR)
+#undef CMD_KEY_STR
+};
+
+static const char * const _unknown[] = {
+  "getSensorData", "GetSensorDat", "GetSensorDataX", "SetHostnam", "Get", "Set",
+  "UpdateFirmwar", "RestartNow", "GETUID", "batch", "DoNothin", "SetEdgeBroker"
+};
+
+#define UNKNOWN_COUNT (sizeof(_unknown) / sizeof(_unknown[0]))
+
+// as strToCmdKey was before the perfect hash
+static CmdKey scanCmdKey(const char *str, size_t len)
+{
+  if (!str || len == 0) return DoNothing;
+  for (int i = 0; i < CmdKeyMaxValue; ++i) {
+    if (strncmp(_names[i], str, len) == 0 && _names[i][len] == '\0') return (CmdKey)i;
+  }
+  return DoNothing;
+}
+
+static int _failures = 0;
+
+void check(bool passed, const std::string &what)
+{
+  std::cout << (passed ? "  pass  " : "  FAIL  ") << what << std::endl;
+  if (!passed) ++_failures;
+}
+
+// names sit in the middle of a json buffer, not terminated where the name ends
+struct Name
+{
+  const char *str;
+  size_t len;
+};
+
+// deque, the names must stay where they are
+static std::deque<std::string> _store;
+
+static std::vector<Name> mixOf(const std::vector<std::string> &pool, std::mt19937 &rng)
+{
+  std::vector<Name> mix;
+  for (int i = 0; i < MIX_SIZE; ++i) {
+    const std::string &name = pool[rng() % pool.size()];
+    _store.push_back("{\"cmd\":\"" + name + "\"}");
+    Name n = { NULL, name.size() };
+    mix.push_back(n);
+  }
+  for (int i = 0; i < MIX_SIZE; ++i) mix[i].str = _store[_store.size() - MIX_SIZE + i].c_str() + 8;
+  return mix;
+}
+
+template <typename Lookup>
+static double nanoPerLookup(const std::vector<Name> &mix, uint64_t count, Lookup lookup)
+{
+  volatile unsigned sink = 0;
+  Clock::time_point start = Clock::now();
+  for (uint64_t i = 0; i < count; ++i) {
+    const Name &name = mix[i % MIX_SIZE];
+    sink += lookup(name.str, name.len);
+  }
+  (void)sink;
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / count;
+}
+
+int main(int argc, const char *argv[])
+{
+  double million = argc > 1 ? atof(argv[1]) : 20;
+  if (million <= 0) {
+    std::cout << "use format: " << argv[0] << " [million lookups]" << std::endl
+              << " ARGUMENTS:" << std::endl
+              << "  million lookups                     per mix and lookup, default 20" << std::endl;
+    return -1;
+  }
+  uint64_t count = (uint64_t)(million * 1000000);
+
+  std::cout << "check" << std::endl;
+  bool own = true;
+  for (int i = 0; i < CmdKeyMaxValue; ++i) {
+    own = own && strToCmdKey(_names[i]) == (CmdKey)i && strcmp(cmdKeyToStr((CmdKey)i), _names[i]) == 0;
+  }
+  check(own, "every name to its key and back");
+  bool none = true;
+  for (size_t i = 0; i < UNKNOWN_COUNT; ++i) none = none && strToCmdKey(_unknown[i]) == DoNothing;
+  check(none, "unknown names to DoNothing");
+  check(strToCmdKey("GetUIDx", 6) == GetUID, "length bounds the name");
+  if (_failures) return 1;
+
+  std::mt19937 rng(7);
+  std::vector<std::string> all(_names, _names + CmdKeyMaxValue);
+  std::vector<std::string> first(_names + 1, _names + 1 + EDGE_COUNT);
+  std::vector<std::string> last(_names + CmdKeyMaxValue - EDGE_COUNT, _names + CmdKeyMaxValue);
+  std::vector<std::string> unknown(_unknown, _unknown + UNKNOWN_COUNT);
+  struct { const char *name; std::vector<Name> mix; } mixes[] = {
+    { "all commands", mixOf(all, rng) },
+    { "first of list", mixOf(first, rng) },
+    { "last of list", mixOf(last, rng) },
+    { "unknown names", mixOf(unknown, rng) }
+  };
+
+  std::cout << CmdKeyMaxValue << " commands, " << million << " million lookups per run" << std::endl;
+  std::cout << std::left << std::setw(18) << "" << std::right << std::setw(12) << "hash ns"
+            << std::setw(12) << "scan ns" << std::setw(10) << "speedup" << std::endl;
+  for (size_t i = 0; i < sizeof(mixes) / sizeof(mixes[0]); ++i) {
+    double hash = nanoPerLookup(mixes[i].mix, count, [](const char *str, size_t len) { return strToCmdKey(str, len); });
+    double scan = nanoPerLookup(mixes[i].mix, count, scanCmdKey);
+    std::cout << std::left << std::setw(18) << mixes[i].name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(12) << hash << std::setw(12) << scan << std::setw(9) << scan / hash << "x" << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,427 @@
+/*
+ * cmdStormTest: sensor and display latency under a command storm, with and without CmdLimiter
+ * Copyright (c) 2017 Shenghua Su
+ *
+ * build:  g++ -std=c++11 -O2 -I../components/CmdEngine -o stormtest cmdStormTest.cpp
+ *             ../components/CmdEngine/CmdLimiter.cpp
+ * run:    ./stormtest [seconds]
+ *
+ * Plays the tasks of System on virtual time as FreeRTOS schedules them: sensor tasks,
+ * network task and command worker on the app core, display task on the pro core, all of
+ * priority 3, so a task woken waits for the running one to block or its time slice (one
+ * tick, CONFIG_FREERTOS_HZ 100) to end, then takes its turn behind the other ready ones.
+ * A flash write disables the cache and stalls both cores. The sensor tasks and the
+ * display task run their work and vTaskDelay as System's do; latency is from the end of
+ * the delay to the end of the work.
+ *
+ * Commands arrive as the storm below sends them, into the receive buffers of each
+ * connection (dropped when full). The network task, polling them in turn, parses and
+ * admits each one through the CmdLimiter CmdEngine uses, runs reads and stream commands
+ * itself and queues writes for the worker (refused when the queue is full). CPU costs
+ * are estimates for the ESP32 at 240 MHz, the flash stall one for an NVS entry write
+ * and commit.
+ *
+ * Runs once without commands, then the storm without and with the limiter, and prints
+ * latency percentiles per task. Checks that with the limiter no task's p99 exceeds its
+ * idle maximum by more than a time slice, nor its maximum by more than two and a flash
+ * stall, and that without it the storm does break these bounds. Checks last that
+ * batches, Restart with a read or as many writes as a batch takes, are admitted on an
+ * idle device and each sub-command is charged to its own class.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <stdlib.h>
+#include "CmdLimiter.h"
+
+#define STEP_MICRO              50
+#define TICK_MICRO              10000   // CONFIG_FREERTOS_HZ 100
+#define QUEUE_LENGTH            8       // CMD_QUEUE_LENGTH
+#define INBOX_CAPACITY          8       // commands lwip buffers per connection
+#define CMD_BATCH_MAX_COUNT     16      // CmdFormat.h
+
+// estimated cpu time
+#define PARSE_MICRO             150     // receive, json parse, admission
+#define REFUSE_MICRO            100     // rate limited or busy reply
+#define READ_MICRO              400
+#define STREAM_MICRO            1500    // GetSensorData json and websocket send
+#define WRITE_MICRO             800
+#define FLASH_STALL_MICRO       12000
+
+enum Core
+{
+  ProCore,
+  AppCore,
+  CoreCount
+};
+
+struct TaskSpec
+{
+  const char   *name;
+  Core          core;
+  uint32_t      delayMilli;     // vTaskDelay after each run
+  uint32_t      workMicro;
+};
+
+// as System creates them
+static const TaskSpec _periodic[] = {
+  { "display_task",       ProCore, 100,  15000 },
+  { "sht3x_sensor_task",  AppCore, 500,  1200 },
+  { "pm_sensor_task",     AppCore, 500,  800 },
+  { "co2_sensor_task",    AppCore, 1000, 800 },
+  { "tsl2561_sensor_task", AppCore, 1000, 1000 },
+  { "orientation_task",   AppCore, 100,  300 }
+};
+
+#define PERIODIC_COUNT (sizeof(_periodic) / sizeof(_periodic[0]))
+
+struct Sender
+{
+  const char     *what;
+  uint32_t        sourceId;     // as CmdEngine keys websocket connections
+  CmdLimitClass   limitClass;
+  uint32_t        perSecond;
+};
+
+// the buggy app build: every open page polls sensor data, one keeps saving the name
+static const Sender _senders[] = {
+  { "GetSensorData", 1 << 1, CmdLimitStream, 250 },
+  { "GetSensorData", 2 << 1, CmdLimitStream, 250 },
+  { "GetSensorData", 3 << 1, CmdLimitStream, 250 },
+  { "GetSensorData", 4 << 1, CmdLimitStream, 250 },
+  { "GetDeviceInfo", 5 << 1, CmdLimitRead,   300 },
+  { "SetDeviceName", 6 << 1, CmdLimitWrite,  25 }
+};
+
+#define SENDER_COUNT (sizeof(_senders) / sizeof(_senders[0]))
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// scheduler
+/////////////////////////////////////////////////////////////////////////////////////////
+struct Task
+{
+  std::string             name;
+  Core                    core;
+  uint32_t                delayMicro;
+  uint32_t                workMicro;
+  bool                    periodic;
+  bool                    ready;
+  uint64_t                wakeMicro;
+  uint64_t                releaseMicro;
+  uint32_t                remain;         // of the current work
+  uint32_t                stallRemain;    // flash part of it, cores stalled while it runs
+  std::vector<double>     latencies;      // ms
+};
+
+struct Command
+{
+  uint32_t        sourceId;
+  CmdLimitClass   limitClass;
+};
+
+struct Stats
+{
+  Stats() : arrived(0), dropped(0), admitted(0), refused(0), busy(0), stallMicro(0) {}
+  uint64_t arrived;
+  uint64_t dropped;       // receive buffers full
+  uint64_t admitted;
+  uint64_t refused;       // rate limited
+  uint64_t busy;          // worker queue full
+  uint64_t stallMicro;
+};
+
+class Device
+{
+public:
+  Device(bool storm, bool limited) : _storm(storm), _limited(limited), _now(0), _pending(0), _polled(0), _jobs(0) {
+    for (size_t i = 0; i < PERIODIC_COUNT; ++i) {
+      const TaskSpec &spec = _periodic[i];
+      _tasks.push_back(makeTask(spec.name, spec.core, spec.delayMilli * 1000, spec.workMicro, true));
+    }
+    _tasks.push_back(makeTask("net_task", AppCore, 0, 0, false));
+    _tasks.push_back(makeTask("cmd_worker_task", AppCore, 0, 0, false));
+    _net = &_tasks[PERIODIC_COUNT];
+    _worker = &_tasks[PERIODIC_COUNT + 1];
+    for (int c = 0; c < CoreCount; ++c) _running[c] = NULL;
+    for (size_t i = 0; i < SENDER_COUNT; ++i) _nextSend[i] = i * 1000;
+  }
+
+  void run(uint32_t seconds) {
+    uint64_t end = (uint64_t)seconds * 1000000;
+    for (_now = 0; _now < end; _now += STEP_MICRO) {
+      if (_storm) _arrive();
+      _wake();
+      bool stalled = _running[AppCore] == _worker && _worker->remain <= _worker->stallRemain && _worker->remain > 0;
+      if (stalled) _stats.stallMicro += STEP_MICRO;
+      for (int c = 0; c < CoreCount; ++c) _step((Core)c, stalled);
+      if ((_now + STEP_MICRO) % TICK_MICRO == 0) {
+        for (int c = 0; c < CoreCount; ++c) _slice((Core)c);
+      }
+    }
+  }
+
+  const Task & task(size_t index) const { return _tasks[index]; }
+  const Stats & stats() const { return _stats; }
+
+private:
+  static Task makeTask(const char *name, Core core, uint32_t delayMicro, uint32_t workMicro, bool periodic) {
+    Task task;
+    task.name = name;
+    task.core = core;
+    task.delayMicro = delayMicro;
+    task.workMicro = workMicro;
+    task.periodic = periodic;
+    task.ready = false;
+    // tasks start staggered as they are created
+    task.wakeMicro = periodic ? workMicro : 0;
+    task.releaseMicro = 0;
+    task.remain = 0;
+    task.stallRemain = 0;
+    return task;
+  }
+
+  void _makeReady(Task *task) {
+    task->ready = true;
+    task->releaseMicro = _now;
+    _readyList[task->core].push_back(task);
+  }
+
+  void _arrive() {
+    for (size_t i = 0; i < SENDER_COUNT; ++i) {
+      uint64_t interval = 1000000 / _senders[i].perSecond;
+      while (_nextSend[i] <= _now) {
+        _nextSend[i] += interval;
+        ++_stats.arrived;
+        if (_inbox[i].size() >= INBOX_CAPACITY) {
+          ++_stats.dropped;
+          continue;
+        }
+        Command command = { _senders[i].sourceId, _senders[i].limitClass };
+        _inbox[i].push_back(command);
+        ++_pending;
+      }
+    }
+    if (_pending > 0 && !_net->ready) _makeReady(_net);
+  }
+
+  void _wake() {
+    for (size_t i = 0; i < PERIODIC_COUNT; ++i) {
+      Task &task = _tasks[i];
+      if (!task.ready && task.wakeMicro <= _now) {
+        task.remain = task.workMicro;
+        _makeReady(&task);
+      }
+    }
+  }
+
+  // next piece of work of the event driven tasks, false if none
+  bool _nextWork(Task *task) {
+    if (task == _worker) {
+      if (_jobs == 0) return false;
+      task->remain = WRITE_MICRO + FLASH_STALL_MICRO;
+      task->stallRemain = FLASH_STALL_MICRO;
+      return true;
+    }
+    if (_pending == 0) return false;
+    // the reactor polls the connections in turn
+    do _polled = (_polled + 1) % SENDER_COUNT; while (_inbox[_polled].empty());
+    Command command = _inbox[_polled].front();
+    _inbox[_polled].pop_front();
+    --_pending;
+    task->remain = PARSE_MICRO;
+    if (_limited && _limiter.admit(command.sourceId, command.limitClass, 1, _now / 1000) != CmdLimiter::Admitted) {
+      ++_stats.refused;
+      task->remain += REFUSE_MICRO;
+      return true;
+    }
+    switch (command.limitClass) {
+      case CmdLimitRead:    task->remain += READ_MICRO; break;
+      case CmdLimitStream:  task->remain += STREAM_MICRO; break;
+      default:
+        if (_jobs >= QUEUE_LENGTH) {
+          ++_stats.busy;
+          task->remain += REFUSE_MICRO;
+          return true;
+        }
+        if (++_jobs == 1 && !_worker->ready) {
+          _worker->remain = 0;
+          _makeReady(_worker);
+        }
+        break;
+    }
+    ++_stats.admitted;
+    return true;
+  }
+
+  void _step(Core core, bool stalled) {
+    Task *&running = _running[core];
+    if (!running) {
+      if (_readyList[core].empty()) return;
+      running = _readyList[core].front();
+      _readyList[core].pop_front();
+    }
+    if (running->remain == 0 && !running->periodic && !_nextWork(running)) {
+      _block(core);
+      return;
+    }
+    // cache off, only the flash operation itself goes on
+    if (stalled && running != _worker) return;
+
+    running->remain = running->remain > STEP_MICRO ? running->remain - STEP_MICRO : 0;
+    if (running->remain > 0) return;
+
+    if (running->periodic) {
+      running->latencies.push_back((_now + STEP_MICRO - running->releaseMicro) / 1000.0);
+      running->wakeMicro = _now + STEP_MICRO + running->delayMicro;
+      _block(core);
+    }
+    else if (running == _worker) {
+      running->stallRemain = 0;
+      --_jobs;
+    }
+  }
+
+  void _block(Core core) {
+    _running[core]->ready = false;
+    _running[core] = NULL;
+  }
+
+  // time slice over, the running task goes behind the other ready ones
+  void _slice(Core core) {
+    Task *running = _running[core];
+    if (!running || _readyList[core].empty()) return;
+    _readyList[core].push_back(running);
+    _running[core] = _readyList[core].front();
+    _readyList[core].pop_front();
+  }
+
+  bool                  _storm;
+  bool                  _limited;
+  uint64_t              _now;
+  std::deque<Task>      _tasks;
+  Task                 *_net;
+  Task                 *_worker;
+  Task                 *_running[CoreCount];
+  std::deque<Task *>    _readyList[CoreCount];
+  std::deque<Command>   _inbox[SENDER_COUNT];
+  uint32_t              _pending;
+  size_t                _polled;
+  uint32_t              _jobs;
+  uint64_t              _nextSend[SENDER_COUNT];
+  CmdLimiter            _limiter;
+  Stats                 _stats;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// run
+/////////////////////////////////////////////////////////////////////////////////////////
+static double percentile(std::vector<double> values, double p)
+{
+  if (values.empty()) return 0;
+  size_t index = (size_t)(p / 100 * (values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+static int _failures = 0;
+
+void check(bool passed, const std::string &what)
+{
+  std::cout << (passed ? "  pass  " : "  FAIL  ") << what << std::endl;
+  if (!passed) ++_failures;
+}
+
+// every task's p99 within a time slice of its idle maximum, its maximum within two
+// and a flash stall
+static bool bounded(const Device &device, const Device &idle)
+{
+  for (size_t i = 0; i < PERIODIC_COUNT; ++i) {
+    double idleMax = percentile(idle.task(i).latencies, 100);
+    if (percentile(device.task(i).latencies, 99) > idleMax + TICK_MICRO / 1000.0) return false;
+    if (percentile(device.task(i).latencies, 100) > idleMax + (2.0 * TICK_MICRO + FLASH_STALL_MICRO) / 1000) return false;
+  }
+  return true;
+}
+
+static void printRun(const char *title, const Device &device, uint32_t seconds)
+{
+  const Stats &stats = device.stats();
+  std::cout << title << std::endl;
+  if (stats.arrived > 0) {
+    std::cout << "  commands " << stats.arrived << ", admitted " << stats.admitted << ", rate limited " << stats.refused
+              << ", queue full " << stats.busy << ", dropped " << stats.dropped << std::endl;
+  }
+  std::cout << "  flash stalled " << std::fixed << std::setprecision(1)
+            << stats.stallMicro / (seconds * 10000.0) << "% of the time" << std::endl;
+  std::cout << "  " << std::left << std::setw(22) << "latency ms" << std::right << std::setw(8) << "runs"
+            << std::setw(9) << "p50" << std::setw(9) << "p99" << std::setw(9) << "max" << std::endl;
+  for (size_t i = 0; i < PERIODIC_COUNT; ++i) {
+    const Task &task = device.task(i);
+    std::cout << "  " << std::left << std::setw(22) << task.name << std::right << std::setw(8) << task.latencies.size()
+              << std::setprecision(2) << std::setw(9) << percentile(task.latencies, 50)
+              << std::setw(9) << percentile(task.latencies, 99) << std::setw(9) << percentile(task.latencies, 100)
+              << std::endl;
+  }
+}
+
+// batches on an idle device, charged as CmdEngine counts their sub-commands
+static CmdLimiter::Result admitBatch(CmdLimiter &limiter, uint32_t sourceId, uint8_t read, uint8_t stream,
+                                     uint8_t write, uint8_t strict, uint32_t nowMilli)
+{
+  uint8_t costs[CmdLimitClassCount] = { read, stream, write, strict };
+  return limiter.admit(sourceId, costs, nowMilli);
+}
+
+static void checkBatches()
+{
+  CmdLimiter limiter;
+  check(admitBatch(limiter, 2, 1, 0, 0, 1, 0) == CmdLimiter::Admitted, "batch of Restart and a read admitted");
+  check(admitBatch(limiter, 2, 1, 0, 0, 1, 0) != CmdLimiter::Admitted, "second one at once over strict quota");
+  check(admitBatch(limiter, 4, 0, 0, CMD_BATCH_MAX_COUNT, 0, 0) == CmdLimiter::Admitted,
+        "batch of 16 writes admitted, charged a full write bucket");
+  check(limiter.admit(4, CmdLimitWrite, 1, 0) != CmdLimiter::Admitted, "no write left after it");
+  check(limiter.admit(4, CmdLimitRead, 1, 0) == CmdLimiter::Admitted, "reads of that source untouched");
+  // 3 reads and 2 writes leave 3 of the 5 writes
+  check(admitBatch(limiter, 6, 3, 0, 2, 0, 0) == CmdLimiter::Admitted, "batch of reads and writes admitted");
+  int writes = 0;
+  while (limiter.admit(6, CmdLimitWrite, 1, 0) == CmdLimiter::Admitted) ++writes;
+  check(writes == 3, "each sub-command charged to its own class");
+}
+
+int main(int argc, const char *argv[])
+{
+  uint32_t seconds = argc > 1 ? atoi(argv[1]) : 60;
+  if (seconds == 0) {
+    std::cout << "use format: " << argv[0] << " [seconds]" << std::endl
+              << " ARGUMENTS:" << std::endl
+              << "  seconds                             device time of each run, default 60" << std::endl;
+    return -1;
+  }
+
+  std::cout << "storm:";
+  for (size_t i = 0; i < SENDER_COUNT; ++i) {
+    std::cout << (i ? ", " : " ") << _senders[i].what << " " << _senders[i].perSecond << "/s";
+  }
+  std::cout << std::endl << std::endl;
+
+  Device idle(false, false), unlimited(true, false), limited(true, true);
+  idle.run(seconds);
+  unlimited.run(seconds);
+  limited.run(seconds);
+  printRun("no commands", idle, seconds);
+  printRun("storm, no limiter", unlimited, seconds);
+  printRun("storm, CmdLimiter", limited, seconds);
+
+  std::cout << std::endl << "check" << std::endl;
+  check(bounded(limited, idle), "storm with the limiter within bounds");
+  check(!bounded(unlimited, idle), "storm without the limiter out of them");
+  checkBatches();
+  if (_failures) return 1;
+  std::cout << "all passed" << std::endl;
+  return 0;
+}
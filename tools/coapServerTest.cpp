@@ -0,0 +1,379 @@
+/*
+ * coapServerTest: CoapServer on a Linux host driven by a UDP CoAP client
+ * Copyright (c) 2017 Shenghua Su
+ *
+ * build:  g++ -std=c++11 -O1 -Ihost -I../components/MessageProtocol -I../components/Common
+ *             -I../components/Config -DMG_ENABLE_COAP=1 -o coaptest coapServerTest.cpp
+ *             ../components/MessageProtocol/{CoapServer,HttpRouter,NetReactor,LoopWaker}.cpp
+ *             host/HostRtos.cpp -x c -DMG_ENABLE_COAP=1 ../components/MessageProtocol/mongoose/mongoose.c -lpthread
+ * run:    ./coaptest
+ *
+ * The server listens on its port (5683) of the loopback, the main thread runs the reactor
+ * as the network task does and a client thread sends the requests over a plain socket.
+ * The interpreter behind COAP_CMD_PATH answers as a read only CmdEngine would: a reply,
+ * none, or a refusal status by the payload. Checks GET of a route with its ETag, unknown
+ * path and method, command replies and refusal codes, block-wise transfer, observe with
+ * its cancellation, and that requesters are known by address. Exits 0 if all checks pass.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "HostRtos.h"
+#include "CoapServer.h"
+
+#define SERVER_PORT         5683
+#define WAIT_MILLI          2000
+#define LARGE_BODY_SIZE     2500
+
+#define CODE(c, d)          (((c) << 5) | (d))
+#define TYPE_CON            0
+#define TYPE_NON            1
+#define TYPE_ACK            2
+#define TYPE_RST            3
+
+#define OPTION_ETAG         4
+#define OPTION_OBSERVE      6
+#define OPTION_URI_PATH     11
+#define OPTION_MAX_AGE      14
+#define OPTION_BLOCK2       23
+
+static int _failures = 0;
+
+void check(bool passed, const std::string &what)
+{
+  std::cout << (passed ? "  pass  " : "  FAIL  ") << what << std::endl;
+  if (!passed) ++_failures;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// server side
+/////////////////////////////////////////////////////////////////////////////////////////
+class SensorRoute : public HttpRouteHandler
+{
+public:
+  SensorRoute() : temp(235) {}
+  virtual int onHttpRoute(HttpResponse &response, void *context) {
+    int value = temp;
+    response.printf("{\"temp\":%d.%d}", value / 10, value % 10);
+    return 200;
+  }
+  std::atomic<int> temp;
+};
+
+class LargeRoute : public HttpRouteHandler
+{
+public:
+  LargeRoute() {
+    for (int i = 0; i < LARGE_BODY_SIZE; ++i) body += (char)('a' + i % 26);
+  }
+  virtual int onHttpRoute(HttpResponse &response, void *context) {
+    char *buf = response.reserve(body.size());
+    if (!buf) return 503;
+    memcpy(buf, body.data(), body.size());
+    response.commit(body.size());
+    response.setContentType("text/plain");
+    return 200;
+  }
+  std::string body;
+};
+
+class DeviceSide : public ProtocolMessageInterpreter
+{
+public:
+  DeviceSide(ProtocolDelegate *delegate) : _delegate(delegate) {}
+  virtual void interpreteMqttMsg(const char* topic, size_t topicLen, const char* msg, size_t msgLen) {}
+  virtual void interpreteSocketMsg(const void* msg, size_t msgLen, void *userdata) {
+    std::string cmd((const char *)msg, msgLen);
+    requesters.push_back(_delegate->requesterId(userdata));
+    if (cmd == "read") _delegate->replyMessage("{\"cmd\":\"read\"}", 14, userdata, PROTOCOL_MSG_FORMAT_TEXT);
+    else if (cmd == "write") _delegate->replyStatus(userdata, CMD_STATUS_NOT_ALLOWED);
+    else if (cmd == "busy") _delegate->replyStatus(userdata, CMD_STATUS_BUSY);
+    else if (cmd == "limited") _delegate->replyStatus(userdata, CMD_STATUS_RATE_LIMITED);
+  }
+  std::vector<uint32_t> requesters;
+private:
+  ProtocolDelegate *_delegate;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// client
+/////////////////////////////////////////////////////////////////////////////////////////
+struct Message
+{
+  Message() : type(-1), code(0), msgId(0), observe(-1), block2(-1), maxAge(-1), hasEtag(false) {}
+  int type;
+  int code;
+  uint16_t msgId;
+  std::string token;
+  int64_t observe;
+  int64_t block2;
+  int64_t maxAge;
+  bool hasEtag;
+  std::string etag;
+  std::string payload;
+};
+
+struct Option
+{
+  uint16_t number;
+  std::string value;
+};
+
+static std::string uintValue(uint32_t value)
+{
+  std::string bytes;
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    if (!bytes.empty() || (value >> shift) & 0xFF) bytes += (char)((value >> shift) & 0xFF);
+  }
+  return bytes;
+}
+
+static uint32_t uintOf(const std::string &value)
+{
+  uint32_t v = 0;
+  for (size_t i = 0; i < value.size(); ++i) v = (v << 8) | (uint8_t)value[i];
+  return v;
+}
+
+// options in ascending number order
+static std::string encode(int type, int code, uint16_t msgId, const std::string &token,
+                          const std::vector<Option> &options, const std::string &payload = "")
+{
+  std::string out;
+  out += (char)(0x40 | (type << 4) | token.size());
+  out += (char)code;
+  out += (char)(msgId >> 8);
+  out += (char)(msgId & 0xFF);
+  out += token;
+  uint16_t last = 0;
+  for (size_t i = 0; i < options.size(); ++i) {
+    uint16_t delta = options[i].number - last;
+    last = options[i].number;
+    size_t length = options[i].value.size();
+    out += (char)(((delta < 13 ? delta : 13) << 4) | (length < 13 ? length : 13));
+    if (delta >= 13) out += (char)(delta - 13);
+    if (length >= 13) out += (char)(length - 13);
+    out += options[i].value;
+  }
+  if (!payload.empty()) out += '\xFF' + payload;
+  return out;
+}
+
+static bool decode(const std::string &in, Message &msg)
+{
+  if (in.size() < 4 || (in[0] & 0xC0) != 0x40) return false;
+  msg.type = (in[0] >> 4) & 0x03;
+  size_t tokenLength = in[0] & 0x0F;
+  msg.code = (uint8_t)in[1];
+  msg.msgId = ((uint8_t)in[2] << 8) | (uint8_t)in[3];
+  if (in.size() < 4 + tokenLength) return false;
+  msg.token = in.substr(4, tokenLength);
+  size_t at = 4 + tokenLength;
+  uint16_t number = 0;
+  while (at < in.size()) {
+    uint8_t head = in[at++];
+    if (head == 0xFF) {
+      msg.payload = in.substr(at);
+      break;
+    }
+    size_t delta = head >> 4;
+    size_t length = head & 0x0F;
+    if (delta == 13) delta += (uint8_t)in[at++];
+    else if (delta == 14) { delta = 269 + (((uint8_t)in[at] << 8) | (uint8_t)in[at + 1]); at += 2; }
+    if (length == 13) length += (uint8_t)in[at++];
+    else if (length == 14) { length = 269 + (((uint8_t)in[at] << 8) | (uint8_t)in[at + 1]); at += 2; }
+    if (at + length > in.size()) return false;
+    number += delta;
+    std::string value = in.substr(at, length);
+    at += length;
+    if (number == OPTION_OBSERVE) msg.observe = uintOf(value);
+    else if (number == OPTION_BLOCK2) msg.block2 = uintOf(value);
+    else if (number == OPTION_MAX_AGE) msg.maxAge = uintOf(value);
+    else if (number == OPTION_ETAG) { msg.hasEtag = true; msg.etag = value; }
+  }
+  return true;
+}
+
+class Client
+{
+public:
+  Client() : _msgId(0x1000) {
+    _fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval tv = { 0, 100000 };
+    setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    memset(&_server, 0, sizeof(_server));
+    _server.sin_family = AF_INET;
+    _server.sin_port = htons(SERVER_PORT);
+    _server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  }
+  ~Client() { close(_fd); }
+
+  uint16_t nextMsgId() { return ++_msgId; }
+
+  void send(const std::string &datagram) {
+    sendto(_fd, datagram.data(), datagram.size(), 0, (struct sockaddr *)&_server, sizeof(_server));
+  }
+
+  // next message within milli, CON ones acked
+  bool receive(Message &msg, uint32_t milli = WAIT_MILLI) {
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds(milli);
+    char buf[2048];
+    while (std::chrono::steady_clock::now() < end) {
+      ssize_t n = recv(_fd, buf, sizeof(buf), 0);
+      if (n <= 0) continue;
+      msg = Message();
+      if (!decode(std::string(buf, n), msg)) continue;
+      if (msg.type == TYPE_CON) send(encode(TYPE_ACK, 0, msg.msgId, "", std::vector<Option>()));
+      return true;
+    }
+    return false;
+  }
+
+  // CON request and its piggybacked response
+  bool request(int method, const char *path, Message &msg, const std::string &payload = "",
+               std::vector<Option> extra = std::vector<Option>(), const std::string &token = "tk") {
+    std::vector<Option> options;
+    for (size_t i = 0; i < extra.size() && extra[i].number < OPTION_URI_PATH; ++i) options.push_back(extra[i]);
+    std::string segments(path);
+    for (size_t start = 1, end; start < segments.size(); start = end + 1) {
+      end = segments.find('/', start);
+      if (end == std::string::npos) end = segments.size();
+      Option segment = { OPTION_URI_PATH, segments.substr(start, end - start) };
+      options.push_back(segment);
+    }
+    for (size_t i = 0; i < extra.size(); ++i) {
+      if (extra[i].number > OPTION_URI_PATH) options.push_back(extra[i]);
+    }
+    uint16_t msgId = nextMsgId();
+    send(encode(TYPE_CON, method, msgId, token, options, payload));
+    while (receive(msg)) {
+      if (msg.type == TYPE_ACK && msg.msgId == msgId) return msg.token == token;
+    }
+    return false;
+  }
+
+private:
+  int                  _fd;
+  uint16_t             _msgId;
+  struct sockaddr_in   _server;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// test
+/////////////////////////////////////////////////////////////////////////////////////////
+static NetReactor reactor;
+static CoapServer server;
+static SensorRoute sensorRoute;
+static LargeRoute largeRoute;
+static DeviceSide device(&server);
+
+static void runClient()
+{
+  Client client;
+  Message msg;
+  std::vector<Option> none;
+
+  std::cout << "get" << std::endl;
+  check(client.request(1, "/api/v1/sensors", msg) && msg.code == CODE(2, 5) && msg.payload == "{\"temp\":23.5}",
+        "route body piggybacked, 2.05");
+  check(msg.hasEtag && msg.etag.size() == 4, "with ETag");
+  check(client.request(1, "/api/v1/none", msg) && msg.code == CODE(4, 4) && msg.payload.empty(), "unknown path 4.04");
+  check(client.request(3, "/api/v1/sensors", msg) && msg.code == CODE(4, 5), "PUT 4.05");
+
+  std::cout << "commands" << std::endl;
+  check(client.request(2, COAP_CMD_PATH, msg, "read") && msg.code == CODE(2, 5) && msg.payload == "{\"cmd\":\"read\"}",
+        "reply piggybacked, 2.05");
+  check(client.request(2, COAP_CMD_PATH, msg, "quiet") && msg.code == CODE(2, 4) && msg.payload.empty(),
+        "no reply, 2.04");
+  check(client.request(2, COAP_CMD_PATH, msg, "write") && msg.code == CODE(4, 3), "not allowed 4.03");
+  check(client.request(2, COAP_CMD_PATH, msg, "busy") && msg.code == CODE(5, 3) && msg.maxAge == COAP_RETRY_MAX_AGE,
+        "busy 5.03 with Max-Age");
+  check(client.request(2, COAP_CMD_PATH, msg, "limited") && msg.code == CODE(4, 29) && msg.maxAge == COAP_RETRY_MAX_AGE,
+        "rate limited 4.29 with Max-Age");
+  check(client.request(2, COAP_CMD_PATH, msg) && msg.code == CODE(4, 0), "empty payload 4.00");
+  check(client.request(2, "/api/v1/sensors", msg, "read") && msg.code == CODE(4, 5), "POST elsewhere 4.05");
+
+  std::cout << "block-wise" << std::endl;
+  std::string body;
+  std::string etag;
+  bool sameEtag = true;
+  bool ordered = true;
+  uint32_t num = 0;
+  for (bool more = true; more && num < 16; ++num) {
+    std::vector<Option> block;
+    if (num > 0) {
+      Option block2 = { OPTION_BLOCK2, uintValue(num << 4 | 6) };
+      block.push_back(block2);
+    }
+    if (!client.request(1, "/api/v1/large", msg, "", block) || msg.code != CODE(2, 5) || msg.block2 < 0) break;
+    if (num == 0) etag = msg.etag;
+    sameEtag = sameEtag && msg.etag == etag;
+    ordered = ordered && (uint32_t)(msg.block2 >> 4) == num && (msg.block2 & 0x07) == 6;
+    more = msg.block2 & 0x08;
+    body += msg.payload;
+  }
+  check(num == (LARGE_BODY_SIZE + 1023) / 1024 && ordered, "body in 1024 byte blocks, numbered");
+  check(body == largeRoute.body && sameEtag, "blocks make up the body, one ETag");
+  Option small = { OPTION_BLOCK2, uintValue(1 << 4 | 2) };
+  check(client.request(1, "/api/v1/large", msg, "", std::vector<Option>(1, small)) && msg.payload.size() == 64 &&
+        msg.payload == largeRoute.body.substr(64, 64), "smaller block size asked, taken");
+  Option beyond = { OPTION_BLOCK2, uintValue(9 << 4 | 6) };
+  check(client.request(1, "/api/v1/large", msg, "", std::vector<Option>(1, beyond)) && msg.code == CODE(4, 2),
+        "block past the end 4.02");
+
+  std::cout << "observe" << std::endl;
+  Option registration = { OPTION_OBSERVE, "" };
+  check(client.request(1, "/api/v1/sensors", msg, "", std::vector<Option>(1, registration), "ob") &&
+        msg.code == CODE(2, 5) && msg.observe >= 0 && msg.maxAge == COAP_OBSERVE_MAX_AGE, "registered, Observe in reply");
+  int64_t sequence = msg.observe;
+  sensorRoute.temp = 241;
+  bool notified = client.receive(msg, COAP_OBSERVE_CHECK_INTERVAL * 2 + 500);
+  check(notified && msg.token == "ob" && msg.code == CODE(2, 5) && msg.payload == "{\"temp\":24.1}",
+        "change notified with the token");
+  check(notified && msg.observe > sequence, "Observe increases");
+  check(!client.receive(msg, COAP_OBSERVE_CHECK_INTERVAL * 2), "no notification while unchanged");
+  Option cancel = { OPTION_OBSERVE, uintValue(1) };
+  check(client.request(1, "/api/v1/sensors", msg, "", std::vector<Option>(1, cancel), "ob") && msg.observe < 0,
+        "cancelled, no Observe in reply");
+  sensorRoute.temp = 250;
+  check(!client.receive(msg, COAP_OBSERVE_CHECK_INTERVAL * 2), "no notification after cancel");
+}
+
+int main(int argc, const char *argv[])
+{
+  reactor.init();
+  server.init(&reactor);
+  server.setMessageInterpreter(&device);
+  server.httpRouter()->addRoute("/api/v1/sensors", &sensorRoute);
+  server.httpRouter()->addRoute("/api/v1/large", &largeRoute);
+  server.start();
+
+  std::atomic<bool> done(false);
+  std::thread client([&]() {
+    runClient();
+    done = true;
+  });
+  while (!done) reactor.poll(10);
+  client.join();
+
+  // recorded on the reactor thread, read once the client is done
+  std::cout << "requesters" << std::endl;
+  bool sameRequester = device.requesters.size() == 5;
+  for (size_t i = 0; i < device.requesters.size(); ++i) sameRequester = sameRequester && device.requesters[i] == INADDR_LOOPBACK;
+  check(sameRequester, "one requester by address across exchanges");
+
+  std::cout << (_failures ? std::to_string(_failures) + " failed" : std::string("all passed")) << std::endl;
+  server.deinit();
+  reactor.deinit();
+  return _failures ? 1 : 0;
+}
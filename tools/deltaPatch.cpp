@@ -0,0 +1,311 @@
+/*
+ * deltaPatch: make delta update patches between firmware images, apply them to files
+ * Copyright (c) 2017 Shenghua Su
+ *
+ * build:  g++ -std=c++11 -O2 -I../components/AppUpdater -o dpatch deltaPatch.cpp
+ *             ../components/AppUpdater/DeltaPatch.cpp -lcrypto
+ * diff:   ./dpatch diff old.bin new.bin patch.bin
+ * apply:  ./dpatch apply old.bin patch.bin out.bin [new.bin]
+ *
+ * Patches are bsdiff (Colin Percival's algorithm) with the control, diff and extra
+ * streams interleaved and the zero runs of diff as copies, see DeltaPatch.h. Apply
+ * runs the device's applier with the old image as running partition and feeds the
+ * patch in update blocks, so a patch that applies here applies on the device; with
+ * new.bin given the result is compared.
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+#include <openssl/sha.h>
+#include "DeltaPatch.h"
+
+#define UPDATE_BLOCK_SIZE 4096      // as AppUpdater receives the patch
+
+bool readFile(const std::string &file, std::vector<uint8_t> &data)
+{
+  std::ifstream fi(file.c_str(), std::ios::binary);
+  if (!fi) return false;
+  data.assign(std::istreambuf_iterator<char>(fi), std::istreambuf_iterator<char>());
+  return true;
+}
+
+bool writeFile(const std::string &file, const std::vector<uint8_t> &data)
+{
+  std::ofstream fo(file.c_str(), std::ios::binary);
+  if (!fo) return false;
+  fo.write((const char *)data.data(), data.size());
+  return fo.good();
+}
+
+void appendUint32(std::vector<uint8_t> &out, uint32_t value)
+{
+  for (int i = 0; i < 4; ++i) out.push_back((value >> (8 * i)) & 0xff);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// diff
+/////////////////////////////////////////////////////////////////////////////////////////
+// suffix array by prefix doubling, the empty suffix included and sorted first
+void suffixSort(const std::vector<uint8_t> &old, std::vector<int32_t> &sa)
+{
+  int32_t n = old.size();
+  std::vector<int32_t> rank(n + 1), next(n + 1);
+  sa.resize(n + 1);
+  for (int32_t i = 0; i <= n; ++i) {
+    sa[i] = i;
+    rank[i] = i < n ? old[i] : -1;
+  }
+
+  for (int32_t k = 1; ; k <<= 1) {
+    auto less = [&](int32_t a, int32_t b) {
+      if (rank[a] != rank[b]) return rank[a] < rank[b];
+      int32_t ra = a + k <= n ? rank[a + k] : -1;
+      int32_t rb = b + k <= n ? rank[b + k] : -1;
+      return ra < rb;
+    };
+    std::sort(sa.begin(), sa.end(), less);
+    next[sa[0]] = 0;
+    for (int32_t i = 1; i <= n; ++i) next[sa[i]] = next[sa[i - 1]] + (less(sa[i - 1], sa[i]) ? 1 : 0);
+    rank.swap(next);
+    if (rank[sa[n]] == n) break;
+  }
+}
+
+int32_t matchLength(const uint8_t *old, int32_t oldSize, const uint8_t *cur, int32_t curSize)
+{
+  int32_t i = 0;
+  while (i < oldSize && i < curSize && old[i] == cur[i]) ++i;
+  return i;
+}
+
+// longest match of cur in old, its old offset in pos
+int32_t search(const std::vector<int32_t> &sa, const std::vector<uint8_t> &old,
+               const uint8_t *cur, int32_t curSize, int32_t st, int32_t en, int32_t &pos)
+{
+  int32_t oldSize = old.size();
+  while (en - st >= 2) {
+    int32_t x = st + (en - st) / 2;
+    int32_t length = std::min(oldSize - sa[x], curSize);
+    if (memcmp(old.data() + sa[x], cur, length) < 0) st = x;
+    else en = x;
+  }
+  int32_t x = matchLength(old.data() + sa[st], oldSize - sa[st], cur, curSize);
+  int32_t y = matchLength(old.data() + sa[en], oldSize - sa[en], cur, curSize);
+  pos = x > y ? sa[st] : sa[en];
+  return x > y ? x : y;
+}
+
+// diff bytes as records, zero runs of DELTA_COPY_MIN or more copied instead; extra and
+// seek go with the last record
+#define DELTA_COPY_MIN 16
+
+void appendRecords(std::vector<uint8_t> &patch, const std::vector<uint8_t> &diffBytes,
+                   const uint8_t *extra, int32_t extraLength, int32_t seek)
+{
+  int32_t length = diffBytes.size();
+  int32_t i = 0;
+  do {
+    int32_t copy = 0;
+    while (i + copy < length && diffBytes[i + copy] == 0) ++copy;
+    int32_t start = i + copy, end = start;
+    while (end < length) {
+      if (diffBytes[end] != 0) {
+        ++end;
+        continue;
+      }
+      int32_t zeros = 0;
+      while (end + zeros < length && diffBytes[end + zeros] == 0) ++zeros;
+      if (zeros >= DELTA_COPY_MIN) break;
+      end += zeros;
+    }
+
+    bool last = end == length;
+    appendUint32(patch, copy);
+    appendUint32(patch, end - start);
+    appendUint32(patch, last ? extraLength : 0);
+    appendUint32(patch, last ? seek : 0);
+    patch.insert(patch.end(), diffBytes.begin() + start, diffBytes.begin() + end);
+    if (last) patch.insert(patch.end(), extra, extra + extraLength);
+    i = end;
+  } while (i < length);
+}
+
+void diff(const std::vector<uint8_t> &old, const std::vector<uint8_t> &cur, std::vector<uint8_t> &patch)
+{
+  std::vector<int32_t> sa;
+  suffixSort(old, sa);
+
+  patch.assign(DELTA_PATCH_MAGIC, DELTA_PATCH_MAGIC + DELTA_PATCH_MAGIC_SIZE);
+  appendUint32(patch, old.size());
+  appendUint32(patch, cur.size());
+  uint8_t hash[SHA256_DIGEST_LENGTH];
+  SHA256(old.data(), old.size(), hash);
+  patch.insert(patch.end(), hash, hash + SHA256_DIGEST_LENGTH);
+
+  int32_t oldSize = old.size(), curSize = cur.size();
+  int32_t scan = 0, length = 0, pos = 0;
+  int32_t lastScan = 0, lastPos = 0, lastOffset = 0;
+  while (scan < curSize) {
+    int32_t oldScore = 0;
+    for (int32_t scsc = scan += length; scan < curSize; ++scan) {
+      length = search(sa, old, cur.data() + scan, curSize - scan, 0, oldSize, pos);
+      for (; scsc < scan + length; ++scsc) {
+        if (scsc + lastOffset < oldSize && old[scsc + lastOffset] == cur[scsc]) ++oldScore;
+      }
+      if ((length == oldScore && length != 0) || length > oldScore + 8) break;
+      if (scan + lastOffset < oldSize && old[scan + lastOffset] == cur[scan]) --oldScore;
+    }
+    if (length == oldScore && scan != curSize) continue;
+
+    // extend the last match forward and this one backward, split their overlap
+    int32_t s = 0, sf = 0, lengthF = 0;
+    for (int32_t i = 0; lastScan + i < scan && lastPos + i < oldSize; ) {
+      if (old[lastPos + i] == cur[lastScan + i]) ++s;
+      ++i;
+      if (s * 2 - i > sf * 2 - lengthF) { sf = s; lengthF = i; }
+    }
+    int32_t lengthB = 0;
+    if (scan < curSize) {
+      int32_t sb = 0;
+      s = 0;
+      for (int32_t i = 1; scan >= lastScan + i && pos >= i; ++i) {
+        if (old[pos - i] == cur[scan - i]) ++s;
+        if (s * 2 - i > sb * 2 - lengthB) { sb = s; lengthB = i; }
+      }
+    }
+    if (lastScan + lengthF > scan - lengthB) {
+      int32_t overlap = (lastScan + lengthF) - (scan - lengthB);
+      int32_t ss = 0, lengthS = 0;
+      s = 0;
+      for (int32_t i = 0; i < overlap; ++i) {
+        if (cur[lastScan + lengthF - overlap + i] == old[lastPos + lengthF - overlap + i]) ++s;
+        if (cur[scan - lengthB + i] == old[pos - lengthB + i]) --s;
+        if (s > ss) { ss = s; lengthS = i + 1; }
+      }
+      lengthF += lengthS - overlap;
+      lengthB -= lengthS;
+    }
+
+    std::vector<uint8_t> diffBytes(lengthF);
+    for (int32_t i = 0; i < lengthF; ++i) diffBytes[i] = cur[lastScan + i] - old[lastPos + i];
+    const uint8_t *extra = cur.data() + lastScan + lengthF;
+    appendRecords(patch, diffBytes, extra, (scan - lengthB) - (lastScan + lengthF), (pos - lengthB) - (lastPos + lengthF));
+
+    lastScan = scan - lengthB;
+    lastPos = pos - lengthB;
+    lastOffset = pos - scan;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// apply, files standing in for the partitions
+/////////////////////////////////////////////////////////////////////////////////////////
+class FileSource : public DeltaPatchSource
+{
+public:
+  FileSource(const std::vector<uint8_t> &data) : _data(data) {}
+
+  virtual bool verify(uint32_t size, const uint8_t *sha256) {
+    uint8_t hash[SHA256_DIGEST_LENGTH];
+    if (size > _data.size()) return false;
+    SHA256(_data.data(), size, hash);
+    return memcmp(hash, sha256, SHA256_DIGEST_LENGTH) == 0;
+  }
+
+  virtual bool read(uint32_t offset, uint8_t *buf, size_t length) {
+    if (offset + length > _data.size()) return false;
+    memcpy(buf, _data.data() + offset, length);
+    return true;
+  }
+
+protected:
+  const std::vector<uint8_t> &_data;
+};
+
+class FileTarget : public DeltaPatchTarget
+{
+public:
+  virtual bool write(const uint8_t *data, size_t length) {
+    _data.insert(_data.end(), data, data + length);
+    return true;
+  }
+
+  std::vector<uint8_t> & data() { return _data; }
+
+protected:
+  std::vector<uint8_t> _data;
+};
+
+int apply(const std::vector<uint8_t> &old, const std::vector<uint8_t> &patch, std::vector<uint8_t> &out)
+{
+  FileSource source(old);
+  FileTarget target;
+  DeltaPatch applier;
+  applier.begin(&source, &target);
+  for (size_t offset = 0; offset < patch.size(); offset += UPDATE_BLOCK_SIZE) {
+    size_t length = std::min(patch.size() - offset, (size_t)UPDATE_BLOCK_SIZE);
+    if (applier.apply(patch.data() + offset, length) != DeltaPatch::DELTA_OK) break;
+  }
+  int status = applier.finish();
+  out.swap(target.data());
+  return status;
+}
+
+int main(int argc, const char* argv[])
+{
+  std::string command = argc > 1 ? argv[1] : "";
+  if (!(command == "diff" && argc == 5) && !(command == "apply" && (argc == 5 || argc == 6))) {
+    std::cout << "use format: " << std::endl
+              << argv[0] << " diff old new patch" << std::endl
+              << argv[0] << " apply old patch out [new]" << std::endl
+              << " ARGUMENTS:" << std::endl
+              << "  old                                 image the device runs" << std::endl
+              << "  new                                 image to update to" << std::endl
+              << "  patch                               delta patch" << std::endl
+              << "  out                                 old patched" << std::endl;
+    return -1;
+  }
+
+  std::vector<uint8_t> old, second;
+  if (!readFile(argv[2], old) || !readFile(argv[3], second)) {
+    std::cout << "read " << argv[2] << " or " << argv[3] << " failed" << std::endl;
+    return -1;
+  }
+
+  if (command == "diff") {
+    std::vector<uint8_t> patch;
+    diff(old, second, patch);
+    if (!writeFile(argv[4], patch)) {
+      std::cout << "write " << argv[4] << " failed" << std::endl;
+      return -1;
+    }
+    std::cout << old.size() << " -> " << second.size() << " bytes, patch " << patch.size() << " bytes" << std::endl;
+    return 0;
+  }
+
+  std::vector<uint8_t> out;
+  int status = apply(old, second, out);
+  if (status != DeltaPatch::DELTA_OK) {
+    std::cout << "apply failed, status " << status << std::endl;
+    return -1;
+  }
+  if (!writeFile(argv[4], out)) {
+    std::cout << "write " << argv[4] << " failed" << std::endl;
+    return -1;
+  }
+  if (argc == 6) {
+    std::vector<uint8_t> expected;
+    if (!readFile(argv[5], expected) || expected != out) {
+      std::cout << "result differs from " << argv[5] << std::endl;
+      return -1;
+    }
+  }
+  std::cout << "applied, " << out.size() << " bytes" << std::endl;
+  return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * HostRtos: FreeRTOS and esp-idf calls of the components on a Linux host
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#include "HostRtos.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static const std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+static std::atomic<bool> _virtualTicks(false);
+static std::atomic<uint32_t> _ticks(0);
+
+void hostUseVirtualTicks(bool on)
+{
+  _ticks = xTaskGetTickCount();
+  _virtualTicks = on;
+}
+
+void hostAdvanceTicks(uint32_t ticks)
+{
+  _ticks += ticks;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// task
+/////////////////////////////////////////////////////////////////////////////////////////
+struct HostTask
+{
+  TaskFunction_t  function;
+  void           *params;
+};
+
+static thread_local HostTask _mainTask;
+static thread_local TaskHandle_t _currentTask = NULL;
+
+TickType_t xTaskGetTickCount()
+{
+  if (_virtualTicks) return _ticks;
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _start).count();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  if (_virtualTicks) hostAdvanceTicks(ticks);
+  else std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+  return _currentTask ? _currentTask : &_mainTask;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackSize, void *params,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+  HostTask *task = new HostTask;
+  task->function = function;
+  task->params = params;
+  if (handle) *handle = task;
+  std::thread([task]() {
+    _currentTask = task;
+    task->function(task->params);
+  }).detach();
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t handle)
+{
+  // the thread returns from its function right after, as a task never does
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// queue
+/////////////////////////////////////////////////////////////////////////////////////////
+struct HostQueue
+{
+  size_t                              length;
+  size_t                              itemSize;
+  std::deque<std::vector<uint8_t> >   items;
+  std::mutex                          mutex;
+  std::condition_variable             changed;
+};
+
+// portMAX_DELAY waits for good, virtual ticks or not
+static bool waitFor(std::unique_lock<std::mutex> &lock, std::condition_variable &cv, TickType_t waitTicks,
+                    const std::function<bool()> &ready)
+{
+  if (waitTicks == portMAX_DELAY) {
+    cv.wait(lock, ready);
+    return true;
+  }
+  return cv.wait_for(lock, std::chrono::milliseconds(waitTicks), ready);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+  HostQueue *queue = new HostQueue;
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+  delete queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t waitTicks)
+{
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!waitFor(lock, queue->changed, waitTicks, [queue]() { return queue->items.size() < queue->length; }))
+    return pdFALSE;
+  const uint8_t *bytes = (const uint8_t *)item;
+  queue->items.push_back(std::vector<uint8_t>(bytes, bytes + queue->itemSize));
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t waitTicks)
+{
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!waitFor(lock, queue->changed, waitTicks, [queue]() { return !queue->items.empty(); }))
+    return pdFALSE;
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  return queue->items.size();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// semaphore
+/////////////////////////////////////////////////////////////////////////////////////////
+struct HostMutex
+{
+  std::timed_mutex    mutex;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  return new HostMutex;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+  delete semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t waitTicks)
+{
+  if (waitTicks == portMAX_DELAY) {
+    semaphore->mutex.lock();
+    return pdTRUE;
+  }
+  return semaphore->mutex.try_lock_for(std::chrono::milliseconds(waitTicks)) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+  semaphore->mutex.unlock();
+  return pdTRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// esp
+/////////////////////////////////////////////////////////////////////////////////////////
+uint32_t esp_get_free_heap_size()
+{
+  return 0;
+}
+
+void esp_restart()
+{
+  exit(0);
+}
+
+int64_t esp_timer_get_time()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count();
+}
+
+uint32_t esp_log_timestamp()
+{
+  return xTaskGetTickCount();
+}
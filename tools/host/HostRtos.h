@@ -0,0 +1,23 @@
+/*
+ * HostRtos: FreeRTOS and esp-idf calls of the components on a Linux host
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _HOST_RTOS_H
+#define _HOST_RTOS_H
+
+#include <stdint.h>
+
+// Host programs under tools/ build component sources as they are, with this directory
+// first on the include path so freertos/*.h, esp_system.h, esp_log.h, esp_timer.h and
+// System.h resolve here, and HostRtos.cpp linked in. Tasks are threads, queues and mutexes
+// their std counterparts, a tick is a millisecond.
+//
+// Ticks follow the steady clock, or with virtual ticks on, only hostAdvanceTicks() and
+// vTaskDelay() move them, so a program can play minutes of device time in no time.
+
+void hostUseVirtualTicks(bool on);
+void hostAdvanceTicks(uint32_t ticks);
+
+#endif // _HOST_RTOS_H
@@ -0,0 +1,24 @@
+/*
+ * System.h: host build, see HostRtos.h
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _HOST_SYSTEM_H
+#define _HOST_SYSTEM_H
+
+// the part of System protocol sources use, so they build without the application;
+// a source needing more of it does not build on host, which is on purpose
+#define HOST_SYSTEM_UID   "240ac4a1b2c3"
+
+class System
+{
+public:
+  static System * instance() {
+    static System system;
+    return &system;
+  }
+  const char * uid() { return HOST_SYSTEM_UID; }
+};
+
+#endif // _HOST_SYSTEM_H
@@ -0,0 +1,30 @@
+/*
+ * esp_log.h: host build, what AppLog.h takes of it, see HostRtos.h
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _HOST_ESP_LOG_H
+#define _HOST_ESP_LOG_H
+
+#include <stdint.h>
+
+#define LOG_COLOR_BLACK   "30"
+#define LOG_COLOR_RED     "31"
+#define LOG_COLOR_GREEN   "32"
+#define LOG_COLOR_BROWN   "33"
+#define LOG_COLOR_BLUE    "34"
+#define LOG_COLOR_PURPLE  "35"
+#define LOG_COLOR_CYAN    "36"
+#define LOG_COLOR(COLOR)  "\033[0;" COLOR "m"
+#define LOG_RESET_COLOR   "\033[0m"
+#define LOG_COLOR_E       LOG_COLOR(LOG_COLOR_RED)
+#define LOG_COLOR_W       LOG_COLOR(LOG_COLOR_BROWN)
+#define LOG_COLOR_I       LOG_COLOR(LOG_COLOR_GREEN)
+#define LOG_COLOR_D
+#define LOG_COLOR_V
+
+// ms, as the tick count
+uint32_t esp_log_timestamp();
+
+#endif // _HOST_ESP_LOG_H
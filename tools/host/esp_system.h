@@ -0,0 +1,16 @@
+/*
+ * esp_system.h: host build, see HostRtos.h
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _HOST_ESP_SYSTEM_H
+#define _HOST_ESP_SYSTEM_H
+
+#include <stdint.h>
+
+// no heap accounting on host, always 0
+uint32_t esp_get_free_heap_size();
+void esp_restart();
+
+#endif // _HOST_ESP_SYSTEM_H
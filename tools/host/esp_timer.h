@@ -0,0 +1,15 @@
+/*
+ * esp_timer.h: host build, see HostRtos.h
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _HOST_ESP_TIMER_H
+#define _HOST_ESP_TIMER_H
+
+#include <stdint.h>
+
+// microseconds since start, real time even with virtual ticks
+int64_t esp_timer_get_time();
+
+#endif // _HOST_ESP_TIMER_H
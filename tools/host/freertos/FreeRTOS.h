@@ -0,0 +1,25 @@
+/*
+ * FreeRTOS.h: host build, see HostRtos.h
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _HOST_FREERTOS_H
+#define _HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t        TickType_t;
+typedef int             BaseType_t;
+typedef unsigned int    UBaseType_t;
+
+#define portTICK_PERIOD_MS      1
+#define portTICK_RATE_MS        portTICK_PERIOD_MS
+#define portMAX_DELAY           ((TickType_t)0xffffffff)
+#define pdFALSE                 0
+#define pdTRUE                  1
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+
+#endif // _HOST_FREERTOS_H
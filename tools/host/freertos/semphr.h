@@ -0,0 +1,20 @@
+/*
+ * semphr.h: host build, mutexes only, see HostRtos.h
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _HOST_FREERTOS_SEMPHR_H
+#define _HOST_FREERTOS_SEMPHR_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct HostMutex * SemaphoreHandle_t;
+typedef SemaphoreHandle_t xSemaphoreHandle;
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t waitTicks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+#endif // _HOST_FREERTOS_SEMPHR_H
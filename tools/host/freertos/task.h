@@ -0,0 +1,24 @@
+/*
+ * task.h: host build, tasks are threads, see HostRtos.h
+ * Copyright (c) 2017 Shenghua Su
+ *
+ */
+
+#ifndef _HOST_FREERTOS_TASK_H
+#define _HOST_FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef void * TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+TickType_t xTaskGetTickCount();
+void vTaskDelay(TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+// stack size and priority are ignored
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackSize, void *params,
+                       UBaseType_t priority, TaskHandle_t *handle);
+// NULL only, the calling thread ends
+void vTaskDelete(TaskHandle_t handle);
+
+#endif // _HOST_FREERTOS_TASK_H
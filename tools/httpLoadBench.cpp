@@ -0,0 +1,309 @@
+/*
+ * httpLoadBench: requests per second and latency of the REST routes under local load
+ * Copyright (c) 2017 Shenghua Su
+ *
+ * build:  g++ -std=c++11 -O2 -Ihost -I../components/MessageProtocol -I../components/Common
+ *             -I../components/Config -DHTTP_LISTEN_ADDR='"8080"' -o httpbench httpLoadBench.cpp
+ *             ../components/MessageProtocol/{HttpServer,HttpRouter,LiveStream,WebAssetServer,NetReactor,LoopWaker}.cpp
+ *             ../components/Common/StrFormat.cpp host/HostRtos.cpp
+ *             -x c ../components/MessageProtocol/mongoose/mongoose.c -lpthread
+ * run:    ./httpbench [connections] [seconds]
+ *
+ * HttpServer with its router on the loopback, the main thread runs the reactor as the
+ * network task does; /api/v1/sensors writes the sensor json the way SensorDataPacker
+ * does, straight into the send buffer. A load generator thread keeps every connection
+ * busy with one request at a time and times each until the last byte of its response:
+ * once on keep-alive connections, once with If-None-Match answered by 304, and once
+ * with a new connection per request as before the router. Prints requests per second
+ * and latency percentiles of each run.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "HostRtos.h"
+#include "HttpServer.h"
+#include "StrFormat.h"
+
+#define BENCH_PORT              8080
+#define BENCH_PATH              "/api/v1/sensors"
+#define CONNECTIONS_MAX         64
+#define RESPONSE_BUF_SIZE       4096
+#define HTTP_JSON_BODY_RESERVE  1024    // as CmdEngine's routes
+
+typedef std::chrono::steady_clock Clock;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// server side
+/////////////////////////////////////////////////////////////////////////////////////////
+// fields as SensorDataPacker::dataJsonFields writes them on a device with all sensors
+class SensorRoute : public HttpRouteHandler
+{
+public:
+  virtual int onHttpRoute(HttpResponse &response, void *context) {
+    char *buf = response.reserve(HTTP_JSON_BODY_RESERVE);
+    if (!buf) return 503;
+    size_t length = 0;
+    appendf(buf, HTTP_JSON_BODY_RESERVE, length,
+            "{\"temp\":%.1f,\"templvl\":%d,\"humid\":%.1f,\"humidlvl\":%d,\"lumi\":%d,\"lumilvl\":%d,"
+            "\"pm1.0\":%.1f,\"pm2.5\":%.1f,\"pm10\":%.1f,\"pm2.5us\":%d,\"pm2.5uslvl\":%d,"
+            "\"pm2.5cn\":%d,\"pm2.5cnlvl\":%d,\"pm10us\":%d,\"pm10uslvl\":%d,"
+            "\"hcho\":%.3f,\"hcholvl\":%d,\"co2\":%d,\"co2lvl\":%d}",
+            23.5f, 1, 45.0f, 1, 180, 1, 12.0f, 35.0f, 41.0f, 99, 2, 49, 1, 38, 1, 0.03f, 1, 620, 1);
+    if (length >= HTTP_JSON_BODY_RESERVE) return 500;
+    response.commit(length);
+    return 200;
+  }
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// load generator
+/////////////////////////////////////////////////////////////////////////////////////////
+enum Mode {
+  KeepAlive,
+  Conditional,
+  CloseEach
+};
+
+struct Client
+{
+  int                 fd;
+  std::string         request;
+  size_t              sent;
+  char                buf[RESPONSE_BUF_SIZE];
+  size_t              received;
+  Clock::time_point   start;
+};
+
+struct Result
+{
+  Result() : requests(0), errors(0), status304(0), seconds(0) {}
+  uint64_t              requests;
+  uint64_t              errors;
+  uint64_t              status304;
+  double                seconds;
+  std::vector<double>   latencies;   // ms
+};
+
+static std::string _etag;
+
+static int openConnection()
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(BENCH_PORT);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+static std::string requestOf(Mode mode)
+{
+  std::string request = "GET " BENCH_PATH " HTTP/1.1\r\nHost: 127.0.0.1\r\n";
+  if (mode == Conditional) request += "If-None-Match: " + _etag + "\r\n";
+  if (mode == CloseEach) request += "Connection: close\r\n";
+  return request + "\r\n";
+}
+
+// length of the complete response in buf, 0 if not complete yet
+static size_t responseLength(const char *buf, size_t received)
+{
+  const char *end = (const char *)memmem(buf, received, "\r\n\r\n", 4);
+  if (!end) return 0;
+  size_t head = end - buf + 4;
+  size_t body = 0;
+  for (const char *p = buf; p < end; ) {
+    const char *eol = (const char *)memmem(p, end - p + 2, "\r\n", 2);
+    if (strncasecmp(p, "Content-Length:", 15) == 0) body = strtoul(p + 15, NULL, 10);
+    p = eol + 2;
+  }
+  return received >= head + body ? head + body : 0;
+}
+
+static bool startRequest(Client &client, Mode mode)
+{
+  client.start = Clock::now();
+  if (client.fd < 0) client.fd = openConnection();
+  if (client.fd < 0) return false;
+  client.request = requestOf(mode);
+  client.sent = 0;
+  client.received = 0;
+  return true;
+}
+
+// one request in flight per connection until seconds are over
+static Result runLoad(Mode mode, int connections, int seconds)
+{
+  Result result;
+  std::vector<Client> clients(connections);
+  for (int i = 0; i < connections; ++i) {
+    clients[i].fd = -1;
+    startRequest(clients[i], mode);
+  }
+  Clock::time_point begin = Clock::now();
+  Clock::time_point end = begin + std::chrono::seconds(seconds);
+  std::vector<struct pollfd> fds(connections);
+  while (Clock::now() < end) {
+    for (int i = 0; i < connections; ++i) {
+      fds[i].fd = clients[i].fd;
+      fds[i].events = clients[i].sent < clients[i].request.size() ? POLLOUT : POLLIN;
+      fds[i].revents = 0;
+    }
+    if (poll(fds.data(), connections, 100) <= 0) continue;
+    for (int i = 0; i < connections; ++i) {
+      Client &client = clients[i];
+      if (!fds[i].revents) continue;
+      if (client.sent < client.request.size()) {
+        ssize_t n = send(client.fd, client.request.data() + client.sent, client.request.size() - client.sent, MSG_NOSIGNAL);
+        if (n > 0) client.sent += n;
+        else if (errno != EAGAIN) fds[i].revents = POLLERR;
+        if (!(fds[i].revents & POLLERR)) continue;
+      }
+      ssize_t n = fds[i].revents & POLLERR ? -1 : recv(client.fd, client.buf + client.received,
+                                                        sizeof(client.buf) - client.received, 0);
+      if (n < 0 && errno == EAGAIN) continue;
+      size_t length = n > 0 ? responseLength(client.buf, client.received += n) : 0;
+      if (n <= 0 || client.received == sizeof(client.buf)) {
+        // closed or broken, count and start over on a new connection
+        ++result.errors;
+        close(client.fd);
+        client.fd = -1;
+        startRequest(client, mode);
+        continue;
+      }
+      if (length == 0) continue;
+      ++result.requests;
+      if (strncmp(client.buf, "HTTP/1.1 304", 12) == 0) ++result.status304;
+      result.latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - client.start).count());
+      if (mode == CloseEach) {
+        close(client.fd);
+        client.fd = -1;
+      }
+      startRequest(client, mode);
+    }
+  }
+  result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+  for (int i = 0; i < connections; ++i) {
+    if (clients[i].fd >= 0) close(clients[i].fd);
+  }
+  return result;
+}
+
+// etag of the route's body, for the conditional run
+static bool fetchEtag()
+{
+  Client client;
+  client.fd = -1;
+  if (!startRequest(client, KeepAlive)) return false;
+  fcntl(client.fd, F_SETFL, fcntl(client.fd, F_GETFL) & ~O_NONBLOCK);
+  send(client.fd, client.request.data(), client.request.size(), MSG_NOSIGNAL);
+  size_t length = 0;
+  while (length == 0) {
+    ssize_t n = recv(client.fd, client.buf + client.received, sizeof(client.buf) - client.received, 0);
+    if (n <= 0) break;
+    length = responseLength(client.buf, client.received += n);
+  }
+  close(client.fd);
+  std::string head(client.buf, client.received);
+  size_t at = head.find("ETag: ");
+  if (at == std::string::npos) return false;
+  _etag = head.substr(at + 6, head.find("\r\n", at) - at - 6);
+  return true;
+}
+
+static double percentile(std::vector<double> &values, double p)
+{
+  if (values.empty()) return 0;
+  size_t index = (size_t)(p / 100 * (values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+static void printRow(const std::string &name, Result &result)
+{
+  std::cout << std::left << std::setw(22) << name << std::right << std::fixed
+            << std::setw(10) << std::setprecision(0) << result.requests / result.seconds
+            << std::setw(10) << std::setprecision(3) << percentile(result.latencies, 50)
+            << std::setw(10) << percentile(result.latencies, 99)
+            << std::setw(10) << percentile(result.latencies, 100)
+            << std::setw(8) << result.errors << std::endl;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// run
+/////////////////////////////////////////////////////////////////////////////////////////
+static NetReactor reactor;
+static HttpServer server;
+static SensorRoute route;
+
+int main(int argc, const char *argv[])
+{
+  int connections = argc > 1 ? atoi(argv[1]) : 4;
+  int seconds = argc > 2 ? atoi(argv[2]) : 3;
+  if (connections <= 0 || connections > CONNECTIONS_MAX || seconds <= 0) {
+    std::cout << "use format: " << argv[0] << " [connections] [seconds]" << std::endl
+              << " ARGUMENTS:" << std::endl
+              << "  connections                         concurrent clients, 1 to " << CONNECTIONS_MAX << ", default 4" << std::endl
+              << "  seconds                             length of each run, default 3" << std::endl;
+    return -1;
+  }
+
+  reactor.init();
+  server.init(&reactor);
+  server.httpRouter()->addRoute(BENCH_PATH, &route);
+  server.start();
+
+  std::atomic<bool> done(false);
+  std::thread load([&]() {
+    if (!fetchEtag()) {
+      std::cout << "no response from server" << std::endl;
+      done = true;
+      return;
+    }
+    std::cout << connections << " connections, " << seconds << " s each, GET " BENCH_PATH << std::endl;
+    std::cout << std::left << std::setw(22) << "" << std::right << std::setw(10) << "req/s"
+              << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms" << std::setw(10) << "max ms"
+              << std::setw(8) << "errors" << std::endl;
+    Result keepAlive = runLoad(KeepAlive, connections, seconds);
+    printRow("keep-alive", keepAlive);
+    Result conditional = runLoad(Conditional, connections, seconds);
+    printRow("keep-alive, 304", conditional);
+    if (conditional.status304 != conditional.requests) {
+      std::cout << "  " << conditional.requests - conditional.status304 << " not answered with 304" << std::endl;
+    }
+    Result closeEach = runLoad(CloseEach, connections, seconds);
+    printRow("connection per req", closeEach);
+    done = true;
+  });
+  while (!done) reactor.poll(10);
+  load.join();
+  reactor.deinit();
+  return 0;
+}
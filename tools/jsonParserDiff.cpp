@@ -0,0 +1,442 @@
+/*
+ * jsonParserDiff: JsonParser against the cJSON of esp-idf, differential test and benchmark
+ * Copyright (c) 2017 Shenghua Su
+ *
+ * build:  g++ -std=c++11 -O2 -I../components/CmdEngine -I$IDF_PATH/components/json/cJSON
+ *             -o jsondiff jsonParserDiff.cpp ../components/CmdEngine/JsonParser.cpp
+ *             -x c $IDF_PATH/components/json/cJSON/cJSON.c -lm
+ * run:    ./jsondiff [cases] [seed]
+ *
+ * Every case goes to both parsers: command payloads as apps send them, random documents
+ * (nesting, escapes and surrogate pairs, numbers, case variants and duplicates of keys,
+ * control chars as space) and those documents with a byte changed, dropped or inserted.
+ * Where both accept, values are compared the way CmdEngine reads them: each key cJSON
+ * holds looked up on both sides (case insensitive, first duplicate), array elements by
+ * index, numbers, booleans and unescaped strings; and a key neither has must be missing
+ * on both. Cases JsonParser takes but cJSON refuses, or read differently, are failures.
+ * Cases only JsonParser refuses are listed: deeper than JSON_PARSER_DEPTH_MAX, \u0000,
+ * and number forms outside the JSON grammar strtod still reads (01, 1., 1.e5, -01).
+ *
+ * Then times parse and field lookup of the command payloads on both, with the heap
+ * allocations cJSON makes for each.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <string.h>
+#include <stdlib.h>
+#include "JsonParser.h"
+#include "cJSON.h"
+
+#define TOKEN_CAPACITY          1024
+#define CMD_TOKEN_CAPACITY      96      // JSON_CMD_TOKEN_CAPACITY of CmdEngine.cpp
+#define STRING_BUF_SIZE         4096
+#define GEN_DEPTH_MAX           10
+#define EXAMPLE_COUNT           5
+#define BENCH_MILLI             1000
+
+typedef std::chrono::steady_clock Clock;
+
+static JsonToken _tokens[TOKEN_CAPACITY];
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// command payloads
+/////////////////////////////////////////////////////////////////////////////////////////
+struct Payload
+{
+  const char *name;
+  const char *json;
+  const char *fields[8];    // looked up as the command's parser does, NULL ended
+};
+
+static const Payload _payloads[] = {
+  { "GetSensorData", "{\"cmd\":\"GetSensorData\"}", { NULL } },
+  { "GetHostname versioned", "{\"cmd\":\"GetHostname\",\"ver\":17,\"id\":\"a1\"}", { "ver", "id", NULL } },
+  { "SetStaSsidPass", "{\"cmd\":\"SetStaSsidPass\",\"ssid\":\"home \\\"5G\\\"\",\"pass\":\"p\\u00e4ss\\/w\\u0072d\"}",
+    { "ssid", "pass", NULL } },
+  { "TurnOnDisplay", "{ \"cmd\" : \"TurnOnDisplay\", \"on\" : true }", { "on", NULL } },
+  { "SetSensorAlertConfig",
+    "{\"cmd\":\"SetSensorAlertConfig\",\"config\":{"
+    "\"temp\":{\"len\":true,\"gen\":true,\"lval\":10.5,\"gval\":30},"
+    "\"humid\":{\"len\":false,\"gen\":true,\"lval\":20,\"gval\":80},"
+    "\"pm2.5\":{\"len\":false,\"gen\":true,\"lval\":0,\"gval\":75},"
+    "\"pm10\":{\"len\":false,\"gen\":true,\"lval\":0,\"gval\":150},"
+    "\"hcho\":{\"len\":false,\"gen\":true,\"lval\":0,\"gval\":0.1},"
+    "\"co2\":{\"len\":false,\"gen\":true,\"lval\":0,\"gval\":1500}}}",
+    { "config", NULL } },
+  { "Batch",
+    "{\"cmd\":\"Batch\",\"id\":\"b-7\",\"cmds\":[{\"cmd\":\"GetUID\"},{\"cmd\":\"GetHostname\"},"
+    "{\"cmd\":\"GetFirmwareVersion\"},{\"cmd\":\"TurnOnDisplay\",\"on\":false}]}",
+    { "id", "cmds", NULL } },
+  { "SetEdgeBrokers", "{\"cmd\":\"SetEdgeBrokers\",\"brokers\":[\"mqtt://10.0.0.2:1883\",\"mqtt://edge.local\"]}",
+    { "brokers", NULL } }
+};
+
+#define PAYLOAD_COUNT (sizeof(_payloads) / sizeof(_payloads[0]))
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// generator
+/////////////////////////////////////////////////////////////////////////////////////////
+static const char * const _keys[] = { "cmd", "id", "on", "config", "ssid", "pass", "len", "gval", "ver", "" };
+static const char * const _numbers[] = {
+  "0", "-0", "7", "-12", "3.25", "1e3", "2E-2", "-4.5e+1", "1234567890123", "1e400", "0.1",
+  // outside the grammar, cJSON reads them with strtod
+  "01", "1.", "1.e5", "-01", "+1", ".5", "-", "1e", "0x10", "1.2.3"
+};
+static const char * const _escapes[] = {
+  "\\\"", "\\\\", "\\/", "\\b", "\\f", "\\n", "\\r", "\\t", "\\u0041", "\\u00e9", "\\u20ac",
+  "\\ud83d\\ude00", "\\uD834\\uDD1E",
+  // malformed or left to cJSON's reading
+  "\\u0000", "\\ud800", "\\udc00", "\\ud800\\u0041", "\\u12", "\\x", "\\"
+};
+static const char _spaces[] = { ' ', '\t', '\n', '\r', '\x01', '\x1f' };
+
+#define COUNT_OF(a) (sizeof(a) / sizeof(a[0]))
+
+class Generator
+{
+public:
+  Generator(uint32_t seed) : _rng(seed) {}
+
+  uint32_t below(uint32_t n) { return _rng() % n; }
+
+  std::string document() {
+    return space() + value(0) + space();
+  }
+
+  // one byte changed, dropped or inserted
+  std::string mutate(std::string json) {
+    if (json.empty()) return json;
+    static const char bytes[] = "{}[]\",:\\u0e.-tfn 1";
+    size_t at = below(json.size());
+    switch (below(3)) {
+      case 0: json[at] = bytes[below(sizeof(bytes) - 1)]; break;
+      case 1: json.erase(at, 1); break;
+      default: json.insert(at, 1, bytes[below(sizeof(bytes) - 1)]); break;
+    }
+    return json;
+  }
+
+private:
+  std::string space() {
+    std::string s;
+    while (below(4) == 0) s += _spaces[below(sizeof(_spaces))];
+    return s;
+  }
+
+  std::string string() {
+    std::string s = "\"";
+    uint32_t parts = below(5);
+    for (uint32_t i = 0; i < parts; ++i) {
+      uint32_t kind = below(10);
+      if (kind < 6) s += (char)('a' + below(26));
+      else if (kind < 9) s += _escapes[below(COUNT_OF(_escapes) - 7)];
+      else s += _escapes[below(COUNT_OF(_escapes))];
+    }
+    return s + "\"";
+  }
+
+  std::string key() {
+    // case variants and repeats exercise the lookup
+    std::string k = _keys[below(COUNT_OF(_keys))];
+    if (below(4) == 0 && !k.empty()) k[0] = toupper(k[0]);
+    if (below(8) == 0) return string();
+    return "\"" + k + "\"";
+  }
+
+  std::string value(int depth) {
+    uint32_t kind = below(depth < GEN_DEPTH_MAX ? 8 : 6);
+    switch (kind) {
+      case 0: return "true";
+      case 1: return "false";
+      case 2: return "null";
+      case 3: return _numbers[below(below(5) == 0 ? COUNT_OF(_numbers) : 11)];
+      case 4:
+      case 5: return string();
+      case 6: {
+        std::string s = "[" + space();
+        uint32_t count = below(4);
+        for (uint32_t i = 0; i < count; ++i) s += (i ? "," : "") + space() + value(depth + 1) + space();
+        return s + "]";
+      }
+      default: {
+        std::string s = "{" + space();
+        uint32_t count = below(5);
+        for (uint32_t i = 0; i < count; ++i) {
+          s += (i ? "," : "") + space() + key() + space() + ":" + space() + value(depth + 1) + space();
+        }
+        return s + "}";
+      }
+    }
+  }
+
+  std::mt19937 _rng;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// comparison
+/////////////////////////////////////////////////////////////////////////////////////////
+static const char * typeName(int type)
+{
+  static const char * const names[] = { "none", "object", "array", "string", "number", "true", "false", "null" };
+  return names[type];
+}
+
+static JsonType cjsonType(const cJSON *item)
+{
+  switch (item->type & 0xFF) {
+    case cJSON_False:  return JsonFalse;
+    case cJSON_True:   return JsonTrue;
+    case cJSON_NULL:   return JsonNull;
+    case cJSON_Number: return JsonNumber;
+    case cJSON_String: return JsonString;
+    case cJSON_Array:  return JsonArray;
+    case cJSON_Object: return JsonObject;
+    default:           return JsonNone;
+  }
+}
+
+// first difference of the values, empty if they agree
+static std::string compare(const cJSON *item, const JsonParser &json, int token, const std::string &path)
+{
+  JsonType type = cjsonType(item);
+  if (json.type(token) != type) {
+    return path + ": " + typeName(json.type(token)) + " instead of " + typeName(type);
+  }
+  switch (type) {
+    case JsonNumber: {
+      double value;
+      if (!json.number(token, value) || value != item->valuedouble) return path + ": number differs";
+      return "";
+    }
+    case JsonString: {
+      char buf[STRING_BUF_SIZE];
+      size_t length;
+      if (!json.copyString(token, buf, sizeof(buf), length)) return path + ": string not copied";
+      if (length != strlen(item->valuestring) || strcmp(buf, item->valuestring) != 0) return path + ": string differs";
+      if (length < JSON_PARSER_COMPARE_MAX && !json.stringEquals(token, item->valuestring))
+        return path + ": stringEquals false";
+      return "";
+    }
+    case JsonArray: {
+      int size = cJSON_GetArraySize(item);
+      if (json.element(token, size) >= 0) return path + ": more elements";
+      for (int i = 0; i < size; ++i) {
+        std::string at = path + "[" + std::to_string(i) + "]";
+        int element = json.element(token, i);
+        if (element < 0) return at + ": missing";
+        std::string diff = compare(cJSON_GetArrayItem(item, i), json, element, at);
+        if (!diff.empty()) return diff;
+      }
+      return "";
+    }
+    case JsonObject: {
+      for (const cJSON *child = item->child; child; child = child->next) {
+        // keys escaped beyond the compare buffer are not matched, CmdEngine's are short
+        if (strlen(child->string) + 1 >= JSON_PARSER_COMPARE_MAX) continue;
+        std::string at = path + "." + child->string;
+        int member = json.find(child->string, token);
+        if (member < 0) return at + ": not found";
+        std::string diff = compare(cJSON_GetObjectItem(item, child->string), json, member, at);
+        if (!diff.empty()) return diff;
+      }
+      if (json.find("no such key", token) >= 0) return path + ": found a key not there";
+      return "";
+    }
+    default:
+      return "";
+  }
+}
+
+static size_t depthOf(const std::string &text)
+{
+  size_t depth = 0, deepest = 0;
+  bool inString = false;
+  for (size_t i = 0; i < text.size(); ++i) {
+    char c = text[i];
+    if (inString) {
+      if (c == '\\') ++i;
+      else if (c == '"') inString = false;
+    }
+    else if (c == '"') inString = true;
+    else if (c == '{' || c == '[') deepest = ++depth > deepest ? depth : deepest;
+    else if ((c == '}' || c == ']') && depth > 0) --depth;
+  }
+  return deepest;
+}
+
+static std::string printable(const std::string &text)
+{
+  std::string out;
+  for (size_t i = 0; i < text.size() && out.size() < 160; ++i) {
+    uint8_t c = text[i];
+    if (c >= ' ' && c < 0x7f) out += (char)c;
+    else {
+      char hex[8];
+      snprintf(hex, sizeof(hex), "\\x%02x", c);
+      out += hex;
+    }
+  }
+  return out;
+}
+
+struct Tally
+{
+  Tally() : cases(0), bothAccept(0), bothRefuse(0), stricter(0), looser(0), differ(0) {}
+  uint64_t cases;
+  uint64_t bothAccept;
+  uint64_t bothRefuse;
+  uint64_t stricter;      // only JsonParser refuses
+  uint64_t looser;        // only cJSON refuses
+  uint64_t differ;
+  std::vector<std::string> stricterExamples;
+  std::vector<std::string> failures;
+};
+
+static void diff(const std::string &text, Tally &tally)
+{
+  ++tally.cases;
+  cJSON *root = cJSON_Parse(text.c_str());
+  JsonParser json(_tokens, TOKEN_CAPACITY);
+  bool accepted = json.parse(text.data(), text.size());
+  if (!root && !accepted) ++tally.bothRefuse;
+  else if (!accepted) {
+    ++tally.stricter;
+    if (tally.stricterExamples.size() < EXAMPLE_COUNT) {
+      tally.stricterExamples.push_back("depth " + std::to_string(depthOf(text)) + "  " + printable(text));
+    }
+  }
+  else if (!root) {
+    ++tally.looser;
+    if (tally.failures.size() < EXAMPLE_COUNT) tally.failures.push_back("cJSON refuses: " + printable(text));
+  }
+  else {
+    ++tally.bothAccept;
+    std::string difference = compare(root, json, 0, "$");
+    if (!difference.empty()) {
+      ++tally.differ;
+      if (tally.failures.size() < EXAMPLE_COUNT) tally.failures.push_back(difference + "  " + printable(text));
+    }
+  }
+  cJSON_Delete(root);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// benchmark
+/////////////////////////////////////////////////////////////////////////////////////////
+static uint64_t _allocCount = 0;
+static uint64_t _allocBytes = 0;
+
+static void * countingMalloc(size_t size)
+{
+  ++_allocCount;
+  _allocBytes += size;
+  return malloc(size);
+}
+
+// parse and look up the payload's fields as CmdEngine does, true if all found
+static bool parserRun(const Payload &payload, size_t length)
+{
+  static JsonToken tokens[CMD_TOKEN_CAPACITY];
+  JsonParser json(tokens, CMD_TOKEN_CAPACITY);
+  if (!json.parse(payload.json, length)) return false;
+  char name[64];
+  size_t nameLength;
+  bool found = json.copyString(json.find("cmd"), name, sizeof(name), nameLength);
+  for (int i = 0; payload.fields[i]; ++i) found = found && json.find(payload.fields[i]) >= 0;
+  return found;
+}
+
+static bool cjsonRun(const Payload &payload, size_t length)
+{
+  cJSON *root = cJSON_Parse(payload.json);
+  if (!root) return false;
+  cJSON *cmd = cJSON_GetObjectItem(root, "cmd");
+  bool found = cmd && (cmd->type & 0xFF) == cJSON_String;
+  for (int i = 0; payload.fields[i]; ++i) found = found && cJSON_GetObjectItem(root, payload.fields[i]);
+  cJSON_Delete(root);
+  return found;
+}
+
+template <typename Run>
+static double nanoPerRun(const Payload &payload, Run run, uint64_t &runs)
+{
+  size_t length = strlen(payload.json);
+  volatile unsigned sink = 0;
+  runs = 0;
+  Clock::time_point start = Clock::now();
+  Clock::time_point end = start + std::chrono::milliseconds(BENCH_MILLI);
+  do {
+    for (int i = 0; i < 256; ++i) sink += run(payload, length);
+    runs += 256;
+  } while (Clock::now() < end);
+  (void)sink;
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / runs;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// run
+/////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, const char *argv[])
+{
+  long cases = argc > 1 ? atol(argv[1]) : 200000;
+  uint32_t seed = argc > 2 ? strtoul(argv[2], NULL, 10) : 1;
+  if (cases <= 0) {
+    std::cout << "use format: " << argv[0] << " [cases] [seed]" << std::endl
+              << " ARGUMENTS:" << std::endl
+              << "  cases                               random documents, as many mutated, default 200000" << std::endl
+              << "  seed                                of the generator, default 1" << std::endl;
+    return -1;
+  }
+
+  Tally tally;
+  for (size_t i = 0; i < PAYLOAD_COUNT; ++i) diff(_payloads[i].json, tally);
+  bool payloadsAgree = tally.bothAccept == PAYLOAD_COUNT && tally.differ == 0;
+  Generator generator(seed);
+  for (long i = 0; i < cases; ++i) {
+    std::string document = generator.document();
+    diff(document, tally);
+    diff(generator.mutate(document), tally);
+  }
+
+  std::cout << tally.cases << " cases, seed " << seed << std::endl
+            << "  both accept, same values   " << tally.bothAccept - tally.differ << std::endl
+            << "  both refuse                " << tally.bothRefuse << std::endl
+            << "  only JsonParser refuses    " << tally.stricter << std::endl
+            << "  only cJSON refuses         " << tally.looser << std::endl
+            << "  values differ              " << tally.differ << std::endl;
+  for (size_t i = 0; i < tally.stricterExamples.size(); ++i) {
+    std::cout << "    stricter: " << tally.stricterExamples[i] << std::endl;
+  }
+  for (size_t i = 0; i < tally.failures.size(); ++i) std::cout << "    FAIL  " << tally.failures[i] << std::endl;
+  if (!payloadsAgree) std::cout << "    FAIL  command payloads not read alike" << std::endl;
+  bool passed = payloadsAgree && tally.looser == 0 && tally.differ == 0;
+
+  std::cout << std::endl << "parse and field lookup, " << BENCH_MILLI << " ms each" << std::endl;
+  std::cout << std::left << std::setw(24) << "" << std::right << std::setw(8) << "bytes"
+            << std::setw(14) << "JsonParser ns" << std::setw(10) << "cJSON ns"
+            << std::setw(10) << "speedup" << std::setw(14) << "cJSON allocs" << std::setw(14) << "cJSON bytes" << std::endl;
+  cJSON_Hooks hooks = { countingMalloc, free };
+  cJSON_InitHooks(&hooks);
+  for (size_t i = 0; i < PAYLOAD_COUNT; ++i) {
+    const Payload &payload = _payloads[i];
+    uint64_t parserRuns, cjsonRuns;
+    double parser = nanoPerRun(payload, parserRun, parserRuns);
+    _allocCount = _allocBytes = 0;
+    double cjson = nanoPerRun(payload, cjsonRun, cjsonRuns);
+    std::cout << std::left << std::setw(24) << payload.name << std::right << std::fixed << std::setprecision(0)
+              << std::setw(8) << strlen(payload.json) << std::setw(14) << parser << std::setw(10) << cjson
+              << std::setw(9) << std::setprecision(1) << cjson / parser << "x"
+              << std::setw(14) << std::setprecision(0) << (double)_allocCount / cjsonRuns
+              << std::setw(14) << (double)_allocBytes / cjsonRuns << std::endl;
+  }
+  cJSON_InitHooks(NULL);
+
+  std::cout << std::endl << (passed ? "all passed" : "FAILED") << std::endl;
+  return passed ? 0 : 1;
+}
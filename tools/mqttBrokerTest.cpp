@@ -0,0 +1,259 @@
+/*
+ * mqttBrokerTest: MqttBroker on a Linux host driven by local MQTT clients
+ * Copyright (c) 2017 Shenghua Su
+ *
+ * build:  g++ -std=c++11 -O1 -Ihost -I../components/MessageProtocol -I../components/Common
+ *             -I../components/Config -o brokertest mqttBrokerTest.cpp
+ *             ../components/MessageProtocol/{MqttBroker,MqttClientDelegate,NetReactor,LoopWaker,TopicRouter}.cpp
+ *             host/HostRtos.cpp -x c ../components/MessageProtocol/mongoose/mongoose.c -lpthread
+ * run:    ./brokertest
+ *
+ * The device's broker listens on its port (1883) of the loopback, the clients are mongoose
+ * MQTT clients on the same manager, so the one thread runs them all as the reactor task;
+ * device publishes from other tasks come from a second thread. Checks connect, subscribe
+ * and delivery between apps at capped QoS, device side dispatch, retained messages,
+ * unsubscribe, the session table limit, client id takeover and the keep alive timeout.
+ * Exits 0 if all checks pass.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <string.h>
+#include "HostRtos.h"
+#include "MqttBroker.h"
+
+#define BROKER_ADDR         "127.0.0.1:" MQTT_BROKER_LISTEN_ADDR
+#define WAIT_MILLI          2000
+#define QUIET_MILLI         300
+#define KEEP_ALIVE_SECONDS  1
+
+static int _failures = 0;
+
+void check(bool passed, const std::string &what)
+{
+  std::cout << (passed ? "  pass  " : "  FAIL  ") << what << std::endl;
+  if (!passed) ++_failures;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// clients
+/////////////////////////////////////////////////////////////////////////////////////////
+struct Received
+{
+  std::string topic;
+  std::string payload;
+  int qos;
+};
+
+struct TestClient
+{
+  TestClient(const char *clientId) : id(clientId), keepAlive(60), nc(NULL), connack(-1), closed(false),
+                                     subacks(0), unsubacks(0), pubacks(0), grantedQos(-1) {}
+  std::string id;
+  uint16_t keepAlive;
+  struct mg_connection *nc;
+  int connack;
+  bool closed;
+  int subacks;
+  int unsubacks;
+  int pubacks;
+  int grantedQos;
+  std::vector<Received> received;
+};
+
+static void clientHandler(struct mg_connection *nc, int ev, void *p)
+{
+  TestClient *client = static_cast<TestClient *>(nc->user_data);
+  struct mg_mqtt_message *msg = (struct mg_mqtt_message *)p;
+  switch (ev) {
+    case MG_EV_CONNECT: {
+      if (*(int *)p != 0) {
+        client->closed = true;
+        break;
+      }
+      mg_set_protocol_mqtt(nc);
+      struct mg_send_mqtt_handshake_opts opts;
+      memset(&opts, 0, sizeof(opts));
+      opts.flags = MG_MQTT_CLEAN_SESSION;
+      opts.keep_alive = client->keepAlive;
+      mg_send_mqtt_handshake_opt(nc, client->id.c_str(), opts);
+      break;
+    }
+    case MG_EV_MQTT_CONNACK:
+      client->connack = msg->connack_ret_code;
+      break;
+    case MG_EV_MQTT_SUBACK:
+      ++client->subacks;
+      // mongoose leaves the granted qos unparsed, the last byte of the packet
+      client->grantedQos = (uint8_t)nc->recv_mbuf.buf[msg->len - 1];
+      break;
+    case MG_EV_MQTT_UNSUBACK:
+      ++client->unsubacks;
+      break;
+    case MG_EV_MQTT_PUBACK:
+      ++client->pubacks;
+      break;
+    case MG_EV_MQTT_PUBLISH: {
+      Received r = { std::string(msg->topic.p, msg->topic.len), std::string(msg->payload.p, msg->payload.len), msg->qos };
+      client->received.push_back(r);
+      if (msg->qos == 1) mg_mqtt_puback(nc, msg->message_id);
+      break;
+    }
+    case MG_EV_CLOSE:
+      client->closed = true;
+      break;
+  }
+}
+
+class DeviceSide : public ProtocolMessageInterpreter
+{
+public:
+  virtual void interpreteMqttMsg(const char* topic, size_t topicLen, const char* msg, size_t msgLen) {
+    topics.push_back(std::string(topic, topicLen));
+  }
+  virtual void interpreteSocketMsg(const void* msg, size_t msgLen, void *userdata) {}
+  std::vector<std::string> topics;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// test
+/////////////////////////////////////////////////////////////////////////////////////////
+static NetReactor reactor;
+static MqttBroker broker;
+
+// polls as the reactor task does until done, false on timeout
+bool pollUntil(const std::function<bool()> &done, uint32_t milli = WAIT_MILLI)
+{
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds(milli);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > end) return false;
+    reactor.poll(10);
+  }
+  return true;
+}
+
+void pollFor(uint32_t milli)
+{
+  pollUntil([]() { return false; }, milli);
+}
+
+bool connect(TestClient &client)
+{
+  struct mg_connect_opts opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.user_data = &client;
+  client.nc = mg_connect_opt(reactor.manager(), BROKER_ADDR, clientHandler, opts);
+  if (!client.nc) return false;
+  return pollUntil([&]() { return client.connack != -1 || client.closed; });
+}
+
+void subscribe(TestClient &client, const char *filter, uint8_t qos)
+{
+  struct mg_mqtt_topic_expression topic = { filter, qos };
+  int subacks = client.subacks;
+  mg_mqtt_subscribe(client.nc, &topic, 1, 1);
+  pollUntil([&]() { return client.subacks > subacks; });
+}
+
+int main(int argc, const char *argv[])
+{
+  DeviceSide device;
+  reactor.init();
+  broker.init(&reactor);
+  broker.setMessageInterpreter(&device);
+  broker.setup();
+  broker.start();
+
+  std::cout << "connect" << std::endl;
+  TestClient a("app-a"), b("app-b"), c("app-c");
+  check(connect(a) && a.connack == MG_EV_MQTT_CONNACK_ACCEPTED, "app-a accepted");
+  check(connect(b) && b.connack == MG_EV_MQTT_CONNACK_ACCEPTED, "app-b accepted");
+  check(broker.sessionCount() == 2, "2 sessions");
+
+  std::cout << "subscribe and deliver" << std::endl;
+  subscribe(b, "api/test/#", 2);
+  check(b.subacks == 1 && b.grantedQos == 1, "qos 2 subscription granted qos 1");
+  mg_mqtt_publish(a.nc, "api/test/x", 7, MG_MQTT_QOS(1), "hello", 5);
+  check(pollUntil([&]() { return a.pubacks == 1 && b.received.size() == 1; }), "app-a acked, app-b got it");
+  check(b.received.size() == 1 && b.received[0].topic == "api/test/x" && b.received[0].payload == "hello" &&
+        b.received[0].qos == 1, "topic, payload and qos 1 as sent");
+  mg_mqtt_publish(a.nc, "api/test", 0, MG_MQTT_QOS(0), "parent", 6);
+  check(pollUntil([&]() { return b.received.size() == 2; }) && b.received[1].qos == 0,
+        "'#' takes the parent level, qos 0 stays 0");
+  mg_mqtt_publish(a.nc, "api/other", 0, MG_MQTT_QOS(0), "x", 1);
+  pollFor(QUIET_MILLI);
+  check(b.received.size() == 2, "not matching topic not delivered");
+  check(a.received.empty(), "publisher gets none of its own");
+
+  std::cout << "device side" << std::endl;
+  size_t deviceCount = device.topics.size();
+  mg_mqtt_publish(a.nc, MqttClientDelegate::cmdTopic(), 0, MG_MQTT_QOS(0), "\x01\x00", 2);
+  check(pollUntil([&]() { return device.topics.size() > deviceCount; }) &&
+        device.topics.back() == MqttClientDelegate::cmdTopic(), "command topic reaches the interpreter");
+
+  std::string large(600, 'd');
+  std::thread other([&]() { broker.publish("api/test/dev", large.data(), large.size(), 1); });
+  other.join();
+  check(pollUntil([&]() { return b.received.size() == 3; }) && b.received[2].topic == "api/test/dev" &&
+        b.received[2].payload == large, "publish from other task, larger than a job, delivered");
+
+  std::cout << "retained" << std::endl;
+  mg_mqtt_publish(a.nc, "api/ret/a", 0, MG_MQTT_QOS(1) | MG_MQTT_RETAIN, "kept", 4);
+  pollUntil([&]() { return a.pubacks == 2; });
+  check(connect(c) && c.connack == MG_EV_MQTT_CONNACK_ACCEPTED, "app-c accepted");
+  subscribe(c, "api/ret/+", 0);
+  check(pollUntil([&]() { return c.received.size() == 1; }) && c.received[0].payload == "kept" &&
+        c.received[0].qos == 0, "retained sent on subscribe at the subscription qos");
+  mg_mqtt_publish(a.nc, "api/ret/a", 0, MG_MQTT_RETAIN, "", 0);
+  pollFor(QUIET_MILLI);
+  TestClient d("app-d");
+  check(connect(d), "app-d accepted");
+  subscribe(d, "api/ret/#", 0);
+  pollFor(QUIET_MILLI);
+  check(d.received.empty(), "empty retained publish clears it");
+
+  std::cout << "unsubscribe" << std::endl;
+  char *filter = (char *)"api/test/#";
+  mg_mqtt_unsubscribe(b.nc, &filter, 1, 2);
+  check(pollUntil([&]() { return b.unsubacks == 1; }), "unsuback");
+  size_t bCount = b.received.size();
+  mg_mqtt_publish(a.nc, "api/test/x", 0, MG_MQTT_QOS(0), "late", 4);
+  pollFor(QUIET_MILLI);
+  check(b.received.size() == bCount, "nothing after unsubscribe");
+
+  std::cout << "sessions" << std::endl;
+  check(broker.sessionCount() == MQTT_BROKER_SESSION_CAPACITY, "table full");
+  TestClient e("app-e");
+  connect(e);
+  check(e.connack == MG_EV_MQTT_CONNACK_SERVER_UNAVAILABLE, "one more refused, server unavailable");
+  check(pollUntil([&]() { return e.closed; }), "and closed");
+
+  TestClient a2("app-a");
+  check(connect(a2) && a2.connack == MG_EV_MQTT_CONNACK_ACCEPTED, "same client id accepted");
+  check(pollUntil([&]() { return a.closed; }), "old connection of the id closed");
+  check(broker.sessionCount() == MQTT_BROKER_SESSION_CAPACITY, "session taken over, not added");
+
+  std::cout << "keep alive" << std::endl;
+  d.nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+  check(pollUntil([]() { return broker.sessionCount() < MQTT_BROKER_SESSION_CAPACITY; }), "closed session freed");
+  TestClient silent("app-silent");
+  silent.keepAlive = KEEP_ALIVE_SECONDS;
+  check(connect(silent) && silent.connack == MG_EV_MQTT_CONNACK_ACCEPTED, "app-silent accepted");
+  // client stops pinging
+  ((struct mg_mqtt_proto_data *)silent.nc->proto_data)->keep_alive = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bool closed = pollUntil([&]() { return silent.closed; }, KEEP_ALIVE_SECONDS * 1500 + 2 * MQTT_BROKER_KEEP_ALIVE_CHECK_INTERVAL);
+  uint32_t milli = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+  check(closed && milli >= KEEP_ALIVE_SECONDS * 1500 - MQTT_BROKER_KEEP_ALIVE_CHECK_INTERVAL,
+        "silent session closed after 1.5 keep alive periods (" + std::to_string(milli) + " ms)");
+  check(!b.closed && !c.closed, "pinging sessions kept");
+
+  std::cout << (_failures ? std::to_string(_failures) + " failed" : std::string("all passed")) << std::endl;
+  reactor.deinit();
+  return _failures ? 1 : 0;
+}
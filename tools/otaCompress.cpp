@@ -0,0 +1,254 @@
+/*
+ * otaCompress: compress firmware images for compressed updates, check and time them
+ * Copyright (c) 2017 Shenghua Su
+ *
+ * build:       g++ -std=c++11 -O2 -I../components/AppUpdater -o otacompress otaCompress.cpp
+ *                  ../components/AppUpdater/HeatshrinkDecoder.cpp
+ * compress:    ./otacompress c image.bin image.hs
+ * decompress:  ./otacompress d image.hs out.bin [image.bin]
+ * benchmark:   ./otacompress bench image.bin [link KB/s]
+ *
+ * Output is the heatshrink stream HeatshrinkDecoder takes, the same as the heatshrink
+ * tool makes with the window and lookahead bits of HeatshrinkDecoder.h. Decompress runs
+ * the device's decoder fed in update blocks, with image.bin given the result is compared.
+ * Benchmark does compress and decompress in memory, and estimates the transfer time with
+ * and without compression at a link rate, the one AppUpdater's download stats report.
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "HeatshrinkDecoder.h"
+
+#define UPDATE_BLOCK_SIZE 4096      // as AppUpdater receives the image
+#define MATCH_MAX         (1 << HEATSHRINK_LOOKAHEAD_BITS)
+#define MATCH_MIN         2         // a backref of 2 is already shorter than 2 literals
+#define CHAIN_MAX         512       // candidates looked at per position
+#define LINK_RATE_KBPS    40        // default of benchmark
+
+bool readFile(const std::string &file, std::vector<uint8_t> &data)
+{
+  std::ifstream fi(file.c_str(), std::ios::binary);
+  if (!fi) return false;
+  data.assign(std::istreambuf_iterator<char>(fi), std::istreambuf_iterator<char>());
+  return true;
+}
+
+bool writeFile(const std::string &file, const std::vector<uint8_t> &data)
+{
+  std::ofstream fo(file.c_str(), std::ios::binary);
+  if (!fo) return false;
+  fo.write((const char *)data.data(), data.size());
+  return fo.good();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// compress
+/////////////////////////////////////////////////////////////////////////////////////////
+class BitWriter
+{
+public:
+  BitWriter(std::vector<uint8_t> &out) : _out(out), _byte(0), _count(0) {}
+
+  void put(uint32_t value, int bits) {
+    while (bits--) {
+      _byte = (_byte << 1) | ((value >> bits) & 1);
+      if (++_count == 8) flush();
+    }
+  }
+  // zero bits to the byte end
+  void flush() {
+    if (_count == 0) return;
+    _out.push_back(_byte << (8 - _count));
+    _byte = 0;
+    _count = 0;
+  }
+
+protected:
+  std::vector<uint8_t> &_out;
+  uint8_t _byte;
+  int _count;
+};
+
+// greedy, the longest match in the window found through chains of 2 byte prefixes
+void compress(const std::vector<uint8_t> &in, std::vector<uint8_t> &out)
+{
+  int32_t n = in.size();
+  std::vector<int32_t> head(1 << 16, -1), prev(n, -1);
+  BitWriter writer(out);
+  out.clear();
+
+  auto insert = [&](int32_t i) {
+    if (i + 1 >= n) return;
+    uint32_t key = in[i] << 8 | in[i + 1];
+    prev[i] = head[key];
+    head[key] = i;
+  };
+
+  for (int32_t i = 0; i < n; ) {
+    int32_t bestLength = 0, bestOffset = 0;
+    if (i + 1 < n) {
+      int32_t limit = std::min(MATCH_MAX, n - i);
+      int32_t chain = CHAIN_MAX;
+      for (int32_t j = head[in[i] << 8 | in[i + 1]]; j >= 0 && i - j <= HEATSHRINK_WINDOW_SIZE && chain--;
+           j = prev[j]) {
+        int32_t length = 0;
+        while (length < limit && in[j + length] == in[i + length]) ++length;
+        if (length > bestLength) {
+          bestLength = length;
+          bestOffset = i - j;
+          if (length == limit) break;
+        }
+      }
+    }
+
+    if (bestLength >= MATCH_MIN) {
+      writer.put(0, 1);
+      writer.put(bestOffset - 1, HEATSHRINK_WINDOW_BITS);
+      writer.put(bestLength - 1, HEATSHRINK_LOOKAHEAD_BITS);
+    }
+    else {
+      bestLength = 1;
+      writer.put(1, 1);
+      writer.put(in[i], 8);
+    }
+    for (int32_t k = 0; k < bestLength; ++k) insert(i + k);
+    i += bestLength;
+  }
+  writer.flush();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// decompress
+/////////////////////////////////////////////////////////////////////////////////////////
+class VectorOutput : public HeatshrinkOutput
+{
+public:
+  virtual bool decoded(const uint8_t *data, size_t length) {
+    out.insert(out.end(), data, data + length);
+    return true;
+  }
+  std::vector<uint8_t> out;
+};
+
+// through the device's decoder in update blocks
+HeatshrinkDecoder::Status decompress(const std::vector<uint8_t> &in, std::vector<uint8_t> &out)
+{
+  static HeatshrinkDecoder decoder;
+  VectorOutput output;
+  decoder.begin(&output);
+  HeatshrinkDecoder::Status status = HeatshrinkDecoder::HEATSHRINK_OK;
+  for (size_t offset = 0; offset < in.size() && status == HeatshrinkDecoder::HEATSHRINK_OK;
+       offset += UPDATE_BLOCK_SIZE) {
+    size_t length = std::min((size_t)UPDATE_BLOCK_SIZE, in.size() - offset);
+    status = decoder.decode(in.data() + offset, length);
+  }
+  if (status == HeatshrinkDecoder::HEATSHRINK_OK) status = decoder.finish();
+  out.swap(output.out);
+  return status;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// main
+/////////////////////////////////////////////////////////////////////////////////////////
+double secondsSince(const std::chrono::steady_clock::time_point &start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+unsigned percentOf(size_t part, size_t whole)
+{
+  return whole ? (unsigned)((uint64_t)part * 100 / whole) : 100;
+}
+
+int usage()
+{
+  std::cout << "usage: otacompress c image.bin image.hs" << std::endl;
+  std::cout << "       otacompress d image.hs out.bin [image.bin]" << std::endl;
+  std::cout << "       otacompress bench image.bin [link KB/s]" << std::endl;
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3) return usage();
+  std::string mode(argv[1]);
+  std::vector<uint8_t> in, out;
+  if (!readFile(argv[2], in)) {
+    std::cout << "failed to read " << argv[2] << std::endl;
+    return 1;
+  }
+
+  if (mode == "c" && argc == 4) {
+    compress(in, out);
+    if (!writeFile(argv[3], out)) {
+      std::cout << "failed to write " << argv[3] << std::endl;
+      return 1;
+    }
+    std::cout << in.size() << " -> " << out.size() << " bytes, " << percentOf(out.size(), in.size())
+              << "% of the image" << std::endl;
+    return 0;
+  }
+
+  if (mode == "d" && (argc == 4 || argc == 5)) {
+    HeatshrinkDecoder::Status status = decompress(in, out);
+    if (status != HeatshrinkDecoder::HEATSHRINK_OK) {
+      std::cout << "decompress failed, status " << status << std::endl;
+      return 1;
+    }
+    if (!writeFile(argv[3], out)) {
+      std::cout << "failed to write " << argv[3] << std::endl;
+      return 1;
+    }
+    std::cout << in.size() << " -> " << out.size() << " bytes" << std::endl;
+    if (argc == 5) {
+      std::vector<uint8_t> image;
+      if (!readFile(argv[4], image)) {
+        std::cout << "failed to read " << argv[4] << std::endl;
+        return 1;
+      }
+      bool same = image == out;
+      std::cout << (same ? "same as " : "differs from ") << argv[4] << std::endl;
+      return same ? 0 : 1;
+    }
+    return 0;
+  }
+
+  if (mode == "bench" && (argc == 3 || argc == 4)) {
+    double rate = argc == 4 ? atof(argv[3]) : LINK_RATE_KBPS;
+    if (rate <= 0) return usage();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    compress(in, out);
+    double compressSeconds = secondsSince(start);
+
+    std::vector<uint8_t> round;
+    start = std::chrono::steady_clock::now();
+    HeatshrinkDecoder::Status status = decompress(out, round);
+    double decompressSeconds = secondsSince(start);
+    if (status != HeatshrinkDecoder::HEATSHRINK_OK || round != in) {
+      std::cout << "round trip failed, status " << status << std::endl;
+      return 1;
+    }
+
+    double rawSeconds = in.size() / (rate * 1024);
+    double compressedSeconds = out.size() / (rate * 1024);
+    std::cout << "window " << HEATSHRINK_WINDOW_SIZE << ", lookahead " << MATCH_MAX << std::endl;
+    std::cout << in.size() << " -> " << out.size() << " bytes, " << percentOf(out.size(), in.size())
+              << "% of the image" << std::endl;
+    std::cout << "compress " << compressSeconds << " s, decompress "
+              << (decompressSeconds > 0 ? in.size() / decompressSeconds / 1048576 : 0) << " MB/s (host)" << std::endl;
+    std::cout << "transfer at " << rate << " KB/s: raw " << rawSeconds << " s, compressed "
+              << compressedSeconds << " s" << std::endl;
+    return 0;
+  }
+
+  return usage();
+}
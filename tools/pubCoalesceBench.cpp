@@ -0,0 +1,179 @@
+/*
+ * pubCoalesceBench: wire bytes and TLS records of sensor telemetry with and without coalescing
+ * Copyright (c) 2017 Shenghua Su
+ *
+ * build:  g++ -std=c++11 -O2 -Ihost -I../components/MessageProtocol -o pcbench pubCoalesceBench.cpp
+ *             ../components/MessageProtocol/PubCoalescer.cpp host/HostRtos.cpp -lpthread
+ * run:    ./pcbench [minutes] [qos]
+ *
+ * Plays the sensor tasks' cadences (SHT3x and PM 500 ms, CO2 and TSL2561 1 s) on virtual
+ * ticks, one publish per sample on api/sensor/<uid>/<type> as the device sends them, once
+ * straight to the broker and once through PubCoalescer at several windows. Counted as
+ * mongoose and mbedTLS put them on the wire: the publishes sent in one poll share one
+ * TLS record (AES-GCM, 29 bytes of header, nonce and tag), each record one TCP segment
+ * (40 bytes of IPv4 and TCP headers); with qos 1 the PUBACKs come back the same way.
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "HostRtos.h"
+#include "PubCoalescer.h"
+
+#define DEVICE_UID              "240ac4a1b2c3"
+#define SENSOR_TOPIC_HEAD       "api/sensor/" DEVICE_UID "/"
+#define BATCH_TOPIC             "api/batch/" DEVICE_UID
+#define TLS_RECORD_OVERHEAD     29
+#define TCP_SEGMENT_OVERHEAD    40
+#define MQTT_PUBACK_SIZE        4
+
+struct Stream
+{
+  const char   *type;
+  const char   *format;
+  uint32_t      periodMilli;
+  float         base;
+  float         swing;
+};
+
+// as System's sensor tasks sample them
+static const Stream _streams[] = {
+  { "PM",    "{\"PM\":%.0f}",    500,  35,   12 },
+  { "HCHO",  "{\"HCHO\":%.2f}",  500,  0.03, 0.02 },
+  { "TEMP",  "{\"TEMP\":%.1f}",  500,  23.5, 1.5 },
+  { "HUMID", "{\"HUMID\":%.1f}", 500,  45,   5 },
+  { "CO2",   "{\"CO2\":%.0f}",   1000, 620,  80 },
+  { "LUMI",  "{\"LUMI\":%.0f}",  1000, 180,  60 }
+};
+#define STREAM_COUNT (sizeof(_streams) / sizeof(_streams[0]))
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// wire
+/////////////////////////////////////////////////////////////////////////////////////////
+struct WireStats
+{
+  WireStats() : publishes(0), mqttBytes(0), records(0), wireBytes(0) {}
+  uint64_t publishes;
+  uint64_t mqttBytes;
+  uint64_t records;
+  uint64_t wireBytes;
+};
+
+class Wire : public PubCoalescerDelegate
+{
+public:
+  Wire(uint8_t qos) : _qos(qos), _pollBytes(0), _pollPublishes(0) {}
+
+  virtual void publishCoalesced(const char *topic, const void *data, size_t len, uint8_t qos) {
+    publish(topic, len);
+  }
+
+  void publish(const char *topic, size_t len) {
+    size_t remaining = 2 + strlen(topic) + (_qos ? 2 : 0) + len;
+    size_t lengthBytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : 3;
+    _pollBytes += 1 + lengthBytes + remaining;
+    ++_pollPublishes;
+  }
+
+  // end of a reactor poll, what was sent in it goes out as one record
+  void endPoll() {
+    if (_pollPublishes == 0) return;
+    stats.publishes += _pollPublishes;
+    stats.mqttBytes += _pollBytes;
+    ++stats.records;
+    stats.wireBytes += _pollBytes + TLS_RECORD_OVERHEAD + TCP_SEGMENT_OVERHEAD;
+    if (_qos) {
+      stats.mqttBytes += _pollPublishes * MQTT_PUBACK_SIZE;
+      ++stats.records;
+      stats.wireBytes += _pollPublishes * MQTT_PUBACK_SIZE + TLS_RECORD_OVERHEAD + TCP_SEGMENT_OVERHEAD;
+    }
+    _pollBytes = 0;
+    _pollPublishes = 0;
+  }
+
+  WireStats stats;
+
+protected:
+  uint8_t   _qos;
+  size_t    _pollBytes;
+  size_t    _pollPublishes;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// run
+/////////////////////////////////////////////////////////////////////////////////////////
+// window 0 publishes every sample straight away
+WireStats run(uint32_t minutes, uint8_t qos, uint32_t windowMilli)
+{
+  static PubCoalescer coalescer;
+  Wire wire(qos);
+  coalescer.init();
+  coalescer.setDelegate(&wire);
+  coalescer.setBatchTopic(BATCH_TOPIC);
+  coalescer.setWindow(windowMilli);
+
+  std::string topics[STREAM_COUNT];
+  for (size_t i = 0; i < STREAM_COUNT; ++i) topics[i] = std::string(SENSOR_TOPIC_HEAD) + _streams[i].type;
+
+  char payload[32];
+  uint32_t endMilli = minutes * 60000;
+  for (uint32_t milli = 0; milli < endMilli; ++milli) {
+    for (size_t i = 0; i < STREAM_COUNT; ++i) {
+      const Stream &stream = _streams[i];
+      if (milli % stream.periodMilli) continue;
+      float value = stream.base + stream.swing * sinf(milli / 60000.0f * 6.2832f * (i + 1));
+      int length = snprintf(payload, sizeof(payload), stream.format, value);
+      if (windowMilli == 0) wire.publish(topics[i].c_str(), length);
+      else if (!coalescer.add(topics[i].c_str(), payload, length, qos)) wire.publish(topics[i].c_str(), length);
+    }
+    if (windowMilli) coalescer.processLoop();
+    wire.endPoll();
+    hostAdvanceTicks(1);
+  }
+  coalescer.flush();
+  wire.endPoll();
+  return wire.stats;
+}
+
+void printRow(const std::string &name, const WireStats &stats, uint32_t minutes, const WireStats &direct)
+{
+  std::cout << std::left << std::setw(18) << name << std::right
+            << std::setw(12) << stats.publishes / minutes
+            << std::setw(12) << stats.mqttBytes / minutes
+            << std::setw(14) << stats.records / minutes
+            << std::setw(12) << stats.wireBytes / minutes
+            << std::setw(9) << (direct.wireBytes ? stats.wireBytes * 100 / direct.wireBytes : 0) << "%"
+            << std::endl;
+}
+
+int main(int argc, const char *argv[])
+{
+  uint32_t minutes = argc > 1 ? atoi(argv[1]) : 1;
+  uint8_t qos = argc > 2 ? atoi(argv[2]) : 0;
+  if (minutes == 0 || qos > 1) {
+    std::cout << "use format: " << argv[0] << " [minutes] [qos]" << std::endl
+              << " ARGUMENTS:" << std::endl
+              << "  minutes                             device time played, default 1" << std::endl
+              << "  qos                                 0 or 1, default 0" << std::endl;
+    return -1;
+  }
+  hostUseVirtualTicks(true);
+
+  std::cout << "per minute, qos " << (int)qos << std::endl;
+  std::cout << std::left << std::setw(18) << "" << std::right << std::setw(12) << "publishes"
+            << std::setw(12) << "mqtt bytes" << std::setw(14) << "tls records" << std::setw(12) << "wire bytes"
+            << std::setw(10) << "of direct" << std::endl;
+  WireStats direct = run(minutes, qos, 0);
+  printRow("direct", direct, minutes, direct);
+  const uint32_t windows[] = { COALESCE_WINDOW_MIN, COALESCE_WINDOW_DEFAULT, 2000, COALESCE_WINDOW_MAX };
+  for (size_t i = 0; i < sizeof(windows) / sizeof(windows[0]); ++i) {
+    WireStats stats = run(minutes, qos, windows[i]);
+    printRow("window " + std::to_string(windows[i]) + " ms", stats, minutes, direct);
+  }
+  return 0;
+}
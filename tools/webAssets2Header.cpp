@@ -0,0 +1,177 @@
+/*
+ * webAssets2Header: gzip web files into a const WebAsset table header
+ * Copyright (c) 2018 Shenghua Su
+ *
+ * build:  g++ -std=c++11 -o wa2h webAssets2Header.cpp -lz
+ * export: ./wa2h -o web_assets.h index.html app.js style.css
+ *
+ */
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <zlib.h>
+
+struct Asset {
+  std::string           file;
+  std::string           path;
+  std::string           contentType;
+  std::vector<uint8_t>  gzipped;
+  size_t                plainSize;
+};
+
+std::string baseName(const std::string &file)
+{
+  size_t pos = file.find_last_of("/\\");
+  return pos == std::string::npos ? file : file.substr(pos + 1);
+}
+
+std::string contentTypeOf(const std::string &name)
+{
+  size_t pos = name.rfind('.');
+  std::string ext = pos == std::string::npos ? "" : name.substr(pos + 1);
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  if (ext == "html" || ext == "htm") return "text/html; charset=utf-8";
+  if (ext == "js")   return "application/javascript; charset=utf-8";
+  if (ext == "css")  return "text/css; charset=utf-8";
+  if (ext == "json") return "application/json";
+  if (ext == "svg")  return "image/svg+xml";
+  if (ext == "png")  return "image/png";
+  if (ext == "ico")  return "image/x-icon";
+  return "application/octet-stream";
+}
+
+bool readFile(const std::string &file, std::vector<uint8_t> &data)
+{
+  std::ifstream fi(file.c_str(), std::ios::in | std::ios::binary);
+  if (!fi) return false;
+  data.assign(std::istreambuf_iterator<char>(fi), std::istreambuf_iterator<char>());
+  return true;
+}
+
+// gzip wrapper (windowBits 15 + 16), best compression, no file name or time
+// in the header so the output and its etag only change with the content
+bool gzip(const std::vector<uint8_t> &in, std::vector<uint8_t> &out)
+{
+  z_stream zs = {};
+  if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+  out.resize(deflateBound(&zs, in.size()));
+  zs.next_in = const_cast<Bytef *>(in.data());
+  zs.avail_in = in.size();
+  zs.next_out = out.data();
+  zs.avail_out = out.size();
+  int ret = deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return ret == Z_STREAM_END;
+}
+
+// fnv-1a, same as the router etag for dynamic bodies
+std::string etagOf(const std::vector<uint8_t> &data)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < data.size(); ++i) {
+    hash ^= data[i];
+    hash *= 16777619u;
+  }
+  std::stringstream ss;
+  ss << "\\\"" << std::hex << std::setw(8) << std::setfill('0') << hash << "\\\"";
+  return ss.str();
+}
+
+void writeHeader(std::ostream &fo, std::vector<Asset> &assets)
+{
+  fo <<  "/*\n" \
+       " * WebAsset table header\n" \
+       " * Copyright (c) 2018 Shenghua Su\n" \
+       " *\n" \
+       " * This file is generated by script, should not be modified\n" \
+       " */\n\n";
+  fo << "#ifndef _WEB_ASSETS_H" << std::endl;
+  fo << "#define _WEB_ASSETS_H" << std::endl << std::endl;
+  fo << "#include \"WebAssetServer.h\"" << std::endl << std::endl;
+
+  for (size_t i = 0; i < assets.size(); ++i) {
+    Asset &asset = assets[i];
+    fo << "// " << asset.file << ", " << asset.plainSize << " -> " << asset.gzipped.size() << " bytes" << std::endl;
+    fo << "static const uint8_t webAssetData" << i << "[] = {";
+    for (size_t j = 0; j < asset.gzipped.size(); ++j) {
+      if (j % 16 == 0) fo << std::endl << "  ";
+      fo << "0x" << std::hex << std::setw(2) << std::setfill('0') << (int)asset.gzipped[j] << std::dec;
+      if (j + 1 < asset.gzipped.size()) fo << ",";
+    }
+    fo << std::endl << "};" << std::endl << std::endl;
+  }
+
+  fo << "static const WebAsset webAssets[] = {" << std::endl;
+  for (size_t i = 0; i < assets.size(); ++i) {
+    Asset &asset = assets[i];
+    std::string etag = etagOf(asset.gzipped);
+    std::stringstream entry;
+    entry << "\"" << asset.contentType << "\", \"" << etag << "\", webAssetData" << i << ", " << asset.gzipped.size();
+    // index page also answers the site root
+    if (asset.path == "/index.html")
+      fo << "  { \"/\", " << entry.str() << " }," << std::endl;
+    fo << "  { \"" << asset.path << "\", " << entry.str() << " }";
+    fo << (i + 1 < assets.size() ? "," : "") << std::endl;
+  }
+  fo << "};" << std::endl << std::endl;
+  fo << "#define WEB_ASSET_COUNT (sizeof(webAssets) / sizeof(webAssets[0]))" << std::endl << std::endl;
+  fo << "#endif // _WEB_ASSETS_H" << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+  std::string outputFileName;
+  std::vector<Asset> assets;
+  bool formatErr = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg == "-o" || arg == "--output") {
+      if (++i >= argc) { formatErr = true; break; }
+      outputFileName = argv[i];
+    }
+    else {
+      Asset asset;
+      asset.file = arg;
+      asset.path = "/" + baseName(arg);
+      asset.contentType = contentTypeOf(asset.path);
+      assets.push_back(asset);
+    }
+  }
+  if (outputFileName.empty() || assets.empty()) formatErr = true;
+
+  if (formatErr) {
+    std::cout << "use format: " << std::endl
+              << argv[0] << " -o output files..." << std::endl
+              << " ARGUMENTS:" << std::endl
+              << "  -o(--output) file                   output header name" << std::endl
+              << "  files                               web files, served at /<file name>" << std::endl;
+    return -1;
+  }
+
+  for (size_t i = 0; i < assets.size(); ++i) {
+    std::vector<uint8_t> plain;
+    if (!readFile(assets[i].file, plain)) {
+      std::cout << "read " << assets[i].file << " failed" << std::endl;
+      return -1;
+    }
+    assets[i].plainSize = plain.size();
+    if (!gzip(plain, assets[i].gzipped)) {
+      std::cout << "compress " << assets[i].file << " failed" << std::endl;
+      return -1;
+    }
+  }
+
+  std::fstream fo(outputFileName.c_str(), std::fstream::out);
+  writeHeader(fo, assets);
+  fo.close();
+  return 0;
+}